@@ -99,6 +99,7 @@ LDAP_BEGIN_DECL
 #define LBER_OPT_BER_TOTAL_BYTES		0x04
 #define LBER_OPT_BER_BYTES_TO_WRITE		0x05
 #define LBER_OPT_BER_MEMCTX				0x06
+#define LBER_OPT_BER_UNFLUSHED			0x07	/* get only */
 
 #define LBER_OPT_DEBUG_LEVEL	LBER_OPT_BER_DEBUG
 #define LBER_OPT_REMAINING_BYTES	LBER_OPT_BER_REMAINING_BYTES
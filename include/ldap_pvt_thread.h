@@ -226,6 +226,11 @@ ldap_pvt_thread_pool_maxthreads LDAP_P((
 	ldap_pvt_thread_pool_t *pool,
 	int max_threads ));
 
+LDAP_F( int )
+ldap_pvt_thread_pool_queues LDAP_P((
+	ldap_pvt_thread_pool_t *pool,
+	int numqs ));
+
 #ifndef LDAP_PVT_THREAD_H_DONE
 typedef enum {
 	LDAP_PVT_THREAD_POOL_PARAM_UNKNOWN = -1,
@@ -240,7 +245,8 @@ typedef enum {
 	LDAP_PVT_THREAD_POOL_PARAM_ACTIVE_MAX,
 	LDAP_PVT_THREAD_POOL_PARAM_PENDING_MAX,
 	LDAP_PVT_THREAD_POOL_PARAM_BACKLOAD_MAX,
-	LDAP_PVT_THREAD_POOL_PARAM_STATE
+	LDAP_PVT_THREAD_POOL_PARAM_STATE,
+	LDAP_PVT_THREAD_POOL_PARAM_QUEUES
 } ldap_pvt_thread_pool_param_t;
 #endif /* !LDAP_PVT_THREAD_H_DONE */
 
@@ -144,8 +144,11 @@ ber_realloc( BerElement *ber, ber_len_t len )
 #define LBER_EXBUFSIZ	4060 /* a few words less than 2^N for binary buddy */
 #if defined( LBER_EXBUFSIZ ) && LBER_EXBUFSIZ > 0
 # ifndef notdef
-	/* don't realloc by small amounts */
-	total += len < LBER_EXBUFSIZ ? LBER_EXBUFSIZ : len;
+	/* don't realloc by small amounts, and at least double a big
+	 * buffer so that encoding a large PDU copies it only a few times
+	 */
+	if ( len < LBER_EXBUFSIZ ) len = LBER_EXBUFSIZ;
+	total += len < total ? total : len;
 # else
 	{	/* not sure what value this adds.  reduce fragmentation? */
 		ber_len_t have = (total + (LBER_EXBUFSIZE - 1)) / LBER_EXBUFSIZ;
@@ -105,6 +105,15 @@ ber_get_option(
 		assert( LBER_VALID( ber ) );
 		*((void **) outvalue) = ber->ber_memctx;
 		return LBER_OPT_SUCCESS;
+
+	case LBER_OPT_BER_UNFLUSHED:
+		/* what ber_flush2() has yet to write */
+		assert( LBER_VALID( ber ) );
+		((struct berval *) outvalue)->bv_val = ber->ber_rwptr
+			? ber->ber_rwptr : ber->ber_buf;
+		((struct berval *) outvalue)->bv_len = ber->ber_ptr -
+			((struct berval *) outvalue)->bv_val;
+		return LBER_OPT_SUCCESS;
 	
 	default:
 		/* bad param */
@@ -574,7 +574,8 @@ Sockbuf_IO ber_sockbuf_io_tcp = {
 
 
 /*
- * Support for readahead (UDP needs it)
+ * Support for readahead (UDP needs it, and it lets stream servers
+ * take several pipelined PDUs from the kernel with a single read)
  */
 
 static int
@@ -638,6 +639,23 @@ sb_rdahead_read( Sockbuf_IO_Desc *sbiod, void *buf, ber_len_t len )
 
 	if ( len == 0 ) return bufptr;
 
+	/* The buffer is empty now; a request at least as large as the
+	 * buffer is better read straight into the caller's memory.
+	 */
+	if ( len >= p->buf_size ) {
+		while ( 1 ) {
+			ret = LBER_SBIOD_READ_NEXT( sbiod, (char *) buf + bufptr, len );
+#ifdef EINTR	
+			if ( ( ret < 0 ) && ( errno == EINTR ) ) continue;
+#endif
+			break;
+		}
+		if ( ret < 0 ) {
+			return ( bufptr ? bufptr : ret );
+		}
+		return bufptr + ret;
+	}
+
 	max = p->buf_size - p->buf_end;
 	ret = 0;
 	while ( max > 0 ) {
@@ -114,6 +114,7 @@
 #define	ldap_pvt_thread_pool_init		ldap_int_thread_pool_init
 #define	ldap_pvt_thread_pool_submit		ldap_int_thread_pool_submit
 #define	ldap_pvt_thread_pool_maxthreads	ldap_int_thread_pool_maxthreads
+#define	ldap_pvt_thread_pool_queues		ldap_int_thread_pool_queues
 #define	ldap_pvt_thread_pool_backload	ldap_int_thread_pool_backload
 #define	ldap_pvt_thread_pool_pause		ldap_int_thread_pool_pause
 #define	ldap_pvt_thread_pool_resume		ldap_int_thread_pool_resume
@@ -177,6 +178,7 @@
 #undef	ldap_pvt_thread_pool_init
 #undef	ldap_pvt_thread_pool_submit
 #undef	ldap_pvt_thread_pool_maxthreads
+#undef	ldap_pvt_thread_pool_queues
 #undef	ldap_pvt_thread_pool_backload
 #undef	ldap_pvt_thread_pool_pause
 #undef	ldap_pvt_thread_pool_resume
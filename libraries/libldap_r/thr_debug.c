@@ -1195,6 +1195,15 @@ ldap_pvt_thread_pool_maxthreads(
 	return ldap_int_thread_pool_maxthreads(	tpool, max_threads );
 }
 
+int
+ldap_pvt_thread_pool_queues(
+	ldap_pvt_thread_pool_t *tpool,
+	int numqs )
+{
+	ERROR_IF( !threading_enabled, "ldap_pvt_thread_pool_queues" );
+	return ldap_int_thread_pool_queues(	tpool, numqs );
+}
+
 int
 ldap_pvt_thread_pool_backload( ldap_pvt_thread_pool_t *tpool )
 {
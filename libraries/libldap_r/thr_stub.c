@@ -180,6 +180,12 @@ ldap_pvt_thread_pool_maxthreads ( ldap_pvt_thread_pool_t *tpool, int max_threads
 	return(0);
 }
 
+int
+ldap_pvt_thread_pool_queues ( ldap_pvt_thread_pool_t *tpool, int numqs )
+{
+	return(0);
+}
+
 int
 ldap_pvt_thread_pool_query( ldap_pvt_thread_pool_t *tpool,
 	ldap_pvt_thread_pool_param_t param, void *value )
@@ -50,8 +50,9 @@ typedef struct ldap_int_tpool_key_s {
 /* (Theoretical) max number of pending requests */
 #define MAX_PENDING (INT_MAX/2)	/* INT_MAX - (room to avoid overflow) */
 
-/* Context: thread ID and thread-specific key/data pairs */
+/* Context: thread ID, work queue and thread-specific key/data pairs */
 typedef struct ldap_int_thread_userctx_s {
+	struct ldap_int_thread_poolq_s *ltu_pq;	/* NULL if not a pool thread */
 	ldap_pvt_thread_t ltu_id;
 	ldap_int_tpool_key_t ltu_key[MAXKEYS];
 } ldap_int_thread_userctx_t;
@@ -60,7 +61,7 @@ typedef struct ldap_int_thread_userctx_s {
 /* Simple {thread ID -> context} hash table; key=ctx->ltu_id.
  * Protected by ldap_pvt_thread_pool_mutex except during pauses,
  * when it is read-only (used by pool_purgekey and pool_context).
- * Protected by tpool->ltp_mutex during pauses.
+ * Protected by the work queue mutexes during pauses.
  */
 static struct {
 	ldap_int_thread_userctx_t *ctx;
@@ -88,10 +89,17 @@ typedef struct ldap_int_thread_task_s {
 
 typedef LDAP_STAILQ_HEAD(tcq, ldap_int_thread_task_s) ldap_int_tpool_plist_t;
 
-struct ldap_int_thread_pool_s {
-	LDAP_STAILQ_ENTRY(ldap_int_thread_pool_s) ltp_next;
+/* A work queue.  Every pool thread belongs to exactly one queue and
+ * normally only runs tasks from it.  With several queues (threadqueues
+ * in slapd), submits from a pool thread go to its own queue, other
+ * submits are spread round-robin, and a thread whose queue is empty
+ * steals the oldest pending task of another queue before going idle.
+ * The pool-wide limits are divided evenly between the queues.
+ */
+struct ldap_int_thread_poolq_s {
+	struct ldap_int_thread_pool_s *ltp_pool;
 
-	/* protect members below, and protect thread_keys[] during pauses */
+	/* protect members below */
 	ldap_pvt_thread_mutex_t ltp_mutex;
 
 	/* not paused and something to do for pool_<wrapper/pause/destroy>() */
@@ -109,6 +117,56 @@ struct ldap_int_thread_pool_s {
 	ldap_int_tpool_plist_t ltp_pending_list;
 	LDAP_SLIST_HEAD(tcl, ldap_int_thread_task_s) ltp_free_list;
 
+	/* Copy of the pool's ltp_pause, set and cleared when pool_<pause/
+	 * resume>() get to this queue.  Tested instead of the pool's since
+	 * they adjust ltp_<open_count/work_list> of one queue at a time.
+	 */
+	int ltp_pause;
+
+	/* This queue's share of the pool's ltp_max_count */
+	int ltp_max_count;
+
+	/* This queue's share of the pool's ltp_max_pending,
+	 * negated when ltp_finishing
+	 */
+	int ltp_max_pending;
+
+	int ltp_pending_count;		/* Pending or paused requests */
+	int ltp_active_count;		/* Active, not paused requests */
+	int ltp_open_count;			/* Number of threads, negated when ltp_pause */
+	int ltp_starting;			/* Currenlty starting threads */
+
+	/* >0 if paused or we may open a thread, <0 if we should close a thread.
+	 * Updated when ltp_<finishing/pause/max_count/open_count> change.
+	 * Maintained to reduce the time ltp_mutex must be locked in
+	 * ldap_pvt_thread_pool_<submit/wrapper>().
+	 */
+	int ltp_vary_open_count;
+#	define SET_VARY_OPEN_COUNT(pq)	\
+		((pq)->ltp_vary_open_count =	\
+		 (pq)->ltp_pause                ?  1 :	\
+		 (pq)->ltp_pool->ltp_finishing  ? -1 :	\
+		 (pq)->ltp_max_count - (pq)->ltp_open_count)
+};
+
+struct ldap_int_thread_pool_s {
+	LDAP_STAILQ_ENTRY(ldap_int_thread_pool_s) ltp_next;
+
+	/* protect members below.  Not held while waiting for the work
+	 * queues, so threads in the queues never block on it while active.
+	 */
+	ldap_pvt_thread_mutex_t ltp_mutex;
+
+	/* pause ended, for threads which do not belong to a work queue */
+	ldap_pvt_thread_cond_t ltp_cond;
+
+	/* the work queues; ltp_numqs only changes while no thread is open */
+	struct ldap_int_thread_poolq_s *ltp_wqs;
+	int ltp_numqs;
+
+	/* next queue for submits from outside the pool, updated unlocked */
+	unsigned ltp_nextq;
+
 	/* The pool is finishing, waiting for its threads to close.
 	 * They close when ltp_pending_list is done.  pool_submit()
 	 * rejects new tasks.  ltp_max_pending = -(its old value).
@@ -127,24 +185,6 @@ struct ldap_int_thread_pool_s {
 
 	/* Max number of pending + paused requests, negated when ltp_finishing */
 	int ltp_max_pending;
-
-	int ltp_pending_count;		/* Pending or paused requests */
-	int ltp_active_count;		/* Active, not paused requests */
-	int ltp_open_count;			/* Number of threads, negated when ltp_pause */
-	int ltp_starting;			/* Currenlty starting threads */
-
-	/* >0 if paused or we may open a thread, <0 if we should close a thread.
-	 * Updated when ltp_<finishing/pause/max_count/open_count> change.
-	 * Maintained to reduce the time ltp_mutex must be locked in
-	 * ldap_pvt_thread_pool_<submit/wrapper>().
-	 */
-	int ltp_vary_open_count;
-#	define SET_VARY_OPEN_COUNT(pool)	\
-		((pool)->ltp_vary_open_count =	\
-		 (pool)->ltp_pause      ?  1 :	\
-		 (pool)->ltp_finishing  ? -1 :	\
-		 ((pool)->ltp_max_count ? (pool)->ltp_max_count : LDAP_MAXTHR) \
-		 - (pool)->ltp_open_count)
 };
 
 static ldap_int_tpool_plist_t empty_pending_list =
@@ -157,7 +197,7 @@ static LDAP_STAILQ_HEAD(tpq, ldap_int_thread_pool_s)
 
 static ldap_pvt_thread_mutex_t ldap_pvt_thread_pool_mutex;
 
-static void *ldap_int_thread_pool_wrapper( void *pool );
+static void *ldap_int_thread_pool_wrapper( void *pq );
 
 static ldap_pvt_thread_key_t	ldap_tpool_key;
 
@@ -185,6 +225,113 @@ ldap_int_thread_pool_shutdown ( void )
 	return(0);
 }
 
+/* Allocate and initialize numqs work queues */
+static struct ldap_int_thread_poolq_s *
+ldap_int_thread_poolq_create(
+	struct ldap_int_thread_pool_s *pool,
+	int numqs )
+{
+	struct ldap_int_thread_poolq_s *wqs, *pq;
+	int i;
+
+	wqs = (struct ldap_int_thread_poolq_s *) LDAP_CALLOC(numqs,
+		sizeof(struct ldap_int_thread_poolq_s));
+	if (wqs == NULL)
+		return(NULL);
+
+	for (i = 0; i < numqs; i++) {
+		pq = &wqs[i];
+		pq->ltp_pool = pool;
+		if (ldap_pvt_thread_mutex_init(&pq->ltp_mutex) != 0 ||
+			ldap_pvt_thread_cond_init(&pq->ltp_cond) != 0 ||
+			ldap_pvt_thread_cond_init(&pq->ltp_pcond) != 0)
+		{
+			LDAP_FREE(wqs);
+			return(NULL);
+		}
+		LDAP_STAILQ_INIT(&pq->ltp_pending_list);
+		pq->ltp_work_list = &pq->ltp_pending_list;
+		LDAP_SLIST_INIT(&pq->ltp_free_list);
+	}
+
+	return(wqs);
+}
+
+/* Free work queues.  They must have no threads left. */
+static void
+ldap_int_thread_poolq_free(
+	struct ldap_int_thread_poolq_s *wqs,
+	int numqs )
+{
+	struct ldap_int_thread_poolq_s *pq;
+	ldap_int_thread_task_t *task;
+	int i;
+
+	for (i = 0; i < numqs; i++) {
+		pq = &wqs[i];
+		while ((task = LDAP_STAILQ_FIRST(&pq->ltp_pending_list)) != NULL) {
+			LDAP_STAILQ_REMOVE_HEAD(&pq->ltp_pending_list, ltt_next.q);
+			LDAP_FREE(task);
+		}
+		while ((task = LDAP_SLIST_FIRST(&pq->ltp_free_list)) != NULL) {
+			LDAP_SLIST_REMOVE_HEAD(&pq->ltp_free_list, ltt_next.l);
+			LDAP_FREE(task);
+		}
+		ldap_pvt_thread_cond_destroy(&pq->ltp_pcond);
+		ldap_pvt_thread_cond_destroy(&pq->ltp_cond);
+		ldap_pvt_thread_mutex_destroy(&pq->ltp_mutex);
+	}
+	LDAP_FREE(wqs);
+}
+
+/* Divide the pool's ltp_max_<count/pending> between the work queues.
+ * If max #threads was lowered below the number of queues, the queues
+ * past it get neither threads nor new tasks; whatever they still hold
+ * is stolen by the others.  Call with pool->ltp_mutex locked.
+ */
+static void
+ldap_int_thread_pool_share( struct ldap_int_thread_pool_s *pool )
+{
+	struct ldap_int_thread_poolq_s *pq;
+	int i, numqs = pool->ltp_numqs, useqs;
+	int max_count, max_pending;
+
+	max_count = pool->ltp_max_count ? pool->ltp_max_count : LDAP_MAXTHR;
+	max_pending = pool->ltp_max_pending;
+	if (max_pending < 0)
+		max_pending = -max_pending;
+	useqs = numqs < max_count ? numqs : max_count;
+
+	for (i = 0; i < numqs; i++) {
+		pq = &pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		if (i < useqs) {
+			pq->ltp_max_count = max_count / useqs + (i < max_count % useqs);
+			pq->ltp_max_pending = max_pending / useqs +
+				(i < max_pending % useqs);
+		} else {
+			pq->ltp_max_count = 0;
+			pq->ltp_max_pending = 0;
+		}
+		if (pool->ltp_max_pending < 0)
+			pq->ltp_max_pending = -pq->ltp_max_pending;
+		SET_VARY_OPEN_COUNT(pq);
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	}
+}
+
+/* The work queue of the calling thread, or NULL if it is not in the pool */
+static struct ldap_int_thread_poolq_s *
+ldap_int_thread_pool_ownq( struct ldap_int_thread_pool_s *pool )
+{
+	ldap_int_thread_userctx_t *ctx = NULL;
+
+	ldap_pvt_thread_key_getdata( ldap_tpool_key, (void **)&ctx );
+	if ( ctx && ctx->ltu_pq && ctx->ltu_pq->ltp_pool == pool )
+		return ctx->ltu_pq;
+	return NULL;
+}
+
 
 /* Create a thread pool */
 int
@@ -216,19 +363,17 @@ ldap_pvt_thread_pool_init (
 	rc = ldap_pvt_thread_cond_init(&pool->ltp_cond);
 	if (rc != 0)
 		return(rc);
-	rc = ldap_pvt_thread_cond_init(&pool->ltp_pcond);
-	if (rc != 0)
-		return(rc);
+
+	pool->ltp_wqs = ldap_int_thread_poolq_create(pool, 1);
+	if (pool->ltp_wqs == NULL)
+		return(-1);
+	pool->ltp_numqs = 1;
 
 	ldap_int_has_thread_pool = 1;
 
 	pool->ltp_max_count = max_threads;
-	SET_VARY_OPEN_COUNT(pool);
 	pool->ltp_max_pending = max_pending;
-
-	LDAP_STAILQ_INIT(&pool->ltp_pending_list);
-	pool->ltp_work_list = &pool->ltp_pending_list;
-	LDAP_SLIST_INIT(&pool->ltp_free_list);
+	ldap_int_thread_pool_share(pool);
 
 	ldap_pvt_thread_mutex_lock(&ldap_pvt_thread_pool_mutex);
 	LDAP_STAILQ_INSERT_TAIL(&ldap_int_thread_pool_list, pool, ltp_next);
@@ -245,6 +390,88 @@ ldap_pvt_thread_pool_init (
 	return(0);
 }
 
+/* Wake an idle thread of some other work queue than pq, so it can
+ * steal the task pq has no thread for.  Called with nothing locked.
+ */
+static void
+ldap_int_thread_pool_wake( struct ldap_int_thread_poolq_s *pq )
+{
+	struct ldap_int_thread_pool_s *pool = pq->ltp_pool;
+	struct ldap_int_thread_poolq_s *vq;
+	int i, numqs = pool->ltp_numqs, qi = pq - pool->ltp_wqs;
+
+	for (i = 1; i < numqs; i++) {
+		vq = &pool->ltp_wqs[(qi + i) % numqs];
+		/* unlocked peek, only a hint */
+		if (vq->ltp_open_count - vq->ltp_active_count - vq->ltp_starting <= 0)
+			continue;
+		ldap_pvt_thread_mutex_lock(&vq->ltp_mutex);
+		if (vq->ltp_open_count - vq->ltp_active_count - vq->ltp_starting > 0) {
+			ldap_pvt_thread_cond_signal(&vq->ltp_cond);
+			ldap_pvt_thread_mutex_unlock(&vq->ltp_mutex);
+			break;
+		}
+		ldap_pvt_thread_mutex_unlock(&vq->ltp_mutex);
+	}
+}
+
+/* Take the oldest pending task of some other work queue than pq.
+ * Called with pq->ltp_mutex locked; other queues are only trylocked
+ * so that two thieves cannot deadlock.  Returns NULL if none found.
+ *
+ * While the pool is finishing, every thread helps drain the other
+ * queues before it exits, since some may have pending tasks but no
+ * thread of their own left (e.g. after the max #threads was lowered).
+ * No new tasks arrive then, so a busy queue is not skipped: pq is
+ * unlocked while another queue is locked instead.
+ */
+static ldap_int_thread_task_t *
+ldap_int_thread_pool_steal( struct ldap_int_thread_poolq_s *pq )
+{
+	struct ldap_int_thread_pool_s *pool = pq->ltp_pool;
+	struct ldap_int_thread_poolq_s *vq;
+	ldap_int_thread_task_t *task = NULL;
+	int i, numqs = pool->ltp_numqs, qi = pq - pool->ltp_wqs;
+
+	/* Nothing to steal from, this queue is paused, or it has more
+	 * threads than its share; let those go idle and exit instead.
+	 */
+	if (numqs < 2 || pq->ltp_pause ||
+		(pq->ltp_vary_open_count < 0 && !pool->ltp_finishing))
+		return(NULL);
+
+	for (i = 1; i < numqs && task == NULL; i++) {
+		vq = &pool->ltp_wqs[(qi + i) % numqs];
+		if (pool->ltp_finishing) {
+			ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+			ldap_pvt_thread_mutex_lock(&vq->ltp_mutex);
+		} else {
+			/* unlocked peek, only a hint */
+			if (LDAP_STAILQ_EMPTY(vq->ltp_work_list))
+				continue;
+			if (ldap_pvt_thread_mutex_trylock(&vq->ltp_mutex) != 0)
+				continue;
+		}
+		task = LDAP_STAILQ_FIRST(vq->ltp_work_list);
+		if (task != NULL) {
+			LDAP_STAILQ_REMOVE_HEAD(vq->ltp_work_list, ltt_next.q);
+			vq->ltp_pending_count--;
+		}
+		ldap_pvt_thread_mutex_unlock(&vq->ltp_mutex);
+		if (pool->ltp_finishing) {
+			ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+			if (pq->ltp_pause && task != NULL) {
+				/* A pause got here meanwhile, run the task after it */
+				LDAP_STAILQ_INSERT_HEAD(&pq->ltp_pending_list, task,
+					ltt_next.q);
+				pq->ltp_pending_count++;
+				return(NULL);
+			}
+		}
+	}
+
+	return(task);
+}
 
 /* Submit a task to be performed by the thread pool */
 int
@@ -253,8 +480,10 @@ ldap_pvt_thread_pool_submit (
 	ldap_pvt_thread_start_t *start_routine, void *arg )
 {
 	struct ldap_int_thread_pool_s *pool;
+	struct ldap_int_thread_poolq_s *pq;
 	ldap_int_thread_task_t *task;
 	ldap_pvt_thread_t thr;
+	int i, qi, numqs, wake = 0;
 
 	if (tpool == NULL)
 		return(-1);
@@ -264,14 +493,30 @@ ldap_pvt_thread_pool_submit (
 	if (pool == NULL)
 		return(-1);
 
-	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
+	/* Pool threads submit to their own queue, others round-robin.
+	 * Move on to the next queue while the chosen one is full.
+	 */
+	numqs = pool->ltp_numqs;
+	pq = ldap_int_thread_pool_ownq(pool);
+	if (pq != NULL) {
+		qi = pq - pool->ltp_wqs;
+	} else {
+		qi = pool->ltp_nextq++ % numqs;
+	}
 
-	if (pool->ltp_pending_count >= pool->ltp_max_pending)
-		goto failed;
+	for (i = 0;; i++) {
+		pq = &pool->ltp_wqs[(qi + i) % numqs];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		if (pq->ltp_pending_count < pq->ltp_max_pending)
+			break;
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+		if (i == numqs-1)
+			return(-1);
+	}
 
-	task = LDAP_SLIST_FIRST(&pool->ltp_free_list);
+	task = LDAP_SLIST_FIRST(&pq->ltp_free_list);
 	if (task) {
-		LDAP_SLIST_REMOVE_HEAD(&pool->ltp_free_list, ltt_next.l);
+		LDAP_SLIST_REMOVE_HEAD(&pq->ltp_free_list, ltt_next.l);
 	} else {
 		task = (ldap_int_thread_task_t *) LDAP_MALLOC(sizeof(*task));
 		if (task == NULL)
@@ -281,66 +526,73 @@ ldap_pvt_thread_pool_submit (
 	task->ltt_start_routine = start_routine;
 	task->ltt_arg = arg;
 
-	pool->ltp_pending_count++;
-	LDAP_STAILQ_INSERT_TAIL(&pool->ltp_pending_list, task, ltt_next.q);
+	pq->ltp_pending_count++;
+	LDAP_STAILQ_INSERT_TAIL(&pq->ltp_pending_list, task, ltt_next.q);
 
-	/* true if ltp_pause != 0 or we should open (create) a thread */
-	if (pool->ltp_vary_open_count > 0 &&
-		pool->ltp_open_count < pool->ltp_active_count+pool->ltp_pending_count)
-	{
-		if (pool->ltp_pause)
-			goto done;
+	if (pq->ltp_open_count < pq->ltp_active_count+pq->ltp_pending_count) {
+		/* true if ltp_pause != 0 or we should open (create) a thread */
+		if (pq->ltp_vary_open_count > 0) {
+			if (pq->ltp_pause)
+				goto done;
 
-		pool->ltp_starting++;
-		pool->ltp_open_count++;
-		SET_VARY_OPEN_COUNT(pool);
+			pq->ltp_starting++;
+			pq->ltp_open_count++;
+			SET_VARY_OPEN_COUNT(pq);
 
-		if (0 != ldap_pvt_thread_create(
-			&thr, 1, ldap_int_thread_pool_wrapper, pool))
-		{
-			/* couldn't create thread.  back out of
-			 * ltp_open_count and check for even worse things.
-			 */
-			pool->ltp_starting--;
-			pool->ltp_open_count--;
-			SET_VARY_OPEN_COUNT(pool);
-
-			if (pool->ltp_open_count == 0) {
-				/* no open threads at all?!?
+			if (0 != ldap_pvt_thread_create(
+				&thr, 1, ldap_int_thread_pool_wrapper, pq))
+			{
+				/* couldn't create thread.  back out of
+				 * ltp_open_count and check for even worse things.
 				 */
-				ldap_int_thread_task_t *ptr;
+				pq->ltp_starting--;
+				pq->ltp_open_count--;
+				SET_VARY_OPEN_COUNT(pq);
 
-				/* let pool_destroy know there are no more threads */
-				ldap_pvt_thread_cond_signal(&pool->ltp_cond);
-
-				LDAP_STAILQ_FOREACH(ptr, &pool->ltp_pending_list, ltt_next.q)
-					if (ptr == task) break;
-				if (ptr == task) {
-					/* no open threads, task not handled, so
-					 * back out of ltp_pending_count, free the task,
-					 * report the error.
+				if (pq->ltp_open_count == 0) {
+					/* no open threads at all?!?
 					 */
-					pool->ltp_pending_count--;
-					LDAP_STAILQ_REMOVE(&pool->ltp_pending_list, task,
-						ldap_int_thread_task_s, ltt_next.q);
-					LDAP_SLIST_INSERT_HEAD(&pool->ltp_free_list, task,
-						ltt_next.l);
-					goto failed;
+					ldap_int_thread_task_t *ptr;
+
+					/* let pool_destroy know there are no more threads */
+					ldap_pvt_thread_cond_signal(&pq->ltp_cond);
+
+					LDAP_STAILQ_FOREACH(ptr, &pq->ltp_pending_list, ltt_next.q)
+						if (ptr == task) break;
+					if (ptr == task) {
+						/* no open threads, task not handled, so
+						 * back out of ltp_pending_count, free the task,
+						 * report the error.
+						 */
+						pq->ltp_pending_count--;
+						LDAP_STAILQ_REMOVE(&pq->ltp_pending_list, task,
+							ldap_int_thread_task_s, ltt_next.q);
+						LDAP_SLIST_INSERT_HEAD(&pq->ltp_free_list, task,
+							ltt_next.l);
+						goto failed;
+					}
 				}
+				/* there is another open thread, so this
+				 * task will be handled eventually.
+				 */
 			}
-			/* there is another open thread, so this
-			 * task will be handled eventually.
+		} else {
+			/* This queue is at its thread limit and has no idle
+			 * thread left, let another queue steal the task.
 			 */
+			wake = numqs > 1;
 		}
 	}
-	ldap_pvt_thread_cond_signal(&pool->ltp_cond);
+	ldap_pvt_thread_cond_signal(&pq->ltp_cond);
 
  done:
-	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+	ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	if (wake)
+		ldap_int_thread_pool_wake(pq);
 	return(0);
 
  failed:
-	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+	ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 	return(-1);
 }
 
@@ -360,7 +612,9 @@ ldap_pvt_thread_pool_retract (
 	ldap_pvt_thread_start_t *start_routine, void *arg )
 {
 	struct ldap_int_thread_pool_s *pool;
-	ldap_int_thread_task_t *task;
+	struct ldap_int_thread_poolq_s *pq;
+	ldap_int_thread_task_t *task = NULL;
+	int i;
 
 	if (tpool == NULL)
 		return(-1);
@@ -370,18 +624,21 @@ ldap_pvt_thread_pool_retract (
 	if (pool == NULL)
 		return(-1);
 
-	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
-	LDAP_STAILQ_FOREACH(task, &pool->ltp_pending_list, ltt_next.q)
-		if (task->ltt_start_routine == start_routine &&
-			task->ltt_arg == arg) {
-			/* Could LDAP_STAILQ_REMOVE the task, but that
-			 * walks ltp_pending_list again to find it.
-			 */
-			task->ltt_start_routine = no_task;
-			task->ltt_arg = NULL;
-			break;
-		}
-	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+	for (i = 0; i < pool->ltp_numqs && task == NULL; i++) {
+		pq = &pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		LDAP_STAILQ_FOREACH(task, &pq->ltp_pending_list, ltt_next.q)
+			if (task->ltt_start_routine == start_routine &&
+				task->ltt_arg == arg) {
+				/* Could LDAP_STAILQ_REMOVE the task, but that
+				 * walks ltp_pending_list again to find it.
+				 */
+				task->ltt_start_routine = no_task;
+				task->ltt_arg = NULL;
+				break;
+			}
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	}
 	return task != NULL;
 }
 
@@ -407,7 +664,69 @@ ldap_pvt_thread_pool_maxthreads(
 	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
 
 	pool->ltp_max_count = max_threads;
-	SET_VARY_OPEN_COUNT(pool);
+	ldap_int_thread_pool_share(pool);
+
+	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+	return(0);
+}
+
+/* Set the number of work queues.  1 gives the classic pool with a
+ * single pending list; more enable the per-queue work-stealing mode.
+ * numqs is capped at the max #threads; should that be lowered later,
+ * the queues past it are left without threads.  Only possible while
+ * the pool has no open threads and no pending tasks, i.e. before the
+ * first submit.
+ */
+int
+ldap_pvt_thread_pool_queues(
+	ldap_pvt_thread_pool_t *tpool,
+	int numqs )
+{
+	struct ldap_int_thread_pool_s *pool;
+	struct ldap_int_thread_poolq_s *wqs, *pq;
+	int i, busy = 0;
+
+	if (tpool == NULL)
+		return(-1);
+
+	pool = *tpool;
+
+	if (pool == NULL)
+		return(-1);
+
+	if (numqs < 1)
+		numqs = 1;
+
+	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
+
+	if (pool->ltp_max_count && numqs > pool->ltp_max_count)
+		numqs = pool->ltp_max_count;
+	if (numqs > LDAP_MAXTHR)
+		numqs = LDAP_MAXTHR;
+
+	if (numqs == pool->ltp_numqs) {
+		ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+		return(0);
+	}
+
+	for (i = 0; i < pool->ltp_numqs; i++) {
+		pq = &pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		busy |= pq->ltp_open_count || pq->ltp_pending_count;
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	}
+
+	if (busy || pool->ltp_pause || pool->ltp_finishing ||
+		(wqs = ldap_int_thread_poolq_create(pool, numqs)) == NULL)
+	{
+		ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+		return(-1);
+	}
+
+	ldap_int_thread_poolq_free(pool->ltp_wqs, pool->ltp_numqs);
+	pool->ltp_wqs = wqs;
+	pool->ltp_numqs = numqs;
+	ldap_int_thread_pool_share(pool);
 
 	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
 	return(0);
@@ -421,7 +740,8 @@ ldap_pvt_thread_pool_query(
 	void *value )
 {
 	struct ldap_int_thread_pool_s	*pool;
-	int				count = -1;
+	struct ldap_int_thread_poolq_s	*pq;
+	int				count = -1, i;
 
 	if ( tpool == NULL || value == NULL ) {
 		return -1;
@@ -447,30 +767,51 @@ ldap_pvt_thread_pool_query(
 			count = 0;
 		break;
 
-	case LDAP_PVT_THREAD_POOL_PARAM_OPEN:
-		count = pool->ltp_open_count;
-		if (count < 0)
-			count = -count;
-		break;
-
-	case LDAP_PVT_THREAD_POOL_PARAM_STARTING:
-		count = pool->ltp_starting;
-		break;
-
-	case LDAP_PVT_THREAD_POOL_PARAM_ACTIVE:
-		count = pool->ltp_active_count;
-		break;
-
 	case LDAP_PVT_THREAD_POOL_PARAM_PAUSING:
 		count = pool->ltp_pause;
 		break;
 
-	case LDAP_PVT_THREAD_POOL_PARAM_PENDING:
-		count = pool->ltp_pending_count;
+	case LDAP_PVT_THREAD_POOL_PARAM_QUEUES:
+		count = pool->ltp_numqs;
 		break;
 
+	case LDAP_PVT_THREAD_POOL_PARAM_OPEN:
+	case LDAP_PVT_THREAD_POOL_PARAM_STARTING:
+	case LDAP_PVT_THREAD_POOL_PARAM_ACTIVE:
+	case LDAP_PVT_THREAD_POOL_PARAM_PENDING:
 	case LDAP_PVT_THREAD_POOL_PARAM_BACKLOAD:
-		count = pool->ltp_pending_count + pool->ltp_active_count;
+	case LDAP_PVT_THREAD_POOL_PARAM_STATE:
+		/* sum up the work queues */
+		for ( count = 0, i = 0; i < pool->ltp_numqs; i++ ) {
+			pq = &pool->ltp_wqs[i];
+			ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+			switch ( param ) {
+			case LDAP_PVT_THREAD_POOL_PARAM_OPEN:
+				count += pq->ltp_open_count < 0 ?
+					-pq->ltp_open_count : pq->ltp_open_count;
+				break;
+			case LDAP_PVT_THREAD_POOL_PARAM_STARTING:
+				count += pq->ltp_starting;
+				break;
+			case LDAP_PVT_THREAD_POOL_PARAM_ACTIVE:
+				count += pq->ltp_active_count;
+				break;
+			case LDAP_PVT_THREAD_POOL_PARAM_BACKLOAD:
+				count += pq->ltp_active_count;
+				/* FALLTHRU */
+			default:
+				count += pq->ltp_pending_count;
+				break;
+			}
+			ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+		}
+		if ( param == LDAP_PVT_THREAD_POOL_PARAM_STATE ) {
+			*((char **)value) =
+				pool->ltp_pause ? "pausing" :
+				!pool->ltp_finishing ? "running" :
+				count ? "finishing" : "stopping";
+			count = -1;
+		}
 		break;
 
 	case LDAP_PVT_THREAD_POOL_PARAM_ACTIVE_MAX:
@@ -482,13 +823,6 @@ ldap_pvt_thread_pool_query(
 	case LDAP_PVT_THREAD_POOL_PARAM_BACKLOAD_MAX:
 		break;
 
-	case LDAP_PVT_THREAD_POOL_PARAM_STATE:
-		*((char **)value) =
-			pool->ltp_pause ? "pausing" :
-			!pool->ltp_finishing ? "running" :
-			pool->ltp_pending_count ? "finishing" : "stopping";
-		break;
-
 	case LDAP_PVT_THREAD_POOL_PARAM_UNKNOWN:
 		break;
 	}
@@ -498,7 +832,8 @@ ldap_pvt_thread_pool_query(
 		*((int *)value) = count;
 	}
 
-	return ( count == -1 ? -1 : 0 );
+	return ( count == -1 && param != LDAP_PVT_THREAD_POOL_PARAM_STATE ?
+		-1 : 0 );
 }
 
 /*
@@ -542,7 +877,9 @@ int
 ldap_pvt_thread_pool_destroy ( ldap_pvt_thread_pool_t *tpool, int run_pending )
 {
 	struct ldap_int_thread_pool_s *pool, *pptr;
+	struct ldap_int_thread_poolq_s *pq;
 	ldap_int_thread_task_t *task;
+	int i;
 
 	if (tpool == NULL)
 		return(-1);
@@ -564,32 +901,43 @@ ldap_pvt_thread_pool_destroy ( ldap_pvt_thread_pool_t *tpool, int run_pending )
 	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
 
 	pool->ltp_finishing = 1;
-	SET_VARY_OPEN_COUNT(pool);
 	if (pool->ltp_max_pending > 0)
 		pool->ltp_max_pending = -pool->ltp_max_pending;
 
-	if (!run_pending) {
-		while ((task = LDAP_STAILQ_FIRST(&pool->ltp_pending_list)) != NULL) {
-			LDAP_STAILQ_REMOVE_HEAD(&pool->ltp_pending_list, ltt_next.q);
-			LDAP_FREE(task);
-		}
-		pool->ltp_pending_count = 0;
-	}
+	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
 
-	while (pool->ltp_open_count) {
-		if (!pool->ltp_pause)
-			ldap_pvt_thread_cond_broadcast(&pool->ltp_cond);
-		ldap_pvt_thread_cond_wait(&pool->ltp_cond, &pool->ltp_mutex);
+	/* Tell every queue first, so threads still stealing from
+	 * the queues not yet drained see the pool finishing.
+	 */
+	for (i = 0; i < pool->ltp_numqs; i++) {
+		pq = &pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		SET_VARY_OPEN_COUNT(pq);
+		if (pq->ltp_max_pending > 0)
+			pq->ltp_max_pending = -pq->ltp_max_pending;
+
+		if (!run_pending) {
+			while ((task = LDAP_STAILQ_FIRST(&pq->ltp_pending_list)) != NULL) {
+				LDAP_STAILQ_REMOVE_HEAD(&pq->ltp_pending_list, ltt_next.q);
+				LDAP_FREE(task);
+			}
+			pq->ltp_pending_count = 0;
+		}
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 	}
 
-	while ((task = LDAP_SLIST_FIRST(&pool->ltp_free_list)) != NULL)
-	{
-		LDAP_SLIST_REMOVE_HEAD(&pool->ltp_free_list, ltt_next.l);
-		LDAP_FREE(task);
+	for (i = 0; i < pool->ltp_numqs; i++) {
+		pq = &pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		while (pq->ltp_open_count) {
+			if (!pq->ltp_pause)
+				ldap_pvt_thread_cond_broadcast(&pq->ltp_cond);
+			ldap_pvt_thread_cond_wait(&pq->ltp_cond, &pq->ltp_mutex);
+		}
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 	}
 
-	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
-	ldap_pvt_thread_cond_destroy(&pool->ltp_pcond);
+	ldap_int_thread_poolq_free(pool->ltp_wqs, pool->ltp_numqs);
 	ldap_pvt_thread_cond_destroy(&pool->ltp_cond);
 	ldap_pvt_thread_mutex_destroy(&pool->ltp_mutex);
 	LDAP_FREE(pool);
@@ -600,31 +948,34 @@ ldap_pvt_thread_pool_destroy ( ldap_pvt_thread_pool_t *tpool, int run_pending )
 
 /* Thread loop.  Accept and handle submitted tasks. */
 static void *
-ldap_int_thread_pool_wrapper ( 
-	void *xpool )
+ldap_int_thread_pool_wrapper (
+	void *xpq )
 {
-	struct ldap_int_thread_pool_s *pool = xpool;
+	struct ldap_int_thread_poolq_s *pq = xpq;
+	struct ldap_int_thread_pool_s *pool;
 	ldap_int_thread_task_t *task;
 	ldap_int_tpool_plist_t *work_list;
 	ldap_int_thread_userctx_t ctx, *kctx;
 	unsigned i, keyslot, hash;
 
-	assert(pool != NULL);
+	assert(pq != NULL);
+	pool = pq->ltp_pool;
 
 	for ( i=0; i<MAXKEYS; i++ ) {
 		ctx.ltu_key[i].ltk_key = NULL;
 	}
 
+	ctx.ltu_pq = pq;
 	ctx.ltu_id = ldap_pvt_thread_self();
 	TID_HASH(ctx.ltu_id, hash);
 
 	ldap_pvt_thread_key_setdata( ldap_tpool_key, &ctx );
 
-	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
+	ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
 
 	/* thread_keys[] is read-only when paused */
 	while (pool->ltp_pause)
-		ldap_pvt_thread_cond_wait(&pool->ltp_cond, &pool->ltp_mutex);
+		ldap_pvt_thread_cond_wait(&pq->ltp_cond, &pq->ltp_mutex);
 
 	/* find a key slot to give this thread ID and store a
 	 * pointer to our keys there; start at the thread ID
@@ -637,20 +988,25 @@ ldap_int_thread_pool_wrapper (
 	thread_keys[keyslot].ctx = &ctx;
 	ldap_pvt_thread_mutex_unlock(&ldap_pvt_thread_pool_mutex);
 
-	pool->ltp_starting--;
-	pool->ltp_active_count++;
+	pq->ltp_starting--;
+	pq->ltp_active_count++;
 
 	for (;;) {
-		work_list = pool->ltp_work_list; /* help the compiler a bit */
+		work_list = pq->ltp_work_list; /* help the compiler a bit */
 		task = LDAP_STAILQ_FIRST(work_list);
-		if (task == NULL) {	/* paused or no pending tasks */
-			if (--(pool->ltp_active_count) < 2) {
+		if (task != NULL) {
+			LDAP_STAILQ_REMOVE_HEAD(work_list, ltt_next.q);
+			pq->ltp_pending_count--;
+
+		} else if ((task = ldap_int_thread_pool_steal(pq)) == NULL) {
+			/* paused or no pending tasks */
+			if (--(pq->ltp_active_count) < 2) {
 				/* Notify pool_pause it is the sole active thread. */
-				ldap_pvt_thread_cond_signal(&pool->ltp_pcond);
+				ldap_pvt_thread_cond_signal(&pq->ltp_pcond);
 			}
 
 			do {
-				if (pool->ltp_vary_open_count < 0) {
+				if (pq->ltp_vary_open_count < 0) {
 					/* Not paused, and either finishing or too many
 					 * threads running (can happen if ltp_max_count
 					 * was reduced).  Let this thread die.
@@ -663,33 +1019,38 @@ ldap_int_thread_pool_wrapper (
 				 * Only die if there are other open threads (i.e.,
 				 * always have at least one thread open).
 				 * The check should be like this:
-				 *   if (pool->ltp_open_count>1 && pool->ltp_starting==0)
+				 *   if (pq->ltp_open_count>1 && pq->ltp_starting==0)
 				 *       check timer, wait if ltp_pause, leave thread;
 				 *
 				 * Just use pthread_cond_timedwait() if we want to
 				 * check idle time.
 				 */
-				ldap_pvt_thread_cond_wait(&pool->ltp_cond, &pool->ltp_mutex);
+				ldap_pvt_thread_cond_wait(&pq->ltp_cond, &pq->ltp_mutex);
 
-				work_list = pool->ltp_work_list;
+				work_list = pq->ltp_work_list;
 				task = LDAP_STAILQ_FIRST(work_list);
+				if (task != NULL) {
+					LDAP_STAILQ_REMOVE_HEAD(work_list, ltt_next.q);
+					pq->ltp_pending_count--;
+				} else {
+					task = ldap_int_thread_pool_steal(pq);
+				}
 			} while (task == NULL);
 
-			pool->ltp_active_count++;
+			pq->ltp_active_count++;
 		}
 
-		LDAP_STAILQ_REMOVE_HEAD(work_list, ltt_next.q);
-		pool->ltp_pending_count--;
-		ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 
 		task->ltt_start_routine(&ctx, task->ltt_arg);
 
-		ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
-		LDAP_SLIST_INSERT_HEAD(&pool->ltp_free_list, task, ltt_next.l);
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		LDAP_SLIST_INSERT_HEAD(&pq->ltp_free_list, task, ltt_next.l);
 	}
  done:
 
-	assert(!pool->ltp_pause); /* thread_keys writable, ltp_open_count >= 0 */
+	/* Not paused: thread_keys writable, ltp_open_count >= 0 */
+	assert(pq->ltp_open_count > 0);
 
 	/* The ltp_mutex lock protects ctx->ltu_key from pool_purgekey()
 	 * during this call, since it prevents new pauses. */
@@ -699,22 +1060,62 @@ ldap_int_thread_pool_wrapper (
 	thread_keys[keyslot].ctx = DELETED_THREAD_CTX;
 	ldap_pvt_thread_mutex_unlock(&ldap_pvt_thread_pool_mutex);
 
-	pool->ltp_open_count--;
-	SET_VARY_OPEN_COUNT(pool);
+	pq->ltp_open_count--;
+	SET_VARY_OPEN_COUNT(pq);
 	/* let pool_destroy know we're all done */
-	if (pool->ltp_open_count == 0)
-		ldap_pvt_thread_cond_signal(&pool->ltp_cond);
+	if (pq->ltp_open_count == 0)
+		ldap_pvt_thread_cond_signal(&pq->ltp_cond);
 
-	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+	ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 
 	ldap_pvt_thread_exit(NULL);
 	return(NULL);
 }
 
+/* Wait for the current pause to end.  pq is the caller's work
+ * queue, or NULL if the caller is not a pool thread.
+ * Return 1 if we waited, 0 if not.
+ */
+static int
+wait_resume( struct ldap_int_thread_pool_s *pool,
+	struct ldap_int_thread_poolq_s *pq )
+{
+	int waited = 0;
+
+	if (pq == NULL) {
+		ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
+		while (pool->ltp_pause) {
+			waited = 1;
+			ldap_pvt_thread_cond_wait(&pool->ltp_cond, &pool->ltp_mutex);
+		}
+		ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+		return(waited);
+	}
+
+	ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+	if (pool->ltp_pause) {
+		waited = 1;
+		pq->ltp_pending_count++;
+		pq->ltp_active_count--;
+		/* let the other pool_pause() know when it can proceed */
+		if (pq->ltp_active_count < 2)
+			ldap_pvt_thread_cond_signal(&pq->ltp_pcond);
+		do {
+			ldap_pvt_thread_cond_wait(&pq->ltp_cond, &pq->ltp_mutex);
+		} while (pool->ltp_pause);
+		pq->ltp_pending_count--;
+		pq->ltp_active_count++;
+	}
+	ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	return(waited);
+}
+
 static int
 handle_pause( ldap_pvt_thread_pool_t *tpool, int do_pause )
 {
 	struct ldap_int_thread_pool_s *pool;
+	struct ldap_int_thread_poolq_s *pq, *mq;
+	int i;
 
 	if (tpool == NULL)
 		return(-1);
@@ -727,39 +1128,48 @@ handle_pause( ldap_pvt_thread_pool_t *tpool, int do_pause )
 	if (! (do_pause || pool->ltp_pause))
 		return(0);
 
-	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
+	mq = ldap_int_thread_pool_ownq(pool);
 
-	/* If someone else has already requested a pause, we have to wait */
-	if (pool->ltp_pause) {
-		pool->ltp_pending_count++;
-		pool->ltp_active_count--;
-		/* let the other pool_pause() know when it can proceed */
-		if (pool->ltp_active_count < 2)
-			ldap_pvt_thread_cond_signal(&pool->ltp_pcond);
-		do {
-			ldap_pvt_thread_cond_wait(&pool->ltp_cond, &pool->ltp_mutex);
-		} while (pool->ltp_pause);
-		pool->ltp_pending_count--;
-		pool->ltp_active_count++;
+	if (!do_pause)
+		return(wait_resume(pool, mq));
+
+	/* If someone else has already requested a pause, we have to wait.
+	 * Never hold ltp_mutex while active in a queue: the other pauser
+	 * may be waiting for our queue to go idle.
+	 */
+	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
+	while (pool->ltp_pause) {
+		ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+		wait_resume(pool, mq);
+		ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
 	}
+	pool->ltp_pause = 1;
+	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
 
-	if (do_pause) {
-		/* Wait for everyone else to pause or finish */
-		pool->ltp_pause = 1;
+	for (i = 0; i < pool->ltp_numqs; i++) {
+		pq = &pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
 		/* Let ldap_pvt_thread_pool_submit() through to its ltp_pause test,
 		 * and do not finish threads in ldap_pvt_thread_pool_wrapper() */
-		pool->ltp_open_count = -pool->ltp_open_count;
-		SET_VARY_OPEN_COUNT(pool);
+		pq->ltp_pause = 1;
+		pq->ltp_open_count = -pq->ltp_open_count;
+		SET_VARY_OPEN_COUNT(pq);
 		/* Hide pending tasks from ldap_pvt_thread_pool_wrapper() */
-		pool->ltp_work_list = &empty_pending_list;
+		pq->ltp_work_list = &empty_pending_list;
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	}
 
-		while (pool->ltp_active_count > 1) {
-			ldap_pvt_thread_cond_wait(&pool->ltp_pcond, &pool->ltp_mutex);
+	/* Wait for everyone else to pause or finish */
+	for (i = 0; i < pool->ltp_numqs; i++) {
+		pq = &pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		while (pq->ltp_active_count > (pq == mq)) {
+			ldap_pvt_thread_cond_wait(&pq->ltp_pcond, &pq->ltp_mutex);
 		}
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 	}
 
-	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
-	return(!do_pause);
+	return(0);
 }
 
 /*
@@ -782,10 +1192,12 @@ ldap_pvt_thread_pool_pause( ldap_pvt_thread_pool_t *tpool )
 
 /* End a pause */
 int
-ldap_pvt_thread_pool_resume ( 
+ldap_pvt_thread_pool_resume (
 	ldap_pvt_thread_pool_t *tpool )
 {
 	struct ldap_int_thread_pool_s *pool;
+	struct ldap_int_thread_poolq_s *pq;
+	int i;
 
 	if (tpool == NULL)
 		return(-1);
@@ -799,10 +1211,19 @@ ldap_pvt_thread_pool_resume (
 
 	assert(pool->ltp_pause);
 	pool->ltp_pause = 0;
-	if (pool->ltp_open_count <= 0) /* true when paused, but be paranoid */
-		pool->ltp_open_count = -pool->ltp_open_count;
-	SET_VARY_OPEN_COUNT(pool);
-	pool->ltp_work_list = &pool->ltp_pending_list;
+
+	for (i = 0; i < pool->ltp_numqs; i++) {
+		pq = &pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		pq->ltp_pause = 0;
+		if (pq->ltp_open_count <= 0) /* true when paused, but be paranoid */
+			pq->ltp_open_count = -pq->ltp_open_count;
+		SET_VARY_OPEN_COUNT(pq);
+		pq->ltp_work_list = &pq->ltp_pending_list;
+
+		ldap_pvt_thread_cond_broadcast(&pq->ltp_cond);
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	}
 
 	ldap_pvt_thread_cond_broadcast(&pool->ltp_cond);
 
@@ -280,6 +280,8 @@ bdb_attr_index_config(
 		a->ai_cr = NULL;
 #endif
 		a->ai_desc = ad;
+		a->ai_nvals = 0;
+		memset( a->ai_idlsize, 0, sizeof( a->ai_idlsize ));
 
 		if ( bdb->bi_flags & BDB_IS_OPEN ) {
 			a->ai_indexmask = 0;
@@ -43,7 +43,23 @@ LDAP_BEGIN_DECL
 #define BDB_SUFFIX		".bdb"
 #define BDB_ID2ENTRY	0
 #define BDB_DN2ID		1
-#define BDB_NDB			2
+#define BDB_AD2I		2
+#define BDB_NDB			3
+
+/* Size of the attribute dictionary kept in the ad2i database */
+#define BDB_MAXADS		8192
+
+/* ad2i keys are big-endian indexes below BDB_MAXADS, so their first
+ * byte is always zero. Keys starting with this byte hold other data.
+ */
+#define BDB_AD2I_META	'\377'
+
+/* Compressed id2entry records, see compress.c */
+#define BDB_CZ_MARK		0x80
+#define BDB_CZ_DICT		0x01	/* compressed against the dictionary */
+#define BDB_CZ_HDRLEN	10
+#define BDB_CZ_RECORD(p,len)	((len) >= BDB_CZ_HDRLEN && !(p)[0] && \
+	(((unsigned char *)(p))[1] & BDB_CZ_MARK))
 
 /* The bdb on-disk entry format is pretty space-inefficient. Average
  * sized user entries are 3-4K each. You need at least two entries to
@@ -54,6 +70,27 @@ LDAP_BEGIN_DECL
 #define	BDB_ID2ENTRY_PAGESIZE	16384
 #endif
 
+/* Smallest buffer bdb_id2entry reads a record into */
+#define BDB_ID2ENTRY_MINREAD	1024
+
+/* Search candidates read ahead in one bulk read, and the buffer for it */
+#define BDB_PREFETCH_IDS		64
+#define BDB_PREFETCH_BUFSIZE	(256*1024)
+
+/* A write to id2entry only invalidates what was read ahead from its
+ * range of IDs; the ranges are as wide as a read ahead can span.
+ */
+#define BDB_ID2ENTRY_SEQS		64
+#define BDB_ID2ENTRY_SEQ(id)	(((id) / (4*BDB_PREFETCH_IDS)) % \
+	BDB_ID2ENTRY_SEQS)
+
+/* Large searches screen candidates on helper threads, a batch at a
+ * time, chunks of at least BDB_PAR_CHUNK each.
+ */
+#define BDB_PAR_BATCH		1024
+#define BDB_PAR_CHUNK		128
+#define BDB_PAR_MAXTHREADS	(BDB_PAR_BATCH/BDB_PAR_CHUNK)
+
 #define DEFAULT_CACHE_SIZE     1000
 
 /* The default search IDL stack cache depth */
@@ -67,10 +104,55 @@ typedef struct bdb_idl_cache_entry_s {
 	ID      *idl;
 	DB      *db;
 	int		idl_flags;
-	struct bdb_idl_cache_entry_s* idl_lru_prev;
-	struct bdb_idl_cache_entry_s* idl_lru_next;
+#define	IDL_CACHE_MAIN	0x01	/* on the main queue, else probation */
+	unsigned	idl_hash;
+	unsigned long	idl_size;	/* bytes charged to the cache */
+	LDAP_TAILQ_ENTRY(bdb_idl_cache_entry_s) idl_lru;
 } bdb_idl_cache_entry_t;
 
+LDAP_TAILQ_HEAD(bdb_idl_cache_queue, bdb_idl_cache_entry_s);
+
+/* The IDL cache is split into partitions by a hash of the key, each
+ * with its own lock. Within a partition, new IDLs go on a probation
+ * queue; those referenced again while there, or whose keys were
+ * recently dropped from it, go on the main queue. A scan only churns
+ * the probation queue.
+ */
+#define BDB_IDL_CACHE_PARTS	16
+#define BDB_IDL_CACHE_GHOSTS	256	/* keys remembered per partition */
+#define BDB_IDL_CACHE_STATS	32	/* indices counted per partition */
+
+typedef struct bdb_idl_cache_stat {
+	DB		*is_db;		/* NULL for the overflow slot */
+	unsigned long	is_hits;
+	unsigned long	is_misses;
+	unsigned long	is_evicts;
+} bdb_idl_cache_stat;
+
+typedef struct bdb_idl_cache_part {
+	ldap_pvt_thread_rdwr_t	ip_rwlock;	/* tree, queues and sizes */
+	Avlnode		*ip_tree;
+	struct bdb_idl_cache_queue	ip_probation;
+	struct bdb_idl_cache_queue	ip_main;
+	ID		ip_count;
+	ID		ip_pcount;		/* on probation */
+	unsigned long	ip_bytes;
+	unsigned long	ip_pbytes;	/* on probation */
+	unsigned	ip_ghosts[BDB_IDL_CACHE_GHOSTS];
+	int		ip_ghostpos;
+	ldap_pvt_thread_mutex_t	ip_statlock;	/* taking a stats slot */
+	bdb_idl_cache_stat	ip_stats[BDB_IDL_CACHE_STATS];
+} bdb_idl_cache_part;
+
+#define BDB_IDL_CACHING(bdb)	((bdb)->bi_idl_cache_max_size || \
+	(bdb)->bi_idl_cache_max_bytes)
+
+/* An IDL intersection kernel, see idlkern.c */
+typedef struct bdb_idl_kernel {
+	const char *ik_name;
+	ID (*ik_isect)( ID *out, ID *a, ID na, ID *b, ID nb );
+} bdb_idl_kernel;
+
 /* BDB backend specific entry info */
 typedef struct bdb_entry_info {
 	struct bdb_entry_info *bei_parent;
@@ -105,6 +187,7 @@ typedef struct bdb_entry_info {
 	int	bei_dkids;	/* number of kids on-disk, plus 1 */
 #endif
 	Entry	*bei_e;
+	unsigned long	bei_esize;	/* bytes charged for bei_e */
 	Avlnode	*bei_kids;
 #ifdef SLAP_ZONE_ALLOC
 	struct bdb_info *bei_bdb;
@@ -118,10 +201,35 @@ typedef struct bdb_entry_info {
 #undef BEI
 #define BEI(e)	((EntryInfo *) ((e)->e_private))
 
+/* The ID tree is hash-partitioned on the entry ID, each partition
+ * with its own lock, so that concurrent lookups by ID don't all
+ * serialize on a single rwlock. Must be a power of 2.
+ */
+#ifndef BDB_CACHE_SHARDS
+#define BDB_CACHE_SHARDS	16
+#endif
+
+typedef struct bdb_cache_shard {
+	Avlnode		*cs_idtree;
+	ldap_pvt_thread_rdwr_t cs_rwlock;
+} bdb_cache_shard;
+
+#define BDB_CACHE_SHARD(c, id)	(&(c)->c_shards[(id) & (BDB_CACHE_SHARDS-1)])
+
+/* Purge latency histogram: under 100us, 1ms, 10ms, 100ms, and slower */
+#define BDB_PURGE_BUCKETS	5
+
+/* c_purging states */
+#define BDB_PURGE_QUEUED	1	/* waiting for a pool thread */
+#define BDB_PURGE_RUNNING	2
+
+/* Percent of the limits past which a queued purge is not waited for */
+#define BDB_PURGE_HARD	125
+
 /* for the in-core cache of entries */
 typedef struct bdb_cache {
 	EntryInfo	*c_eifree;	/* free list */
-	Avlnode		*c_idtree;
+	bdb_cache_shard	c_shards[BDB_CACHE_SHARDS];
 	EntryInfo	*c_lruhead;	/* lru - add accessed entries here */
 	EntryInfo	*c_lrutail;	/* lru - rem lru entries from here */
 	EntryInfo	c_dntree;
@@ -131,17 +239,30 @@ typedef struct bdb_cache {
 	ID		c_eimax;
 	ID		c_eiused;	/* EntryInfo's in use */
 	ID		c_leaves;	/* EntryInfo leaf nodes */
-	int		c_purging;
+	unsigned long	c_maxbytes;
+	unsigned long	c_curbytes;	/* memory held by cached entries */
+	int		c_purging;	/* BDB_PURGE_xxx, 0 if idle */
+	ldap_pvt_thread_cond_t	c_purge_cond;	/* a purge ended */
+	int		c_purge_high;	/* percent of the limits that starts a purge */
+	int		c_purge_low;	/* percent of the limits a purge stops at */
+	unsigned long	c_purge_runs;
+	unsigned long	c_purge_max;	/* slowest purge, in microseconds */
+	unsigned long	c_purge_hist[BDB_PURGE_BUCKETS];
 	DB_TXN	*c_txn;	/* used by lru cleaner */
-	ldap_pvt_thread_rdwr_t c_rwlock;
 	ldap_pvt_thread_mutex_t c_lru_mutex;
-	ldap_pvt_thread_mutex_t c_count_mutex;
+	ldap_pvt_thread_mutex_t c_count_mutex;	/* also for c_eiused, c_leaves,
+											 * c_curbytes, c_purging,
+											 * purge stats */
 	ldap_pvt_thread_mutex_t c_eifree_mutex;
 #ifdef SLAP_ZONE_ALLOC
 	void *c_zctx;
 #endif
 } Cache;
  
+/* Entries are charged for their memory when either budget is set */
+#define BDB_CACHE_BYTES(bdb)	((bdb)->bi_cache.c_maxbytes || \
+	entry_cache_budget)
+
 #define CACHE_READ_LOCK                0
 #define CACHE_WRITE_LOCK       1
  
@@ -191,6 +312,7 @@ struct bdb_info {
 	int			bi_nattrs;
 	void		*bi_search_stack;
 	int		bi_search_stack_depth;
+	int		bi_search_threads;	/* helpers per large search */
 	int		bi_linear_index;
 
 	int			bi_txn_cp;
@@ -204,12 +326,31 @@ struct bdb_info {
 
 	ID			bi_lastid;
 	ldap_pvt_thread_mutex_t	bi_lastid_mutex;
+	long		bi_id2entry_avg;	/* running size of entry blocks */
+	unsigned long	bi_id2entry_seq[BDB_ID2ENTRY_SEQS];	/* by ID range */
+	unsigned long	bi_cache_seq;	/* bumped by changes to cached entries */
+	ldap_pvt_thread_mutex_t	bi_id2entry_mutex;	/* for the above, see bdb_id2entry_avg() */
+
+	/* attribute dictionary for id2entry records, index 0 unused */
+	AttributeDescription	**bi_ads;
+	int			bi_nads;
+	Avlnode		*bi_adtree;
+	ldap_pvt_thread_mutex_t	bi_ads_mutex;
+
+	int			bi_compress;
+	struct bdb_czdict	*bi_czdict;	/* set once, see compress.c */
+	ldap_pvt_thread_mutex_t	bi_cz_mutex;
+	struct berval	bi_cz_sample;	/* records kept to train the dictionary */
+	int			bi_cz_nsamples;	/* -1 while training */
+	unsigned long	bi_cz_in;	/* bytes given to bdb_compress */
+	unsigned long	bi_cz_out;	/* bytes stored */
+	unsigned long	bi_cz_decodes;
+	unsigned long	bi_cz_dtime;	/* microseconds spent decompressing */
+
 	ID	bi_idl_cache_max_size;
-	ID		bi_idl_cache_size;
-	Avlnode		*bi_idl_tree;
-	bdb_idl_cache_entry_t	*bi_idl_lru_head;
-	bdb_idl_cache_entry_t	*bi_idl_lru_tail;
-	ldap_pvt_thread_rdwr_t bi_idl_tree_rwlock;
+	unsigned long	bi_idl_cache_max_bytes;
+	bdb_idl_cache_part	bi_idl_cache[BDB_IDL_CACHE_PARTS];
+	ID		bi_idl_cache_size;	/* tool mode IDL cache */
 	ldap_pvt_thread_mutex_t bi_idl_tree_lrulock;
 	alock_info_t	bi_alock_info;
 	char		*bi_db_config_path;
@@ -223,6 +364,25 @@ struct bdb_info {
 	Avlnode		*bi_idx;
 #endif /* BDB_MONITOR_IDX */
 
+	ID			bi_plan_threshold;
+	unsigned long	bi_plan_count;	/* AND filters that were planned */
+	unsigned long	bi_plan_skipped;	/* index lookups skipped */
+	ldap_pvt_thread_mutex_t	bi_plan_mutex;	/* protects bi_plan_last */
+	char		bi_plan_last[256];	/* last sampled plan */
+
+	int		bi_warm;	/* keep a cache snapshot across restarts */
+	struct bdb_warm	*bi_warm_run;	/* preload in progress */
+	ldap_pvt_thread_mutex_t	bi_warm_mutex;
+	ldap_pvt_thread_cond_t	bi_warm_cond;
+	int		bi_warm_state;
+#define	BDB_WARM_IDLE		0
+#define	BDB_WARM_LOADING	1
+#define	BDB_WARM_DONE		2
+#define	BDB_WARM_STOPPED	3
+	ID		bi_warm_total;	/* IDs in the snapshot */
+	ID		bi_warm_done;	/* IDs loaded so far */
+	ID		bi_warm_missing;	/* IDs no longer in the database */
+
 	int		bi_flags;
 #define	BDB_IS_OPEN		0x01
 #define	BDB_HAS_CONFIG	0x02
@@ -238,6 +398,7 @@ struct bdb_info {
 
 #define bi_id2entry	bi_databases[BDB_ID2ENTRY]
 #define bi_dn2id	bi_databases[BDB_DN2ID]
+#define bi_ad2i		bi_databases[BDB_AD2I]
 
 
 struct bdb_lock_info {
@@ -346,6 +507,20 @@ extern int __db_logmsg(const DB_ENV *env, DB_TXN *txn, const char *op, u_int32_t
 LDAP_END_DECL
 
 /* for the cache of attribute information (which are indexed, etc.) */
+/* Filter types the search planner keeps statistics for */
+#define BDB_PLAN_PRES	0
+#define BDB_PLAN_EQ		1
+#define BDB_PLAN_APPROX	2
+#define BDB_PLAN_SUB	3
+#define BDB_PLAN_INEQ	4
+#define BDB_PLAN_NTYPES	5
+
+/* Default for the planthreshold keyword */
+#define BDB_PLAN_THRESHOLD	16
+
+/* Only one planned AND in this many is described for cn=monitor */
+#define BDB_PLAN_SAMPLE	64
+
 typedef struct bdb_attrinfo {
 	AttributeDescription *ai_desc; /* attribute description cn;lang-en */
 	slap_mask_t ai_indexmask;	/* how the attr is indexed	*/
@@ -353,6 +528,11 @@ typedef struct bdb_attrinfo {
 #ifdef LDAP_COMP_MATCH
 	ComponentReference* ai_cr; /*component indexing*/
 #endif
+	/* Planner statistics, see filterindex.c. They are updated
+	 * without locking, since they only need to be roughly right.
+	 */
+	long ai_nvals;			/* values indexed since startup */
+	ID ai_idlsize[BDB_PLAN_NTYPES];	/* smoothed IDL size, 0 if unknown */
 } AttrInfo;
 
 /* These flags must not clash with SLAP_INDEX flags or ops in slap.h! */
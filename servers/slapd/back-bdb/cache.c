@@ -30,8 +30,11 @@
 
 #ifdef BDB_HIER
 #define bdb_cache_lru_purge	hdb_cache_lru_purge
+#define bdb_cache_purge	hdb_cache_purge
+#define bdb_cache_purge_task	hdb_cache_purge_task
 #endif
 static void bdb_cache_lru_purge( struct bdb_info *bdb );
+static void bdb_cache_purge( struct bdb_info *bdb, int now );
 
 static int	bdb_cache_delete_internal(Cache *cache, EntryInfo *e, int decr);
 #ifdef LDAP_DEBUG
@@ -42,6 +45,83 @@ static void	bdb_idtree_print(Cache *cache);
 #endif
 #endif
 
+/* Approximate memory held by an entry */
+static unsigned long
+bdb_entry_memsize( Entry *e )
+{
+	Attribute *a;
+	unsigned long size;
+	unsigned i, nv;
+
+	size = sizeof( Entry ) + e->e_name.bv_len + e->e_nname.bv_len + 2;
+	for ( a = e->e_attrs; a; a = a->a_next ) {
+		nv = a->a_nvals != a->a_vals;
+		size += sizeof( Attribute ) +
+			( a->a_numvals + 1 ) * sizeof( struct berval ) * ( nv + 1 );
+		for ( i = 0; i < a->a_numvals; i++ ) {
+			size += a->a_vals[i].bv_len + 1;
+			if ( nv )
+				size += a->a_nvals[i].bv_len + 1;
+		}
+	}
+	return size;
+}
+
+/* Charge an entry's size to the byte budgets, replacing whatever
+ * it was charged before. Must hold c_count_mutex.
+ */
+static void
+bdb_cache_charge( Cache *cache, EntryInfo *ei, unsigned long esize )
+{
+	entry_cache_charge( (long)( esize - ei->bei_esize ));
+	cache->c_curbytes += esize - ei->bei_esize;
+	ei->bei_esize = esize;
+}
+
+/* pct percent of a cache limit; zero means the limit itself */
+#define BDB_CACHE_MARK(max, pct)	( (pct) ? \
+	(max) / 100 * (pct) + (max) % 100 * (pct) / 100 : (max) )
+
+/* Must hold c_count_mutex */
+static int
+bdb_cache_overbytes( Cache *cache, int pct )
+{
+	if ( cache->c_maxbytes &&
+		cache->c_curbytes > BDB_CACHE_MARK( cache->c_maxbytes, pct ))
+		return 1;
+	return entry_cache_over( pct, 0 ) > 0;
+}
+
+/* Has the cache reached pct percent of its limits? Must hold
+ * c_count_mutex
+ */
+static int
+bdb_cache_full( Cache *cache, int bytes, int pct )
+{
+	return cache->c_cursize > BDB_CACHE_MARK( cache->c_maxsize, pct ) ||
+		( bytes && bdb_cache_overbytes( cache, pct ));
+}
+
+/* Should an insert start a purge? 1 to queue one, 2 if a queued one
+ * is still waiting for a thread and the cache has grown so far past
+ * its limits that the inserting thread must purge itself. Sets
+ * c_purging accordingly. Must hold c_count_mutex.
+ */
+static int
+bdb_cache_needs_purge( Cache *cache, int bytes )
+{
+	if ( !cache->c_purging ) {
+		if ( !bdb_cache_full( cache, bytes, cache->c_purge_high ))
+			return 0;
+		cache->c_purging = BDB_PURGE_QUEUED;
+		return 1;
+	}
+	if ( cache->c_purging == BDB_PURGE_QUEUED &&
+		bdb_cache_full( cache, bytes, BDB_PURGE_HARD ))
+		return 2;
+	return 0;
+}
+
 /* For concurrency experiments only! */
 #if 0
 #define	ldap_pvt_thread_rdwr_wlock(a)	0
@@ -94,6 +174,7 @@ bdb_cache_entryinfo_free( Cache *cache, EntryInfo *ei )
 	ei->bei_parent = NULL;
 	ei->bei_kids = NULL;
 	ei->bei_lruprev = NULL;
+	ei->bei_esize = 0;
 
 #if 0
 	ldap_pvt_thread_mutex_lock( &cache->c_eifree_mutex );
@@ -331,7 +412,8 @@ bdb_id_dup_err( void *v1, void *v2 )
 	return -1;
 }
 
-/* Create an entryinfo in the cache. Caller must release the locks later.
+/* Create an entryinfo in the cache. Caller must release the locks later,
+ * i.e. the parent and the ID tree shard of ei->bei_id.
  */
 static int
 bdb_entryinfo_add_internal(
@@ -339,6 +421,7 @@ bdb_entryinfo_add_internal(
 	EntryInfo *ei,
 	EntryInfo **res )
 {
+	bdb_cache_shard *cs = BDB_CACHE_SHARD( &bdb->bi_cache, ei->bei_id );
 	EntryInfo *ei2 = NULL;
 
 	*res = NULL;
@@ -346,7 +429,7 @@ bdb_entryinfo_add_internal(
 	ei2 = bdb_cache_entryinfo_new( &bdb->bi_cache );
 
 	bdb_cache_entryinfo_lock( ei->bei_parent );
-	ldap_pvt_thread_rdwr_wlock( &bdb->bi_cache.c_rwlock );
+	ldap_pvt_thread_rdwr_wlock( &cs->cs_rwlock );
 
 	ei2->bei_id = ei->bei_id;
 	ei2->bei_parent = ei->bei_parent;
@@ -358,7 +441,7 @@ bdb_entryinfo_add_internal(
 #endif
 
 	/* Add to cache ID tree */
-	if (avl_insert( &bdb->bi_cache.c_idtree, ei2, bdb_id_cmp,
+	if (avl_insert( &cs->cs_idtree, ei2, bdb_id_cmp,
 		bdb_id_dup_err )) {
 		EntryInfo *eix = ei2->bei_lrunext;
 		bdb_cache_entryinfo_free( &bdb->bi_cache, ei2 );
@@ -372,15 +455,17 @@ bdb_entryinfo_add_internal(
 	} else {
 		int rc;
 
-		bdb->bi_cache.c_eiused++;
 		ber_dupbv( &ei2->bei_nrdn, &ei->bei_nrdn );
 
 		/* This is a new leaf node. But if parent had no kids, then it was
 		 * a leaf and we would be decrementing that. So, only increment if
 		 * the parent already has kids.
 		 */
+		ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
+		bdb->bi_cache.c_eiused++;
 		if ( ei->bei_parent->bei_kids || !ei->bei_parent->bei_id )
 			bdb->bi_cache.c_leaves++;
+		ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
 		rc = avl_insert( &ei->bei_parent->bei_kids, ei2, bdb_rdn_cmp,
 			avl_dup_error );
 #ifdef BDB_HIER
@@ -474,9 +559,10 @@ bdb_cache_find_ndn(
 			/* DN exists but needs to be added to cache */
 			ei.bei_nrdn.bv_len = len;
 			rc = bdb_entryinfo_add_internal( bdb, &ei, &ei2 );
-			/* add_internal left eip and c_rwlock locked */
+			/* add_internal left eip and the ID shard locked */
 			eip->bei_finders--;
-			ldap_pvt_thread_rdwr_wunlock( &bdb->bi_cache.c_rwlock );
+			ldap_pvt_thread_rdwr_wunlock(
+				&BDB_CACHE_SHARD( &bdb->bi_cache, ei.bei_id )->cs_rwlock );
 			if ( cursor ) cursor->c_close( cursor );
 			if ( rc ) {
 				*res = eip;
@@ -529,6 +615,7 @@ hdb_cache_find_parent(
 {
 	struct bdb_info *bdb = (struct bdb_info *) op->o_bd->be_private;
 	EntryInfo ei, eip, *ei2 = NULL, *ein = NULL, *eir = NULL;
+	bdb_cache_shard *cs;
 	int rc, add;
 
 	ei.bei_id = id;
@@ -568,17 +655,18 @@ hdb_cache_find_parent(
 
 again:
 		/* Insert this node into the ID tree */
-		ldap_pvt_thread_rdwr_wlock( &bdb->bi_cache.c_rwlock );
-		if ( avl_insert( &bdb->bi_cache.c_idtree, (caddr_t)ein,
+		cs = BDB_CACHE_SHARD( &bdb->bi_cache, ein->bei_id );
+		ldap_pvt_thread_rdwr_wlock( &cs->cs_rwlock );
+		if ( avl_insert( &cs->cs_idtree, (caddr_t)ein,
 			bdb_id_cmp, bdb_id_dup_err ) ) {
 			EntryInfo *eix = ein->bei_lrunext;
 
 			if ( bdb_cache_entryinfo_trylock( eix )) {
-				ldap_pvt_thread_rdwr_wunlock( &bdb->bi_cache.c_rwlock );
+				ldap_pvt_thread_rdwr_wunlock( &cs->cs_rwlock );
 				ldap_pvt_thread_yield();
 				goto again;
 			}
-			ldap_pvt_thread_rdwr_wunlock( &bdb->bi_cache.c_rwlock );
+			ldap_pvt_thread_rdwr_wunlock( &cs->cs_rwlock );
 
 			/* Someone else created this node just before us.
 			 * Free our new copy and use the existing one.
@@ -603,25 +691,38 @@ again:
 		/* If there was a previous node, link it to this one */
 		if ( ei2 ) ei2->bei_parent = ein;
 
+		/* The new node is marked NOT_LINKED, so nobody will use it
+		 * before we're done. Drop its shard before looking up the
+		 * parent, which may live in another one.
+		 */
+		ldap_pvt_thread_rdwr_wunlock( &cs->cs_rwlock );
+
 		/* Look for this node's parent */
 par2:
 		if ( eip.bei_id ) {
-			ei2 = (EntryInfo *) avl_find( bdb->bi_cache.c_idtree,
+			cs = BDB_CACHE_SHARD( &bdb->bi_cache, eip.bei_id );
+			ldap_pvt_thread_rdwr_rlock( &cs->cs_rwlock );
+			ei2 = (EntryInfo *) avl_find( cs->cs_idtree,
 					(caddr_t) &eip, bdb_id_cmp );
 		} else {
+			cs = NULL;
 			ei2 = &bdb->bi_cache.c_dntree;
 		}
 		if ( ei2 && bdb_cache_entryinfo_trylock( ei2 )) {
-			ldap_pvt_thread_rdwr_wunlock( &bdb->bi_cache.c_rwlock );
+			if ( cs )
+				ldap_pvt_thread_rdwr_runlock( &cs->cs_rwlock );
 			ldap_pvt_thread_yield();
-			ldap_pvt_thread_rdwr_wlock( &bdb->bi_cache.c_rwlock );
 			goto par2;
 		}
+		if ( cs )
+			ldap_pvt_thread_rdwr_runlock( &cs->cs_rwlock );
+
+		ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
 		if ( add )
 			bdb->bi_cache.c_eiused++;
 		if ( ei2 && ( ei2->bei_kids || !ei2->bei_id ))
 			bdb->bi_cache.c_leaves++;
-		ldap_pvt_thread_rdwr_wunlock( &bdb->bi_cache.c_rwlock );
+		ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
 
 gotparent:
 		/* Got the parent, link in and we're done. */
@@ -678,7 +779,8 @@ int hdb_cache_load(
 
 		rc = bdb_entryinfo_add_internal( bdb, ei, res );
 		bdb_cache_entryinfo_unlock( ei->bei_parent );
-		ldap_pvt_thread_rdwr_wunlock( &bdb->bi_cache.c_rwlock );
+		ldap_pvt_thread_rdwr_wunlock(
+			&BDB_CACHE_SHARD( &bdb->bi_cache, ei->bei_id )->cs_rwlock );
 	} else {
 		/* Found, return it */
 		*res = ei2;
@@ -700,20 +802,50 @@ bdb_cache_lru_purge( struct bdb_info *bdb )
 	int islocked;
 	ID eicount, ecount;
 	ID count, efree, eifree = 0;
+	ID mark;
+	unsigned long bcount, bfree = 0, bmark, usec, bucket;
+	struct timeval start, end;
+	int low, i;
 #ifdef LDAP_DEBUG
 	int iter;
 #endif
 
 	/* Wait for the mutex; we're the only one trying to purge. */
 	ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_lru_mutex );
+	gettimeofday( &start, NULL );
 
-	if ( bdb->bi_cache.c_cursize > bdb->bi_cache.c_maxsize ) {
-		efree = bdb->bi_cache.c_cursize - bdb->bi_cache.c_maxsize;
-		efree += bdb->bi_cache.c_minfree;
+	/* With a low watermark we free down to it, otherwise to
+	 * c_minfree entries below the limit.
+	 */
+	low = bdb->bi_cache.c_purge_low;
+	mark = BDB_CACHE_MARK( bdb->bi_cache.c_maxsize, low );
+	if ( bdb->bi_cache.c_cursize > mark ) {
+		efree = bdb->bi_cache.c_cursize - mark;
+		if ( !low )
+			efree += bdb->bi_cache.c_minfree;
 	} else {
 		efree = 0;
 	}
 
+	/* Bytes to free to get back under our own budget or, if the
+	 * cachebudget shared by all databases is exceeded, to give back
+	 * our share of what it's over by. Whichever cache happens to
+	 * purge doesn't pay for all the others.
+	 */
+	if ( BDB_CACHE_BYTES( bdb )) {
+		ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
+		bmark = BDB_CACHE_MARK( bdb->bi_cache.c_maxbytes, low );
+		if ( bdb->bi_cache.c_maxbytes && bdb->bi_cache.c_curbytes > bmark )
+			bfree = bdb->bi_cache.c_curbytes - bmark;
+		bmark = entry_cache_over( low, bdb->bi_cache.c_curbytes );
+		if ( bmark > bfree )
+			bfree = bmark;
+		if ( bfree && !low && bdb->bi_cache.c_cursize )
+			bfree += bdb->bi_cache.c_minfree *
+				( bdb->bi_cache.c_curbytes / bdb->bi_cache.c_cursize );
+		ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
+	}
+
 	/* maximum number of EntryInfo leaves to cache. In slapcat
 	 * we always free all leaf nodes.
 	 */
@@ -727,9 +859,12 @@ bdb_cache_lru_purge( struct bdb_info *bdb )
 			eifree /= 2;
 	}
 
-	if ( !efree && !eifree ) {
+	if ( !efree && !eifree && !bfree ) {
 		ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_lru_mutex );
+		ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
 		bdb->bi_cache.c_purging = 0;
+		ldap_pvt_thread_cond_broadcast( &bdb->bi_cache.c_purge_cond );
+		ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
 		return;
 	}
 
@@ -740,6 +875,7 @@ bdb_cache_lru_purge( struct bdb_info *bdb )
 	}
 
 	count = 0;
+	bcount = 0;
 	eicount = 0;
 	ecount = 0;
 #ifdef LDAP_DEBUG
@@ -795,7 +931,10 @@ bdb_cache_lru_purge( struct bdb_info *bdb )
 				if ( !efree && ecount > bdb->bi_cache.c_maxsize )
 					efree = bdb->bi_cache.c_minfree;
 
-				if ( count < efree ) {
+				/* Big entries go a long way towards bfree */
+				if ( count < efree || bcount < bfree ) {
+					bcount += elru->bei_esize;
+					elru->bei_esize = 0;
 					elru->bei_e->e_private = NULL;
 #ifdef SLAP_ZONE_ALLOC
 					bdb_entry_return( bdb, elru->bei_e, elru->bei_zseq );
@@ -833,7 +972,7 @@ next:
 			bdb_cache_entryinfo_unlock( elru->bei_parent );
 		}
 
-		if ( count >= efree && eicount >= eifree )
+		if ( count >= efree && bcount >= bfree && eicount >= eifree )
 			break;
 bottom:
 		if ( elnext == bdb->bi_cache.c_lruhead )
@@ -843,17 +982,146 @@ bottom:
 #endif
 	}
 
+	gettimeofday( &end, NULL );
+	usec = ( end.tv_sec - start.tv_sec ) * 1000000 +
+		end.tv_usec - start.tv_usec;
+	for ( i = 0, bucket = 100; i < BDB_PURGE_BUCKETS - 1 && usec >= bucket;
+		i++, bucket *= 10 );
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
 	if ( count || ecount > bdb->bi_cache.c_cursize ) {
-		ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
 		/* HACK: we seem to be losing track, fix up now */
 		if ( ecount > bdb->bi_cache.c_cursize )
 			bdb->bi_cache.c_cursize = ecount;
 		bdb->bi_cache.c_cursize -= count;
-		ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
+		if ( bcount ) {
+			bdb->bi_cache.c_curbytes -= bcount;
+			entry_cache_charge( -(long)bcount );
+		}
 	}
+	bdb->bi_cache.c_purge_runs++;
+	bdb->bi_cache.c_purge_hist[i]++;
+	if ( usec > bdb->bi_cache.c_purge_max )
+		bdb->bi_cache.c_purge_max = usec;
 	bdb->bi_cache.c_lruhead = elnext;
-	ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_lru_mutex );
 	bdb->bi_cache.c_purging = 0;
+	ldap_pvt_thread_cond_broadcast( &bdb->bi_cache.c_purge_cond );
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_lru_mutex );
+}
+
+static void
+bdb_cache_purge_run( struct bdb_info *bdb )
+{
+	ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
+	bdb->bi_cache.c_purging = BDB_PURGE_RUNNING;
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
+	bdb_cache_lru_purge( bdb );
+}
+
+static void *
+bdb_cache_purge_task( void *ctx, void *arg )
+{
+	bdb_cache_purge_run( arg );
+	return NULL;
+}
+
+/* Hand a purge off to the thread pool so the operation that
+ * filled the cache doesn't pay for emptying it. Tools have no
+ * pool to spare and purge inline. Caller has set c_purging.
+ *
+ * With a busy pool the purge may wait for a thread while the cache
+ * keeps growing. Past BDB_PURGE_HARD the inserting threads call
+ * here with now set: one of them takes the purge back from the
+ * pool and does it itself.
+ */
+static void
+bdb_cache_purge( struct bdb_info *bdb, int now )
+{
+	if ( slapMode & SLAP_TOOL_MODE ) {
+		bdb_cache_purge_run( bdb );
+	} else if ( now ) {
+		if ( ldap_pvt_thread_pool_retract( &connection_pool,
+			bdb_cache_purge_task, bdb ) > 0 )
+			bdb_cache_purge_run( bdb );
+	} else if ( ldap_pvt_thread_pool_submit( &connection_pool,
+		bdb_cache_purge_task, bdb )) {
+		/* Let the next insert try again */
+		ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
+		bdb->bi_cache.c_purging = 0;
+		ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
+	}
+}
+
+/* Cancel or wait out a pending purge before the cache goes away */
+void
+bdb_cache_purge_stop( struct bdb_info *bdb )
+{
+	ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
+	if ( bdb->bi_cache.c_purging == BDB_PURGE_QUEUED &&
+		ldap_pvt_thread_pool_retract( &connection_pool,
+		bdb_cache_purge_task, bdb ) > 0 )
+	{
+		bdb->bi_cache.c_purging = 0;
+	}
+	while ( bdb->bi_cache.c_purging )
+		ldap_pvt_thread_cond_wait( &bdb->bi_cache.c_purge_cond,
+			&bdb->bi_cache.c_count_mutex );
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
+}
+
+/*
+ * cache_has_entry - see whether the entry for an id is loaded.
+ * The answer may be stale by the time the caller looks at it,
+ * so it is only good as a hint.
+ */
+int
+bdb_cache_has_entry(
+	struct bdb_info *bdb,
+	ID				id )
+{
+	bdb_cache_shard *cs = BDB_CACHE_SHARD( &bdb->bi_cache, id );
+	EntryInfo ei, *eip;
+	int rc;
+
+	ei.bei_id = id;
+	ldap_pvt_thread_rdwr_rlock( &cs->cs_rwlock );
+	eip = (EntryInfo *) avl_find( cs->cs_idtree, (caddr_t) &ei, bdb_id_cmp );
+	rc = eip && eip->bei_e;
+	ldap_pvt_thread_rdwr_runlock( &cs->cs_rwlock );
+	return rc;
+}
+
+/* Count an entry loaded with ID_NOCACHE as cached after all, e.g.
+ * because another thread wants it too. Called with the info locked.
+ */
+static void
+bdb_cache_entry_cached( struct bdb_info *bdb, EntryInfo *ei )
+{
+	unsigned long esize = 0;
+
+	if ( !( ei->bei_state & CACHE_ENTRY_NOT_CACHED ))
+		return;
+
+	ei->bei_state &= ~CACHE_ENTRY_NOT_CACHED;
+	if ( ei->bei_e && BDB_CACHE_BYTES( bdb ))
+		esize = bdb_entry_memsize( ei->bei_e );
+	ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
+	++bdb->bi_cache.c_cursize;
+	if ( esize )
+		bdb_cache_charge( &bdb->bi_cache, ei, esize );
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
+}
+
+/* Keep an entry found with ID_NOCACHE in the cache when it is returned,
+ * for a thread that will look it up shortly.
+ */
+void
+bdb_cache_keep( struct bdb_info *bdb, EntryInfo *ei )
+{
+	bdb_cache_entryinfo_lock( ei );
+	bdb_cache_entry_cached( bdb, ei );
+	bdb_cache_entryinfo_unlock( ei );
 }
 
 /*
@@ -861,7 +1129,6 @@ bottom:
  * The entry is locked for Read upon return. Call with flag ID_LOCKED if
  * the supplied *eip was already locked.
  */
-
 int
 bdb_cache_find_id(
 	Operation *op,
@@ -872,6 +1139,7 @@ bdb_cache_find_id(
 	DB_LOCK		*lock )
 {
 	struct bdb_info *bdb = (struct bdb_info *) op->o_bd->be_private;
+	bdb_cache_shard *cs = BDB_CACHE_SHARD( &bdb->bi_cache, id );
 	Entry	*ep = NULL;
 	int	rc = 0, load = 0;
 	EntryInfo ei = { 0 };
@@ -883,14 +1151,14 @@ bdb_cache_find_id(
 #endif
 	/* If we weren't given any info, see if we have it already cached */
 	if ( !*eip ) {
-again:	ldap_pvt_thread_rdwr_rlock( &bdb->bi_cache.c_rwlock );
-		*eip = (EntryInfo *) avl_find( bdb->bi_cache.c_idtree,
+again:	ldap_pvt_thread_rdwr_rlock( &cs->cs_rwlock );
+		*eip = (EntryInfo *) avl_find( cs->cs_idtree,
 			(caddr_t) &ei, bdb_id_cmp );
 		if ( *eip ) {
 			/* If the lock attempt fails, the info is in use */
 			if ( bdb_cache_entryinfo_trylock( *eip )) {
 				int del = (*eip)->bei_state & CACHE_ENTRY_DELETED;
-				ldap_pvt_thread_rdwr_runlock( &bdb->bi_cache.c_rwlock );
+				ldap_pvt_thread_rdwr_runlock( &cs->cs_rwlock );
 				/* If this node is being deleted, treat
 				 * as if the delete has already finished
 				 */
@@ -906,19 +1174,21 @@ again:	ldap_pvt_thread_rdwr_rlock( &bdb->bi_cache.c_rwlock );
 			 */
 			if ( (*eip)->bei_state & CACHE_ENTRY_NOT_LINKED ) {
 				bdb_cache_entryinfo_unlock( *eip );
-				ldap_pvt_thread_rdwr_runlock( &bdb->bi_cache.c_rwlock );
+				ldap_pvt_thread_rdwr_runlock( &cs->cs_rwlock );
 				ldap_pvt_thread_yield();
 				goto again;
 			}
 			flag |= ID_LOCKED;
 		}
-		ldap_pvt_thread_rdwr_runlock( &bdb->bi_cache.c_rwlock );
+		ldap_pvt_thread_rdwr_runlock( &cs->cs_rwlock );
 	}
 
 	/* See if the ID exists in the database; add it to the cache if so */
 	if ( !*eip ) {
 #ifndef BDB_HIER
-		rc = bdb_id2entry( op->o_bd, tid, id, &ep );
+		rc = bdb_id2entry_prefetched( op, id, &ep );
+		if ( rc )
+			rc = bdb_id2entry( op->o_bd, tid, id, &ep );
 		if ( rc == 0 ) {
 			rc = bdb_cache_find_ndn( op, tid,
 				&ep->e_nname, eip );
@@ -974,12 +1244,7 @@ load1:
 				 * loading it, i.e it is already cached or
 				 * another thread is currently loading it.
 				 */
-				if ( (*eip)->bei_state & CACHE_ENTRY_NOT_CACHED ) {
-					(*eip)->bei_state &= ~CACHE_ENTRY_NOT_CACHED;
-					ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
-					++bdb->bi_cache.c_cursize;
-					ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
-				}
+				bdb_cache_entry_cached( bdb, *eip );
 				flag &= ~ID_NOCACHE;
 			}
 
@@ -997,7 +1262,9 @@ load1:
 			} else if ( rc == 0 ) {
 				if ( load ) {
 					if ( !ep) {
-						rc = bdb_id2entry( op->o_bd, tid, id, &ep );
+						rc = bdb_id2entry_prefetched( op, id, &ep );
+						if ( rc )
+							rc = bdb_id2entry( op->o_bd, tid, id, &ep );
 					}
 					if ( rc == 0 ) {
 						ep->e_private = *eip;
@@ -1075,23 +1342,33 @@ load1:
 	}
 	if ( rc == 0 ) {
 		int purge = 0;
+		unsigned long esize = 0;
+
+		if ( load && !( flag & ID_NOCACHE ) && BDB_CACHE_BYTES( bdb ))
+			esize = bdb_entry_memsize( (*eip)->bei_e );
 
-		if (( load && !( flag & ID_NOCACHE )) || bdb->bi_cache.c_eimax ) {
+		/* Plain cache hits must not touch the global count mutex;
+		 * only take it when we loaded an entry or the unlocked
+		 * peek says the EntryInfo limit may have been exceeded.
+		 */
+		if (( load && !( flag & ID_NOCACHE )) ||
+			( bdb->bi_cache.c_eimax && !bdb->bi_cache.c_purging &&
+			bdb->bi_cache.c_leaves > bdb->bi_cache.c_eimax )) {
 			ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
 			if ( load && !( flag & ID_NOCACHE )) {
 				bdb->bi_cache.c_cursize++;
-				if ( !bdb->bi_cache.c_purging && bdb->bi_cache.c_cursize > bdb->bi_cache.c_maxsize ) {
-					purge = 1;
-					bdb->bi_cache.c_purging = 1;
-				}
+				if ( esize )
+					bdb_cache_charge( &bdb->bi_cache, *eip, esize );
+				purge = bdb_cache_needs_purge( &bdb->bi_cache,
+					esize != 0 );
 			} else if ( !bdb->bi_cache.c_purging && bdb->bi_cache.c_eimax && bdb->bi_cache.c_leaves > bdb->bi_cache.c_eimax ) {
 				purge = 1;
-				bdb->bi_cache.c_purging = 1;
+				bdb->bi_cache.c_purging = BDB_PURGE_QUEUED;
 			}
 			ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
 		}
 		if ( purge )
-			bdb_cache_lru_purge( bdb );
+			bdb_cache_purge( bdb, purge > 1 );
 	}
 
 #ifdef SLAP_ZONE_ALLOC
@@ -1136,6 +1413,7 @@ bdb_cache_add(
 {
 	EntryInfo *new, ei;
 	int rc, purge = 0;
+	unsigned long esize = 0;
 #ifdef BDB_HIER
 	struct berval rdn = e->e_name;
 #endif
@@ -1186,24 +1464,36 @@ bdb_cache_add(
 	eip->bei_state &= ~CACHE_ENTRY_NO_KIDS;
 	bdb_cache_entryinfo_unlock( eip );
 
-	ldap_pvt_thread_rdwr_wunlock( &bdb->bi_cache.c_rwlock );
+	ldap_pvt_thread_rdwr_wunlock(
+		&BDB_CACHE_SHARD( &bdb->bi_cache, ei.bei_id )->cs_rwlock );
+	if ( BDB_CACHE_BYTES( bdb ))
+		esize = bdb_entry_memsize( e );
 	ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
 	++bdb->bi_cache.c_cursize;
-	if ( bdb->bi_cache.c_cursize > bdb->bi_cache.c_maxsize &&
-		!bdb->bi_cache.c_purging ) {
-		purge = 1;
-		bdb->bi_cache.c_purging = 1;
-	}
+	if ( esize )
+		bdb_cache_charge( &bdb->bi_cache, new, esize );
+	purge = bdb_cache_needs_purge( &bdb->bi_cache, esize != 0 );
 	ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
 
 	bdb_cache_lru_link( bdb, new );
 
 	if ( purge )
-		bdb_cache_lru_purge( bdb );
+		bdb_cache_purge( bdb, purge > 1 );
 
 	return rc;
 }
 
+/* Searches that screen their candidates in other threads must learn
+ * that a cached entry changed. Called with the entry write locked.
+ */
+static void
+bdb_cache_written( struct bdb_info *bdb )
+{
+	ldap_pvt_thread_mutex_lock( &bdb->bi_id2entry_mutex );
+	bdb->bi_cache_seq++;
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_id2entry_mutex );
+}
+
 int
 bdb_cache_modify(
 	struct bdb_info *bdb,
@@ -1225,6 +1515,13 @@ bdb_cache_modify(
 			attrs_free( e->e_attrs ); 
 		}
 		e->e_attrs = newAttrs;
+		bdb_cache_written( bdb );
+		if ( ei->bei_esize ) {
+			unsigned long esize = bdb_entry_memsize( e );
+			ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
+			bdb_cache_charge( &bdb->bi_cache, ei, esize );
+			ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
+		}
 	}
 	return rc;
 }
@@ -1267,6 +1564,7 @@ bdb_cache_modrdn(
 	}
 	e->e_name = new->e_name;
 	e->e_nname = new->e_nname;
+	bdb_cache_written( bdb );
 
 	/* Lock the parent's kids AVL tree */
 	pei = ei->bei_parent;
@@ -1433,6 +1731,7 @@ bdb_cache_delete_internal(
     EntryInfo		*e,
     int		decr )
 {
+	bdb_cache_shard *cs = BDB_CACHE_SHARD( cache, e->bei_id );
 	int rc = 0;	/* return code */
 	int decr_leaf = 0;
 
@@ -1456,28 +1755,28 @@ bdb_cache_delete_internal(
 	if ( e->bei_parent->bei_kids )
 		decr_leaf = 1;
 
-	ldap_pvt_thread_rdwr_wlock( &cache->c_rwlock );
+	ldap_pvt_thread_rdwr_wlock( &cs->cs_rwlock );
 	/* id tree */
-	if ( avl_delete( &cache->c_idtree, (caddr_t) e, bdb_id_cmp )) {
-		cache->c_eiused--;
-		if ( decr_leaf )
-			cache->c_leaves--;
-	} else {
+	if ( avl_delete( &cs->cs_idtree, (caddr_t) e, bdb_id_cmp ) == NULL ) {
 		rc = -1;
 		assert(0);
 	}
-	ldap_pvt_thread_rdwr_wunlock( &cache->c_rwlock );
+	ldap_pvt_thread_rdwr_wunlock( &cs->cs_rwlock );
 	bdb_cache_entryinfo_unlock( e->bei_parent );
 
 	if ( rc == 0 ){
 		/* lru */
 		LRU_DEL( cache, e );
 
-		if ( e->bei_e ) {
-			ldap_pvt_thread_mutex_lock( &cache->c_count_mutex );
+		ldap_pvt_thread_mutex_lock( &cache->c_count_mutex );
+		cache->c_eiused--;
+		if ( decr_leaf )
+			cache->c_leaves--;
+		if ( e->bei_e )
 			cache->c_cursize--;
-			ldap_pvt_thread_mutex_unlock( &cache->c_count_mutex );
-		}
+		if ( e->bei_esize )
+			bdb_cache_charge( cache, e, 0 );
+		ldap_pvt_thread_mutex_unlock( &cache->c_count_mutex );
 	}
 
 	return( rc );
@@ -1504,31 +1803,39 @@ bdb_entryinfo_release( void *data )
 void
 bdb_cache_release_all( Cache *cache )
 {
-	/* set cache write lock */
-	ldap_pvt_thread_rdwr_wlock( &cache->c_rwlock );
+	int i;
+
+	/* set cache write locks */
+	for ( i = 0; i < BDB_CACHE_SHARDS; i++ )
+		ldap_pvt_thread_rdwr_wlock( &cache->c_shards[i].cs_rwlock );
 	/* set lru mutex */
 	ldap_pvt_thread_mutex_lock( &cache->c_lru_mutex );
 
 	Debug( LDAP_DEBUG_TRACE, "====> bdb_cache_release_all\n", 0, 0, 0 );
 
 	avl_free( cache->c_dntree.bei_kids, NULL );
-	avl_free( cache->c_idtree, bdb_entryinfo_release );
+	for ( i = 0; i < BDB_CACHE_SHARDS; i++ ) {
+		avl_free( cache->c_shards[i].cs_idtree, bdb_entryinfo_release );
+		cache->c_shards[i].cs_idtree = NULL;
+	}
 	for (;cache->c_eifree;cache->c_eifree = cache->c_lruhead) {
 		cache->c_lruhead = cache->c_eifree->bei_lrunext;
 		bdb_cache_entryinfo_destroy(cache->c_eifree);
 	}
+	entry_cache_charge( -(long)cache->c_curbytes );
+	cache->c_curbytes = 0;
 	cache->c_cursize = 0;
 	cache->c_eiused = 0;
 	cache->c_leaves = 0;
-	cache->c_idtree = NULL;
 	cache->c_lruhead = NULL;
 	cache->c_lrutail = NULL;
 	cache->c_dntree.bei_kids = NULL;
 
 	/* free lru mutex */
 	ldap_pvt_thread_mutex_unlock( &cache->c_lru_mutex );
-	/* free cache write lock */
-	ldap_pvt_thread_rdwr_wunlock( &cache->c_rwlock );
+	/* free cache write locks */
+	for ( i = BDB_CACHE_SHARDS - 1; i >= 0; i-- )
+		ldap_pvt_thread_rdwr_wunlock( &cache->c_shards[i].cs_rwlock );
 }
 
 #ifdef LDAP_DEBUG
@@ -1569,7 +1876,11 @@ bdb_entryinfo_print(void *data, void *arg)
 static void
 bdb_idtree_print(Cache *cache)
 {
-	avl_apply( cache->c_idtree, bdb_entryinfo_print, NULL, -1, AVL_INORDER );
+	int i;
+
+	for ( i = 0; i < BDB_CACHE_SHARDS; i++ )
+		avl_apply( cache->c_shards[i].cs_idtree, bdb_entryinfo_print,
+			NULL, -1, AVL_INORDER );
 }
 #endif
 #endif
@@ -0,0 +1,689 @@
+/* compress.c - id2entry record compression */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2010 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Entries in id2entry are mostly made of strings that repeat from one
+ * entry to the next: attribute values like objectClass names, DN
+ * suffixes, and the length prefixes around them. Compressing each
+ * record on its own finds little of that, so records are compressed
+ * against a preset dictionary built from a sample of the database the
+ * first time it is opened with compression enabled, or from the first
+ * records written if the database is still small then. The dictionary
+ * is kept in the ad2i database under a BDB_AD2I_META key and never
+ * changes; records written before it existed are compressed without it.
+ *
+ * The codec is a plain LZ77 byte format: each sequence is a token
+ * byte holding a literal count and a match length, the literals, and
+ * a 16 bit offset back into the output or the dictionary. The last
+ * sequence has literals only.
+ *
+ * A compressed record starts with a zero byte and a format byte with
+ * BDB_CZ_MARK set, like the formats of entry_encode, followed by the
+ * decoded length and value count that bdb_id2entry needs to allocate
+ * the block entry_decode works in.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+#include <ac/time.h>
+
+#include "back-bdb.h"
+
+#define	CZ_MINMATCH		4
+#define	CZ_MAXOFF		0xffff
+#define	CZ_HASHBITS		12
+#define	CZ_HASHSIZE		(1<<CZ_HASHBITS)
+
+#define	CZ_MINLEN		64		/* don't bother with smaller records */
+#define	CZ_DICTSIZE		8192
+#define	CZ_SAMPLES		256		/* records read to train the dictionary */
+#define	CZ_SAMPLEMAX	16384	/* bytes used from each of them */
+#define	CZ_SEGMIN		4		/* shortest and longest strings */
+#define	CZ_SEGMAX		128		/* considered for the dictionary */
+
+typedef struct bdb_czdict {
+	struct berval cd_dict;
+	int cd_hash[CZ_HASHSIZE];	/* last position of each hash in cd_dict */
+} bdb_czdict;
+
+static const char cz_dictkey[] = { BDB_AD2I_META, 'c', 'z', 'd', 'i', 'c', 't' };
+
+static void cz_collect( struct bdb_info *bdb, struct berval *bv );
+
+static unsigned
+cz_hash( const unsigned char *p )
+{
+	unsigned v = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+
+	return ( v * 2654435761U ) >> ( 32 - CZ_HASHBITS );
+}
+
+static void
+cz_putlen( unsigned char **pp, ber_len_t len )
+{
+	unsigned char *p = *pp;
+
+	for ( ; len >= 255; len -= 255 )
+		*p++ = 255;
+	*p++ = len;
+	*pp = p;
+}
+
+/* Compress in[0..ilen-1] into out, using the dictionary that precedes
+ * it in src. src holds dlen bytes of dictionary followed by the input;
+ * table has already been filled for the dictionary. Returns the
+ * compressed length, or 0 if it would not fit in omax bytes.
+ */
+static ber_len_t
+cz_squeeze( unsigned char *src, ber_len_t dlen, ber_len_t ilen,
+	int *table, unsigned char *out, ber_len_t omax )
+{
+	unsigned char *op = out, *oend = out + omax;
+	ber_len_t ip, anchor, end, limit, lit, mlen;
+	long ref;
+	unsigned h;
+
+	ip = anchor = dlen;
+	end = dlen + ilen;
+	limit = end - CZ_MINMATCH;
+
+	while ( ip <= limit ) {
+		h = cz_hash( src + ip );
+		ref = table[h];
+		table[h] = ip;
+		if ( ref < 0 || ip - ref > CZ_MAXOFF ||
+			memcmp( src + ref, src + ip, CZ_MINMATCH ) ) {
+			ip++;
+			continue;
+		}
+		for ( mlen = CZ_MINMATCH; ip + mlen < end &&
+			src[ref + mlen] == src[ip + mlen]; mlen++ );
+
+		/* token, literal and match length bytes, literals, offset */
+		lit = ip - anchor;
+		if ( oend - op < 1 + lit/255 + 1 + lit + 2 + (mlen-CZ_MINMATCH)/255 + 1 )
+			return 0;
+		*op++ = ( lit < 15 ? lit : 15 ) << 4 |
+			( mlen - CZ_MINMATCH < 15 ? mlen - CZ_MINMATCH : 15 );
+		if ( lit >= 15 )
+			cz_putlen( &op, lit - 15 );
+		AC_MEMCPY( op, src + anchor, lit );
+		op += lit;
+		*op++ = ( ip - ref ) & 0xff;
+		*op++ = ( ip - ref ) >> 8;
+		if ( mlen - CZ_MINMATCH >= 15 )
+			cz_putlen( &op, mlen - CZ_MINMATCH - 15 );
+
+		ip += mlen;
+		anchor = ip;
+	}
+
+	lit = end - anchor;
+	if ( oend - op < 1 + lit/255 + 1 + lit )
+		return 0;
+	*op++ = ( lit < 15 ? lit : 15 ) << 4;
+	if ( lit >= 15 )
+		cz_putlen( &op, lit - 15 );
+	AC_MEMCPY( op, src + anchor, lit );
+	op += lit;
+
+	return op - out;
+}
+
+/* Expand in[0..ilen-1] into exactly olen bytes of out. Returns 0 on
+ * success, -1 if the input is damaged.
+ */
+static int
+cz_expand( const unsigned char *dict, ber_len_t dlen,
+	const unsigned char *in, ber_len_t ilen,
+	unsigned char *out, ber_len_t olen )
+{
+	const unsigned char *ip = in, *iend = in + ilen;
+	ber_len_t op = 0, lit, mlen, off;
+	unsigned c;
+
+	for (;;) {
+		if ( ip >= iend )
+			return -1;
+		c = *ip++;
+		lit = c >> 4;
+		mlen = c & 15;
+		if ( lit == 15 ) {
+			do {
+				if ( ip >= iend )
+					return -1;
+				c = *ip++;
+				lit += c;
+			} while ( c == 255 );
+		}
+		if ( lit > (ber_len_t)(iend - ip) || lit > olen - op )
+			return -1;
+		AC_MEMCPY( out + op, ip, lit );
+		ip += lit;
+		op += lit;
+		if ( ip == iend )
+			break;
+
+		if ( iend - ip < 2 )
+			return -1;
+		off = ip[0] | ( ip[1] << 8 );
+		ip += 2;
+		if ( mlen == 15 ) {
+			do {
+				if ( ip >= iend )
+					return -1;
+				c = *ip++;
+				mlen += c;
+			} while ( c == 255 );
+		}
+		mlen += CZ_MINMATCH;
+		if ( !off || off > op + dlen || mlen > olen - op )
+			return -1;
+
+		if ( off > op ) {
+			/* starts in the dictionary */
+			const unsigned char *p = dict + dlen - ( off - op );
+			while ( mlen && p < dict + dlen ) {
+				out[op++] = *p++;
+				mlen--;
+			}
+			off = op;
+		}
+		for ( ; mlen; mlen-- ) {
+			out[op] = out[op - off];
+			op++;
+		}
+	}
+
+	return op == olen ? 0 : -1;
+}
+
+static void
+cz_getlen( unsigned char *p, ber_len_t *len )
+{
+	*len = ( (ber_len_t)p[0] << 24 ) | ( p[1] << 16 ) | ( p[2] << 8 ) | p[3];
+}
+
+static void
+cz_putlen32( unsigned char *p, ber_len_t len )
+{
+	p[0] = len >> 24;
+	p[1] = len >> 16;
+	p[2] = len >> 8;
+	p[3] = len;
+}
+
+/* Replace bv with its compressed form, if that is smaller. */
+int
+bdb_compress( struct bdb_info *bdb, struct berval *bv )
+{
+	bdb_czdict *cd = bdb->bi_czdict;
+	EntryHeader eh;
+	unsigned char *src, *out;
+	ber_len_t dlen = cd ? cd->cd_dict.bv_len : 0, olen = 0;
+	int table[CZ_HASHSIZE];
+
+	if ( !cd )
+		cz_collect( bdb, bv );
+
+	if ( bv->bv_len >= CZ_MINLEN ) {
+		eh.bv = *bv;
+		if ( entry_header( &eh ) != LDAP_SUCCESS )
+			return -1;
+
+		if ( dlen ) {
+			src = ch_malloc( dlen + bv->bv_len );
+			AC_MEMCPY( src, cd->cd_dict.bv_val, dlen );
+			AC_MEMCPY( src + dlen, bv->bv_val, bv->bv_len );
+			AC_MEMCPY( table, cd->cd_hash, sizeof( table ));
+		} else {
+			src = (unsigned char *)bv->bv_val;
+			memset( table, 0xff, sizeof( table ));
+		}
+
+		out = ch_malloc( bv->bv_len );
+		olen = cz_squeeze( src, dlen, bv->bv_len, table,
+			out + BDB_CZ_HDRLEN, bv->bv_len - BDB_CZ_HDRLEN - 1 );
+		if ( dlen )
+			ch_free( src );
+
+		if ( olen ) {
+			out[0] = '\0';
+			out[1] = BDB_CZ_MARK | ( dlen ? BDB_CZ_DICT : 0 );
+			cz_putlen32( out + 2, bv->bv_len );
+			cz_putlen32( out + 6, eh.nvals );
+			olen += BDB_CZ_HDRLEN;
+		} else {
+			ch_free( out );
+		}
+	}
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_cz_mutex );
+	bdb->bi_cz_in += bv->bv_len;
+	bdb->bi_cz_out += olen ? olen : bv->bv_len;
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_cz_mutex );
+
+	if ( olen ) {
+		ch_free( bv->bv_val );
+		bv->bv_val = (char *)out;
+		bv->bv_len = olen;
+	}
+	return 0;
+}
+
+/* Expand the compressed record zbv into the block entry_decode works
+ * in: eh->bv is (re)allocated to hold the value array followed by the
+ * record, and eh->data is set as entry_header would.
+ */
+int
+bdb_decompress( struct bdb_info *bdb, struct berval *zbv, EntryHeader *eh )
+{
+	bdb_czdict *cd = bdb->bi_czdict;
+	unsigned char *p = (unsigned char *)zbv->bv_val;
+	ber_len_t ulen, nvals;
+	struct berval bv, blk;
+	struct timeval start, end;
+	int rc, flags;
+
+	if ( zbv->bv_len < BDB_CZ_HDRLEN )
+		return LDAP_OTHER;
+	flags = p[1];
+	cz_getlen( p + 2, &ulen );
+	cz_getlen( p + 6, &nvals );
+	if ( ( flags & BDB_CZ_DICT ) && !cd ) {
+		/* it may have just been trained by another thread */
+		ldap_pvt_thread_mutex_lock( &bdb->bi_cz_mutex );
+		cd = bdb->bi_czdict;
+		ldap_pvt_thread_mutex_unlock( &bdb->bi_cz_mutex );
+	}
+	if ( ( flags & BDB_CZ_DICT ) && !cd ) {
+		Debug( LDAP_DEBUG_ANY, "bdb_decompress: "
+			"record needs the compression dictionary, which is missing\n",
+			0, 0, 0 );
+		return LDAP_OTHER;
+	}
+	if ( nvals > ulen )
+		return LDAP_OTHER;
+
+	gettimeofday( &start, NULL );
+	eh->bv.bv_len = nvals * sizeof( struct berval ) + ulen;
+	eh->bv.bv_val = ch_realloc( eh->bv.bv_val, eh->bv.bv_len );
+	bv.bv_val = eh->bv.bv_val + nvals * sizeof( struct berval );
+	bv.bv_len = ulen;
+	if ( flags & BDB_CZ_DICT ) {
+		rc = cz_expand( (unsigned char *)cd->cd_dict.bv_val,
+			cd->cd_dict.bv_len, p + BDB_CZ_HDRLEN,
+			zbv->bv_len - BDB_CZ_HDRLEN, (unsigned char *)bv.bv_val, ulen );
+	} else {
+		rc = cz_expand( NULL, 0, p + BDB_CZ_HDRLEN,
+			zbv->bv_len - BDB_CZ_HDRLEN, (unsigned char *)bv.bv_val, ulen );
+	}
+	gettimeofday( &end, NULL );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY,
+			"bdb_decompress: damaged record\n", 0, 0, 0 );
+		return LDAP_OTHER;
+	}
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_cz_mutex );
+	bdb->bi_cz_decodes++;
+	bdb->bi_cz_dtime += ( end.tv_sec - start.tv_sec ) * 1000000 +
+		end.tv_usec - start.tv_usec;
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_cz_mutex );
+
+	/* parse the header of the expanded record in place */
+	blk = eh->bv;
+	eh->bv = bv;
+	rc = entry_header( eh );
+	eh->bv = blk;
+	if ( rc == LDAP_SUCCESS && eh->nvals != nvals )
+		rc = LDAP_OTHER;
+	return rc;
+}
+
+typedef struct cz_seg {
+	ber_len_t off;
+	ber_len_t len;
+	unsigned long count;
+} cz_seg;
+
+static int
+cz_seg_cmp( const void *v1, const void *v2 )
+{
+	const cz_seg *s1 = v1, *s2 = v2;
+	unsigned long sc1 = ( s1->count - 1 ) * s1->len,
+		sc2 = ( s2->count - 1 ) * s2->len;
+
+	return sc1 < sc2 ? 1 : sc1 > sc2 ? -1 : 0;
+}
+
+/* Build a dictionary from the strings that recur most often, weighted
+ * by length, across the sample. The best ones go last, where they can
+ * be reached with the shortest offsets.
+ */
+static void
+cz_train( struct berval *sample, struct berval *dict )
+{
+	unsigned char *p = (unsigned char *)sample->bv_val;
+	cz_seg *segs;
+	ber_len_t i, start, len, total;
+	int nsegs = CZ_HASHSIZE * 4, n, j;
+	char *ptr;
+
+	segs = ch_calloc( nsegs, sizeof( cz_seg ));
+	for ( i = start = 0; i < sample->bv_len; i++ ) {
+		unsigned h = 2166136261U;
+
+		if ( p[i] )
+			continue;
+		len = i + 1 - start;
+		if ( len >= CZ_SEGMIN && len <= CZ_SEGMAX ) {
+			ber_len_t k;
+			for ( k = start; k <= i; k++ )
+				h = ( h ^ p[k] ) * 16777619U;
+			for ( j = 0; j < 8; j++ ) {
+				cz_seg *s = &segs[( h + j ) % nsegs];
+				if ( !s->count ) {
+					s->off = start;
+					s->len = len;
+					s->count = 1;
+					break;
+				}
+				if ( s->len == len && !memcmp( p + s->off, p + start, len )) {
+					s->count++;
+					break;
+				}
+			}
+		}
+		start = i + 1;
+	}
+
+	for ( i = n = 0; i < nsegs; i++ ) {
+		if ( segs[i].count > 1 )
+			segs[n++] = segs[i];
+	}
+	qsort( segs, n, sizeof( cz_seg ), cz_seg_cmp );
+	for ( j = 0, total = 0; j < n && total + segs[j].len <= CZ_DICTSIZE; j++ )
+		total += segs[j].len;
+
+	dict->bv_len = total;
+	dict->bv_val = ptr = total ? ch_malloc( total ) : NULL;
+	while ( j-- > 0 ) {
+		AC_MEMCPY( ptr, p + segs[j].off, segs[j].len );
+		ptr += segs[j].len;
+	}
+	ch_free( segs );
+}
+
+/* Read records spread evenly over the ID space of id2entry */
+static int
+cz_sample( struct bdb_info *bdb, struct berval *sample )
+{
+	DB *db = bdb->bi_id2entry->bdi_db;
+	DBT key, data;
+	DBC *cursor;
+	ID nid, id, last = NOID;
+	char *buf = NULL;
+	ber_len_t bufsize = 0, len;
+	int rc, i;
+
+	rc = db->cursor( db, NULL, &cursor, bdb->bi_db_opflags );
+	if ( rc ) return rc;
+
+	DBTzero( &key );
+	key.data = &nid;
+	key.size = key.ulen = sizeof(ID);
+	key.flags = DB_DBT_USERMEM;
+	DBTzero( &data );
+	data.flags = DB_DBT_USERMEM;
+
+	BER_BVZERO( sample );
+	for ( i = 0; i < CZ_SAMPLES; i++ ) {
+		EntryHeader eh;
+		struct berval bv;
+
+		BDB_ID2DISK( 1 + bdb->bi_lastid * i / CZ_SAMPLES, &nid );
+		data.data = buf;
+		data.ulen = bufsize;
+		rc = cursor->c_get( cursor, &key, &data, DB_SET_RANGE );
+		if ( rc == DB_BUFFER_SMALL ) {
+			bufsize = data.size;
+			buf = ch_realloc( buf, bufsize );
+			data.data = buf;
+			data.ulen = bufsize;
+			rc = cursor->c_get( cursor, &key, &data, DB_CURRENT );
+		}
+		if ( rc == DB_NOTFOUND ) {
+			rc = 0;
+			break;
+		}
+		if ( rc ) break;
+		BDB_DISK2ID( &nid, &id );
+		if ( id == last )
+			continue;
+		last = id;
+
+		DBT2bv( &data, &bv );
+		BER_BVZERO( &eh.bv );
+		if ( BDB_CZ_RECORD( bv.bv_val, bv.bv_len )) {
+			if ( bdb_decompress( bdb, &bv, &eh ) == LDAP_SUCCESS ) {
+				bv.bv_val = eh.data;
+				bv.bv_len = eh.bv.bv_len - ( eh.data - eh.bv.bv_val );
+			} else {
+				BER_BVZERO( &bv );
+			}
+		}
+		len = bv.bv_len < CZ_SAMPLEMAX ? bv.bv_len : CZ_SAMPLEMAX;
+		if ( len ) {
+			sample->bv_val = ch_realloc( sample->bv_val,
+				sample->bv_len + len );
+			AC_MEMCPY( sample->bv_val + sample->bv_len, bv.bv_val, len );
+			sample->bv_len += len;
+		}
+		ch_free( eh.bv.bv_val );
+	}
+	cursor->c_close( cursor );
+	ch_free( buf );
+	return rc;
+}
+
+static void
+cz_index( bdb_czdict *cd )
+{
+	unsigned char *p = (unsigned char *)cd->cd_dict.bv_val;
+	ber_len_t i;
+
+	memset( cd->cd_hash, 0xff, sizeof( cd->cd_hash ));
+	for ( i = 0; i + CZ_MINMATCH <= cd->cd_dict.bv_len; i++ )
+		cd->cd_hash[cz_hash( p + i )] = i;
+}
+
+/* Train a dictionary from sample and index it. Returns NULL if the
+ * sample has nothing worth putting in one.
+ */
+static bdb_czdict *
+cz_build( struct berval *sample )
+{
+	bdb_czdict *cd;
+
+	cd = ch_malloc( sizeof( bdb_czdict ));
+	cz_train( sample, &cd->cd_dict );
+	if ( !cd->cd_dict.bv_len ) {
+		ch_free( cd );
+		return NULL;
+	}
+	cz_index( cd );
+	return cd;
+}
+
+static void
+cz_free( bdb_czdict *cd )
+{
+	if ( cd ) {
+		ch_free( cd->cd_dict.bv_val );
+		ch_free( cd );
+	}
+}
+
+static void
+cz_dictkey2DBT( DBT *key )
+{
+	DBTzero( key );
+	key->data = (void *)cz_dictkey;
+	key->size = sizeof( cz_dictkey );
+}
+
+/* Store a new dictionary. Like new ad2i indexes it is committed on
+ * its own, so it is never lost while records refer to it.
+ */
+static int
+cz_store( struct bdb_info *bdb, bdb_czdict *cd )
+{
+	DB *db = bdb->bi_ad2i->bdi_db;
+	DBT key, data;
+	int rc;
+
+	cz_dictkey2DBT( &key );
+	DBTzero( &data );
+	bv2DBT( &cd->cd_dict, &data );
+	rc = db->put( db, NULL, &key, &data, DB_NOOVERWRITE );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, "bdb_compress: "
+			"storing the dictionary failed: %s (%d)\n",
+			db_strerror(rc), rc, 0 );
+	}
+	return rc;
+}
+
+/* Until there is a dictionary, keep the start of each record written
+ * and train one once there are CZ_SAMPLES of them. This covers
+ * databases that were empty or nearly so when compression was first
+ * enabled. The thread that completes the sample does the training;
+ * if that fails, sampling starts over.
+ */
+static void
+cz_collect( struct bdb_info *bdb, struct berval *bv )
+{
+	struct berval *s = &bdb->bi_cz_sample, sample;
+	ber_len_t len = bv->bv_len < CZ_SAMPLEMAX ? bv->bv_len : CZ_SAMPLEMAX;
+	bdb_czdict *cd;
+	int rc = -1;
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_cz_mutex );
+	if ( bdb->bi_czdict || bdb->bi_cz_nsamples < 0 ||
+		!bdb->bi_ad2i->bdi_db ) {
+		ldap_pvt_thread_mutex_unlock( &bdb->bi_cz_mutex );
+		return;
+	}
+	s->bv_val = ch_realloc( s->bv_val, s->bv_len + len );
+	AC_MEMCPY( s->bv_val + s->bv_len, bv->bv_val, len );
+	s->bv_len += len;
+	if ( ++bdb->bi_cz_nsamples < CZ_SAMPLES ) {
+		ldap_pvt_thread_mutex_unlock( &bdb->bi_cz_mutex );
+		return;
+	}
+	sample = *s;
+	BER_BVZERO( s );
+	bdb->bi_cz_nsamples = -1;
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_cz_mutex );
+
+	cd = cz_build( &sample );
+	if ( cd ) {
+		rc = cz_store( bdb, cd );
+		Debug( LDAP_DEBUG_STATS, LDAP_XSTRING(bdb_compress)
+			": trained a %lu byte dictionary from %lu bytes\n",
+			cd->cd_dict.bv_len, sample.bv_len, 0 );
+	}
+	ch_free( sample.bv_val );
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_cz_mutex );
+	if ( rc == 0 ) {
+		bdb->bi_czdict = cd;
+	} else {
+		cz_free( cd );
+		bdb->bi_cz_nsamples = 0;
+	}
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_cz_mutex );
+}
+
+/* Load the compression dictionary. If compression is enabled and
+ * there is none yet, train one from the database if it has enough
+ * entries, otherwise bdb_compress will train one from the first
+ * records it is given.
+ */
+int
+bdb_compress_open( BackendDB *be )
+{
+	struct bdb_info *bdb = (struct bdb_info *) be->be_private;
+	DB *db = bdb->bi_ad2i->bdi_db;
+	bdb_czdict *cd = NULL;
+	DBT key, data;
+	int rc;
+
+	if ( !db ) return 0;
+
+	cz_dictkey2DBT( &key );
+	DBTzero( &data );
+	data.flags = DB_DBT_USERMEM;
+
+	rc = db->get( db, NULL, &key, &data, 0 );
+	if ( rc == DB_BUFFER_SMALL ) {
+		cd = ch_malloc( sizeof( bdb_czdict ));
+		cd->cd_dict.bv_len = data.size;
+		cd->cd_dict.bv_val = ch_malloc( data.size );
+		data.data = cd->cd_dict.bv_val;
+		data.ulen = data.size;
+		rc = db->get( db, NULL, &key, &data, 0 );
+		if ( rc == 0 )
+			cz_index( cd );
+	} else if ( rc == DB_NOTFOUND && bdb->bi_compress &&
+		bdb->bi_lastid >= CZ_SAMPLES &&
+		!( slapMode & (SLAP_TOOL_READONLY|SLAP_TOOL_READMAIN) )) {
+		struct berval sample;
+
+		rc = cz_sample( bdb, &sample );
+		if ( rc == 0 && sample.bv_len ) {
+			cd = cz_build( &sample );
+			if ( cd ) {
+				rc = cz_store( bdb, cd );
+				Debug( LDAP_DEBUG_STATS, LDAP_XSTRING(bdb_compress_open)
+					": trained a %lu byte dictionary from %lu bytes\n",
+					cd->cd_dict.bv_len, sample.bv_len, 0 );
+			}
+		}
+		ch_free( sample.bv_val );
+	} else if ( rc == DB_NOTFOUND ) {
+		rc = 0;
+	}
+
+	if ( rc ) {
+		cz_free( cd );
+	} else {
+		bdb->bi_czdict = cd;
+	}
+	return rc;
+}
+
+void
+bdb_compress_close( struct bdb_info *bdb )
+{
+	cz_free( bdb->bi_czdict );
+	bdb->bi_czdict = NULL;
+	ch_free( bdb->bi_cz_sample.bv_val );
+	BER_BVZERO( &bdb->bi_cz_sample );
+	bdb->bi_cz_nsamples = 0;
+}
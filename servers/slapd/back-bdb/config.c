@@ -52,7 +52,9 @@ enum {
 	BDB_SSTACK,
 	BDB_MODE,
 	BDB_PGSIZE,
-	BDB_CHECKSUM
+	BDB_CHECKSUM,
+	BDB_CPURGE,
+	BDB_CWARM
 };
 
 static ConfigTable bdbcfg[] = {
@@ -61,16 +63,29 @@ static ConfigTable bdbcfg[] = {
 			"DESC 'Directory for database content' "
 			"EQUALITY caseIgnoreMatch "
 			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
+	{ "cachebytes", "bytes", 2, 2, 0, ARG_ULONG|ARG_OFFSET,
+		(void *)offsetof(struct bdb_info, bi_cache.c_maxbytes),
+		"( OLcfgDbAt:1.21 NAME 'olcDbCacheBytes' "
+			"DESC 'Entry cache size in bytes' "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "cachefree", "size", 2, 2, 0, ARG_ULONG|ARG_OFFSET,
 		(void *)offsetof(struct bdb_info, bi_cache.c_minfree),
 		"( OLcfgDbAt:1.11 NAME 'olcDbCacheFree' "
 			"DESC 'Number of extra entries to free when max is reached' "
 			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "cachepurge", "high> <low", 3, 3, 0, ARG_MAGIC|BDB_CPURGE,
+		bdb_cf_gen, "( OLcfgDbAt:1.23 NAME 'olcDbCachePurge' "
+			"DESC 'Entry cache purge watermarks in percent of the limits' "
+			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ "cachesize", "size", 2, 2, 0, ARG_ULONG|ARG_OFFSET,
 		(void *)offsetof(struct bdb_info, bi_cache.c_maxsize),
 		"( OLcfgDbAt:1.1 NAME 'olcDbCacheSize' "
 			"DESC 'Entry cache size in entries' "
 			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "cachewarm", NULL, 1, 2, 0, ARG_ON_OFF|ARG_MAGIC|BDB_CWARM,
+		bdb_cf_gen, "( OLcfgDbAt:1.24 NAME 'olcDbCacheWarm' "
+			"DESC 'Save the entry cache contents at shutdown and reload them' "
+			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
 	{ "checkpoint", "kbyte> <min", 3, 3, 0, ARG_MAGIC|BDB_CHKPT,
 		bdb_cf_gen, "( OLcfgDbAt:1.2 NAME 'olcDbCheckpoint' "
 			"DESC 'Database checkpoint interval in kbytes and minutes' "
@@ -79,6 +94,11 @@ static ConfigTable bdbcfg[] = {
 		bdb_cf_gen, "( OLcfgDbAt:1.16 NAME 'olcDbChecksum' "
 			"DESC 'Enable database checksum validation' "
 			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
+	{ "compress", NULL, 1, 2, 0, ARG_ON_OFF|ARG_OFFSET,
+		(void *)offsetof(struct bdb_info, bi_compress),
+		"( OLcfgDbAt:1.18 NAME 'olcDbCompress' "
+		"DESC 'Compress id2entry records' "
+		"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
 	{ "cryptfile", "file", 2, 2, 0, ARG_STRING|ARG_MAGIC|BDB_CRYPTFILE,
 		bdb_cf_gen, "( OLcfgDbAt:1.13 NAME 'olcDbCryptFile' "
 			"DESC 'Pathname of file containing the DB encryption key' "
@@ -119,6 +139,11 @@ static ConfigTable bdbcfg[] = {
 		"( OLcfgDbAt:1.6 NAME 'olcDbIDLcacheSize' "
 		"DESC 'IDL cache size in IDLs' "
 		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "idlcachebytes", "size", 2, 2, 0, ARG_ULONG|ARG_OFFSET,
+		(void *)offsetof(struct bdb_info, bi_idl_cache_max_bytes),
+		"( OLcfgDbAt:1.20 NAME 'olcDbIDLcacheBytes' "
+		"DESC 'IDL cache size in bytes' "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "index", "attr> <[pres,eq,approx,sub]", 2, 3, 0, ARG_MAGIC|BDB_INDEX,
 		bdb_cf_gen, "( OLcfgDbAt:0.2 NAME 'olcDbIndex' "
 		"DESC 'Attribute index parameters' "
@@ -137,10 +162,20 @@ static ConfigTable bdbcfg[] = {
 		bdb_cf_gen, "( OLcfgDbAt:0.3 NAME 'olcDbMode' "
 		"DESC 'Unix permissions of database files' "
 		"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
+	{ "planthreshold", "count", 2, 2, 0, ARG_ULONG|ARG_OFFSET,
+		(void *)offsetof(struct bdb_info, bi_plan_threshold),
+		"( OLcfgDbAt:1.17 NAME 'olcDbPlanThreshold' "
+		"DESC 'Stop reading indices once this few candidates remain' "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "searchstack", "depth", 2, 2, 0, ARG_INT|ARG_MAGIC|BDB_SSTACK,
 		bdb_cf_gen, "( OLcfgDbAt:1.9 NAME 'olcDbSearchStack' "
 		"DESC 'Depth of search stack in IDLs' "
 		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "searchthreads", "count", 2, 2, 0, ARG_INT|ARG_OFFSET,
+		(void *)offsetof(struct bdb_info, bi_search_threads),
+		"( OLcfgDbAt:1.19 NAME 'olcDbSearchThreads' "
+		"DESC 'Helper threads used to screen large search candidate sets' "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "shm_key", "key", 2, 2, 0, ARG_LONG|ARG_OFFSET,
 		(void *)offsetof(struct bdb_info, bi_shm_key), 
 		"( OLcfgDbAt:1.10 NAME 'olcDbShmKey' "
@@ -168,7 +203,10 @@ static ConfigOCs bdbocs[] = {
 		"olcDbNoSync $ olcDbDirtyRead $ olcDbIDLcacheSize $ "
 		"olcDbIndex $ olcDbLinearIndex $ olcDbLockDetect $ "
 		"olcDbMode $ olcDbSearchStack $ olcDbShmKey $ "
-		"olcDbCacheFree $ olcDbDNcacheSize $ olcDbPageSize ) )",
+		"olcDbCacheFree $ olcDbDNcacheSize $ olcDbPageSize $ "
+		"olcDbPlanThreshold $ olcDbCompress $ olcDbSearchThreads $ "
+		"olcDbIDLcacheBytes $ olcDbCacheBytes $ "
+		"olcDbCachePurge $ olcDbCacheWarm ) )",
 		 	Cft_Database, bdbcfg },
 	{ NULL, 0, NULL }
 };
@@ -477,6 +515,10 @@ bdb_cf_gen( ConfigArgs *c )
 				c->value_int = 1;
 			break;
 
+		case BDB_CWARM:
+			c->value_int = bdb->bi_warm;
+			break;
+
 		case BDB_INDEX:
 			bdb_attr_index_unparse( bdb, &c->rvalue_vals );
 			if ( !c->rvalue_vals ) rc = 1;
@@ -500,6 +542,19 @@ bdb_cf_gen( ConfigArgs *c )
 			c->value_int = bdb->bi_search_stack_depth;
 			break;
 
+		case BDB_CPURGE:
+			if ( bdb->bi_cache.c_purge_high ) {
+				char buf[64];
+				struct berval bv;
+				bv.bv_len = snprintf( buf, sizeof(buf), "%d %d",
+					bdb->bi_cache.c_purge_high, bdb->bi_cache.c_purge_low );
+				bv.bv_val = buf;
+				value_add_one( &c->rvalue_vals, &bv );
+			} else {
+				rc = 1;
+			}
+			break;
+
 		case BDB_PGSIZE: {
 				struct bdb_db_pgsize *ps;
 				char buf[SLAP_TEXT_BUFLEN];
@@ -534,6 +589,11 @@ bdb_cf_gen( ConfigArgs *c )
 		case BDB_SSTACK:
 			break;
 
+		case BDB_CPURGE:
+			bdb->bi_cache.c_purge_high = 0;
+			bdb->bi_cache.c_purge_low = 0;
+			break;
+
 		case BDB_CHKPT:
 			if ( bdb->bi_txn_cp_task ) {
 				struct re_s *re = bdb->bi_txn_cp_task;
@@ -590,6 +650,10 @@ bdb_cf_gen( ConfigArgs *c )
 		case BDB_CHECKSUM:
 			bdb->bi_flags &= ~BDB_CHKSUM;
 			break;
+
+		case BDB_CWARM:
+			bdb->bi_warm = 0;
+			break;
 		case BDB_INDEX:
 			if ( c->valx == -1 ) {
 				int i;
@@ -903,6 +967,33 @@ bdb_cf_gen( ConfigArgs *c )
 		bdb->bi_search_stack_depth = c->value_int;
 		break;
 
+	case BDB_CWARM:
+		/* Turning it on in a running server also reloads the
+		 * last snapshot, in the background.
+		 */
+		if ( c->value_int && !bdb->bi_warm &&
+			( bdb->bi_flags & BDB_IS_OPEN ) &&
+			( slapMode & SLAP_SERVER_MODE ))
+			bdb_warm_start( c->be, 0 );
+		bdb->bi_warm = c->value_int;
+		break;
+
+	case BDB_CPURGE: {
+		int high, low;
+
+		if ( lutil_atoi( &high, c->argv[1] ) != 0 ||
+			lutil_atoi( &low, c->argv[2] ) != 0 ||
+			low < 1 || low >= high || high > 100 ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ),
+				"%s: watermarks must satisfy 0 < low < high <= 100",
+				c->log );
+			Debug( LDAP_DEBUG_ANY, "%s\n", c->cr_msg, 0, 0 );
+			return -1;
+		}
+		bdb->bi_cache.c_purge_high = high;
+		bdb->bi_cache.c_purge_low = low;
+		} break;
+
 	case BDB_PGSIZE: {
 		struct bdb_db_pgsize *ps, **prev;
 		int i, s;
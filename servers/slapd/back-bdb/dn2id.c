@@ -311,7 +311,7 @@ bdb_dn2id_children(
 	((char *)key.data)[0] = DN_ONE_PREFIX;
 	AC_MEMCPY( &((char *)key.data)[1], e->e_nname.bv_val, key.size - 1 );
 
-	if ( bdb->bi_idl_cache_size ) {
+	if ( BDB_IDL_CACHING( bdb )) {
 		rc = bdb_idl_cache_get( bdb, db, &key, NULL );
 		if ( rc != LDAP_NO_SUCH_OBJECT ) {
 			op->o_tmpfree( key.data, op->o_tmpmemctx );
@@ -497,6 +497,14 @@ int hdb_fix_dn(
 	return 0;
 }
 
+/* A modrdn moves an entry's whole subtree, but the cached subtree IDLs
+ * of its old and new parents are only patched with the entry's own ID.
+ * If it may have children, those IDLs are dropped instead. New entries
+ * have no EntryInfo yet, and no children either.
+ */
+#define HDB_DN2ID_SUBTREE(e)	( BEI(e) && \
+	!( BEI(e)->bei_state & CACHE_ENTRY_NO_KIDS ))
+
 /* We add two elements to the DN2ID database - a data item under the parent's
  * entryID containing the child's RDN and entryID, and an item under the
  * child's entryID containing the parent's entryID.
@@ -571,9 +579,10 @@ hdb_dn2id_add(
 	}
 
 	/* Update all parents' IDL cache entries */
-	if ( rc == 0 && bdb->bi_idl_cache_size ) {
+	if ( rc == 0 && BDB_IDL_CACHING( bdb )) {
 		ID tmp[2];
 		char *ptr = ((char *)&tmp[1])-1;
+		int subtree = HDB_DN2ID_SUBTREE( e );
 		key.data = ptr;
 		key.size = sizeof(ID)+1;
 		tmp[1] = eip->bei_id;
@@ -583,12 +592,18 @@ hdb_dn2id_add(
 			*ptr = DN_SUBTREE_PREFIX;
 			for (; eip && eip->bei_parent->bei_id; eip = eip->bei_parent) {
 				tmp[1] = eip->bei_id;
-				bdb_idl_cache_add_id( bdb, db, &key, e->e_id );
+				if ( subtree )
+					bdb_idl_cache_del( bdb, db, &key );
+				else
+					bdb_idl_cache_add_id( bdb, db, &key, e->e_id );
 			}
 			/* Handle DB with empty suffix */
 			if ( !op->o_bd->be_suffix[0].bv_len && eip ) {
 				tmp[1] = eip->bei_id;
-				bdb_idl_cache_add_id( bdb, db, &key, e->e_id );
+				if ( subtree )
+					bdb_idl_cache_del( bdb, db, &key );
+				else
+					bdb_idl_cache_add_id( bdb, db, &key, e->e_id );
 			}
 		}
 	}
@@ -670,9 +685,10 @@ func_leave:
 	op->o_tmpfree( d, op->o_tmpmemctx );
 
 	/* Delete IDL cache entries */
-	if ( rc == 0 && bdb->bi_idl_cache_size ) {
+	if ( rc == 0 && BDB_IDL_CACHING( bdb )) {
 		ID tmp[2];
 		char *ptr = ((char *)&tmp[1])-1;
+		int subtree = HDB_DN2ID_SUBTREE( e );
 		key.data = ptr;
 		key.size = sizeof(ID)+1;
 		tmp[1] = eip->bei_id;
@@ -682,12 +698,18 @@ func_leave:
 			*ptr = DN_SUBTREE_PREFIX;
 			for (; eip && eip->bei_parent->bei_id; eip = eip->bei_parent) {
 				tmp[1] = eip->bei_id;
-				bdb_idl_cache_del_id( bdb, db, &key, e->e_id );
+				if ( subtree )
+					bdb_idl_cache_del( bdb, db, &key );
+				else
+					bdb_idl_cache_del_id( bdb, db, &key, e->e_id );
 			}
 			/* Handle DB with empty suffix */
 			if ( !op->o_bd->be_suffix[0].bv_len && eip ) {
 				tmp[1] = eip->bei_id;
-				bdb_idl_cache_del_id( bdb, db, &key, e->e_id );
+				if ( subtree )
+					bdb_idl_cache_del( bdb, db, &key );
+				else
+					bdb_idl_cache_del_id( bdb, db, &key, e->e_id );
 			}
 		}
 	}
@@ -856,7 +878,7 @@ hdb_dn2id_children(
 	BDB_ID2DISK( e->e_id, &id );
 
 	/* IDL cache is in host byte order */
-	if ( bdb->bi_idl_cache_size ) {
+	if ( BDB_IDL_CACHING( bdb )) {
 		rc = bdb_idl_cache_get( bdb, db, &key, NULL );
 		if ( rc != LDAP_NO_SUCH_OBJECT ) {
 			return rc;
@@ -894,7 +916,21 @@ hdb_dn2id_children(
  * We descend the tree recursively, so we define this cookie
  * to hold our necessary state information. The bdb_dn2idl_internal
  * function uses this cookie when calling itself.
+ *
+ * The subtree IDL of every node within HDB_DN2IDL_SUBTREES levels of
+ * the base is collected on the way and put into the IDL cache, so that
+ * later searches based below it get their candidates without a walk.
+ * add, delete and modrdn keep those IDLs current. Subtrees of more than
+ * HDB_DN2IDL_SUBMAX entries are not cached: near the root they are
+ * nearly as big as the base's own IDL, and cost more to keep than the
+ * walk they save.
  */
+#ifndef HDB_DN2IDL_SUBTREES
+#define HDB_DN2IDL_SUBTREES	3
+#endif
+#ifndef HDB_DN2IDL_SUBMAX
+#define HDB_DN2IDL_SUBMAX	(BDB_IDL_DB_SIZE/4)
+#endif
 
 struct dn2id_cookie {
 	struct bdb_info *bdb;
@@ -911,10 +947,12 @@ struct dn2id_cookie {
 	ID dbuf;
 	ID id;
 	ID nid;
+	ID *subs[HDB_DN2IDL_SUBTREES];	/* subtree IDLs being built */
 	int rc;
 	int depth;
 	char need_sort;
 	char prefix;
+	char cached;	/* the last subtree came from the IDL cache */
 };
 
 static int
@@ -929,6 +967,11 @@ apply_func(
 	return 0;
 }
 
+static void
+hdb_dn2idl_subtree(
+	struct dn2id_cookie *cx
+);
+
 static int
 hdb_dn2idl_internal(
 	struct dn2id_cookie *cx
@@ -936,7 +979,7 @@ hdb_dn2idl_internal(
 {
 	BDB_IDL_ZERO( cx->tmp );
 
-	if ( cx->bdb->bi_idl_cache_size ) {
+	if ( BDB_IDL_CACHING( cx->bdb )) {
 		char *ptr = ((char *)&cx->id)-1;
 
 		cx->key.data = ptr;
@@ -947,9 +990,12 @@ hdb_dn2idl_internal(
 			cx->rc = bdb_idl_cache_get(cx->bdb, cx->db, &cx->key, ids);
 			if ( cx->rc == LDAP_SUCCESS ) {
 				if ( cx->depth ) {
+					/* Our parent already listed us */
+					bdb_idl_delete( cx->tmp, cx->id );
 					bdb_idl_append( cx->ids, cx->tmp );
 					cx->need_sort = 1;
 				}
+				cx->cached = 1;
 				return cx->rc;
 			}
 		}
@@ -1076,7 +1122,7 @@ synced:
 
 	if ( !BDB_IDL_IS_RANGE( cx->tmp ) && cx->tmp[0] > 3 )
 		bdb_idl_sort( cx->tmp, cx->buf );
-	if ( cx->bdb->bi_idl_cache_max_size && !BDB_IDL_IS_ZERO( cx->tmp )) {
+	if ( BDB_IDL_CACHING( cx->bdb ) && !BDB_IDL_IS_ZERO( cx->tmp )) {
 		char *ptr = ((char *)&cx->id)-1;
 		cx->key.data = ptr;
 		cx->key.size = sizeof(ID)+1;
@@ -1111,7 +1157,7 @@ gotit:
 						ei2 = cx->ei;
 						if ( !( ei2->bei_state & CACHE_ENTRY_NO_KIDS )) {
 							BDB_ID2DISK( cx->id, &cx->nid );
-							hdb_dn2idl_internal( cx );
+							hdb_dn2idl_subtree( cx );
 							if ( !BDB_IDL_IS_ZERO( cx->tmp ))
 								nokids = 0;
 						}
@@ -1139,6 +1185,57 @@ gotit:
 	return cx->rc;
 }
 
+/* Descend into a child of the current node. Near the base, collect
+ * the child's subtree separately so it can be cached on its own, then
+ * add it to the caller's list.
+ */
+static void
+hdb_dn2idl_subtree(
+	struct dn2id_cookie *cx
+)
+{
+	ID *ids = cx->ids, *sub, id = cx->id;
+	char *ptr;
+
+	if ( !BDB_IDL_CACHING( cx->bdb ) || cx->depth > HDB_DN2IDL_SUBTREES ||
+		BDB_IDL_IS_RANGE( ids )) {
+		hdb_dn2idl_internal( cx );
+		return;
+	}
+
+	sub = cx->subs[cx->depth-1];
+	if ( !sub ) {
+		sub = cx->op->o_tmpalloc( BDB_IDL_UM_SIZEOF, cx->op->o_tmpmemctx );
+		cx->subs[cx->depth-1] = sub;
+	}
+	sub[0] = 1;
+	sub[1] = id;
+
+	cx->ids = sub;
+	cx->cached = 0;
+	hdb_dn2idl_internal( cx );
+	cx->ids = ids;
+
+	if ( !BDB_IDL_IS_RANGE( sub ) && sub[0] > 3 )
+		bdb_idl_sort( sub, cx->buf );
+	if ( cx->cached ) {
+		cx->cached = 0;
+	} else if ( cx->rc == 0 && sub[0] > 1 && !BDB_IDL_IS_RANGE( sub ) &&
+		sub[0] <= HDB_DN2IDL_SUBMAX ) {
+		ptr = ((char *)&cx->id)-1;
+		cx->id = id;
+		cx->key.data = ptr;
+		cx->key.size = sizeof(ID)+1;
+		*ptr = DN_SUBTREE_PREFIX;
+		bdb_idl_cache_put( cx->bdb, cx->db, &cx->key, sub, cx->rc );
+	}
+
+	/* Our parent already listed us */
+	bdb_idl_delete( sub, id );
+	bdb_idl_append( ids, sub );
+	cx->need_sort = 1;
+}
+
 int
 hdb_dn2idl(
 	Operation	*op,
@@ -1150,6 +1247,7 @@ hdb_dn2idl(
 {
 	struct bdb_info *bdb = (struct bdb_info *)op->o_bd->be_private;
 	struct dn2id_cookie cx;
+	int i;
 
 	Debug( LDAP_DEBUG_TRACE, "=> hdb_dn2idl(\"%s\")\n",
 		ndn->bv_val, 0, 0 );
@@ -1178,6 +1276,8 @@ hdb_dn2idl(
 	cx.txn = txn;
 	cx.need_sort = 0;
 	cx.depth = 0;
+	cx.cached = 0;
+	memset( cx.subs, 0, sizeof( cx.subs ));
 
 	if ( cx.prefix == DN_SUBTREE_PREFIX ) {
 		ids[0] = 1;
@@ -1204,10 +1304,15 @@ hdb_dn2idl(
 		cx.key.size = sizeof(ID)+1;
 		*ptr = cx.prefix;
 		cx.id = ei->bei_id;
-		if ( cx.bdb->bi_idl_cache_max_size )
+		if ( BDB_IDL_CACHING( cx.bdb ))
 			bdb_idl_cache_put( cx.bdb, cx.db, &cx.key, cx.ids, cx.rc );
 	}
 
+	for ( i = 0; i < HDB_DN2IDL_SUBTREES; i++ ) {
+		if ( cx.subs[i] )
+			op->o_tmpfree( cx.subs[i], op->o_tmpmemctx );
+	}
+
 	if ( cx.rc == DB_NOTFOUND )
 		cx.rc = LDAP_SUCCESS;
 
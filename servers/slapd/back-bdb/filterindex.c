@@ -75,6 +75,12 @@ ext_candidates(
         ID *tmp,
         ID *stack);
 
+static void
+plan_record(
+	Operation *op,
+	Filter *f,
+	ID *ids );
+
 #ifdef LDAP_COMP_MATCH
 static int
 comp_candidates (
@@ -217,6 +223,9 @@ bdb_filter_candidates(
 		}
 	}
 
+	if ( rc == 0 )
+		plan_record( op, f, ids );
+
 out:
 	Debug( LDAP_DEBUG_FILTER,
 		"<= bdb_filter_candidates: id=%ld first=%ld last=%ld\n",
@@ -557,6 +566,300 @@ ext_candidates(
 	return 0;
 }
 
+/* Search planning.
+ *
+ * Each indexed attribute keeps a smoothed size of the IDLs its index
+ * lookups returned, per filter type, plus a count of the values indexed
+ * since startup. list_candidates uses them to estimate how many IDs each
+ * term of an AND will yield, evaluates the most selective terms first,
+ * and stops reading indices once the running candidate set has shrunk
+ * to bi_plan_threshold IDs or less: test_filter() will weed out the rest
+ * more cheaply than further key reads would.
+ */
+
+/* Which statistics slot, and which index type, serve filter f */
+static int
+plan_type(
+	Filter *f,
+	AttributeDescription **descp,
+	slap_mask_t *maskp )
+{
+	switch ( f->f_choice ) {
+	case LDAP_FILTER_PRESENT:
+		if ( f->f_desc == slap_schema.si_ad_objectClass )
+			break;
+		*descp = f->f_desc;
+		*maskp = SLAP_INDEX_PRESENT;
+		return BDB_PLAN_PRES;
+	case LDAP_FILTER_EQUALITY:
+		*descp = f->f_av_desc;
+		*maskp = SLAP_INDEX_EQUALITY;
+		return BDB_PLAN_EQ;
+	case LDAP_FILTER_APPROX:
+		*descp = f->f_av_desc;
+		*maskp = SLAP_INDEX_APPROX|SLAP_INDEX_EQUALITY;
+		return BDB_PLAN_APPROX;
+	case LDAP_FILTER_SUBSTRINGS:
+		*descp = f->f_sub_desc;
+		*maskp = SLAP_INDEX_SUBSTR;
+		return BDB_PLAN_SUB;
+	case LDAP_FILTER_GE:
+	case LDAP_FILTER_LE:
+		*descp = f->f_av_desc;
+		*maskp = SLAP_INDEX_EQUALITY|SLAP_INDEX_PRESENT;
+		return BDB_PLAN_INEQ;
+	}
+	return -1;
+}
+
+/* Return the AttrInfo whose index will answer filter f, if any */
+static AttrInfo *
+plan_attr(
+	Operation *op,
+	Filter *f,
+	int *typep )
+{
+	AttributeDescription *desc;
+	struct berval atname;
+	slap_mask_t mask;
+	AttrInfo *ai;
+
+	*typep = plan_type( f, &desc, &mask );
+	if ( *typep < 0 )
+		return NULL;
+	ai = bdb_index_mask( op->o_bd, desc, &atname );
+	if ( ai && !( ai->ai_indexmask & mask ))
+		ai = NULL;
+	return ai;
+}
+
+/* Fold the size of an index lookup's result into the statistics */
+static void
+plan_record(
+	Operation *op,
+	Filter *f,
+	ID *ids )
+{
+	AttrInfo *ai;
+	ID n;
+	int type;
+
+	ai = plan_attr( op, f, &type );
+	if ( !ai )
+		return;
+
+	n = BDB_IDL_N( ids );
+	if ( n == 0 )
+		n = 1;
+	if ( ai->ai_idlsize[type] )
+		n = ( ai->ai_idlsize[type] * 3 + n ) / 4;
+	ai->ai_idlsize[type] = n ? n : 1;
+}
+
+/* Estimate how many candidates filter f will produce */
+static ID
+plan_estimate(
+	Operation *op,
+	Filter *f )
+{
+	struct bdb_info *bdb = (struct bdb_info *) op->o_bd->be_private;
+	ID all = bdb->bi_lastid ? bdb->bi_lastid : 1;
+	ID est, sub;
+	AttrInfo *ai;
+	int type;
+
+	if ( f->f_choice & SLAPD_FILTER_UNDEFINED )
+		return 0;
+
+	switch ( f->f_choice ) {
+	case SLAPD_FILTER_COMPUTED:
+		return f->f_result == LDAP_COMPARE_TRUE ? all : 0;
+
+	case LDAP_FILTER_AND:
+		est = all;
+		for ( f = f->f_and; f; f = f->f_next ) {
+			sub = plan_estimate( op, f );
+			if ( sub < est )
+				est = sub;
+		}
+		return est;
+
+	case LDAP_FILTER_OR:
+		est = 0;
+		for ( f = f->f_or; f && est < all; f = f->f_next )
+			est += plan_estimate( op, f );
+		return est < all ? est : all;
+
+	case LDAP_FILTER_EQUALITY:
+		if ( f->f_av_desc == slap_schema.si_ad_entryDN )
+			return 1;
+		break;
+	}
+
+	ai = plan_attr( op, f, &type );
+	if ( !ai )
+		return all;
+	if ( ai->ai_idlsize[type] )
+		return ai->ai_idlsize[type] < all ? ai->ai_idlsize[type] : all;
+
+	/* Nothing observed yet, guess from the filter type */
+	switch ( type ) {
+	case BDB_PLAN_EQ:
+		return 1 + all / 16;
+	case BDB_PLAN_APPROX:
+	case BDB_PLAN_SUB:
+		return 1 + all / 4;
+	case BDB_PLAN_INEQ:
+		return 1 + all / 2;
+	default:
+		return ai->ai_nvals > 0 && (ID) ai->ai_nvals < all ?
+			(ID) ai->ai_nvals : all;
+	}
+}
+
+typedef struct plan_term {
+	Filter *pt_filter;
+	ID pt_est;
+} plan_term;
+
+/* Describe one term of a plan, for the log and cn=monitor */
+static void
+plan_describe(
+	char *buf,
+	size_t *lenp,
+	size_t size,
+	plan_term *pt,
+	int skipped )
+{
+	Filter *f = pt->pt_filter;
+	AttributeDescription *desc = NULL;
+	slap_mask_t mask;
+	int len;
+
+	if ( *lenp >= size - 1 )
+		return;
+	if ( plan_type( f, &desc, &mask ) < 0 )
+		desc = NULL;
+	len = snprintf( buf + *lenp, size - *lenp, "%s(%s%s%lu)",
+		*lenp ? " " : "",
+		desc ? desc->ad_cname.bv_val :
+			f->f_choice == LDAP_FILTER_AND ? "&" :
+			f->f_choice == LDAP_FILTER_OR ? "|" :
+			f->f_choice == LDAP_FILTER_NOT ? "!" : "?",
+		skipped ? "~" : "=", (unsigned long) pt->pt_est );
+	if ( len > 0 )
+		*lenp += len;
+	if ( *lenp >= size )
+		*lenp = size - 1;
+}
+
+/* Evaluate the terms of an AND, most selective first */
+static int
+and_candidates(
+	Operation *op,
+	DB_TXN *rtxn,
+	Filter	*flist,
+	ID *ids,
+	ID *tmp,
+	ID *save )
+{
+	struct bdb_info *bdb = (struct bdb_info *) op->o_bd->be_private;
+	plan_term *terms, pt;
+	Filter	*f;
+	char	plan[sizeof( bdb->bi_plan_last )];
+	size_t	plen = 0;
+	int	i, j, n = 0, first = 1, skipped = 0, describe, sample = 0;
+	int rc = 0;
+
+	for ( f = flist; f != NULL; f = f->f_next ) {
+		/* ids already holds a precomputed scope */
+		if ( f->f_choice == SLAPD_FILTER_COMPUTED &&
+		     f->f_result == LDAP_SUCCESS ) {
+			first = 0;
+			continue;
+		}
+		n++;
+	}
+	if ( n == 0 )
+		return 0;
+
+	terms = op->o_tmpalloc( n * sizeof( plan_term ), op->o_tmpmemctx );
+	for ( i = 0, f = flist; f != NULL; f = f->f_next ) {
+		if ( f->f_choice == SLAPD_FILTER_COMPUTED &&
+		     f->f_result == LDAP_SUCCESS ) {
+			continue;
+		}
+		pt.pt_filter = f;
+		pt.pt_est = plan_estimate( op, f );
+		for ( j = i++; j > 0 && terms[j-1].pt_est > pt.pt_est; j-- )
+			terms[j] = terms[j-1];
+		terms[j] = pt;
+	}
+
+	/* Formatting the plan costs more than some of the lookups it
+	 * describes, so cn=monitor only gets every BDB_PLAN_SAMPLE'th one.
+	 */
+	if ( SLAP_DBMONITORING( op->o_bd ))
+		sample = SLAP_COUNTER_ADD( &bdb->bi_plan_count, 1 ) %
+			BDB_PLAN_SAMPLE == 1;
+	describe = sample || LogTest( LDAP_DEBUG_FILTER );
+	plan[0] = '\0';
+
+	for ( i = 0; i < n; i++ ) {
+		if ( !first && bdb->bi_plan_threshold &&
+			BDB_IDL_N( ids ) <= bdb->bi_plan_threshold ) {
+			/* Few enough candidates left, let test_filter do the rest */
+			skipped = n - i;
+			break;
+		}
+		if ( describe )
+			plan_describe( plan, &plen, sizeof( plan ), &terms[i], 0 );
+
+		BDB_IDL_ZERO( save );
+		rc = bdb_filter_candidates( op, rtxn, terms[i].pt_filter, save, tmp,
+			save+BDB_IDL_UM_SIZE );
+
+		if ( rc != 0 ) {
+			if ( rc == DB_LOCK_DEADLOCK )
+				break;
+			/* this term can't narrow the result */
+			rc = 0;
+			continue;
+		}
+
+		if ( first ) {
+			BDB_IDL_CPY( ids, save );
+			first = 0;
+		} else {
+			bdb_idl_intersection( ids, save );
+		}
+		if( BDB_IDL_IS_ZERO( ids ) )
+			break;
+	}
+
+	/* No term could be answered from an index */
+	if ( first && rc == 0 )
+		BDB_IDL_ALL( bdb, ids );
+
+	if ( describe ) {
+		for ( j = n - skipped; j < n; j++ )
+			plan_describe( plan, &plen, sizeof( plan ), &terms[j], 1 );
+		Debug( LDAP_DEBUG_FILTER, "bdb_list_candidates: plan %s\n",
+			plan, 0, 0 );
+	}
+	op->o_tmpfree( terms, op->o_tmpmemctx );
+
+	if ( skipped && SLAP_DBMONITORING( op->o_bd ))
+		SLAP_COUNTER_ADD( &bdb->bi_plan_skipped, skipped );
+	if ( sample ) {
+		ldap_pvt_thread_mutex_lock( &bdb->bi_plan_mutex );
+		AC_MEMCPY( bdb->bi_plan_last, plan, plen + 1 );
+		ldap_pvt_thread_mutex_unlock( &bdb->bi_plan_mutex );
+	}
+
+	return rc;
+}
+
 static int
 list_candidates(
 	Operation *op,
@@ -571,6 +874,11 @@ list_candidates(
 	Filter	*f;
 
 	Debug( LDAP_DEBUG_FILTER, "=> bdb_list_candidates 0x%x\n", ftype, 0, 0 );
+	if ( ftype == LDAP_FILTER_AND ) {
+		rc = and_candidates( op, rtxn, flist, ids, tmp, save );
+		goto done;
+	}
+
 	for ( f = flist; f != NULL; f = f->f_next ) {
 		/* ignore precomputed scopes */
 		if ( f->f_choice == SLAPD_FILTER_COMPUTED &&
@@ -582,34 +890,17 @@ list_candidates(
 			save+BDB_IDL_UM_SIZE );
 
 		if ( rc != 0 ) {
-			if ( rc == DB_LOCK_DEADLOCK )
-				return rc;
-
-			if ( ftype == LDAP_FILTER_AND ) {
-				rc = 0;
-				continue;
-			}
 			break;
 		}
 
-		
-		if ( ftype == LDAP_FILTER_AND ) {
-			if ( f == flist ) {
-				BDB_IDL_CPY( ids, save );
-			} else {
-				bdb_idl_intersection( ids, save );
-			}
-			if( BDB_IDL_IS_ZERO( ids ) )
-				break;
+		if ( f == flist ) {
+			BDB_IDL_CPY( ids, save );
 		} else {
-			if ( f == flist ) {
-				BDB_IDL_CPY( ids, save );
-			} else {
-				bdb_idl_union( ids, save );
-			}
+			bdb_idl_union( ids, save );
 		}
 	}
 
+done:
 	if( rc == LDAP_SUCCESS ) {
 		Debug( LDAP_DEBUG_FILTER,
 			"<= bdb_list_candidates: id=%ld first=%ld last=%ld\n",
@@ -22,6 +22,161 @@
 
 #include "back-bdb.h"
 
+/* The ad2i database maps small integers to attribute descriptions,
+ * so that id2entry records can name their attributes by index. The
+ * dictionary only ever grows; an index once assigned is never reused.
+ */
+static int
+bdb_ad_cmp( const void *v1, const void *v2 )
+{
+	const AttributeDescription * const *a1 = v1, * const *a2 = v2;
+
+	return SLAP_PTRCMP( *a1, *a2 );
+}
+
+int bdb_ad_read(
+	BackendDB *be )
+{
+	struct bdb_info *bdb = (struct bdb_info *) be->be_private;
+	DB *db = bdb->bi_ad2i->bdi_db;
+	DBT key, data;
+	DBC *cursor;
+	ID nid[2], i;
+	int rc;
+
+	bdb->bi_ads = ch_calloc( BDB_MAXADS, sizeof(AttributeDescription *) );
+	bdb->bi_nads = 1;
+	if ( !db ) return 0;
+
+	rc = db->cursor( db, NULL, &cursor, bdb->bi_db_opflags );
+	if ( rc ) return rc;
+
+	DBTzero( &key );
+	key.data = nid;
+	key.ulen = sizeof(nid);
+	key.flags = DB_DBT_USERMEM;
+	DBTzero( &data );
+
+	while (( rc = cursor->c_get( cursor, &key, &data, DB_NEXT )) == 0 ) {
+		AttributeDescription *ad = NULL;
+		struct berval bv;
+		const char *text;
+
+		if ( *(unsigned char *)nid == (unsigned char)BDB_AD2I_META ) {
+			/* not an attribute, e.g. the compression dictionary */
+			continue;
+		}
+		BDB_DISK2ID( nid, &i );
+		if ( key.size != sizeof(ID) || i == 0 || i >= BDB_MAXADS ) {
+			Debug( LDAP_DEBUG_ANY,
+				"bdb_ad_read: invalid index %lu\n", i, 0, 0 );
+			rc = LDAP_OTHER;
+			break;
+		}
+		DBT2bv( &data, &bv );
+		rc = slap_bv2ad( &bv, &ad, &text );
+		if ( rc != LDAP_SUCCESS ) {
+			rc = slap_bv2undef_ad( &bv, &ad, &text, 0 );
+			if ( rc != LDAP_SUCCESS ) {
+				Debug( LDAP_DEBUG_ANY,
+					"bdb_ad_read: slap_bv2undef_ad(%.*s): %s\n",
+					(int) bv.bv_len, bv.bv_val, text );
+				break;
+			}
+		}
+		bdb->bi_ads[i] = ad;
+		avl_insert( &bdb->bi_adtree, &bdb->bi_ads[i], bdb_ad_cmp,
+			avl_dup_error );
+		if ( i >= bdb->bi_nads )
+			bdb->bi_nads = i + 1;
+	}
+	cursor->c_close( cursor );
+
+	if ( rc == DB_NOTFOUND ) rc = 0;
+	return rc;
+}
+
+/* Return the dictionary index of ad, assigning one if needed.
+ * The new mapping is committed on its own, independent of the
+ * caller's transaction, so that it is never lost while entries
+ * refer to it. Returns 0 if no index could be assigned.
+ */
+int bdb_ad_index(
+	void *arg,
+	AttributeDescription *ad )
+{
+	struct bdb_info *bdb = arg;
+	DB *db = bdb->bi_ad2i->bdi_db;
+	AttributeDescription **ptr;
+	DBT key, data;
+	ID nid;
+	int i = 0, rc;
+
+	if ( !bdb->bi_ads )
+		return 0;
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_ads_mutex );
+	ptr = avl_find( bdb->bi_adtree, &ad, bdb_ad_cmp );
+	if ( ptr ) {
+		i = ptr - bdb->bi_ads;
+	} else if ( db && bdb->bi_nads < BDB_MAXADS ) {
+		i = bdb->bi_nads;
+		DBTzero( &key );
+		key.data = &nid;
+		key.size = sizeof(ID);
+		BDB_ID2DISK( (ID)i, &nid );
+		DBTzero( &data );
+		bv2DBT( &ad->ad_cname, &data );
+
+		rc = db->put( db, NULL, &key, &data, DB_NOOVERWRITE );
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY,
+				"bdb_ad_index: put(%s) failed: %s (%d)\n",
+				ad->ad_cname.bv_val, db_strerror(rc), rc );
+			i = 0;
+		} else {
+			bdb->bi_ads[i] = ad;
+			avl_insert( &bdb->bi_adtree, &bdb->bi_ads[i], bdb_ad_cmp,
+				avl_dup_error );
+			bdb->bi_nads++;
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_ads_mutex );
+
+	return i;
+}
+
+/* The record for id was changed, see bdb_id2entry_prefetch() */
+static void
+bdb_id2entry_written( struct bdb_info *bdb, ID id )
+{
+	ldap_pvt_thread_mutex_lock( &bdb->bi_id2entry_mutex );
+	bdb->bi_id2entry_seq[BDB_ID2ENTRY_SEQ( id )]++;
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_id2entry_mutex );
+}
+
+/* Fold a block of need bytes into the running size of entry blocks,
+ * or with need 0 just read it, see bdb_id2entry()
+ */
+static long
+bdb_id2entry_avg( struct bdb_info *bdb, long need )
+{
+	long avg;
+
+#ifdef SLAP_ATOMIC_ADD
+	avg = SLAP_ATOMIC_ADD( &bdb->bi_id2entry_avg, 0 );
+	if ( need )
+		avg = SLAP_ATOMIC_ADD( &bdb->bi_id2entry_avg, ( need - avg ) / 16 );
+#else
+	ldap_pvt_thread_mutex_lock( &bdb->bi_id2entry_mutex );
+	if ( need )
+		bdb->bi_id2entry_avg += ( need - bdb->bi_id2entry_avg ) / 16;
+	avg = bdb->bi_id2entry_avg;
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_id2entry_mutex );
+#endif
+	return avg;
+}
+
 static int bdb_id2entry_put(
 	BackendDB *be,
 	DB_TXN *tid,
@@ -51,13 +206,17 @@ static int bdb_id2entry_put(
 	key.size = sizeof(ID);
 	BDB_ID2DISK( e->e_id, &nid );
 
-	rc = entry_encode( e, &bv );
+	rc = entry_encode_ads( e, &bv, bdb_ad_index, bdb );
 #ifdef BDB_HIER
 	e->e_name = odn; e->e_nname = ondn;
 #endif
 	if( rc != LDAP_SUCCESS ) {
 		return -1;
 	}
+	if ( bdb->bi_compress && bdb_compress( bdb, &bv )) {
+		free( bv.bv_val );
+		return -1;
+	}
 
 	DBTzero( &data );
 	bv2DBT( &bv, &data );
@@ -65,6 +224,9 @@ static int bdb_id2entry_put(
 	rc = db->put( db, tid, &key, &data, flag );
 
 	free( bv.bv_val );
+
+	if ( rc == 0 )
+		bdb_id2entry_written( bdb, e->e_id );
 	return rc;
 }
 
@@ -90,6 +252,81 @@ int bdb_id2entry_update(
 	return bdb_id2entry_put(be, tid, e, 0);
 }
 
+/* Decode the record of len bytes at the start of blk, a malloc'd
+ * block of size bytes. blk is consumed either way.
+ */
+static int bdb_id2entry_decode(
+	struct bdb_info *bdb,
+	char *blk,
+	ber_len_t size,
+	ber_len_t len,
+	ID id,
+	Entry **e )
+{
+	EntryHeader eh;
+	ber_len_t need, voff, off;
+	int rc;
+
+	eh.ads = bdb->bi_ads;
+	eh.nads = bdb->bi_nads;
+	if ( BDB_CZ_RECORD( blk, len )) {
+		struct berval zbv;
+
+		zbv.bv_val = blk;
+		zbv.bv_len = len;
+		BER_BVZERO( &eh.bv );
+		rc = bdb_decompress( bdb, &zbv, &eh );
+		ch_free( blk );
+		if ( rc ) {
+			ch_free( eh.bv.bv_val );
+			return rc;
+		}
+	} else {
+		eh.bv.bv_val = blk;
+		eh.bv.bv_len = len;
+		rc = entry_header( &eh );
+		if ( rc ) {
+			ch_free( blk );
+			return rc;
+		}
+
+		/* The value array goes after the record */
+		off = eh.data - blk;
+		voff = ( len + sizeof(void *) - 1 ) & ~( sizeof(void *) - 1 );
+		need = voff + eh.nvals * sizeof( struct berval );
+		if ( need != size )
+			blk = ch_realloc( blk, need );
+		eh.bv.bv_val = blk;
+		eh.bv.bv_len = need;
+		eh.data = blk + off;
+		eh.vals = (BerVarray)( blk + voff );
+
+		bdb_id2entry_avg( bdb, (long)need );
+	}
+
+#ifdef SLAP_ZONE_ALLOC
+	rc = entry_decode(&eh, e, bdb->bi_cache.c_zctx);
+#else
+	rc = entry_decode(&eh, e);
+#endif
+
+	if( rc == 0 ) {
+		(*e)->e_id = id;
+	} else {
+		/* only free on error. On success, the entry was
+		 * decoded in place.
+		 */
+#ifndef SLAP_ZONE_ALLOC
+		ch_free(eh.bv.bv_val);
+#endif
+	}
+#ifdef SLAP_ZONE_ALLOC
+	ch_free(eh.bv.bv_val);
+#endif
+
+	return rc;
+}
+
 int bdb_id2entry(
 	BackendDB *be,
 	DB_TXN *tid,
@@ -100,9 +337,9 @@ int bdb_id2entry(
 	DB *db = bdb->bi_id2entry->bdi_db;
 	DBT key, data;
 	DBC *cursor;
-	EntryHeader eh;
-	char buf[16];
-	int rc = 0, off;
+	char *blk;
+	ber_len_t size;
+	int rc = 0;
 	ID nid;
 
 	*e = NULL;
@@ -113,71 +350,38 @@ int bdb_id2entry(
 	BDB_ID2DISK( id, &nid );
 
 	DBTzero( &data );
-	data.flags = DB_DBT_USERMEM | DB_DBT_PARTIAL;
+	data.flags = DB_DBT_USERMEM;
 
 	/* fetch it */
 	rc = db->cursor( db, tid, &cursor, bdb->bi_db_opflags );
 	if ( rc ) return rc;
 
-	/* Get the nattrs / nvals counts first */
-	data.ulen = data.dlen = sizeof(buf);
-	data.data = buf;
+	/* Read the record straight into the block the entry will live in,
+	 * guessing its size from recent reads, so that no other copy is
+	 * needed once the size is known.
+	 */
+	size = bdb_id2entry_avg( bdb, 0 ) * 2;
+	if ( size < BDB_ID2ENTRY_MINREAD )
+		size = BDB_ID2ENTRY_MINREAD;
+	blk = ch_malloc( size );
+	data.data = blk;
+	data.ulen = size;
 	rc = cursor->c_get( cursor, &key, &data, DB_SET );
-	if ( rc ) goto finish;
-
-
-	eh.bv.bv_val = buf;
-	eh.bv.bv_len = data.size;
-	rc = entry_header( &eh );
-	if ( rc ) goto finish;
-
-	/* Get the size */
-	data.flags ^= DB_DBT_PARTIAL;
-	data.ulen = 0;
-	rc = cursor->c_get( cursor, &key, &data, DB_CURRENT );
-	if ( rc != DB_BUFFER_SMALL ) goto finish;
-
-	/* Allocate a block and retrieve the data */
-	off = eh.data - eh.bv.bv_val;
-	eh.bv.bv_len = eh.nvals * sizeof( struct berval ) + data.size;
-	eh.bv.bv_val = ch_malloc( eh.bv.bv_len );
-	eh.data = eh.bv.bv_val + eh.nvals * sizeof( struct berval );
-	data.data = eh.data;
-	data.ulen = data.size;
-
-	/* skip past already parsed nattr/nvals */
-	eh.data += off;
-
-	rc = cursor->c_get( cursor, &key, &data, DB_CURRENT );
-
-finish:
+	if ( rc == DB_BUFFER_SMALL ) {
+		size = data.size;
+		blk = ch_realloc( blk, size );
+		data.data = blk;
+		data.ulen = size;
+		rc = cursor->c_get( cursor, &key, &data, DB_CURRENT );
+	}
 	cursor->c_close( cursor );
 
 	if( rc != 0 ) {
+		ch_free( blk );
 		return rc;
 	}
 
-#ifdef SLAP_ZONE_ALLOC
-	rc = entry_decode(&eh, e, bdb->bi_cache.c_zctx);
-#else
-	rc = entry_decode(&eh, e);
-#endif
-
-	if( rc == 0 ) {
-		(*e)->e_id = id;
-	} else {
-		/* only free on error. On success, the entry was
-		 * decoded in place.
-		 */
-#ifndef SLAP_ZONE_ALLOC
-		ch_free(eh.bv.bv_val);
-#endif
-	}
-#ifdef SLAP_ZONE_ALLOC
-	ch_free(eh.bv.bv_val);
-#endif
-
-	return rc;
+	return bdb_id2entry_decode( bdb, blk, size, data.size, id, e );
 }
 
 int bdb_id2entry_delete(
@@ -199,9 +403,187 @@ int bdb_id2entry_delete(
 	/* delete from database */
 	rc = db->del( db, tid, &key, 0 );
 
+	if ( rc == 0 )
+		bdb_id2entry_written( bdb, e->e_id );
 	return rc;
 }
 
+/* Search prefetch: the records of upcoming search candidates are read
+ * in bulk into a per-thread buffer, and bdb_cache_find_id takes them
+ * from there instead of reading each one on its own.
+ *
+ * Writers bump the sequence of a record's ID range once they changed
+ * it, before their transaction commits. A prefetch notes the sequences
+ * before it reads. If a write's bump came first, the read waits on the
+ * writer's page lock and gets the new record; otherwise the record is
+ * dropped once the bump is seen. Either way a record is never used
+ * after its change became visible. A write only spoils the records
+ * of its own range, but also those of ranges that share its sequence.
+ */
+typedef struct bdb_prefetch {
+	struct bdb_info *bp_bdb;
+	int bp_num;
+	int bp_next;
+	ID bp_ids[BDB_PREFETCH_IDS];
+	unsigned long bp_seqs[BDB_PREFETCH_IDS];
+	struct berval bp_recs[BDB_PREFETCH_IDS];
+	char *bp_buf;
+} bdb_prefetch;
+
+static void
+bdb_prefetch_free( void *key, void *data )
+{
+	bdb_prefetch *bp = data;
+
+	ch_free( bp->bp_buf );
+	ch_free( bp );
+}
+
+static bdb_prefetch *
+bdb_prefetch_buf( Operation *op, int create )
+{
+	bdb_prefetch *bp = NULL;
+
+	if ( !op->o_threadctx )
+		return NULL;
+	ldap_pvt_thread_pool_getkey( op->o_threadctx, (void *)bdb_prefetch_buf,
+		(void **)&bp, NULL );
+	if ( !bp && create ) {
+		bp = ch_calloc( 1, sizeof( bdb_prefetch ));
+		bp->bp_buf = ch_malloc( BDB_PREFETCH_BUFSIZE );
+		if ( ldap_pvt_thread_pool_setkey( op->o_threadctx,
+			(void *)bdb_prefetch_buf, bp, bdb_prefetch_free, NULL, NULL )) {
+			bdb_prefetch_free( NULL, bp );
+			bp = NULL;
+		}
+	}
+	return bp;
+}
+
+/* Read the records of the sorted ids[0..nids-1] with one bulk cursor
+ * read. Records that don't fit in the buffer are simply not
+ * prefetched. With nids == 0, drop whatever is left over.
+ */
+int bdb_id2entry_prefetch(
+	Operation *op,
+	DB_TXN *tid,
+	ID *ids,
+	int nids )
+{
+	struct bdb_info *bdb = (struct bdb_info *) op->o_bd->be_private;
+	DB *db = bdb->bi_id2entry->bdi_db;
+	bdb_prefetch *bp;
+	DBT key, data;
+	DBC *cursor;
+	ID nid, id;
+	unsigned long seqs[BDB_PREFETCH_IDS];
+	int rc, i, n = 0;
+
+	bp = bdb_prefetch_buf( op, nids > 0 );
+	if ( !bp )
+		return 0;
+	bp->bp_bdb = NULL;
+	bp->bp_num = bp->bp_next = 0;
+	if ( !nids )
+		return 0;
+#ifdef DB_DIRTY_READ
+	/* uncommitted records could be rolled back after we read them */
+	if ( bdb->bi_db_opflags & DB_DIRTY_READ )
+		return 0;
+#endif
+
+	if ( nids > BDB_PREFETCH_IDS )
+		nids = BDB_PREFETCH_IDS;
+	ldap_pvt_thread_mutex_lock( &bdb->bi_id2entry_mutex );
+	for ( i = 0; i < nids; i++ )
+		seqs[i] = bdb->bi_id2entry_seq[BDB_ID2ENTRY_SEQ( ids[i] )];
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_id2entry_mutex );
+
+	rc = db->cursor( db, tid, &cursor, bdb->bi_db_opflags );
+	if ( rc ) return rc;
+
+	DBTzero( &key );
+	key.data = &nid;
+	key.size = key.ulen = sizeof(ID);
+	key.flags = DB_DBT_USERMEM;
+	BDB_ID2DISK( ids[0], &nid );
+
+	DBTzero( &data );
+	data.data = bp->bp_buf;
+	data.ulen = BDB_PREFETCH_BUFSIZE;
+	data.flags = DB_DBT_USERMEM;
+
+	rc = cursor->c_get( cursor, &key, &data, DB_SET_RANGE | DB_MULTIPLE_KEY );
+	if ( rc == 0 ) {
+		void *ptr, *kptr, *dptr;
+		u_int32_t klen, dlen;
+
+		DB_MULTIPLE_INIT( ptr, &data );
+		for ( i = 0; i < nids; ) {
+			DB_MULTIPLE_KEY_NEXT( ptr, &data, kptr, klen, dptr, dlen );
+			if ( !ptr || klen != sizeof(ID) )
+				break;
+			AC_MEMCPY( &nid, kptr, sizeof(ID) );
+			BDB_DISK2ID( &nid, &id );
+			while ( i < nids && ids[i] < id )
+				i++;
+			if ( i < nids && ids[i] == id ) {
+				bp->bp_ids[n] = id;
+				bp->bp_seqs[n] = seqs[i];
+				bp->bp_recs[n].bv_val = dptr;
+				bp->bp_recs[n].bv_len = dlen;
+				n++;
+				i++;
+			}
+		}
+	}
+	cursor->c_close( cursor );
+
+	bp->bp_bdb = bdb;
+	bp->bp_num = n;
+	return ( rc == DB_NOTFOUND || rc == DB_BUFFER_SMALL ) ? 0 : rc;
+}
+
+/* Decode the entry for id from the prefetch buffer, if it is there
+ * and still current. Returns DB_NOTFOUND otherwise.
+ */
+int bdb_id2entry_prefetched(
+	Operation *op,
+	ID id,
+	Entry **e )
+{
+	struct bdb_info *bdb = (struct bdb_info *) op->o_bd->be_private;
+	bdb_prefetch *bp;
+	unsigned long seq;
+	char *blk;
+	ber_len_t len;
+
+	bp = bdb_prefetch_buf( op, 0 );
+	if ( !bp || bp->bp_bdb != bdb || bp->bp_next >= bp->bp_num )
+		return DB_NOTFOUND;
+
+	while ( bp->bp_next < bp->bp_num && bp->bp_ids[bp->bp_next] < id )
+		bp->bp_next++;
+	if ( bp->bp_next == bp->bp_num || bp->bp_ids[bp->bp_next] != id )
+		return DB_NOTFOUND;
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_id2entry_mutex );
+	seq = bdb->bi_id2entry_seq[BDB_ID2ENTRY_SEQ( id )];
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_id2entry_mutex );
+	if ( seq != bp->bp_seqs[bp->bp_next] ) {
+		bp->bp_next++;
+		return DB_NOTFOUND;
+	}
+
+	len = bp->bp_recs[bp->bp_next].bv_len;
+	blk = ch_malloc( len );
+	AC_MEMCPY( blk, bp->bp_recs[bp->bp_next].bv_val, len );
+	bp->bp_next++;
+
+	*e = NULL;
+	return bdb_id2entry_decode( bdb, blk, len, len, id, e );
+}
+
 int bdb_entry_return(
 	Entry *e
 )
@@ -27,26 +27,6 @@
 
 #define IDL_CMP(x,y)	( x < y ? -1 : ( x > y ? 1 : 0 ) )
 
-#define IDL_LRU_DELETE( bdb, e ) do { \
-	if ( (e) == (bdb)->bi_idl_lru_head ) { \
-		if ( (e)->idl_lru_next == (bdb)->bi_idl_lru_head ) { \
-			(bdb)->bi_idl_lru_head = NULL; \
-		} else { \
-			(bdb)->bi_idl_lru_head = (e)->idl_lru_next; \
-		} \
-	} \
-	if ( (e) == (bdb)->bi_idl_lru_tail ) { \
-		if ( (e)->idl_lru_prev == (bdb)->bi_idl_lru_tail ) { \
-			assert( (bdb)->bi_idl_lru_head == NULL ); \
-			(bdb)->bi_idl_lru_tail = NULL; \
-		} else { \
-			(bdb)->bi_idl_lru_tail = (e)->idl_lru_prev; \
-		} \
-	} \
-	(e)->idl_lru_next->idl_lru_prev = (e)->idl_lru_prev; \
-	(e)->idl_lru_prev->idl_lru_next = (e)->idl_lru_next; \
-} while ( 0 )
-
 static int
 bdb_idl_entry_cmp( const void *v_idl1, const void *v_idl2 )
 {
@@ -61,7 +41,7 @@ bdb_idl_entry_cmp( const void *v_idl1, const void *v_idl2 )
 #if IDL_DEBUG > 0
 static void idl_check( ID *ids )
 {
-	if( BDB_IDL_IS_RANGE( ids ) ) {
+	if( BDB_IDL_IS_RANGE( ids ) || BDB_IDL_IS_BITMAP( ids ) ) {
 		assert( BDB_IDL_RANGE_FIRST(ids) <= BDB_IDL_RANGE_LAST(ids) );
 	} else {
 		ID i;
@@ -99,6 +79,197 @@ static void idl_dump( ID *ids )
 #endif /* IDL_DEBUG > 1 */
 #endif /* IDL_DEBUG > 0 */
 
+/* Bitmap IDL helpers. Bitmaps are always word aligned, so two
+ * bitmaps can be combined a whole word at a time.
+ */
+#define IDL_BM_WORD(ids, id)	(BDB_IDL_BM_WORDS(ids)[((id) - \
+	BDB_IDL_BM_BASE(ids)) / BDB_IDL_BM_BITS])
+#define IDL_BM_BIT(ids, id)		((ID)1 << (((id) - \
+	BDB_IDL_BM_BASE(ids)) % BDB_IDL_BM_BITS))
+#define IDL_BM_HAS(ids, id)		((id) >= BDB_IDL_BM_BASE(ids) && \
+	(id) - BDB_IDL_BM_BASE(ids) < BDB_IDL_BM_NWORDS(ids) * BDB_IDL_BM_BITS)
+#define IDL_BM_SPAN(lo, hi)		(((hi) - ((lo) - (lo) % BDB_IDL_BM_BITS)) \
+	/ BDB_IDL_BM_BITS + 1)
+
+#ifdef __GNUC__
+#define	idl_bm_popcount(w)	__builtin_popcountl(w)
+#define	idl_bm_ctz(w)	__builtin_ctzl(w)
+#define	idl_bm_clz(w)	__builtin_clzl(w)
+#else
+static int idl_bm_popcount( ID w )
+{
+	int n;
+	for ( n = 0; w; n++ )
+		w &= w - 1;
+	return n;
+}
+
+static int idl_bm_ctz( ID w )
+{
+	int n;
+	for ( n = 0; !( w & 1 ); n++ )
+		w >>= 1;
+	return n;
+}
+
+static int idl_bm_clz( ID w )
+{
+	int n;
+	for ( n = 0; !( w & ((ID)1 << (BDB_IDL_BM_BITS-1))); n++ )
+		w <<= 1;
+	return n;
+}
+#endif
+
+/* Set up an empty bitmap covering lo..hi. The caller has checked
+ * that IDL_BM_SPAN(lo, hi) fits.
+ */
+static void
+idl_bm_init( ID *bm, ID lo, ID hi )
+{
+	ID base = lo - lo % BDB_IDL_BM_BITS;
+	ID nwords = IDL_BM_SPAN( lo, hi );
+
+	bm[0] = BDB_IDL_BITMAP;
+	bm[1] = lo;
+	bm[2] = hi;
+	BDB_IDL_BM_COUNT( bm ) = 0;
+	BDB_IDL_BM_BASE( bm ) = base;
+	BDB_IDL_BM_NWORDS( bm ) = nwords;
+	memset( BDB_IDL_BM_WORDS( bm ), 0, nwords * sizeof(ID) );
+}
+
+/* Recompute the count and bounds of a bitmap and trim any
+ * empty words off either end. An empty result becomes a zero IDL.
+ */
+static void
+idl_bm_finish( ID *bm )
+{
+	ID *w = BDB_IDL_BM_WORDS( bm );
+	ID i, lo, hi, n = BDB_IDL_BM_NWORDS( bm );
+
+	for ( lo = 0; lo < n && !w[lo]; lo++ ) ;
+	if ( lo == n ) {
+		BDB_IDL_ZERO( bm );
+		return;
+	}
+	for ( hi = n - 1; !w[hi]; hi-- ) ;
+
+	if ( lo ) {
+		AC_MEMCPY( w, w + lo, ( hi - lo + 1 ) * sizeof(ID) );
+		BDB_IDL_BM_BASE( bm ) += lo * BDB_IDL_BM_BITS;
+	}
+	n = hi - lo + 1;
+	BDB_IDL_BM_NWORDS( bm ) = n;
+
+	BDB_IDL_BM_COUNT( bm ) = 0;
+	for ( i = 0; i < n; i++ )
+		BDB_IDL_BM_COUNT( bm ) += idl_bm_popcount( w[i] );
+
+	bm[1] = BDB_IDL_BM_BASE( bm ) + idl_bm_ctz( w[0] );
+	bm[2] = BDB_IDL_BM_BASE( bm ) + n * BDB_IDL_BM_BITS - 1
+		- idl_bm_clz( w[n-1] );
+}
+
+/* Clear every bit outside lo..hi */
+static void
+idl_bm_clip( ID *bm, ID lo, ID hi )
+{
+	ID *w = BDB_IDL_BM_WORDS( bm );
+	ID base = BDB_IDL_BM_BASE( bm );
+	ID n = BDB_IDL_BM_NWORDS( bm );
+	ID i, off;
+
+	if ( lo > base ) {
+		off = lo - base;
+		i = off / BDB_IDL_BM_BITS;
+		if ( i >= n ) {
+			i = n;
+		} else {
+			w[i] &= ~(ID)0 << ( off % BDB_IDL_BM_BITS );
+		}
+		memset( w, 0, i * sizeof(ID) );
+	}
+	if ( hi < base ) {
+		memset( w, 0, n * sizeof(ID) );
+	} else if ( hi - base < n * BDB_IDL_BM_BITS - 1 ) {
+		off = hi - base;
+		i = off / BDB_IDL_BM_BITS;
+		if ( off % BDB_IDL_BM_BITS < BDB_IDL_BM_BITS - 1 )
+			w[i] &= ( (ID)1 << ( off % BDB_IDL_BM_BITS + 1 )) - 1;
+		memset( w + i + 1, 0, ( n - i - 1 ) * sizeof(ID) );
+	}
+}
+
+/* Merge src into the bitmap bm, whose span must already cover it */
+static void
+idl_bm_or( ID *bm, ID *src )
+{
+	ID i, id;
+
+	if ( BDB_IDL_IS_BITMAP( src )) {
+		ID *w = BDB_IDL_BM_WORDS( src );
+		ID *d = &IDL_BM_WORD( bm, BDB_IDL_BM_BASE( src ));
+
+		for ( i = 0; i < BDB_IDL_BM_NWORDS( src ); i++ )
+			d[i] |= w[i];
+
+	} else if ( BDB_IDL_IS_RANGE( src )) {
+		for ( id = src[1]; id <= src[2]; id++ )
+			IDL_BM_WORD( bm, id ) |= IDL_BM_BIT( bm, id );
+
+	} else {
+		for ( i = 1; i <= src[0]; i++ )
+			IDL_BM_WORD( bm, src[i] ) |= IDL_BM_BIT( bm, src[i] );
+	}
+}
+
+/* Keep only the bits of bm that are also set in the bitmap src */
+static void
+idl_bm_and( ID *bm, ID *src )
+{
+	ID *w = BDB_IDL_BM_WORDS( bm );
+	ID *s = BDB_IDL_BM_WORDS( src );
+	ID base = BDB_IDL_BM_BASE( bm ), sbase = BDB_IDL_BM_BASE( src );
+	ID i, n = BDB_IDL_BM_NWORDS( bm ), sn = BDB_IDL_BM_NWORDS( src );
+	ID lo, hi;
+
+	/* overlapping words, relative to bm */
+	lo = sbase > base ? ( sbase - base ) / BDB_IDL_BM_BITS : 0;
+	hi = ( sbase + sn * BDB_IDL_BM_BITS ) > base ?
+		( sbase + sn * BDB_IDL_BM_BITS - base ) / BDB_IDL_BM_BITS : 0;
+	if ( hi > n ) hi = n;
+	if ( lo > hi ) lo = hi;
+
+	memset( w, 0, lo * sizeof(ID) );
+	s += ( base + lo * BDB_IDL_BM_BITS - sbase ) / BDB_IDL_BM_BITS;
+	for ( i = lo; i < hi; i++ )
+		w[i] &= *s++;
+	memset( w + hi, 0, ( n - hi ) * sizeof(ID) );
+}
+
+/* Return the first ID in bm that is >= id, or NOID */
+static ID
+idl_bm_scan( ID *bm, ID id )
+{
+	ID *w = BDB_IDL_BM_WORDS( bm );
+	ID i, word;
+
+	if ( id < bm[1] )
+		id = bm[1];
+	if ( id > bm[2] )
+		return NOID;
+
+	i = ( id - BDB_IDL_BM_BASE( bm )) / BDB_IDL_BM_BITS;
+	word = w[i] & ( ~(ID)0 << (( id - BDB_IDL_BM_BASE( bm )) % BDB_IDL_BM_BITS ));
+	while ( !word ) {
+		if ( ++i >= BDB_IDL_BM_NWORDS( bm ))
+			return NOID;
+		word = w[i];
+	}
+	return BDB_IDL_BM_BASE( bm ) + i * BDB_IDL_BM_BITS + idl_bm_ctz( word );
+}
+
 unsigned bdb_idl_search( ID *ids, ID id )
 {
 #define IDL_BINARY_SEARCH 1
@@ -169,6 +340,22 @@ int bdb_idl_insert( ID *ids, ID id )
 	idl_check( ids );
 #endif
 
+	if (BDB_IDL_IS_BITMAP( ids )) {
+		if ( IDL_BM_HAS( ids, id )) {
+			if ( IDL_BM_WORD( ids, id ) & IDL_BM_BIT( ids, id ))
+				return -1;
+			IDL_BM_WORD( ids, id ) |= IDL_BM_BIT( ids, id );
+			BDB_IDL_BM_COUNT( ids )++;
+			if ( id < ids[1] )
+				ids[1] = id;
+			else if ( id > ids[2] )
+				ids[2] = id;
+			return 0;
+		}
+		/* Outside the bitmap, it degrades to a range */
+		ids[0] = NOID;
+	}
+
 	if (BDB_IDL_IS_RANGE( ids )) {
 		/* if already in range, treat as a dup */
 		if (id >= BDB_IDL_FIRST(ids) && id <= BDB_IDL_LAST(ids))
@@ -219,7 +406,7 @@ int bdb_idl_insert( ID *ids, ID id )
 	return 0;
 }
 
-static int bdb_idl_delete( ID *ids, ID id )
+int bdb_idl_delete( ID *ids, ID id )
 {
 	unsigned x;
 
@@ -290,6 +477,170 @@ bdb_show_key(
 	}
 }
 
+static unsigned
+idl_cache_hash( DB *db, struct berval *key )
+{
+	unsigned char *c = (unsigned char *) key->bv_val;
+	unsigned h = 2166136261U;
+	ber_len_t i;
+
+	h = ( h ^ (unsigned)( (unsigned long) db >> 4 )) * 16777619U;
+	for ( i = 0; i < key->bv_len; i++ )
+		h = ( h ^ c[i] ) * 16777619U;
+	return h;
+}
+
+#define IDL_CACHE_PART( bdb, h ) \
+	(&(bdb)->bi_idl_cache[(h) % BDB_IDL_CACHE_PARTS])
+
+/* Is a partition, or with share = 4 its probation queue, over its
+ * part of the entry or byte budget?
+ */
+static int
+idl_cache_over(
+	struct bdb_info	*bdb,
+	ID		count,
+	unsigned long	bytes,
+	int		share )
+{
+	ID max = bdb->bi_idl_cache_max_size / BDB_IDL_CACHE_PARTS / share;
+	unsigned long maxb = bdb->bi_idl_cache_max_bytes /
+		BDB_IDL_CACHE_PARTS / share;
+
+	if ( bdb->bi_idl_cache_max_size && count > ( max ? max : 1 ))
+		return 1;
+	if ( bdb->bi_idl_cache_max_bytes && bytes > maxb )
+		return 1;
+	return 0;
+}
+
+/* Find the counters for a db. The last slot counts the dbs that
+ * found no other. A db goes to the slot its handle hashes to, or the
+ * next free one after it, so it is usually found at the first look.
+ *
+ * No lock is needed to find a slot that's in use: its db is only set
+ * once, under ip_statlock, and stays until the cache is emptied. The
+ * counters are bumped without a lock as well, they're approximate.
+ */
+static bdb_idl_cache_stat *
+idl_cache_stat( bdb_idl_cache_part *ip, DB *db )
+{
+	int nslots = BDB_IDL_CACHE_STATS - 1;
+	int i, n = ((unsigned long) db >> 4) % nslots;
+	bdb_idl_cache_stat *is;
+
+	for ( i = 0; i < nslots; i++ ) {
+		is = &ip->ip_stats[( n + i ) % nslots];
+		if ( is->is_db == db )
+			return is;
+		if ( !is->is_db )
+			break;
+	}
+
+	/* Not there yet; another thread may be taking a slot for it */
+	ldap_pvt_thread_mutex_lock( &ip->ip_statlock );
+	for ( ; i < nslots; i++ ) {
+		is = &ip->ip_stats[( n + i ) % nslots];
+		if ( is->is_db == db )
+			break;
+		if ( !is->is_db ) {
+			is->is_db = db;
+			break;
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &ip->ip_statlock );
+
+	return i < nslots ? is : &ip->ip_stats[nslots];
+}
+
+static void
+idl_cache_size( bdb_idl_cache_part *ip, bdb_idl_cache_entry_t *ee )
+{
+	unsigned long size = sizeof( *ee ) + ee->kstr.bv_len +
+		( ee->idl ? BDB_IDL_SIZEOF( ee->idl ) : 0 );
+
+	ip->ip_bytes += size - ee->idl_size;
+	if ( !( ee->idl_flags & IDL_CACHE_MAIN ))
+		ip->ip_pbytes += size - ee->idl_size;
+	ee->idl_size = size;
+}
+
+/* Take an entry out of the cache and free it. Must hold the
+ * partition's write lock.
+ */
+static void
+idl_cache_drop( bdb_idl_cache_part *ip, bdb_idl_cache_entry_t *ee )
+{
+	if ( avl_delete( &ip->ip_tree, (caddr_t) ee,
+		bdb_idl_entry_cmp ) == NULL )
+	{
+		Debug( LDAP_DEBUG_ANY, "=> bdb_idl_cache_drop: "
+			"AVL delete failed\n",
+			0, 0, 0 );
+	}
+	if ( ee->idl_flags & IDL_CACHE_MAIN ) {
+		LDAP_TAILQ_REMOVE( &ip->ip_main, ee, idl_lru );
+	} else {
+		LDAP_TAILQ_REMOVE( &ip->ip_probation, ee, idl_lru );
+		ip->ip_pcount--;
+		ip->ip_pbytes -= ee->idl_size;
+	}
+	ip->ip_count--;
+	ip->ip_bytes -= ee->idl_size;
+	ch_free( ee->kstr.bv_val );
+	if ( ee->idl )
+		ch_free( ee->idl );
+	ch_free( ee );
+}
+
+/* Shrink a partition back to its budget. Entries referenced while on
+ * probation move to the main queue instead of being dropped, the others
+ * leave their key hash behind in case they come back soon. The main
+ * queue gives its referenced entries a second chance.
+ */
+static void
+idl_cache_evict( struct bdb_info *bdb, bdb_idl_cache_part *ip )
+{
+	bdb_idl_cache_entry_t *ee;
+	DB *db;
+
+	while ( ip->ip_count &&
+		idl_cache_over( bdb, ip->ip_count, ip->ip_bytes, 1 ))
+	{
+		if ( !LDAP_TAILQ_EMPTY( &ip->ip_probation ) &&
+			( LDAP_TAILQ_EMPTY( &ip->ip_main ) ||
+			idl_cache_over( bdb, ip->ip_pcount, ip->ip_pbytes, 4 )))
+		{
+			ee = LDAP_TAILQ_LAST( &ip->ip_probation,
+				bdb_idl_cache_entry_s, idl_lru );
+			if ( ee->idl_flags & CACHE_ENTRY_REFERENCED ) {
+				LDAP_TAILQ_REMOVE( &ip->ip_probation, ee, idl_lru );
+				ip->ip_pcount--;
+				ip->ip_pbytes -= ee->idl_size;
+				ee->idl_flags ^= CACHE_ENTRY_REFERENCED;
+				ee->idl_flags |= IDL_CACHE_MAIN;
+				LDAP_TAILQ_INSERT_HEAD( &ip->ip_main, ee, idl_lru );
+				continue;
+			}
+			ip->ip_ghosts[ip->ip_ghostpos] = ee->idl_hash;
+			ip->ip_ghostpos = ( ip->ip_ghostpos + 1 ) %
+				BDB_IDL_CACHE_GHOSTS;
+		} else {
+			ee = LDAP_TAILQ_LAST( &ip->ip_main,
+				bdb_idl_cache_entry_s, idl_lru );
+			if ( ee->idl_flags & CACHE_ENTRY_REFERENCED ) {
+				ee->idl_flags ^= CACHE_ENTRY_REFERENCED;
+				LDAP_TAILQ_REMOVE( &ip->ip_main, ee, idl_lru );
+				LDAP_TAILQ_INSERT_HEAD( &ip->ip_main, ee, idl_lru );
+				continue;
+			}
+		}
+		db = ee->db;
+		idl_cache_drop( ip, ee );
+		idl_cache_stat( ip, db )->is_evicts++;
+	}
+}
+
 /* Find a db/key pair in the IDL cache. If ids is non-NULL,
  * copy the cached IDL into it, otherwise just return the status.
  */
@@ -302,12 +653,16 @@ bdb_idl_cache_get(
 {
 	bdb_idl_cache_entry_t idl_tmp;
 	bdb_idl_cache_entry_t *matched_idl_entry;
+	bdb_idl_cache_part *ip;
+	bdb_idl_cache_stat *is;
 	int rc = LDAP_NO_SUCH_OBJECT;
 
 	DBT2bv( key, &idl_tmp.kstr );
 	idl_tmp.db = db;
-	ldap_pvt_thread_rdwr_rlock( &bdb->bi_idl_tree_rwlock );
-	matched_idl_entry = avl_find( bdb->bi_idl_tree, &idl_tmp,
+	ip = IDL_CACHE_PART( bdb, idl_cache_hash( db, &idl_tmp.kstr ));
+
+	ldap_pvt_thread_rdwr_rlock( &ip->ip_rwlock );
+	matched_idl_entry = avl_find( ip->ip_tree, &idl_tmp,
 				      bdb_idl_entry_cmp );
 	if ( matched_idl_entry != NULL ) {
 		if ( matched_idl_entry->idl && ids )
@@ -318,7 +673,13 @@ bdb_idl_cache_get(
 		else
 			rc = DB_NOTFOUND;
 	}
-	ldap_pvt_thread_rdwr_runlock( &bdb->bi_idl_tree_rwlock );
+	ldap_pvt_thread_rdwr_runlock( &ip->ip_rwlock );
+
+	is = idl_cache_stat( ip, db );
+	if ( matched_idl_entry != NULL )
+		is->is_hits++;
+	else
+		is->is_misses++;
 
 	return rc;
 }
@@ -332,7 +693,9 @@ bdb_idl_cache_put(
 	int			rc )
 {
 	bdb_idl_cache_entry_t idl_tmp;
-	bdb_idl_cache_entry_t *ee, *eprev;
+	bdb_idl_cache_entry_t *ee;
+	bdb_idl_cache_part *ip;
+	int i;
 
 	if ( rc == DB_NOTFOUND || BDB_IDL_IS_ZERO( ids ))
 		return;
@@ -345,69 +708,43 @@ bdb_idl_cache_put(
 	ee->idl = (ID*) ch_malloc( BDB_IDL_SIZEOF ( ids ) );
 	BDB_IDL_CPY( ee->idl, ids );
 
-	ee->idl_lru_prev = NULL;
-	ee->idl_lru_next = NULL;
+	LDAP_TAILQ_ENTRY_INIT( ee, idl_lru );
 	ee->idl_flags = 0;
+	ee->idl_size = 0;
+	ee->idl_hash = idl_cache_hash( db, &idl_tmp.kstr );
 	ber_dupbv( &ee->kstr, &idl_tmp.kstr );
-	ldap_pvt_thread_rdwr_wlock( &bdb->bi_idl_tree_rwlock );
-	if ( avl_insert( &bdb->bi_idl_tree, (caddr_t) ee,
+	ip = IDL_CACHE_PART( bdb, ee->idl_hash );
+
+	ldap_pvt_thread_rdwr_wlock( &ip->ip_rwlock );
+	if ( avl_insert( &ip->ip_tree, (caddr_t) ee,
 		bdb_idl_entry_cmp, avl_dup_error ))
 	{
 		ch_free( ee->kstr.bv_val );
 		ch_free( ee->idl );
 		ch_free( ee );
-		ldap_pvt_thread_rdwr_wunlock( &bdb->bi_idl_tree_rwlock );
+		ldap_pvt_thread_rdwr_wunlock( &ip->ip_rwlock );
 		return;
 	}
-	ldap_pvt_thread_mutex_lock( &bdb->bi_idl_tree_lrulock );
-	/* LRU_ADD */
-	if ( bdb->bi_idl_lru_head ) {
-		assert( bdb->bi_idl_lru_tail != NULL );
-		assert( bdb->bi_idl_lru_head->idl_lru_prev != NULL );
-		assert( bdb->bi_idl_lru_head->idl_lru_next != NULL );
-
-		ee->idl_lru_next = bdb->bi_idl_lru_head;
-		ee->idl_lru_prev = bdb->bi_idl_lru_head->idl_lru_prev;
-		bdb->bi_idl_lru_head->idl_lru_prev->idl_lru_next = ee;
-		bdb->bi_idl_lru_head->idl_lru_prev = ee;
-	} else {
-		ee->idl_lru_next = ee->idl_lru_prev = ee;
-		bdb->bi_idl_lru_tail = ee;
-	}
-	bdb->bi_idl_lru_head = ee;
 
-	if ( bdb->bi_idl_cache_size >= bdb->bi_idl_cache_max_size ) {
-		int i;
-		eprev = bdb->bi_idl_lru_tail;
-		for ( i = 0; (ee = eprev) != NULL && i < 10; i++ ) {
-			eprev = ee->idl_lru_prev;
-			if ( eprev == ee ) {
-				eprev = NULL;
-			}
-			if ( ee->idl_flags & CACHE_ENTRY_REFERENCED ) {
-				ee->idl_flags ^= CACHE_ENTRY_REFERENCED;
-				continue;
-			}
-			if ( avl_delete( &bdb->bi_idl_tree, (caddr_t) ee,
-				    bdb_idl_entry_cmp ) == NULL ) {
-				Debug( LDAP_DEBUG_ANY, "=> bdb_idl_cache_put: "
-					"AVL delete failed\n",
-					0, 0, 0 );
-			}
-			IDL_LRU_DELETE( bdb, ee );
-			i++;
-			--bdb->bi_idl_cache_size;
-			ch_free( ee->kstr.bv_val );
-			ch_free( ee->idl );
-			ch_free( ee );
+	/* A key that was dropped from probation lately skips it */
+	for ( i = 0; i < BDB_IDL_CACHE_GHOSTS; i++ ) {
+		if ( ip->ip_ghosts[i] == ee->idl_hash ) {
+			ip->ip_ghosts[i] = 0;
+			ee->idl_flags |= IDL_CACHE_MAIN;
+			break;
 		}
-		bdb->bi_idl_lru_tail = eprev;
-		assert( bdb->bi_idl_lru_tail != NULL
-			|| bdb->bi_idl_lru_head == NULL );
 	}
-	bdb->bi_idl_cache_size++;
-	ldap_pvt_thread_mutex_unlock( &bdb->bi_idl_tree_lrulock );
-	ldap_pvt_thread_rdwr_wunlock( &bdb->bi_idl_tree_rwlock );
+	if ( ee->idl_flags & IDL_CACHE_MAIN ) {
+		LDAP_TAILQ_INSERT_HEAD( &ip->ip_main, ee, idl_lru );
+	} else {
+		LDAP_TAILQ_INSERT_HEAD( &ip->ip_probation, ee, idl_lru );
+		ip->ip_pcount++;
+	}
+	ip->ip_count++;
+	idl_cache_size( ip, ee );
+
+	idl_cache_evict( bdb, ip );
+	ldap_pvt_thread_rdwr_wunlock( &ip->ip_rwlock );
 }
 
 void
@@ -417,28 +754,19 @@ bdb_idl_cache_del(
 	DBT			*key )
 {
 	bdb_idl_cache_entry_t *matched_idl_entry, idl_tmp;
+	bdb_idl_cache_part *ip;
+
 	DBT2bv( key, &idl_tmp.kstr );
 	idl_tmp.db = db;
-	ldap_pvt_thread_rdwr_wlock( &bdb->bi_idl_tree_rwlock );
-	matched_idl_entry = avl_find( bdb->bi_idl_tree, &idl_tmp,
+	ip = IDL_CACHE_PART( bdb, idl_cache_hash( db, &idl_tmp.kstr ));
+
+	ldap_pvt_thread_rdwr_wlock( &ip->ip_rwlock );
+	matched_idl_entry = avl_find( ip->ip_tree, &idl_tmp,
 				      bdb_idl_entry_cmp );
 	if ( matched_idl_entry != NULL ) {
-		if ( avl_delete( &bdb->bi_idl_tree, (caddr_t) matched_idl_entry,
-				    bdb_idl_entry_cmp ) == NULL ) {
-			Debug( LDAP_DEBUG_ANY, "=> bdb_idl_cache_del: "
-				"AVL delete failed\n",
-				0, 0, 0 );
-		}
-		--bdb->bi_idl_cache_size;
-		ldap_pvt_thread_mutex_lock( &bdb->bi_idl_tree_lrulock );
-		IDL_LRU_DELETE( bdb, matched_idl_entry );
-		ldap_pvt_thread_mutex_unlock( &bdb->bi_idl_tree_lrulock );
-		free( matched_idl_entry->kstr.bv_val );
-		if ( matched_idl_entry->idl )
-			free( matched_idl_entry->idl );
-		free( matched_idl_entry );
+		idl_cache_drop( ip, matched_idl_entry );
 	}
-	ldap_pvt_thread_rdwr_wunlock( &bdb->bi_idl_tree_rwlock );
+	ldap_pvt_thread_rdwr_wunlock( &ip->ip_rwlock );
 }
 
 void
@@ -449,10 +777,14 @@ bdb_idl_cache_add_id(
 	ID			id )
 {
 	bdb_idl_cache_entry_t *cache_entry, idl_tmp;
+	bdb_idl_cache_part *ip;
+
 	DBT2bv( key, &idl_tmp.kstr );
 	idl_tmp.db = db;
-	ldap_pvt_thread_rdwr_wlock( &bdb->bi_idl_tree_rwlock );
-	cache_entry = avl_find( bdb->bi_idl_tree, &idl_tmp,
+	ip = IDL_CACHE_PART( bdb, idl_cache_hash( db, &idl_tmp.kstr ));
+
+	ldap_pvt_thread_rdwr_wlock( &ip->ip_rwlock );
+	cache_entry = avl_find( ip->ip_tree, &idl_tmp,
 				      bdb_idl_entry_cmp );
 	if ( cache_entry != NULL ) {
 		if ( !BDB_IDL_IS_RANGE( cache_entry->idl ) &&
@@ -461,8 +793,10 @@ bdb_idl_cache_add_id(
 			cache_entry->idl = ch_realloc( cache_entry->idl, s );
 		}
 		bdb_idl_insert( cache_entry->idl, id );
+		idl_cache_size( ip, cache_entry );
+		idl_cache_evict( bdb, ip );
 	}
-	ldap_pvt_thread_rdwr_wunlock( &bdb->bi_idl_tree_rwlock );
+	ldap_pvt_thread_rdwr_wunlock( &ip->ip_rwlock );
 }
 
 void
@@ -473,30 +807,125 @@ bdb_idl_cache_del_id(
 	ID			id )
 {
 	bdb_idl_cache_entry_t *cache_entry, idl_tmp;
+	bdb_idl_cache_part *ip;
+
 	DBT2bv( key, &idl_tmp.kstr );
 	idl_tmp.db = db;
-	ldap_pvt_thread_rdwr_wlock( &bdb->bi_idl_tree_rwlock );
-	cache_entry = avl_find( bdb->bi_idl_tree, &idl_tmp,
+	ip = IDL_CACHE_PART( bdb, idl_cache_hash( db, &idl_tmp.kstr ));
+
+	ldap_pvt_thread_rdwr_wlock( &ip->ip_rwlock );
+	cache_entry = avl_find( ip->ip_tree, &idl_tmp,
 				      bdb_idl_entry_cmp );
 	if ( cache_entry != NULL ) {
 		bdb_idl_delete( cache_entry->idl, id );
 		if ( cache_entry->idl[0] == 0 ) {
-			if ( avl_delete( &bdb->bi_idl_tree, (caddr_t) cache_entry,
-						bdb_idl_entry_cmp ) == NULL ) {
-				Debug( LDAP_DEBUG_ANY, "=> bdb_idl_cache_del: "
-					"AVL delete failed\n",
-					0, 0, 0 );
+			idl_cache_drop( ip, cache_entry );
+		}
+	}
+	ldap_pvt_thread_rdwr_wunlock( &ip->ip_rwlock );
+}
+
+void
+bdb_idl_cache_init( struct bdb_info *bdb )
+{
+	int i;
+
+	for ( i = 0; i < BDB_IDL_CACHE_PARTS; i++ ) {
+		bdb_idl_cache_part *ip = &bdb->bi_idl_cache[i];
+
+		ldap_pvt_thread_rdwr_init( &ip->ip_rwlock );
+		ldap_pvt_thread_mutex_init( &ip->ip_statlock );
+		LDAP_TAILQ_INIT( &ip->ip_probation );
+		LDAP_TAILQ_INIT( &ip->ip_main );
+	}
+}
+
+/* Drop everything, including the counters */
+void
+bdb_idl_cache_empty( struct bdb_info *bdb )
+{
+	bdb_idl_cache_entry_t *ee;
+	int i;
+
+	for ( i = 0; i < BDB_IDL_CACHE_PARTS; i++ ) {
+		bdb_idl_cache_part *ip = &bdb->bi_idl_cache[i];
+
+		ldap_pvt_thread_rdwr_wlock( &ip->ip_rwlock );
+		while (( ee = LDAP_TAILQ_FIRST( &ip->ip_probation )) != NULL )
+			idl_cache_drop( ip, ee );
+		while (( ee = LDAP_TAILQ_FIRST( &ip->ip_main )) != NULL )
+			idl_cache_drop( ip, ee );
+		assert( ip->ip_tree == NULL );
+		memset( ip->ip_ghosts, 0, sizeof( ip->ip_ghosts ));
+		ip->ip_ghostpos = 0;
+		ldap_pvt_thread_rdwr_wunlock( &ip->ip_rwlock );
+
+		ldap_pvt_thread_mutex_lock( &ip->ip_statlock );
+		memset( ip->ip_stats, 0, sizeof( ip->ip_stats ));
+		ldap_pvt_thread_mutex_unlock( &ip->ip_statlock );
+	}
+}
+
+void
+bdb_idl_cache_destroy( struct bdb_info *bdb )
+{
+	int i;
+
+	for ( i = 0; i < BDB_IDL_CACHE_PARTS; i++ ) {
+		bdb_idl_cache_part *ip = &bdb->bi_idl_cache[i];
+
+		ldap_pvt_thread_rdwr_destroy( &ip->ip_rwlock );
+		ldap_pvt_thread_mutex_destroy( &ip->ip_statlock );
+	}
+}
+
+/* Sum up the partitions. The per-db counters are returned in a new
+ * array; the one with a NULL db counts the dbs that didn't get a slot.
+ */
+void
+bdb_idl_cache_stats(
+	struct bdb_info	*bdb,
+	ID		*count,
+	unsigned long	*bytes,
+	bdb_idl_cache_stat	**stats,
+	int		*nstats )
+{
+	bdb_idl_cache_stat *st = NULL;
+	int i, j, k, n = 0;
+
+	*count = 0;
+	*bytes = 0;
+
+	for ( i = 0; i < BDB_IDL_CACHE_PARTS; i++ ) {
+		bdb_idl_cache_part *ip = &bdb->bi_idl_cache[i];
+
+		ldap_pvt_thread_rdwr_rlock( &ip->ip_rwlock );
+		*count += ip->ip_count;
+		*bytes += ip->ip_bytes;
+		ldap_pvt_thread_rdwr_runlock( &ip->ip_rwlock );
+
+		ldap_pvt_thread_mutex_lock( &ip->ip_statlock );
+		for ( j = 0; j < BDB_IDL_CACHE_STATS; j++ ) {
+			bdb_idl_cache_stat *is = &ip->ip_stats[j];
+
+			if ( !is->is_db && !is->is_hits &&
+				!is->is_misses && !is->is_evicts )
+				continue;
+			for ( k = 0; k < n && st[k].is_db != is->is_db; k++ )
+				;
+			if ( k == n ) {
+				st = ch_realloc( st, ( n + 1 ) * sizeof( *st ));
+				memset( &st[n], 0, sizeof( *st ));
+				st[n++].is_db = is->is_db;
 			}
-			--bdb->bi_idl_cache_size;
-			ldap_pvt_thread_mutex_lock( &bdb->bi_idl_tree_lrulock );
-			IDL_LRU_DELETE( bdb, cache_entry );
-			ldap_pvt_thread_mutex_unlock( &bdb->bi_idl_tree_lrulock );
-			free( cache_entry->kstr.bv_val );
-			free( cache_entry->idl );
-			free( cache_entry );
+			st[k].is_hits += is->is_hits;
+			st[k].is_misses += is->is_misses;
+			st[k].is_evicts += is->is_evicts;
 		}
+		ldap_pvt_thread_mutex_unlock( &ip->ip_statlock );
 	}
-	ldap_pvt_thread_rdwr_wunlock( &bdb->bi_idl_tree_rwlock );
+	*stats = st;
+	*nstats = n;
 }
 
 int
@@ -563,7 +992,7 @@ bdb_idl_fetch_key(
 	}
 
 	/* only non-range lookups can use the IDL cache */
-	if ( bdb->bi_idl_cache_size && opflag == DB_SET ) {
+	if ( BDB_IDL_CACHING( bdb ) && opflag == DB_SET ) {
 		rc = bdb_idl_cache_get( bdb, db, key, ids );
 		if ( rc != LDAP_NO_SUCH_OBJECT ) return rc;
 	}
@@ -683,7 +1112,7 @@ bdb_idl_fetch_key(
 		return -1;
 	}
 
-	if ( bdb->bi_idl_cache_max_size ) {
+	if ( BDB_IDL_CACHING( bdb )) {
 		bdb_idl_cache_put( bdb, db, key, ids, rc );
 	}
 
@@ -890,7 +1319,7 @@ fail:
 	/* If key was added (didn't already exist) and using IDL cache,
 	 * update key in IDL cache.
 	 */
-	if ( !rc && bdb->bi_idl_cache_max_size ) {
+	if ( !rc && BDB_IDL_CACHING( bdb )) {
 		bdb_idl_cache_add_id( bdb, db, key, id );
 	}
 	rc = cursor->c_close( cursor );
@@ -925,7 +1354,7 @@ bdb_idl_delete_key(
 	}
 	assert( id != NOID );
 
-	if ( bdb->bi_idl_cache_size ) {
+	if ( BDB_IDL_CACHING( bdb )) {
 		bdb_idl_cache_del( bdb, db, key );
 	}
 
@@ -1071,6 +1500,47 @@ bdb_idl_intersection(
 		return 0;
 	}
 
+	if ( BDB_IDL_IS_BITMAP( a ) || BDB_IDL_IS_BITMAP( b ) ) {
+		if ( BDB_IDL_IS_RANGE( a ) ) {
+			/* Clip the bitmap to the range */
+			idl_bm_clip( b, idmin, idmax );
+			idl_bm_finish( b );
+			BDB_IDL_CPY( a, b );
+			return 0;
+		}
+		if ( BDB_IDL_IS_BITMAP( a ) ) {
+			if ( BDB_IDL_IS_BITMAP( b ) ) {
+				idl_bm_and( a, b );
+				idl_bm_finish( a );
+				return 0;
+			}
+			if ( BDB_IDL_IS_RANGE( b ) ) {
+				idl_bm_clip( a, idmin, idmax );
+				idl_bm_finish( a );
+				return 0;
+			}
+			/* Else swap so that b is the bitmap, a is a list */
+			{
+				ID *tmp = a;
+				a = b;
+				b = tmp;
+				swap = 1;
+			}
+		}
+
+		/* Keep the list members whose bit is set */
+		cursorc = 0;
+		for ( cursora = bdb_idl_search( a, idmin );
+			cursora <= a[0] && a[cursora] <= idmax; cursora++ )
+		{
+			ida = a[cursora];
+			if ( IDL_BM_WORD( b, ida ) & IDL_BM_BIT( b, ida ))
+				a[++cursorc] = ida;
+		}
+		a[0] = cursorc;
+		goto done;
+	}
+
 	if ( BDB_IDL_IS_RANGE( a ) ) {
 		if ( BDB_IDL_IS_RANGE(b) ) {
 		/* If both are ranges, just shrink the boundaries */
@@ -1102,6 +1572,17 @@ bdb_idl_intersection(
 		goto done;
 	}
 
+	/* Two lists: skip to idmin in both and let the kernels
+	 * write the result over a.
+	 */
+	if ( !BDB_IDL_IS_RANGE( b ) ) {
+		cursora = bdb_idl_search( a, idmin );
+		cursorb = bdb_idl_search( b, idmin );
+		a[0] = bdb_idl_isect_lists( a + 1, a + cursora, a[0] - cursora + 1,
+			b + cursorb, b[0] - cursorb + 1 );
+		goto done;
+	}
+
 	/* Fine, do the intersection one element at a time.
 	 * First advance to idmin in both IDLs.
 	 */
@@ -1140,6 +1621,7 @@ bdb_idl_union(
 {
 	ID ida, idb;
 	ID cursora = 0, cursorb = 0, cursorc;
+	ID *bm;
 
 	if ( BDB_IDL_IS_ZERO( b ) ) {
 		return 0;
@@ -1159,25 +1641,48 @@ over:		ida = IDL_MIN( BDB_IDL_FIRST(a), BDB_IDL_FIRST(b) );
 		return 0;
 	}
 
-	ida = bdb_idl_first( a, &cursora );
-	idb = bdb_idl_first( b, &cursorb );
+	if ( BDB_IDL_IS_BITMAP( a ) || BDB_IDL_IS_BITMAP( b ) ) {
+bitmap:
+		ida = IDL_MIN( BDB_IDL_FIRST(a), BDB_IDL_FIRST(b) );
+		idb = IDL_MAX( BDB_IDL_LAST(a), BDB_IDL_LAST(b) );
+
+		/* If b already fits inside a, just set its bits */
+		if ( BDB_IDL_IS_BITMAP( a ) && IDL_BM_HAS( a, ida )
+			&& IDL_BM_HAS( a, idb ) ) {
+			idl_bm_or( a, b );
+			idl_bm_finish( a );
+			return 0;
+		}
+
+		cursorc = IDL_BM_SPAN( ida, idb );
+		if ( cursorc > BDB_IDL_BM_MAXWORDS ) {
+			/* Too sparse for a bitmap, fall back to a range */
+			goto over;
+		}
+		bm = ch_malloc( ( BDB_IDL_BM_HDR + cursorc ) * sizeof(ID) );
+		idl_bm_init( bm, ida, idb );
+		idl_bm_or( bm, a );
+		idl_bm_or( bm, b );
+		idl_bm_finish( bm );
+		BDB_IDL_CPY( a, bm );
+		ch_free( bm );
+		return 0;
+	}
 
 	cursorc = b[0];
 
 	/* The distinct elements of a are cat'd to b */
-	while( ida != NOID || idb != NOID ) {
-		if ( ida < idb ) {
-			if( ++cursorc > BDB_IDL_UM_MAX ) {
-				goto over;
-			}
-			b[cursorc] = ida;
-			ida = bdb_idl_next( a, &cursora );
-
-		} else {
-			if ( ida == idb )
-				ida = bdb_idl_next( a, &cursora );
-			idb = bdb_idl_next( b, &cursorb );
+	cursorb = 1;
+	for ( cursora = 1; cursora <= a[0]; cursora++ ) {
+		ida = a[cursora];
+		cursorb = bdb_idl_gallop( b, cursorb, ida );
+		if ( cursorb <= b[0] && b[cursorb] == ida )
+			continue;
+		if( ++cursorc > BDB_IDL_UM_MAX ) {
+			/* b[1..b[0]] is still intact */
+			goto bitmap;
 		}
+		b[cursorc] = ida;
 	}
 
 	/* b is copied back to a in sorted order */
@@ -1190,9 +1695,13 @@ over:		ida = IDL_MIN( BDB_IDL_FIRST(a), BDB_IDL_FIRST(b) );
 			idb = NOID;
 		else
 			idb = b[cursorc];
-		if (cursorb <= b[0] && b[cursorb] < idb)
-			a[cursora++] = b[cursorb++];
-		else {
+		if (cursorb <= b[0] && b[cursorb] < idb) {
+			/* copy the whole run of b below idb at once */
+			ida = bdb_idl_gallop( b, cursorb, idb );
+			AC_MEMCPY( a+cursora, b+cursorb, (ida-cursorb) * sizeof(ID) );
+			cursora += ida - cursorb;
+			cursorb = ida;
+		} else {
 			a[cursora++] = idb;
 			cursorc++;
 		}
@@ -1202,7 +1711,6 @@ over:		ida = IDL_MIN( BDB_IDL_FIRST(a), BDB_IDL_FIRST(b) );
 }
 
 
-#if 0
 /*
  * bdb_idl_notin - return a intersection ~b (or a minus b)
  */
@@ -1228,6 +1736,38 @@ bdb_idl_notin(
 		return 0;
 	}
 
+	if( BDB_IDL_IS_BITMAP( a ) ) {
+		BDB_IDL_CPY( ids, a );
+		if ( BDB_IDL_IS_BITMAP( b ) ) {
+			ID *w = BDB_IDL_BM_WORDS( ids );
+
+			for ( cursora = 0; cursora < BDB_IDL_BM_NWORDS( ids ); cursora++ ) {
+				ida = BDB_IDL_BM_BASE( ids ) + cursora * BDB_IDL_BM_BITS;
+				if ( IDL_BM_HAS( b, ida ))
+					w[cursora] &= ~IDL_BM_WORD( b, ida );
+			}
+		} else {
+			for ( cursorb = 1; cursorb <= b[0]; cursorb++ ) {
+				idb = b[cursorb];
+				if ( IDL_BM_HAS( ids, idb ))
+					IDL_BM_WORD( ids, idb ) &= ~IDL_BM_BIT( ids, idb );
+			}
+		}
+		idl_bm_finish( ids );
+		return 0;
+	}
+
+	if( BDB_IDL_IS_BITMAP( b ) ) {
+		ids[0] = 0;
+		for ( cursora = 1; cursora <= a[0]; cursora++ ) {
+			ida = a[cursora];
+			if ( !IDL_BM_HAS( b, ida ) ||
+				!( IDL_BM_WORD( b, ida ) & IDL_BM_BIT( b, ida )))
+				ids[++ids[0]] = ida;
+		}
+		return 0;
+	}
+
 	ida = bdb_idl_first( a, &cursora ),
 	idb = bdb_idl_first( b, &cursorb );
 
@@ -1254,7 +1794,6 @@ bdb_idl_notin(
 
 	return 0;
 }
-#endif
 
 ID bdb_idl_first( ID *ids, ID *cursor )
 {
@@ -1272,6 +1811,11 @@ ID bdb_idl_first( ID *ids, ID *cursor )
 		return *cursor;
 	}
 
+	if ( BDB_IDL_IS_BITMAP( ids ) ) {
+		*cursor = idl_bm_scan( ids, *cursor );
+		return *cursor;
+	}
+
 	if ( *cursor == 0 )
 		pos = 1;
 	else
@@ -1294,6 +1838,12 @@ ID bdb_idl_next( ID *ids, ID *cursor )
 		return *cursor;
 	}
 
+	if ( BDB_IDL_IS_BITMAP( ids ) ) {
+		if ( *cursor != NOID )
+			*cursor = idl_bm_scan( ids, *cursor + 1 );
+		return *cursor;
+	}
+
 	if ( ++(*cursor) <= ids[0] ) {
 		return ids[*cursor];
 	}
@@ -1309,6 +1859,8 @@ ID bdb_idl_next( ID *ids, ID *cursor )
  */
 int bdb_idl_append_one( ID *ids, ID id )
 {
+	if (BDB_IDL_IS_BITMAP( ids ))
+		ids[0] = NOID;
 	if (BDB_IDL_IS_RANGE( ids )) {
 		/* if already in range, treat as a dup */
 		if (id >= BDB_IDL_FIRST(ids) && id <= BDB_IDL_LAST(ids))
@@ -1362,6 +1914,7 @@ int bdb_idl_append( ID *a, ID *b )
 	ida = BDB_IDL_LAST( a );
 	idb = BDB_IDL_LAST( b );
 	if ( BDB_IDL_IS_RANGE( a ) || BDB_IDL_IS_RANGE(b) ||
+		BDB_IDL_IS_BITMAP( a ) || BDB_IDL_IS_BITMAP( b ) ||
 		a[0] + b[0] >= BDB_IDL_UM_MAX ) {
 		a[2] = IDL_MAX( ida, idb );
 		a[1] = IDL_MIN( a[1], b[1] );
@@ -1409,7 +1962,7 @@ bdb_idl_sort( ID *ids, ID *tmp )
 	int i,j,k,l,ir,jstack;
 	ID a, itmp;
 
-	if ( BDB_IDL_IS_RANGE( ids ))
+	if ( BDB_IDL_IS_RANGE( ids ) || BDB_IDL_IS_BITMAP( ids ))
 		return;
 
 	ir = ids[0];
@@ -1488,7 +2041,7 @@ bdb_idl_sort( ID *ids, ID *tmp )
 	ID *idls[2];
 	unsigned char *maxv = (unsigned char *)&ids[size];
 
- 	if ( BDB_IDL_IS_RANGE( ids ))
+ 	if ( BDB_IDL_IS_RANGE( ids ) || BDB_IDL_IS_BITMAP( ids ))
  		return;
 
 	/* Use insertion sort for small lists */
@@ -32,8 +32,26 @@
 #define BDB_IDL_IS_RANGE(ids)	((ids)[0] == NOID)
 #define BDB_IDL_RANGE_SIZE		(3)
 #define BDB_IDL_RANGE_SIZEOF	(BDB_IDL_RANGE_SIZE * sizeof(ID))
+
+/* Bitmap IDLs are only built in memory, when a union would otherwise
+ * overflow a list and collapse it into a range. Like a range, ids[1]
+ * and ids[2] are the first and last IDs, followed by the number of
+ * IDs set, the ID of bit 0 and the number of bitmap words. Anything
+ * that only looks at the bounds may treat a bitmap as a range.
+ */
+#define BDB_IDL_BITMAP			(NOID-1)
+#define BDB_IDL_IS_BITMAP(ids)	((ids)[0] == BDB_IDL_BITMAP)
+#define BDB_IDL_BM_HDR			(6)
+#define BDB_IDL_BM_BITS			(sizeof(ID)*8)
+#define BDB_IDL_BM_MAXWORDS		(BDB_IDL_UM_SIZE - BDB_IDL_BM_HDR)
+#define BDB_IDL_BM_COUNT(ids)	((ids)[3])
+#define BDB_IDL_BM_BASE(ids)	((ids)[4])
+#define BDB_IDL_BM_NWORDS(ids)	((ids)[5])
+#define BDB_IDL_BM_WORDS(ids)	((ids)+BDB_IDL_BM_HDR)
+
 #define BDB_IDL_SIZEOF(ids)		((BDB_IDL_IS_RANGE(ids) \
-	? BDB_IDL_RANGE_SIZE : ((ids)[0]+1)) * sizeof(ID))
+	? BDB_IDL_RANGE_SIZE : BDB_IDL_IS_BITMAP(ids) \
+	? BDB_IDL_BM_HDR + BDB_IDL_BM_NWORDS(ids) : ((ids)[0]+1)) * sizeof(ID))
 
 #define BDB_IDL_RANGE_FIRST(ids)	((ids)[1])
 #define BDB_IDL_RANGE_LAST(ids)		((ids)[2])
@@ -63,10 +81,11 @@
 
 #define BDB_IDL_FIRST( ids )	( ids[1] )
 #define BDB_IDL_LAST( ids )		( BDB_IDL_IS_RANGE(ids) \
-	? ids[2] : ids[ids[0]] )
+	|| BDB_IDL_IS_BITMAP(ids) ? ids[2] : ids[ids[0]] )
 
 #define BDB_IDL_N( ids )		( BDB_IDL_IS_RANGE(ids) \
-	? (ids[2]-ids[1])+1 : ids[0] )
+	? (ids[2]-ids[1])+1 : BDB_IDL_IS_BITMAP(ids) \
+	? BDB_IDL_BM_COUNT(ids) : ids[0] )
 
 LDAP_BEGIN_DECL
 LDAP_END_DECL
@@ -0,0 +1,147 @@
+/* idlbench.c - IDL intersection kernel micro-benchmark */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2010 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Times every intersection kernel idlkern.c was built with over pairs
+ * of synthetic IDLs of varying density, and checks that they all agree
+ * with the scalar kernel. Build with "make idlbench".
+ *
+ *	idlbench [-n loops] [-s seed]
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+
+#include <ac/stdlib.h>
+#include <ac/string.h>
+#include <ac/time.h>
+#include <ac/unistd.h>
+
+#include "back-bdb.h"
+#include "idl.h"
+
+/* Fill ids with about n IDs spread over [1, span] */
+static ID
+mkidl( ID *ids, ID n, ID span )
+{
+	ID i, id = 0, cnt = 0;
+
+	for ( i = 0; i < n && cnt < BDB_IDL_DB_MAX; i++ ) {
+		id += 1 + rand() % ( 2 * span / n );
+		if ( id > span )
+			break;
+		ids[cnt++] = id;
+	}
+	return cnt;
+}
+
+static double
+now( void )
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static struct {
+	ID na, nb, span;
+} shapes[] = {
+	{ 60000, 60000, 120000 },	/* dense, about half overlap */
+	{ 60000, 60000, 4000000 },	/* sparse, little overlap */
+	{ 60000, 20000, 200000 },	/* mixed density */
+	{ 60000, 1000, 200000 },	/* lopsided, gallops */
+	{ 60000, 10, 200000 },
+	{ 0, 0, 0 }
+};
+
+int
+main( int argc, char **argv )
+{
+	ID *a, *b, *out, *ref;
+	ID na, nb, nr, n = 0;
+	int i, l, loops = 200, seed = 1;
+	double t;
+	bdb_idl_kernel *k, *scalar = NULL;
+
+	while ( (i = getopt( argc, argv, "n:s:" )) != EOF ) {
+		switch ( i ) {
+		case 'n':
+			loops = atoi( optarg );
+			break;
+		case 's':
+			seed = atoi( optarg );
+			break;
+		default:
+			fprintf( stderr, "usage: %s [-n loops] [-s seed]\n", argv[0] );
+			return EXIT_FAILURE;
+		}
+	}
+
+	a = malloc( BDB_IDL_DB_SIZE * sizeof(ID) );
+	b = malloc( BDB_IDL_DB_SIZE * sizeof(ID) );
+	out = malloc( BDB_IDL_DB_SIZE * sizeof(ID) );
+	ref = malloc( BDB_IDL_DB_SIZE * sizeof(ID) );
+	if ( !a || !b || !out || !ref ) {
+		perror( "malloc" );
+		return EXIT_FAILURE;
+	}
+	srand( seed );
+
+	bdb_idl_kern_init();
+	printf( "selected kernel: %s\n", bdb_idl_kern->ik_name );
+	for ( k = bdb_idl_kernels; k->ik_name; k++ ) {
+		if ( !strcmp( k->ik_name, "scalar" ))
+			scalar = k;
+	}
+
+	for ( i = 0; shapes[i].na; i++ ) {
+		na = mkidl( a, shapes[i].na, shapes[i].span );
+		nb = mkidl( b, shapes[i].nb, shapes[i].span );
+		nr = scalar->ik_isect( ref, a, na, b, nb );
+		printf( "a=%lu b=%lu span=%lu result=%lu\n", (unsigned long) na,
+			(unsigned long) nb, (unsigned long) shapes[i].span,
+			(unsigned long) nr );
+
+		for ( k = bdb_idl_kernels; k->ik_name; k++ ) {
+			if ( !bdb_idl_kern_ok( k ))
+				continue;
+			t = now();
+			for ( l = 0; l < loops; l++ ) {
+				n = k->ik_isect( out, a, na, b, nb );
+			}
+			t = now() - t;
+			if ( n != nr || memcmp( out, ref, n * sizeof(ID) )) {
+				fprintf( stderr, "%s gave a different result\n", k->ik_name );
+				return EXIT_FAILURE;
+			}
+			printf( "  %-8s %10.1f us\n", k->ik_name, t * 1000000 / loops );
+		}
+
+		t = now();
+		for ( l = 0; l < loops; l++ ) {
+			n = bdb_idl_isect_lists( out, a, na, b, nb );
+		}
+		t = now() - t;
+		if ( n != nr || memcmp( out, ref, n * sizeof(ID) )) {
+			fprintf( stderr, "dispatch gave a different result\n" );
+			return EXIT_FAILURE;
+		}
+		printf( "  %-8s %10.1f us\n", "dispatch", t * 1000000 / loops );
+	}
+
+	return EXIT_SUCCESS;
+}
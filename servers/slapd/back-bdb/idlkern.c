@@ -0,0 +1,254 @@
+/* idlkern.c - sorted ID list kernels */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2010 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* The inner loops of list intersection live here, apart from the rest
+ * of idl.c, so that they can be built for several instruction sets and
+ * so that idlbench can link them without the rest of slapd.
+ *
+ * Every kernel intersects the sorted arrays a[0..na-1] and b[0..nb-1]
+ * into out[] and returns the number of IDs written. out may point into
+ * a, as long as it does not start after a; a result is never written
+ * past the element of a it was read from.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "back-bdb.h"
+#include "idl.h"
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) \
+	|| defined(__clang__)) && defined(__x86_64__) && SIZEOF_LONG == 8
+#define IDL_SIMD_X86	1
+#include <immintrin.h>
+#endif
+
+/* Use galloping search instead of a merge when one list is
+ * this many times longer than the other
+ */
+#define IDL_GALLOP_RATIO	32
+
+/* Return the first position >= pos in ids[0..n-1] holding an ID >= id,
+ * or n if there is none. Probes 1, 2, 4... elements ahead before
+ * falling back to a binary search, so short skips stay cheap.
+ */
+static ID
+idl_gallop( ID *ids, ID n, ID pos, ID id )
+{
+	ID lo = pos, hi, step = 1;
+
+	if ( pos >= n || ids[pos] >= id )
+		return pos;
+
+	/* ids[lo] < id */
+	for (;;) {
+		hi = lo + step;
+		if ( hi >= n ) {
+			hi = n;
+			break;
+		}
+		if ( ids[hi] >= id )
+			break;
+		lo = hi;
+		step <<= 1;
+	}
+
+	/* ids[lo] < id <= ids[hi] */
+	while ( hi - lo > 1 ) {
+		ID mid = lo + (( hi - lo ) >> 1 );
+		if ( ids[mid] < id )
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return hi;
+}
+
+/* Find the first position >= pos in an IDL whose ID is >= id,
+ * or ids[0]+1 if none.
+ */
+ID
+bdb_idl_gallop( ID *ids, ID pos, ID id )
+{
+	return idl_gallop( ids + 1, ids[0], pos - 1, id ) + 1;
+}
+
+static ID
+idl_isect_tail( ID *out, ID n, ID *a, ID na, ID i, ID *b, ID nb, ID j )
+{
+	while ( i < na && j < nb ) {
+		if ( a[i] == b[j] ) {
+			out[n++] = a[i];
+			i++;
+			j++;
+		} else if ( a[i] < b[j] ) {
+			i++;
+		} else {
+			j++;
+		}
+	}
+	return n;
+}
+
+static ID
+idl_isect_scalar( ID *out, ID *a, ID na, ID *b, ID nb )
+{
+	return idl_isect_tail( out, 0, a, na, 0, b, nb, 0 );
+}
+
+/* Look up each ID of the short list s in the long list l */
+static ID
+idl_isect_gallop( ID *out, ID *s, ID ns, ID *l, ID nl )
+{
+	ID i, j = 0, n = 0;
+
+	for ( i = 0; i < ns; i++ ) {
+		j = idl_gallop( l, nl, j, s[i] );
+		if ( j >= nl )
+			break;
+		if ( l[j] == s[i] )
+			out[n++] = l[j++];
+	}
+	return n;
+}
+
+#ifdef IDL_SIMD_X86
+
+/* Compare a block of 2 IDs of a against a block of 2 IDs of b, in
+ * both rotations, then advance whichever block ends lower.
+ */
+static ID __attribute__((target("sse4.2")))
+idl_isect_sse42( ID *out, ID *a, ID na, ID *b, ID nb )
+{
+	ID i = 0, j = 0, n = 0;
+
+	while ( i + 2 <= na && j + 2 <= nb ) {
+		__m128i va = _mm_loadu_si128( (__m128i *)( a + i ));
+		__m128i vb = _mm_loadu_si128( (__m128i *)( b + j ));
+		__m128i m;
+		ID a0 = a[i], a1 = a[i+1], lb = b[j+1];
+		int mask;
+
+		m = _mm_or_si128( _mm_cmpeq_epi64( va, vb ),
+			_mm_cmpeq_epi64( va, _mm_shuffle_epi32( vb, _MM_SHUFFLE( 1, 0, 3, 2 ))));
+		mask = _mm_movemask_pd( _mm_castsi128_pd( m ));
+
+		if ( mask & 1 )
+			out[n++] = a0;
+		if ( mask & 2 )
+			out[n++] = a1;
+		if ( a1 <= lb )
+			i += 2;
+		if ( lb <= a1 )
+			j += 2;
+	}
+	return idl_isect_tail( out, n, a, na, i, b, nb, j );
+}
+
+/* Same, with blocks of 4 and three rotations of b */
+static ID __attribute__((target("avx2")))
+idl_isect_avx2( ID *out, ID *a, ID na, ID *b, ID nb )
+{
+	ID i = 0, j = 0, n = 0;
+
+	while ( i + 4 <= na && j + 4 <= nb ) {
+		__m256i va = _mm256_loadu_si256( (__m256i *)( a + i ));
+		__m256i vb = _mm256_loadu_si256( (__m256i *)( b + j ));
+		__m256i m;
+		ID blk[4], la = a[i+3], lb = b[j+3];
+		int mask;
+
+		m = _mm256_cmpeq_epi64( va, vb );
+		vb = _mm256_permute4x64_epi64( vb, _MM_SHUFFLE( 0, 3, 2, 1 ));
+		m = _mm256_or_si256( m, _mm256_cmpeq_epi64( va, vb ));
+		vb = _mm256_permute4x64_epi64( vb, _MM_SHUFFLE( 0, 3, 2, 1 ));
+		m = _mm256_or_si256( m, _mm256_cmpeq_epi64( va, vb ));
+		vb = _mm256_permute4x64_epi64( vb, _MM_SHUFFLE( 0, 3, 2, 1 ));
+		m = _mm256_or_si256( m, _mm256_cmpeq_epi64( va, vb ));
+		mask = _mm256_movemask_pd( _mm256_castsi256_pd( m ));
+
+		if ( mask ) {
+			_mm256_storeu_si256( (__m256i *)blk, va );
+			if ( mask & 1 )
+				out[n++] = blk[0];
+			if ( mask & 2 )
+				out[n++] = blk[1];
+			if ( mask & 4 )
+				out[n++] = blk[2];
+			if ( mask & 8 )
+				out[n++] = blk[3];
+		}
+		if ( la <= lb )
+			i += 4;
+		if ( lb <= la )
+			j += 4;
+	}
+	return idl_isect_tail( out, n, a, na, i, b, nb, j );
+}
+#endif /* IDL_SIMD_X86 */
+
+bdb_idl_kernel bdb_idl_kernels[] = {
+#ifdef IDL_SIMD_X86
+	{ "avx2", idl_isect_avx2 },
+	{ "sse4.2", idl_isect_sse42 },
+#endif
+	{ "scalar", idl_isect_scalar },
+	{ NULL, NULL }
+};
+
+/* scalar until bdb_idl_kern_init() has run */
+bdb_idl_kernel *bdb_idl_kern = &bdb_idl_kernels[
+	sizeof( bdb_idl_kernels ) / sizeof( bdb_idl_kernels[0] ) - 2 ];
+
+/* Can this CPU run kernel k? */
+int
+bdb_idl_kern_ok( bdb_idl_kernel *k )
+{
+#ifdef IDL_SIMD_X86
+	__builtin_cpu_init();
+	if ( !strcmp( k->ik_name, "avx2" ))
+		return __builtin_cpu_supports( "avx2" );
+	if ( !strcmp( k->ik_name, "sse4.2" ))
+		return __builtin_cpu_supports( "sse4.2" );
+#endif
+	return 1;
+}
+
+/* Pick the widest kernel this CPU can run */
+void
+bdb_idl_kern_init( void )
+{
+	bdb_idl_kernel *k;
+
+	for ( k = bdb_idl_kernels; !bdb_idl_kern_ok( k ); k++ )
+		;
+	bdb_idl_kern = k;
+}
+
+/* Intersect two sorted arrays, galloping through the longer one
+ * when their lengths are lopsided
+ */
+ID
+bdb_idl_isect_lists( ID *out, ID *a, ID na, ID *b, ID nb )
+{
+	if ( na * IDL_GALLOP_RATIO < nb )
+		return idl_isect_gallop( out, a, na, b, nb );
+	if ( nb * IDL_GALLOP_RATIO < na )
+		return idl_isect_gallop( out, b, nb, a, na );
+	return bdb_idl_kern->ik_isect( out, a, na, b, nb );
+}
@@ -280,6 +280,23 @@ done:
 	return rc;
 }
 
+/* Keep the planner's count of indexed values current */
+static void
+bdb_index_count( AttrInfo *ai, BerVarray vals, int ixop )
+{
+	long n;
+
+	for ( n = 0; vals[n].bv_val != NULL; n++ )
+		;
+	if ( ixop == SLAP_INDEX_ADD_OP ) {
+		ai->ai_nvals += n;
+	} else if ( ai->ai_nvals > n ) {
+		ai->ai_nvals -= n;
+	} else {
+		ai->ai_nvals = 0;
+	}
+}
+
 static int index_at_values(
 	Operation *op,
 	DB_TXN *txn,
@@ -338,6 +355,7 @@ static int index_at_values(
 					vals, id, ixop, mask );
 
 				if( rc ) return rc;
+				bdb_index_count( ai, vals, ixop );
 			}
 		}
 	}
@@ -361,6 +379,7 @@ static int index_at_values(
 					if( rc ) {
 						return rc;
 					}
+					bdb_index_count( ai, vals, ixop );
 				}
 			}
 		}
@@ -36,6 +36,7 @@ static const struct bdbi_database {
 } bdbi_databases[] = {
 	{ "id2entry" BDB_SUFFIX, BER_BVC("id2entry"), DB_BTREE, 0 },
 	{ "dn2id" BDB_SUFFIX, BER_BVC("dn2id"), DB_BTREE, 0 },
+	{ "ad2i" BDB_SUFFIX, BER_BVC("ad2i"), DB_BTREE, 0 },
 	{ NULL, BER_BVNULL, 0, 0 }
 };
 
@@ -50,7 +51,7 @@ static int
 bdb_db_init( BackendDB *be, ConfigReply *cr )
 {
 	struct bdb_info	*bdb;
-	int rc;
+	int rc, i;
 
 	Debug( LDAP_DEBUG_TRACE,
 		LDAP_XSTRING(bdb_db_init) ": Initializing " BDB_UCTYPE " database\n",
@@ -70,18 +71,27 @@ bdb_db_init( BackendDB *be, ConfigReply *cr )
 	bdb->bi_lock_detect = DB_LOCK_DEFAULT;
 	bdb->bi_search_stack_depth = DEFAULT_SEARCH_STACK_DEPTH;
 	bdb->bi_search_stack = NULL;
+	bdb->bi_plan_threshold = BDB_PLAN_THRESHOLD;
 
 	ldap_pvt_thread_mutex_init( &bdb->bi_database_mutex );
 	ldap_pvt_thread_mutex_init( &bdb->bi_lastid_mutex );
+	ldap_pvt_thread_mutex_init( &bdb->bi_ads_mutex );
+	ldap_pvt_thread_mutex_init( &bdb->bi_cz_mutex );
+	ldap_pvt_thread_mutex_init( &bdb->bi_id2entry_mutex );
+	ldap_pvt_thread_mutex_init( &bdb->bi_plan_mutex );
+	ldap_pvt_thread_mutex_init( &bdb->bi_warm_mutex );
+	ldap_pvt_thread_cond_init( &bdb->bi_warm_cond );
 #ifdef BDB_HIER
 	ldap_pvt_thread_mutex_init( &bdb->bi_modrdns_mutex );
 #endif
 	ldap_pvt_thread_mutex_init( &bdb->bi_cache.c_lru_mutex );
 	ldap_pvt_thread_mutex_init( &bdb->bi_cache.c_count_mutex );
+	ldap_pvt_thread_cond_init( &bdb->bi_cache.c_purge_cond );
 	ldap_pvt_thread_mutex_init( &bdb->bi_cache.c_eifree_mutex );
 	ldap_pvt_thread_mutex_init( &bdb->bi_cache.c_dntree.bei_kids_mutex );
-	ldap_pvt_thread_rdwr_init ( &bdb->bi_cache.c_rwlock );
-	ldap_pvt_thread_rdwr_init( &bdb->bi_idl_tree_rwlock );
+	for ( i = 0; i < BDB_CACHE_SHARDS; i++ )
+		ldap_pvt_thread_rdwr_init( &bdb->bi_cache.c_shards[i].cs_rwlock );
+	bdb_idl_cache_init( bdb );
 	ldap_pvt_thread_mutex_init( &bdb->bi_idl_tree_lrulock );
 
 	be->be_private = bdb;
@@ -377,7 +387,6 @@ shm_retry:
 	}
 
 	if ( bdb->bi_idl_cache_max_size ) {
-		bdb->bi_idl_tree = NULL;
 		bdb->bi_idl_cache_size = 0;
 	}
 
@@ -452,6 +461,15 @@ shm_retry:
 			} else {
 				flags |= DB_CREATE;
 			}
+		} else if( i == BDB_AD2I ) {
+			if ( rc )
+				rc = db->bdi_db->set_pagesize( db->bdi_db, rc );
+
+			if ( slapMode & (SLAP_TOOL_READONLY|SLAP_TOOL_READMAIN) ) {
+				flags |= DB_RDONLY;
+			} else {
+				flags |= DB_CREATE;
+			}
 		} else {
 			/* Use FS default size if not configured */
 			if ( rc )
@@ -494,6 +512,13 @@ shm_retry:
 			bdb->bi_dbenv_mode );
 #endif
 
+		if ( rc == ENOENT && i == BDB_AD2I && ( flags & DB_RDONLY )) {
+			/* Database predates the attribute dictionary */
+			db->bdi_db->close( db->bdi_db, 0 );
+			db->bdi_db = NULL;
+			rc = 0;
+		}
+
 		if ( rc != 0 ) {
 			snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
 				"db_open(%s/%s) failed: %s (%d).", 
@@ -515,6 +540,19 @@ shm_retry:
 	bdb->bi_databases[i] = NULL;
 	bdb->bi_ndatabases = i;
 
+	/* load the attribute dictionary */
+	rc = bdb_ad_read( be );
+	if( rc != 0 ) {
+		snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
+			"ad_read(%s) failed: %s (%d).",
+			be->be_suffix[0].bv_val, bdb->bi_dbenv_home,
+			db_strerror(rc), rc );
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(bdb_db_open) ": %s\n",
+			cr->msg, 0, 0 );
+		goto fail;
+	}
+
 	/* get nextid */
 	rc = bdb_last_id( be, NULL );
 	if( rc != 0 ) {
@@ -528,6 +566,18 @@ shm_retry:
 		goto fail;
 	}
 
+	rc = bdb_compress_open( be );
+	if( rc != 0 ) {
+		snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
+			"compress_open(%s) failed: %s (%d).",
+			be->be_suffix[0].bv_val, bdb->bi_dbenv_home,
+			db_strerror(rc), rc );
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(bdb_db_open) ": %s\n",
+			cr->msg, 0, 0 );
+		goto fail;
+	}
+
 	if ( !quick ) {
 		TXN_BEGIN(bdb->bi_dbenv, NULL, &bdb->bi_cache.c_txn, DB_READ_COMMITTED | DB_TXN_NOWAIT);
 	}
@@ -570,6 +620,10 @@ shm_retry:
 
 	bdb->bi_flags |= BDB_IS_OPEN;
 
+	/* Reload the cache before we start serving requests */
+	if ( bdb->bi_warm && ( slapMode & SLAP_SERVER_MODE ))
+		bdb_warm_start( be, 1 );
+
 	return 0;
 
 fail:
@@ -583,7 +637,9 @@ bdb_db_close( BackendDB *be, ConfigReply *cr )
 	int rc;
 	struct bdb_info *bdb = (struct bdb_info *) be->be_private;
 	struct bdb_db_info *db;
-	bdb_idl_cache_entry_t *entry, *next_entry;
+	int wasopen = bdb->bi_flags & BDB_IS_OPEN;
+
+	bdb_warm_stop( bdb );
 
 	/* monitor handling */
 	(void)bdb_monitor_db_close( be );
@@ -615,7 +671,8 @@ bdb_db_close( BackendDB *be, ConfigReply *cr )
 
 	while( bdb->bi_databases && bdb->bi_ndatabases-- ) {
 		db = bdb->bi_databases[bdb->bi_ndatabases];
-		rc = db->bdi_db->close( db->bdi_db, 0 );
+		if ( db->bdi_db )
+			rc = db->bdi_db->close( db->bdi_db, 0 );
 		/* Lower numbered names are not strdup'd */
 		if( bdb->bi_ndatabases >= BDB_NDB )
 			free( db->bdi_name.bv_val );
@@ -624,22 +681,19 @@ bdb_db_close( BackendDB *be, ConfigReply *cr )
 	free( bdb->bi_databases );
 	bdb->bi_databases = NULL;
 
+	avl_free( bdb->bi_adtree, NULL );
+	bdb->bi_adtree = NULL;
+	ch_free( bdb->bi_ads );
+	bdb->bi_ads = NULL;
+	bdb->bi_nads = 0;
+	bdb_compress_close( bdb );
+
+	bdb_cache_purge_stop( bdb );
+	if ( wasopen && bdb->bi_warm && ( slapMode & SLAP_SERVER_MODE ))
+		bdb_warm_save( bdb );
 	bdb_cache_release_all (&bdb->bi_cache);
 
-	if ( bdb->bi_idl_cache_size ) {
-		avl_free( bdb->bi_idl_tree, NULL );
-		bdb->bi_idl_tree = NULL;
-		entry = bdb->bi_idl_lru_head;
-		do {
-			next_entry = entry->idl_lru_next;
-			if ( entry->idl )
-				free( entry->idl );
-			free( entry->kstr.bv_val );
-			free( entry );
-			entry = next_entry;
-		} while ( entry != bdb->bi_idl_lru_head );
-		bdb->bi_idl_lru_head = bdb->bi_idl_lru_tail = NULL;
-	}
+	bdb_idl_cache_empty( bdb );
 
 	/* close db environment */
 	if( bdb->bi_dbenv ) {
@@ -682,6 +736,7 @@ static int
 bdb_db_destroy( BackendDB *be, ConfigReply *cr )
 {
 	struct bdb_info *bdb = (struct bdb_info *) be->be_private;
+	int i;
 
 	/* stop and remove checkpoint task */
 	if ( bdb->bi_txn_cp_task ) {
@@ -702,17 +757,25 @@ bdb_db_destroy( BackendDB *be, ConfigReply *cr )
 
 	bdb_attr_index_destroy( bdb );
 
-	ldap_pvt_thread_rdwr_destroy ( &bdb->bi_cache.c_rwlock );
+	for ( i = 0; i < BDB_CACHE_SHARDS; i++ )
+		ldap_pvt_thread_rdwr_destroy( &bdb->bi_cache.c_shards[i].cs_rwlock );
 	ldap_pvt_thread_mutex_destroy( &bdb->bi_cache.c_lru_mutex );
 	ldap_pvt_thread_mutex_destroy( &bdb->bi_cache.c_count_mutex );
+	ldap_pvt_thread_cond_destroy( &bdb->bi_cache.c_purge_cond );
 	ldap_pvt_thread_mutex_destroy( &bdb->bi_cache.c_eifree_mutex );
 	ldap_pvt_thread_mutex_destroy( &bdb->bi_cache.c_dntree.bei_kids_mutex );
 #ifdef BDB_HIER
 	ldap_pvt_thread_mutex_destroy( &bdb->bi_modrdns_mutex );
 #endif
+	ldap_pvt_thread_cond_destroy( &bdb->bi_warm_cond );
+	ldap_pvt_thread_mutex_destroy( &bdb->bi_warm_mutex );
+	ldap_pvt_thread_mutex_destroy( &bdb->bi_plan_mutex );
+	ldap_pvt_thread_mutex_destroy( &bdb->bi_id2entry_mutex );
+	ldap_pvt_thread_mutex_destroy( &bdb->bi_cz_mutex );
+	ldap_pvt_thread_mutex_destroy( &bdb->bi_ads_mutex );
 	ldap_pvt_thread_mutex_destroy( &bdb->bi_lastid_mutex );
 	ldap_pvt_thread_mutex_destroy( &bdb->bi_database_mutex );
-	ldap_pvt_thread_rdwr_destroy( &bdb->bi_idl_tree_rwlock );
+	bdb_idl_cache_destroy( bdb );
 	ldap_pvt_thread_mutex_destroy( &bdb->bi_idl_tree_lrulock );
 
 	ch_free( bdb );
@@ -796,6 +859,10 @@ bdb_back_initialize(
 	db_env_set_func_yield( ldap_pvt_thread_yield );
 #endif
 
+	bdb_idl_kern_init();
+	Debug( LDAP_DEBUG_TRACE, LDAP_XSTRING(bdb_back_initialize)
+		": %s IDL intersection\n", bdb_idl_kern->ik_name, 0, 0 );
+
 	bi->bi_open = 0;
 	bi->bi_close = 0;
 	bi->bi_config = 0;
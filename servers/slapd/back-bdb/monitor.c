@@ -33,6 +33,10 @@ static ObjectClass		*oc_olmBDBDatabase;
 
 static AttributeDescription	*ad_olmBDBEntryCache,
 	*ad_olmBDBDNCache, *ad_olmBDBIDLCache,
+	*ad_olmBDBPlans, *ad_olmBDBPlanSkips, *ad_olmBDBLastPlan,
+	*ad_olmBDBCompressRatio, *ad_olmBDBDecompressTime,
+	*ad_olmBDBIDLCacheBytes, *ad_olmBDBIDLCacheIndex,
+	*ad_olmBDBEntryCacheBytes, *ad_olmBDBPurgeLatency, *ad_olmBDBCacheWarm,
 	*ad_olmDbDirectory;
 
 #ifdef BDB_MONITOR_IDX
@@ -114,9 +118,93 @@ static struct {
 		&ad_olmBDBNotIndexed },
 #endif /* BDB_MONITOR_IDX */
 
+	{ "( olmBDBAttributes:6 "
+		"NAME ( 'olmBDBPlans' ) "
+		"DESC 'Number of AND filters ordered by the search planner' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmBDBPlans },
+
+	{ "( olmBDBAttributes:7 "
+		"NAME ( 'olmBDBPlanSkips' ) "
+		"DESC 'Number of index lookups skipped by the search planner' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmBDBPlanSkips },
+
+	{ "( olmBDBAttributes:8 "
+		"NAME ( 'olmBDBLastPlan' ) "
+		"DESC 'Recently sampled search plan with estimated candidate counts' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmBDBLastPlan },
+
+	{ "( olmBDBAttributes:9 "
+		"NAME ( 'olmBDBCompressRatio' ) "
+		"DESC 'Percentage of id2entry bytes saved by compression' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmBDBCompressRatio },
+
+	{ "( olmBDBAttributes:10 "
+		"NAME ( 'olmBDBDecompressTime' ) "
+		"DESC 'Average time to decompress an entry, in microseconds' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmBDBDecompressTime },
+
+	{ "( olmBDBAttributes:11 "
+		"NAME ( 'olmBDBIDLCacheBytes' ) "
+		"DESC 'Memory used by IDL Cache, in bytes' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmBDBIDLCacheBytes },
+
+	{ "( olmBDBAttributes:12 "
+		"NAME ( 'olmBDBIDLCacheIndex' ) "
+		"DESC 'IDL Cache hits, misses and evictions per index' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmBDBIDLCacheIndex },
+
+	{ "( olmBDBAttributes:13 "
+		"NAME ( 'olmBDBEntryCacheBytes' ) "
+		"DESC 'Memory used by Entry Cache, in bytes' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmBDBEntryCacheBytes },
+
+	{ "( olmBDBAttributes:14 "
+		"NAME ( 'olmBDBPurgeLatency' ) "
+		"DESC 'Entry Cache purge count and latency distribution' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmBDBPurgeLatency },
+
+	{ "( olmBDBAttributes:15 "
+		"NAME ( 'olmBDBCacheWarm' ) "
+		"DESC 'Progress of reloading the Entry Cache from its snapshot' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmBDBCacheWarm },
+
 	{ NULL }
 };
 
+static const char *bdb_warm_states[] = {
+	"idle", "loading", "done", "stopped"
+};
+
 static struct {
 	char		*desc;
 	ObjectClass	**oc;
@@ -128,9 +216,19 @@ static struct {
 		"SUP top AUXILIARY "
 		"MAY ( "
 			"olmBDBEntryCache "
+			"$ olmBDBEntryCacheBytes "
+			"$ olmBDBPurgeLatency "
+			"$ olmBDBCacheWarm "
 			"$ olmBDBDNCache "
 			"$ olmBDBIDLCache "
+			"$ olmBDBIDLCacheBytes "
+			"$ olmBDBIDLCacheIndex "
 			"$ olmDbDirectory "
+			"$ olmBDBPlans "
+			"$ olmBDBPlanSkips "
+			"$ olmBDBLastPlan "
+			"$ olmBDBCompressRatio "
+			"$ olmBDBDecompressTime "
 #ifdef BDB_MONITOR_IDX
 			"$ olmBDBNotIndexed "
 #endif /* BDB_MONITOR_IDX */
@@ -140,6 +238,71 @@ static struct {
 	{ NULL }
 };
 
+static void
+bdb_monitor_idl_update(
+	struct bdb_info	*bdb,
+	Entry		*e )
+{
+	bdb_idl_cache_stat	*st;
+	BerVarray		vals = NULL;
+	Attribute		*a;
+	char			buf[ BUFSIZ ];
+	struct berval		bv;
+	unsigned long		bytes;
+	ID			count;
+	int			i, j, n;
+
+	bdb_idl_cache_stats( bdb, &count, &bytes, &st, &n );
+
+	bv.bv_val = buf;
+	a = attr_find( e->e_attrs, ad_olmBDBIDLCache );
+	assert( a != NULL );
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", (unsigned long) count );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	a = attr_find( e->e_attrs, ad_olmBDBIDLCacheBytes );
+	assert( a != NULL );
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", bytes );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_database_mutex );
+	for ( i = 0; i < n; i++ ) {
+		char *name = "other";
+
+		for ( j = 0; st[ i ].is_db && j < bdb->bi_ndatabases; j++ ) {
+			if ( bdb->bi_databases[ j ]->bdi_db == st[ i ].is_db ) {
+				name = bdb->bi_databases[ j ]->bdi_name.bv_val;
+				break;
+			}
+		}
+		bv.bv_len = snprintf( buf, sizeof( buf ),
+			"%s hits=%lu misses=%lu evictions=%lu", name,
+			st[ i ].is_hits, st[ i ].is_misses, st[ i ].is_evicts );
+		value_add_one( &vals, &bv );
+	}
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_database_mutex );
+	ch_free( st );
+
+	a = attr_find( e->e_attrs, ad_olmBDBIDLCacheIndex );
+	if ( vals != NULL ) {
+		if ( a != NULL ) {
+			assert( a->a_nvals == a->a_vals );
+
+			ber_bvarray_free( a->a_vals );
+
+		} else {
+			Attribute	**ap;
+
+			for ( ap = &e->e_attrs; *ap != NULL; ap = &(*ap)->a_next )
+				;
+			*ap = attr_alloc( ad_olmBDBIDLCacheIndex );
+			a = *ap;
+		}
+		a->a_vals = vals;
+		a->a_nvals = a->a_vals;
+	}
+}
+
 static int
 bdb_monitor_update(
 	Operation	*op,
@@ -161,15 +324,72 @@ bdb_monitor_update(
 	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", bdb->bi_cache.c_cursize );
 	ber_bvreplace( &a->a_vals[ 0 ], &bv );
 
+	a = attr_find( e->e_attrs, ad_olmBDBEntryCacheBytes );
+	assert( a != NULL );
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", bdb->bi_cache.c_curbytes );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	a = attr_find( e->e_attrs, ad_olmBDBPurgeLatency );
+	assert( a != NULL );
+	ldap_pvt_thread_mutex_lock( &bdb->bi_cache.c_count_mutex );
+	bv.bv_len = snprintf( buf, sizeof( buf ),
+		"count=%lu max=%luus 100us=%lu 1ms=%lu 10ms=%lu 100ms=%lu slower=%lu",
+		bdb->bi_cache.c_purge_runs, bdb->bi_cache.c_purge_max,
+		bdb->bi_cache.c_purge_hist[0], bdb->bi_cache.c_purge_hist[1],
+		bdb->bi_cache.c_purge_hist[2], bdb->bi_cache.c_purge_hist[3],
+		bdb->bi_cache.c_purge_hist[4] );
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_cache.c_count_mutex );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	a = attr_find( e->e_attrs, ad_olmBDBCacheWarm );
+	assert( a != NULL );
+	ldap_pvt_thread_mutex_lock( &bdb->bi_warm_mutex );
+	bv.bv_len = snprintf( buf, sizeof( buf ),
+		"state=%s loaded=%lu missing=%lu total=%lu",
+		bdb_warm_states[ bdb->bi_warm_state ], bdb->bi_warm_done,
+		bdb->bi_warm_missing, bdb->bi_warm_total );
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_warm_mutex );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
 	a = attr_find( e->e_attrs, ad_olmBDBDNCache );
 	assert( a != NULL );
 	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", bdb->bi_cache.c_eiused );
 	ber_bvreplace( &a->a_vals[ 0 ], &bv );
 
-	a = attr_find( e->e_attrs, ad_olmBDBIDLCache );
+	bdb_monitor_idl_update( bdb, e );
+
+	a = attr_find( e->e_attrs, ad_olmBDBPlans );
+	assert( a != NULL );
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", bdb->bi_plan_count );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	a = attr_find( e->e_attrs, ad_olmBDBPlanSkips );
+	assert( a != NULL );
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", bdb->bi_plan_skipped );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_plan_mutex );
+	if ( bdb->bi_plan_last[ 0 ] ) {
+		a = attr_find( e->e_attrs, ad_olmBDBLastPlan );
+		assert( a != NULL );
+		bv.bv_len = snprintf( buf, sizeof( buf ), "%s", bdb->bi_plan_last );
+		ber_bvreplace( &a->a_vals[ 0 ], &bv );
+	}
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_plan_mutex );
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_cz_mutex );
+	a = attr_find( e->e_attrs, ad_olmBDBCompressRatio );
 	assert( a != NULL );
-	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", bdb->bi_idl_cache_size );
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", bdb->bi_cz_in ?
+		100 - bdb->bi_cz_out * 100 / bdb->bi_cz_in : 0 );
 	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	a = attr_find( e->e_attrs, ad_olmBDBDecompressTime );
+	assert( a != NULL );
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", bdb->bi_cz_decodes ?
+		bdb->bi_cz_dtime / bdb->bi_cz_decodes : 0 );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_cz_mutex );
 	
 #ifdef BDB_MONITOR_IDX
 	bdb_monitor_idx_entry_add( bdb, e );
@@ -360,7 +580,7 @@ bdb_monitor_db_open( BackendDB *be )
 	}
 
 	/* alloc as many as required (plus 1 for objectClass) */
-	a = attrs_alloc( 1 + 4 );
+	a = attrs_alloc( 1 + 13 );
 	if ( a == NULL ) {
 		rc = 1;
 		goto cleanup;
@@ -377,6 +597,18 @@ bdb_monitor_db_open( BackendDB *be )
 		attr_valadd( next, &bv, NULL, 1 );
 		next = next->a_next;
 
+		next->a_desc = ad_olmBDBEntryCacheBytes;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmBDBPurgeLatency;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmBDBCacheWarm;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
 		next->a_desc = ad_olmBDBDNCache;
 		attr_valadd( next, &bv, NULL, 1 );
 		next = next->a_next;
@@ -384,6 +616,34 @@ bdb_monitor_db_open( BackendDB *be )
 		next->a_desc = ad_olmBDBIDLCache;
 		attr_valadd( next, &bv, NULL, 1 );
 		next = next->a_next;
+
+		next->a_desc = ad_olmBDBIDLCacheBytes;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmBDBPlans;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmBDBPlanSkips;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmBDBCompressRatio;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmBDBDecompressTime;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+	}
+
+	{
+		struct berval	bv = BER_BVC( "none" );
+
+		next->a_desc = ad_olmBDBLastPlan;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
 	}
 
 	{
@@ -66,6 +66,31 @@ void bdb_attr_info_free( AttrInfo *ai );
 
 int bdb_back_init_cf( BackendInfo *bi );
 
+/*
+ * compress.c
+ */
+#define bdb_compress				BDB_SYMBOL(compress)
+#define bdb_decompress				BDB_SYMBOL(decompress)
+#define bdb_compress_open			BDB_SYMBOL(compress_open)
+#define bdb_compress_close			BDB_SYMBOL(compress_close)
+
+int bdb_compress( struct bdb_info *bdb, struct berval *bv );
+int bdb_decompress( struct bdb_info *bdb, struct berval *zbv,
+	EntryHeader *eh );
+int bdb_compress_open( BackendDB *be );
+void bdb_compress_close( struct bdb_info *bdb );
+
+/*
+ * warm.c
+ */
+#define bdb_warm_save				BDB_SYMBOL(warm_save)
+#define bdb_warm_start				BDB_SYMBOL(warm_start)
+#define bdb_warm_stop				BDB_SYMBOL(warm_stop)
+
+int bdb_warm_save( struct bdb_info *bdb );
+int bdb_warm_start( BackendDB *be, int wait );
+void bdb_warm_stop( struct bdb_info *bdb );
+
 /*
  * dbcache.c
  */
@@ -193,6 +218,10 @@ int bdb_filter_candidates(
 #define bdb_id2entry_add			BDB_SYMBOL(id2entry_add)
 #define bdb_id2entry_update			BDB_SYMBOL(id2entry_update)
 #define bdb_id2entry_delete			BDB_SYMBOL(id2entry_delete)
+#define bdb_id2entry_prefetch		BDB_SYMBOL(id2entry_prefetch)
+#define bdb_id2entry_prefetched		BDB_SYMBOL(id2entry_prefetched)
+#define bdb_ad_read					BDB_SYMBOL(ad_read)
+#define bdb_ad_index				BDB_SYMBOL(ad_index)
 
 int bdb_id2entry_add(
 	BackendDB *be,
@@ -209,6 +238,20 @@ int bdb_id2entry_delete(
 	DB_TXN *tid,
 	Entry *e);
 
+int bdb_id2entry_prefetch(
+	Operation *op,
+	DB_TXN *tid,
+	ID *ids,
+	int nids );
+
+int bdb_id2entry_prefetched(
+	Operation *op,
+	ID id,
+	Entry **e );
+
+int bdb_ad_read( BackendDB *be );
+EntryAdIndex bdb_ad_index;
+
 #ifdef SLAP_ZONE_ALLOC
 #else
 int bdb_id2entry(
@@ -242,6 +285,10 @@ BI_entry_get_rw bdb_entry_get;
 #define bdb_idl_cache_del			BDB_SYMBOL(idl_cache_del)
 #define bdb_idl_cache_add_id		BDB_SYMBOL(idl_cache_add_id)
 #define bdb_idl_cache_del_id		BDB_SYMBOL(idl_cache_del_id)
+#define bdb_idl_cache_init			BDB_SYMBOL(idl_cache_init)
+#define bdb_idl_cache_empty			BDB_SYMBOL(idl_cache_empty)
+#define bdb_idl_cache_destroy		BDB_SYMBOL(idl_cache_destroy)
+#define bdb_idl_cache_stats			BDB_SYMBOL(idl_cache_stats)
 
 int bdb_idl_cache_get(
 	struct bdb_info *bdb,
@@ -277,12 +324,26 @@ bdb_idl_cache_del_id(
 	DBT		*key,
 	ID		id );
 
+void bdb_idl_cache_init( struct bdb_info *bdb );
+void bdb_idl_cache_empty( struct bdb_info *bdb );
+void bdb_idl_cache_destroy( struct bdb_info *bdb );
+
+void
+bdb_idl_cache_stats(
+	struct bdb_info	*bdb,
+	ID		*count,
+	unsigned long	*bytes,
+	bdb_idl_cache_stat	**stats,
+	int		*nstats );
+
 #define bdb_idl_first				BDB_SYMBOL(idl_first)
 #define bdb_idl_next				BDB_SYMBOL(idl_next)
 #define bdb_idl_search				BDB_SYMBOL(idl_search)
 #define bdb_idl_insert				BDB_SYMBOL(idl_insert)
+#define bdb_idl_delete				BDB_SYMBOL(idl_delete)
 #define bdb_idl_intersection		BDB_SYMBOL(idl_intersection)
 #define bdb_idl_union				BDB_SYMBOL(idl_union)
+#define bdb_idl_notin				BDB_SYMBOL(idl_notin)
 #define bdb_idl_sort				BDB_SYMBOL(idl_sort)
 #define bdb_idl_append				BDB_SYMBOL(idl_append)
 #define bdb_idl_append_one			BDB_SYMBOL(idl_append_one)
@@ -303,6 +364,7 @@ int bdb_idl_fetch_key(
 	int                     get_flag );
 
 int bdb_idl_insert( ID *ids, ID id );
+int bdb_idl_delete( ID *ids, ID id );
 
 int bdb_idl_insert_key(
 	BackendDB *be,
@@ -328,6 +390,12 @@ bdb_idl_union(
 	ID *a,
 	ID *b );
 
+int
+bdb_idl_notin(
+	ID *a,
+	ID *b,
+	ID *ids );
+
 ID bdb_idl_first( ID *ids, ID *cursor );
 ID bdb_idl_next( ID *ids, ID *cursor );
 
@@ -336,6 +404,25 @@ int bdb_idl_append( ID *a, ID *b );
 int bdb_idl_append_one( ID *ids, ID id );
 
 
+/*
+ * idlkern.c
+ */
+
+#define bdb_idl_gallop				BDB_SYMBOL(idl_gallop)
+#define bdb_idl_isect_lists			BDB_SYMBOL(idl_isect_lists)
+#define bdb_idl_kern_init			BDB_SYMBOL(idl_kern_init)
+#define bdb_idl_kern_ok				BDB_SYMBOL(idl_kern_ok)
+#define bdb_idl_kernels				BDB_SYMBOL(idl_kernels)
+#define bdb_idl_kern				BDB_SYMBOL(idl_kern)
+
+ID bdb_idl_gallop( ID *ids, ID pos, ID id );
+ID bdb_idl_isect_lists( ID *out, ID *a, ID na, ID *b, ID nb );
+void bdb_idl_kern_init( void );
+int bdb_idl_kern_ok( bdb_idl_kernel *k );
+
+extern bdb_idl_kernel bdb_idl_kernels[];
+extern bdb_idl_kernel *bdb_idl_kern;
+
 /*
  * index.c
  */
@@ -503,9 +590,12 @@ void bdb_unlocked_cache_return_entry_rw( struct bdb_info *bdb, Entry *e, int rw
 #define bdb_cache_find_id			BDB_SYMBOL(cache_find_id)
 #define bdb_cache_find_ndn			BDB_SYMBOL(cache_find_ndn)
 #define bdb_cache_find_parent		BDB_SYMBOL(cache_find_parent)
+#define bdb_cache_has_entry			BDB_SYMBOL(cache_has_entry)
+#define bdb_cache_keep				BDB_SYMBOL(cache_keep)
 #define bdb_cache_modify			BDB_SYMBOL(cache_modify)
 #define bdb_cache_modrdn			BDB_SYMBOL(cache_modrdn)
 #define bdb_cache_release_all		BDB_SYMBOL(cache_release_all)
+#define bdb_cache_purge_stop		BDB_SYMBOL(cache_purge_stop)
 #define bdb_cache_delete_entry		BDB_SYMBOL(cache_delete_entry)
 
 int bdb_cache_children(
@@ -555,6 +645,14 @@ int bdb_cache_find_id(
 	int	flag,
 	DB_LOCK		*lock
 );
+int bdb_cache_has_entry(
+	struct bdb_info *bdb,
+	ID		id
+);
+void bdb_cache_keep(
+	struct bdb_info *bdb,
+	EntryInfo *ei
+);
 int
 bdb_cache_find_parent(
 	Operation *op,
@@ -574,6 +672,8 @@ void bdb_cache_delete_cleanup(
 );
 void bdb_cache_release_all( Cache *cache );
 
+void bdb_cache_purge_stop( struct bdb_info *bdb );
+
 #ifdef BDB_HIER
 int hdb_cache_load(
 	struct bdb_info *bdb,
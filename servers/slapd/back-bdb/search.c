@@ -37,12 +37,43 @@ static int search_candidates(
 
 static int parse_paged_cookie( Operation *op, SlapReply *rs );
 
+static ID search_prefetch(
+	Operation *op,
+	DB_TXN *txn,
+	ID *ids,
+	ID cursor,
+	ID id );
+
 static void send_paged_response( 
 	Operation *op,
 	SlapReply *rs,
 	ID  *lastid,
 	int tentries );
 
+typedef struct search_par search_par;
+
+/* What a helper thread found out about a candidate */
+#define SEARCH_PAR_UNKNOWN	0
+#define SEARCH_PAR_FALSE	1	/* does not match the filter */
+#define SEARCH_PAR_TRUE		2	/* matches the filter */
+
+static search_par *search_par_new(
+	Operation *op,
+	ID *ids );
+
+static int search_par_result(
+	search_par *sp,
+	ID *ids,
+	ID cursor,
+	ID id,
+	int idflag );
+
+static int search_par_current(
+	search_par *sp );
+
+static void search_par_free(
+	search_par *sp );
+
 /* Dereference aliases for a single alias entry. Return the final
  * dereferenced entry on success, NULL on any failure.
  */
@@ -329,6 +360,9 @@ bdb_search( Operation *op, SlapReply *rs )
 	int		tentries = 0;
 	unsigned	nentries = 0;
 	int		idflag = 0;
+	ID		prefetched = 0;
+	search_par	*par = NULL;
+	int		parres = SEARCH_PAR_UNKNOWN;
 
 	DB_LOCK		lock;
 	struct	bdb_op_info	*opinfo = NULL;
@@ -625,6 +659,9 @@ cand_retry:
 		tentries = BDB_IDL_N(candidates);
 	}
 
+	/* Let helper threads screen a large candidate set */
+	par = search_par_new( op, candidates );
+
 	if ( get_pagedresults( op ) > SLAP_CONTROL_IGNORED ) {
 		PagedResultsState *ps = op->o_pagedresults_state;
 		/* deferred cookie parsing */
@@ -692,6 +729,9 @@ loop_begin:
 			goto done;
 		}
 
+		/* don't sit on entries already found while we scan */
+		slap_write_batch_check( op );
+
 		/* If we inspect more entries than will
 		 * fit into the entry cache, stop caching
 		 * any subsequent entries
@@ -701,6 +741,21 @@ loop_begin:
 			idflag = ID_NOCACHE;
 		}
 
+		/* Read ahead the candidates that aren't cached yet */
+		if ( id > prefetched && BDB_IDL_N( candidates ) > 1 ) {
+			prefetched = search_prefetch( op, ltid, candidates,
+				cursor, id );
+		}
+
+		/* Skip candidates a helper found not to match */
+		if ( par ) {
+			parres = search_par_result( par, candidates, cursor,
+				id, idflag );
+			if ( parres == SEARCH_PAR_FALSE &&
+				search_par_current( par ))
+				goto loop_continue;
+		}
+
 fetch_entry_retry:
 		/* get the entry with reader lock */
 		ei = NULL;
@@ -911,8 +966,16 @@ fetch_entry_retry:
 			goto loop_continue;
 		}
 
-		/* if it matches the filter and scope, send it */
-		rs->sr_err = test_filter( op, rs->sr_entry, op->oq_search.rs_filter );
+		/* if it matches the filter and scope, send it. A helper's
+		 * verdict holds if the entry wasn't written since, which
+		 * our read lock on it now makes sure we'd see.
+		 */
+		if ( parres == SEARCH_PAR_TRUE && search_par_current( par )) {
+			rs->sr_err = LDAP_COMPARE_TRUE;
+		} else {
+			rs->sr_err = test_filter( op, rs->sr_entry,
+				op->oq_search.rs_filter );
+		}
 
 		if ( rs->sr_err == LDAP_COMPARE_TRUE ) {
 			/* check size limit */
@@ -1031,6 +1094,12 @@ nochange:
 	rs->sr_err = LDAP_SUCCESS;
 
 done:
+	if ( par ) {
+		search_par_free( par );
+	}
+	if ( prefetched ) {
+		bdb_id2entry_prefetch( op, NULL, NULL, 0 );
+	}
 	if( rs->sr_v2ref ) {
 		ber_bvarray_free( rs->sr_v2ref );
 		rs->sr_v2ref = NULL;
@@ -1119,6 +1188,347 @@ static void *search_stack( Operation *op )
 	return ret;
 }
 
+/* Collect the next candidates, starting at id, whose entries are not
+ * in the cache, and have their records read in bulk. Candidates that
+ * are too far apart to share a read are left to be read one by one.
+ * Returns the last candidate looked at.
+ */
+static ID search_prefetch(
+	Operation *op,
+	DB_TXN *txn,
+	ID *ids,
+	ID cursor,
+	ID id )
+{
+	struct bdb_info *bdb = (struct bdb_info *) op->o_bd->be_private;
+	ID pids[BDB_PREFETCH_IDS], last = id;
+	int i, n = 0;
+
+	for ( i = 0; id != NOID && n < BDB_PREFETCH_IDS &&
+		i < 4 * BDB_PREFETCH_IDS; i++ ) {
+		last = id;
+		if ( !bdb_cache_has_entry( bdb, id ))
+			pids[n++] = id;
+		id = bdb_idl_next( ids, &cursor );
+	}
+
+	if ( n > 1 && pids[n-1] - pids[0] < 4 * BDB_PREFETCH_IDS ) {
+		bdb_id2entry_prefetch( op, txn, pids, n );
+	}
+	return last;
+}
+
+/* Screening of large candidate sets by helper threads.
+ *
+ * The candidates are cut into batches of BDB_PAR_BATCH IDs, and each
+ * batch into chunks that are queued on the thread pool. A helper loads
+ * the entries of its chunk and runs the search filter on them, noting
+ * the result. Entries that match are kept in the entry cache even when
+ * the search has stopped caching, so the search finds them there.
+ * The search itself still walks every candidate in order and does the
+ * scope, ACL and referral work and the sending, so size and time limits,
+ * abandon and paged results cookies behave as before; it just passes
+ * over the candidates a helper already rejected and doesn't test the
+ * filter again on the ones it accepted. The next batch is screened
+ * while the current one is being returned.
+ *
+ * A verdict is only trusted while no entry has been written since the
+ * batch was queued. Writers bump bi_cache_seq while they hold the
+ * entry's write lock, so that is only peeked at without a lock: a
+ * rejected entry is passed over without being locked at all, so a
+ * write racing with the search may be missed, just as if the search
+ * had got to the entry a little earlier.
+ */
+typedef struct search_chunk {
+	search_par	*sc_par;
+	struct search_batch *sc_batch;
+	int		sc_first;
+	int		sc_n;
+	int		sc_queued;
+} search_chunk;
+
+typedef struct search_batch {
+	ID		sb_ids[BDB_PAR_BATCH];
+	char	sb_res[BDB_PAR_BATCH];	/* SEARCH_PAR_xxx */
+	int		sb_n;
+	int		sb_pos;
+	ID		sb_cursor;		/* cursor at the last ID */
+	unsigned long	sb_seq;
+	int		sb_pending;
+	int		sb_nchunks;
+	search_chunk	sb_chunks[BDB_PAR_MAXTHREADS];
+} search_batch;
+
+struct search_par {
+	Operation	*sp_op;
+	int		sp_threads;
+	int		sp_idflag;
+	int		sp_cur;
+	unsigned long	sp_seq;		/* of the batch being returned */
+	ldap_pvt_thread_mutex_t	sp_mutex;
+	ldap_pvt_thread_cond_t	sp_cond;
+	search_batch	sp_batch[2];
+};
+
+static unsigned long search_par_seq( struct bdb_info *bdb )
+{
+	unsigned long seq;
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_id2entry_mutex );
+	seq = bdb->bi_cache_seq;
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_id2entry_mutex );
+	return seq;
+}
+
+static void *search_par_task( void *ctx, void *arg )
+{
+	search_chunk *sc = arg;
+	search_par *sp = sc->sc_par;
+	search_batch *sb = sc->sc_batch;
+	Operation *op = sp->sp_op, op2;
+	Opheader oh;
+	struct bdb_info *bdb = (struct bdb_info *) op->o_bd->be_private;
+	int manageDSAit = get_manageDSAit( op );
+	DB_TXN *ltid = NULL;
+	DB_LOCK lock;
+	EntryInfo *ei;
+	Entry *e;
+	int i, rc;
+
+	/* Same identity and filter, but our own memory and reader txn */
+	op2 = *op;
+	oh = *op->o_hdr;
+	op2.o_hdr = &oh;
+	op2.o_threadctx = ctx;
+	op2.o_tid = ldap_pvt_thread_pool_tid( ctx );
+	op2.o_tmpmemctx = slap_sl_mem_create( SLAP_SLAB_SIZE, SLAP_SLAB_STACK,
+		ctx, 1 );
+	op2.o_tmpmfuncs = &slap_sl_mfuncs;
+	LDAP_SLIST_INIT( &op2.o_extra );
+
+	rc = bdb_reader_get( &op2, bdb->bi_dbenv, &ltid );
+
+	for ( i = sc->sc_first; !rc && i < sc->sc_first + sc->sc_n; i++ ) {
+		if ( op->o_abandon || slapd_shutdown )
+			break;
+
+		ei = NULL;
+		rc = bdb_cache_find_id( &op2, ltid, sb->sb_ids[i], &ei,
+			sp->sp_idflag, &lock );
+		if ( rc == DB_LOCK_DEADLOCK ) {
+			ltid->flags &= ~TXN_DEADLOCK;
+		}
+		if ( rc || !ei || !ei->bei_e ) {
+			/* leave it to the search */
+			rc = 0;
+			continue;
+		}
+		e = ei->bei_e;
+
+		/* Referrals are returned without looking at the filter */
+		if ( manageDSAit || op->ors_scope == LDAP_SCOPE_BASE ||
+			!is_entry_referral( e ))
+		{
+			if ( test_filter( &op2, e, op->oq_search.rs_filter )
+				== LDAP_COMPARE_TRUE )
+			{
+				sb->sb_res[i] = SEARCH_PAR_TRUE;
+				/* the search will want it in a moment */
+				if ( sp->sp_idflag & ID_NOCACHE )
+					bdb_cache_keep( bdb, ei );
+			} else {
+				sb->sb_res[i] = SEARCH_PAR_FALSE;
+			}
+		}
+#ifdef SLAP_ZONE_ALLOC
+		slap_zn_runlock(bdb->bi_cache.c_zctx, e);
+#endif
+		bdb_cache_return_entry_r( bdb, e, &lock );
+	}
+
+	ldap_pvt_thread_mutex_lock( &sp->sp_mutex );
+	sb->sb_pending--;
+	ldap_pvt_thread_cond_signal( &sp->sp_cond );
+	ldap_pvt_thread_mutex_unlock( &sp->sp_mutex );
+
+	return NULL;
+}
+
+/* Wait for a batch's chunks. Chunks no thread has started yet are
+ * taken back instead, so we never wait on a task that can't run,
+ * e.g. while the pool is pausing. Their candidates are just not
+ * screened.
+ */
+static void search_batch_wait( search_par *sp, search_batch *sb )
+{
+	int i;
+
+	for ( i = 0; i < sb->sb_nchunks; i++ ) {
+		search_chunk *sc = &sb->sb_chunks[i];
+		if ( !sc->sc_queued )
+			continue;
+		sc->sc_queued = 0;
+		if ( ldap_pvt_thread_pool_retract( &connection_pool,
+			search_par_task, sc ) > 0 )
+		{
+			ldap_pvt_thread_mutex_lock( &sp->sp_mutex );
+			sb->sb_pending--;
+			ldap_pvt_thread_mutex_unlock( &sp->sp_mutex );
+		}
+	}
+	sb->sb_nchunks = 0;
+
+	ldap_pvt_thread_mutex_lock( &sp->sp_mutex );
+	while ( sb->sb_pending )
+		ldap_pvt_thread_cond_wait( &sp->sp_cond, &sp->sp_mutex );
+	ldap_pvt_thread_mutex_unlock( &sp->sp_mutex );
+}
+
+/* Fill a batch with the candidates starting at id and queue it */
+static void search_batch_fill(
+	search_par *sp,
+	search_batch *sb,
+	ID *ids,
+	ID cursor,
+	ID id )
+{
+	struct bdb_info *bdb = (struct bdb_info *) sp->sp_op->o_bd->be_private;
+	int i, n, per;
+
+	search_batch_wait( sp, sb );
+
+	for ( n = 0; id != NOID && n < BDB_PAR_BATCH; n++ ) {
+		sb->sb_ids[n] = id;
+		sb->sb_cursor = cursor;
+		id = bdb_idl_next( ids, &cursor );
+	}
+	sb->sb_n = n;
+	sb->sb_pos = 0;
+	memset( sb->sb_res, SEARCH_PAR_UNKNOWN, n );
+	if ( !n )
+		return;
+
+	sb->sb_seq = search_par_seq( bdb );
+
+	sb->sb_nchunks = ( n + BDB_PAR_CHUNK - 1 ) / BDB_PAR_CHUNK;
+	if ( sb->sb_nchunks > sp->sp_threads )
+		sb->sb_nchunks = sp->sp_threads;
+	per = ( n + sb->sb_nchunks - 1 ) / sb->sb_nchunks;
+
+	for ( i = 0; i < sb->sb_nchunks; i++ ) {
+		search_chunk *sc = &sb->sb_chunks[i];
+		sc->sc_par = sp;
+		sc->sc_batch = sb;
+		sc->sc_first = i * per;
+		sc->sc_n = n - sc->sc_first < per ? n - sc->sc_first : per;
+		sc->sc_queued = 0;
+		if ( sc->sc_n <= 0 )
+			continue;
+
+		ldap_pvt_thread_mutex_lock( &sp->sp_mutex );
+		sb->sb_pending++;
+		ldap_pvt_thread_mutex_unlock( &sp->sp_mutex );
+		if ( ldap_pvt_thread_pool_submit( &connection_pool,
+			search_par_task, sc ) == 0 )
+		{
+			sc->sc_queued = 1;
+		} else {
+			ldap_pvt_thread_mutex_lock( &sp->sp_mutex );
+			sb->sb_pending--;
+			ldap_pvt_thread_mutex_unlock( &sp->sp_mutex );
+		}
+	}
+}
+
+static search_par *search_par_new( Operation *op, ID *ids )
+{
+	struct bdb_info *bdb = (struct bdb_info *) op->o_bd->be_private;
+	search_par *sp;
+
+	if ( bdb->bi_search_threads < 1 || !op->o_threadctx ||
+		op->ors_scope == LDAP_SCOPE_BASE ||
+		BDB_IDL_N( ids ) < 2 * BDB_PAR_BATCH )
+	{
+		return NULL;
+	}
+
+	sp = ch_calloc( 1, sizeof( search_par ));
+	sp->sp_op = op;
+	sp->sp_threads = bdb->bi_search_threads;
+	if ( sp->sp_threads > BDB_PAR_MAXTHREADS )
+		sp->sp_threads = BDB_PAR_MAXTHREADS;
+	ldap_pvt_thread_mutex_init( &sp->sp_mutex );
+	ldap_pvt_thread_cond_init( &sp->sp_cond );
+
+	return sp;
+}
+
+/* Returns what a helper found out about id, SEARCH_PAR_xxx. Check
+ * search_par_current() before relying on it.
+ */
+static int search_par_result(
+	search_par *sp,
+	ID *ids,
+	ID cursor,
+	ID id,
+	int idflag )
+{
+	search_batch *sb = &sp->sp_batch[sp->sp_cur];
+
+	sp->sp_idflag = idflag;
+
+	if ( !sb->sb_n || id > sb->sb_ids[sb->sb_n - 1] ) {
+		search_batch *next;
+		ID c2;
+
+		/* Move on to the batch queued behind this one, unless
+		 * it doesn't hold id, e.g. on the first call.
+		 */
+		search_batch_wait( sp, sb );
+		sp->sp_cur ^= 1;
+		sb = &sp->sp_batch[sp->sp_cur];
+		if ( !sb->sb_n || id < sb->sb_ids[0] ||
+			id > sb->sb_ids[sb->sb_n - 1] )
+		{
+			search_batch_fill( sp, sb, ids, cursor, id );
+		}
+		sp->sp_seq = sb->sb_seq;
+
+		/* and have the one after it screened meanwhile */
+		next = &sp->sp_batch[sp->sp_cur ^ 1];
+		c2 = sb->sb_cursor;
+		search_batch_fill( sp, next, ids, c2,
+			sb->sb_n ? bdb_idl_next( ids, &c2 ) : NOID );
+
+		search_batch_wait( sp, sb );
+	}
+
+	while ( sb->sb_pos < sb->sb_n && sb->sb_ids[sb->sb_pos] < id )
+		sb->sb_pos++;
+
+	if ( sb->sb_pos < sb->sb_n && sb->sb_ids[sb->sb_pos] == id )
+		return sb->sb_res[sb->sb_pos];
+	return SEARCH_PAR_UNKNOWN;
+}
+
+/* Returns 1 if no entry was written since the current batch was queued */
+static int search_par_current( search_par *sp )
+{
+	struct bdb_info *bdb = (struct bdb_info *) sp->sp_op->o_bd->be_private;
+
+	/* an unlocked peek, see above */
+	return sp->sp_seq == bdb->bi_cache_seq;
+}
+
+static void search_par_free( search_par *sp )
+{
+	search_batch_wait( sp, &sp->sp_batch[0] );
+	search_batch_wait( sp, &sp->sp_batch[1] );
+	ldap_pvt_thread_cond_destroy( &sp->sp_cond );
+	ldap_pvt_thread_mutex_destroy( &sp->sp_mutex );
+	ch_free( sp );
+}
+
 static int search_candidates(
 	Operation *op,
 	SlapReply *rs,
@@ -320,9 +320,10 @@ ID bdb_tool_dn2id_get(
 static int
 bdb_tool_entry_get_int( BackendDB *be, ID id, Entry **ep )
 {
+	struct bdb_info *bdb = (struct bdb_info *) be->be_private;
 	Entry *e = NULL;
 	char *dptr;
-	int rc, eoff;
+	int rc, eoff, compressed;
 
 	assert( be != NULL );
 	assert( slapMode & SLAP_TOOL_MODE );
@@ -350,7 +351,10 @@ bdb_tool_entry_get_int( BackendDB *be, ID id, Entry **ep )
 	dptr = eh.bv.bv_val;
 	eh.bv.bv_val = ehbuf;
 	eh.bv.bv_len = data.size;
-	rc = entry_header( &eh );
+	eh.ads = bdb->bi_ads;
+	eh.nads = bdb->bi_nads;
+	compressed = BDB_CZ_RECORD( ehbuf, data.size );
+	rc = compressed ? 0 : entry_header( &eh );
 	eoff = eh.data - eh.bv.bv_val;
 	eh.bv.bv_val = dptr;
 	if ( rc ) {
@@ -367,6 +371,24 @@ bdb_tool_entry_get_int( BackendDB *be, ID id, Entry **ep )
 		goto done;
 	}
 
+	if ( compressed ) {
+		struct berval zbv;
+
+		zbv.bv_len = data.size;
+		zbv.bv_val = ch_malloc( zbv.bv_len );
+		data.data = zbv.bv_val;
+		data.ulen = data.size;
+		rc = cursor->c_get( cursor, &key, &data, DB_CURRENT );
+		if ( rc == 0 )
+			rc = bdb_decompress( bdb, &zbv, &eh );
+		ch_free( zbv.bv_val );
+		if ( rc ) {
+			rc = LDAP_OTHER;
+			goto done;
+		}
+		goto decode;
+	}
+
 	/* Allocate a block and retrieve the data */
 	eh.bv.bv_len = eh.nvals * sizeof( struct berval ) + data.size;
 	eh.bv.bv_val = ch_realloc( eh.bv.bv_val, eh.bv.bv_len );
@@ -383,6 +405,7 @@ bdb_tool_entry_get_int( BackendDB *be, ID id, Entry **ep )
 		goto done;
 	}
 
+decode:
 #ifndef BDB_HIER
 	/* TODO: handle BDB_HIER accordingly */
 	if ( tool_base != NULL ) {
@@ -406,7 +429,6 @@ bdb_tool_entry_get_int( BackendDB *be, ID id, Entry **ep )
 		e->e_id = id;
 #ifdef BDB_HIER
 		if ( slapMode & SLAP_TOOL_READONLY ) {
-			struct bdb_info *bdb = (struct bdb_info *) be->be_private;
 			EntryInfo *ei = NULL;
 			Operation op = {0};
 			Opheader ohdr = {0};
@@ -0,0 +1,376 @@
+/* warm.c - entry cache snapshot and preload */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2010 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* A freshly started server only fills its entry cache from misses,
+ * which takes a long time on a large database. With "cachewarm" set,
+ * db_close writes the IDs on the cache's LRU list to a file in the
+ * database directory, and db_open reads them back on pool threads
+ * before the database is put into service.
+ *
+ * The file holds a small header and two runs of IDs in LRU order:
+ * first the entries that were cached, then (for back-hdb) the leaf
+ * EntryInfo nodes that only had their DN cached. Loading the leaves
+ * rebuilds their parents as well, so the DN tree comes back in the
+ * same shape. back-bdb can only find an ID's DN by reading its entry,
+ * so it just keeps the entries. IDs that no longer exist are counted
+ * and skipped, so a stale snapshot does no harm.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+#include <ac/errno.h>
+#include <ac/unistd.h>
+#include <sys/stat.h>
+
+#include "back-bdb.h"
+
+#define	BDB_WARM_FILE		"cache.ids"
+#define	BDB_WARM_MAGIC		0x7761726dUL	/* "warm" */
+#define	BDB_WARM_CHUNK		64		/* IDs taken by a worker at a time */
+#define	BDB_WARM_MAXTHREADS	8
+
+#ifdef BDB_HIER
+#define	BDB_WARM_NODE(ei)	( !(ei)->bei_kids )
+#else
+#define	BDB_WARM_NODE(ei)	0
+#endif
+
+typedef struct bdb_warm {
+	BackendDB	*bw_be;
+	ID		*bw_ids;
+	ID		bw_nentries;	/* IDs before this had their entry cached */
+	ID		bw_nids;
+	ID		bw_next;	/* next ID to hand out */
+	int		bw_workers;	/* tasks queued or running */
+	int		bw_stop;
+} bdb_warm;
+
+static void
+bdb_warm_path( struct bdb_info *bdb, char *path, const char *suffix )
+{
+	snprintf( path, MAXPATHLEN, "%s" LDAP_DIRSEP BDB_WARM_FILE "%s",
+		bdb->bi_dbenv_home, suffix );
+}
+
+/* Write the snapshot. Only called from db_close, when nothing else
+ * is using the cache.
+ */
+int
+bdb_warm_save( struct bdb_info *bdb )
+{
+	Cache *cache = &bdb->bi_cache;
+	EntryInfo *ei;
+	ID hdr[3], *ids, ne = 0, nn = 0, i, j;
+	char path[MAXPATHLEN], tmp[MAXPATHLEN];
+	FILE *f;
+	int rc = 0;
+
+	if ( !cache->c_lruhead )
+		return 0;
+
+	ei = cache->c_lruhead;
+	do {
+		if ( ei->bei_e && !( ei->bei_state & CACHE_ENTRY_NOT_CACHED ))
+			ne++;
+		else if ( BDB_WARM_NODE( ei ))
+			nn++;
+		ei = ei->bei_lrunext;
+	} while ( ei != cache->c_lruhead );
+
+	ids = ch_malloc(( ne + nn ) * sizeof( ID ));
+	i = 0;
+	j = ne;
+	do {
+		if ( ei->bei_e && !( ei->bei_state & CACHE_ENTRY_NOT_CACHED ))
+			ids[i++] = ei->bei_id;
+		else if ( BDB_WARM_NODE( ei ))
+			ids[j++] = ei->bei_id;
+		ei = ei->bei_lrunext;
+	} while ( ei != cache->c_lruhead );
+
+	/* Write a new file and move it into place, so that a crash
+	 * while writing leaves the previous snapshot alone.
+	 */
+	bdb_warm_path( bdb, path, "" );
+	bdb_warm_path( bdb, tmp, ".tmp" );
+	f = fopen( tmp, "wb" );
+	if ( f == NULL ) {
+		rc = errno;
+	} else {
+		hdr[0] = BDB_WARM_MAGIC;
+		hdr[1] = ne;
+		hdr[2] = nn;
+		if ( fwrite( hdr, sizeof( ID ), 3, f ) != 3 ||
+			fwrite( ids, sizeof( ID ), ne + nn, f ) != ne + nn )
+			rc = errno ? errno : EIO;
+		if ( fclose( f ) && !rc )
+			rc = errno;
+		if ( !rc && rename( tmp, path ))
+			rc = errno;
+		if ( rc )
+			unlink( tmp );
+	}
+	ch_free( ids );
+
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(bdb_warm_save)
+			": unable to write %s: %s\n", path, STRERROR( rc ), 0 );
+	} else {
+		Debug( LDAP_DEBUG_TRACE, LDAP_XSTRING(bdb_warm_save)
+			": saved %lu entries and %lu DNs\n", ne, nn, 0 );
+	}
+	return rc;
+}
+
+/* Read the snapshot, keeping only as much as the cache can hold */
+static int
+bdb_warm_read( struct bdb_info *bdb, bdb_warm *bw )
+{
+	Cache *cache = &bdb->bi_cache;
+	char path[MAXPATHLEN];
+	struct stat st;
+	ID hdr[3], ne, nn, skip;
+	FILE *f;
+	int rc = 0;
+
+	bdb_warm_path( bdb, path, "" );
+	f = fopen( path, "rb" );
+	if ( f == NULL )
+		return errno;
+
+	if ( fstat( fileno( f ), &st ) ||
+		fread( hdr, sizeof( ID ), 3, f ) != 3 ||
+		hdr[0] != BDB_WARM_MAGIC ||
+		hdr[1] > st.st_size / sizeof( ID ) ||
+		hdr[2] > st.st_size / sizeof( ID ) ||
+		( hdr[1] + hdr[2] + 3 ) * sizeof( ID ) != st.st_size ) {
+		fclose( f );
+		return EINVAL;
+	}
+	ne = hdr[1];
+	nn = hdr[2];
+
+	bw->bw_ids = ch_malloc(( ne + nn + 1 ) * sizeof( ID ));
+	if ( fread( bw->bw_ids, sizeof( ID ), ne + nn, f ) != ne + nn )
+		rc = EIO;
+	fclose( f );
+	if ( rc ) {
+		ch_free( bw->bw_ids );
+		bw->bw_ids = NULL;
+		return rc;
+	}
+
+	/* The coldest IDs come first, drop those that wouldn't fit */
+	if ( ne > cache->c_maxsize ) {
+		skip = ne - cache->c_maxsize;
+		AC_MEMCPY( bw->bw_ids, bw->bw_ids + skip,
+			( ne + nn - skip ) * sizeof( ID ));
+		ne -= skip;
+	}
+	if ( cache->c_eimax && nn > cache->c_eimax ) {
+		skip = nn - cache->c_eimax;
+		AC_MEMCPY( bw->bw_ids + ne, bw->bw_ids + ne + skip,
+			( nn - skip ) * sizeof( ID ));
+		nn -= skip;
+	}
+	bw->bw_nentries = ne;
+	bw->bw_nids = ne + nn;
+	return 0;
+}
+
+static void *
+bdb_warm_task( void *ctx, void *arg )
+{
+	bdb_warm *bw = arg;
+	BackendDB *be = bw->bw_be;
+	struct bdb_info *bdb = (struct bdb_info *) be->be_private;
+
+	Connection conn = {0};
+	OperationBuffer opbuf;
+	Operation *op;
+
+	DB_TXN *rtxn;
+	DB_LOCK lock;
+	EntryInfo *ei;
+	ID i, start, end, done, missing;
+	int rc, flag;
+
+	connection_fake_init( &conn, &opbuf, ctx );
+	op = &opbuf.ob_op;
+	op->o_bd = be;
+
+	rc = bdb_reader_get( op, bdb->bi_dbenv, &rtxn );
+
+	for (;;) {
+		ldap_pvt_thread_mutex_lock( &bdb->bi_warm_mutex );
+		if ( rc || bw->bw_stop || slapd_shutdown ||
+			bw->bw_next >= bw->bw_nids ) {
+			ldap_pvt_thread_mutex_unlock( &bdb->bi_warm_mutex );
+			break;
+		}
+		start = bw->bw_next;
+		end = start + BDB_WARM_CHUNK;
+		if ( end > bw->bw_nids )
+			end = bw->bw_nids;
+		bw->bw_next = end;
+		ldap_pvt_thread_mutex_unlock( &bdb->bi_warm_mutex );
+
+		done = 0;
+		missing = 0;
+		for ( i = start; i < end; i++ ) {
+			flag = i < bw->bw_nentries ? 0 : ID_NOENTRY;
+			ei = NULL;
+			rc = bdb_cache_find_id( op, rtxn, bw->bw_ids[i], &ei,
+				flag, &lock );
+			if ( rc ) {
+				missing++;
+				rc = 0;
+				continue;
+			}
+			if ( flag == ID_NOENTRY ) {
+				bdb_cache_entryinfo_lock( ei );
+				ei->bei_finders--;
+				bdb_cache_entryinfo_unlock( ei );
+			} else {
+				bdb_cache_return_entry_r( bdb, ei->bei_e, &lock );
+			}
+			done++;
+		}
+
+		ldap_pvt_thread_mutex_lock( &bdb->bi_warm_mutex );
+		bdb->bi_warm_done += done;
+		bdb->bi_warm_missing += missing;
+		ldap_pvt_thread_mutex_unlock( &bdb->bi_warm_mutex );
+	}
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_warm_mutex );
+	if ( --bw->bw_workers == 0 ) {
+		bdb->bi_warm_state = bw->bw_next < bw->bw_nids ?
+			BDB_WARM_STOPPED : BDB_WARM_DONE;
+		bdb->bi_warm_run = NULL;
+		ch_free( bw->bw_ids );
+		ch_free( bw );
+		ldap_pvt_thread_cond_broadcast( &bdb->bi_warm_cond );
+	}
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_warm_mutex );
+
+	return NULL;
+}
+
+/* Preload the cache from the snapshot. With wait set, return only
+ * once it has been loaded; otherwise it loads in the background.
+ */
+int
+bdb_warm_start( BackendDB *be, int wait )
+{
+	struct bdb_info *bdb = (struct bdb_info *) be->be_private;
+	bdb_warm *bw;
+	int i, n, rc;
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_warm_mutex );
+	if ( bdb->bi_warm_run ) {
+		ldap_pvt_thread_mutex_unlock( &bdb->bi_warm_mutex );
+		return 0;
+	}
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_warm_mutex );
+
+	bw = ch_calloc( 1, sizeof( bdb_warm ));
+	bw->bw_be = be;
+	rc = bdb_warm_read( bdb, bw );
+	if ( rc ) {
+		if ( rc != ENOENT )
+			Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(bdb_warm_start)
+				": database \"%s\": ignoring cache snapshot: %s\n",
+				be->be_suffix[0].bv_val, STRERROR( rc ), 0 );
+		ch_free( bw );
+		return rc;
+	}
+
+	n = connection_pool_max / 2;
+	if ( n > BDB_WARM_MAXTHREADS )
+		n = BDB_WARM_MAXTHREADS;
+	if ( n > bw->bw_nids / BDB_WARM_CHUNK + 1 )
+		n = bw->bw_nids / BDB_WARM_CHUNK + 1;
+	if ( n < 1 )
+		n = 1;
+
+	/* Hold the mutex so no worker can finish and free bw
+	 * before they have all been submitted.
+	 */
+	ldap_pvt_thread_mutex_lock( &bdb->bi_warm_mutex );
+	bdb->bi_warm_run = bw;
+	bdb->bi_warm_state = BDB_WARM_LOADING;
+	bdb->bi_warm_total = bw->bw_nids;
+	bdb->bi_warm_done = 0;
+	bdb->bi_warm_missing = 0;
+	for ( i = 0; i < n; i++ ) {
+		if ( ldap_pvt_thread_pool_submit( &connection_pool,
+			bdb_warm_task, bw ))
+			break;
+		bw->bw_workers++;
+	}
+	if ( !bw->bw_workers ) {
+		bdb->bi_warm_run = NULL;
+		bdb->bi_warm_state = BDB_WARM_STOPPED;
+		ldap_pvt_thread_mutex_unlock( &bdb->bi_warm_mutex );
+		ch_free( bw->bw_ids );
+		ch_free( bw );
+		return LDAP_OTHER;
+	}
+
+	Debug( LDAP_DEBUG_TRACE, LDAP_XSTRING(bdb_warm_start)
+		": database \"%s\": loading %lu cached IDs\n",
+		be->be_suffix[0].bv_val, bdb->bi_warm_total, 0 );
+
+	/* The workers can't run while the pool is paused */
+	if ( wait && ldap_pvt_thread_pool_pausing( &connection_pool ) <= 0 ) {
+		while ( bdb->bi_warm_run == bw )
+			ldap_pvt_thread_cond_wait( &bdb->bi_warm_cond,
+				&bdb->bi_warm_mutex );
+	}
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_warm_mutex );
+
+	return 0;
+}
+
+/* Stop a preload that is still running */
+void
+bdb_warm_stop( struct bdb_info *bdb )
+{
+	bdb_warm *bw;
+
+	ldap_pvt_thread_mutex_lock( &bdb->bi_warm_mutex );
+	bw = bdb->bi_warm_run;
+	if ( bw ) {
+		bw->bw_stop = 1;
+		/* Tasks that never started must be accounted for here */
+		while ( bw->bw_workers && ldap_pvt_thread_pool_retract(
+			&connection_pool, bdb_warm_task, bw ) > 0 )
+			bw->bw_workers--;
+		if ( !bw->bw_workers ) {
+			bdb->bi_warm_state = BDB_WARM_STOPPED;
+			bdb->bi_warm_run = NULL;
+			ch_free( bw->bw_ids );
+			ch_free( bw );
+		}
+		while ( bdb->bi_warm_run == bw )
+			ldap_pvt_thread_cond_wait( &bdb->bi_warm_cond,
+				&bdb->bi_warm_mutex );
+	}
+	ldap_pvt_thread_mutex_unlock( &bdb->bi_warm_mutex );
+}
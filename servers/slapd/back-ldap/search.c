@@ -313,6 +313,8 @@ retry:
 		}
 
 		if ( rc == 0 || rc == -2 ) {
+			/* nothing new from the target, send what we have */
+			slap_write_batch_check( op );
 			ldap_pvt_thread_yield();
 
 			/* check timeout */
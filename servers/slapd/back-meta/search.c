@@ -1610,6 +1610,9 @@ free_message:;
 				lutil_timermul( &save_tv, 2, &save_tv );
 			}
 
+			/* nothing new from the targets, send what we have */
+			slap_write_batch_check( op );
+
 			if ( alreadybound == 0 ) {
 				tv = save_tv;
 				(void)select( 0, NULL, NULL, NULL, &tv );
@@ -27,6 +27,12 @@
 #include "slap.h"
 #include "back-monitor.h"
 
+static int
+monitor_subsys_listener_update(
+	Operation		*op,
+	SlapReply		*rs,
+	Entry                   *e );
+
 int
 monitor_subsys_listener_init(
 	BackendDB		*be,
@@ -54,6 +60,8 @@ monitor_subsys_listener_init(
 
 	mi = ( monitor_info_t * )be->be_private;
 
+	ms->mss_update = monitor_subsys_listener_update;
+
 	if ( monitor_cache_get( mi, &ms->mss_ndn, &e_listener ) ) {
 		Debug( LDAP_DEBUG_ANY,
 			"monitor_subsys_listener_init: "
@@ -110,6 +118,23 @@ monitor_subsys_listener_init(
 		}
 #endif /* HAVE_TLS */
 
+		/* the listener thread polling this socket */
+		bv.bv_len = snprintf( buf, sizeof( buf ), "thread=%d",
+				(int)( l[ i ]->sl_sd & slapd_daemon_mask ) );
+		bv.bv_val = buf;
+		attr_merge_normalize_one( e, mi->mi_ad_monitoredInfo,
+				&bv, NULL );
+
+		if ( l[ i ]->sl_thread > -1 ) {
+			BER_BVSTR( &bv, "REUSEPORT" );
+			attr_merge_normalize_one( e, mi->mi_ad_monitoredInfo,
+					&bv, NULL );
+		}
+
+		/* connections accepted, see monitor_subsys_listener_update() */
+		BER_BVSTR( &bv, "0" );
+		attr_merge_one( e, mi->mi_ad_monitorCounter, &bv, NULL );
+
 		mp = monitor_entrypriv_create();
 		if ( mp == NULL ) {
 			return -1;
@@ -130,9 +155,128 @@ monitor_subsys_listener_init(
 		*ep = e;
 		ep = &mp->mp_next;
 	}
+
+	/* connections accepted by each listener thread, whichever
+	 * of its listeners they came from */
+	for ( i = 0; i < slapd_daemon_threads; i++ ) {
+		char 		buf[ BACKMONITOR_BUFSIZE ];
+		Entry		*e;
+		struct berval bv;
+
+		bv.bv_len = snprintf( buf, sizeof( buf ),
+				"cn=Thread %d", i );
+		bv.bv_val = buf;
+		e = monitor_entry_stub( &ms->mss_dn, &ms->mss_ndn, &bv,
+			mi->mi_oc_monitoredObject, mi, NULL, NULL );
+
+		if ( e == NULL ) {
+			Debug( LDAP_DEBUG_ANY,
+				"monitor_subsys_listener_init: "
+				"unable to create entry \"cn=Thread %d,%s\"\n",
+				i, ms->mss_ndn.bv_val, 0 );
+			return( -1 );
+		}
+
+		BER_BVSTR( &bv, "0" );
+		attr_merge_one( e, mi->mi_ad_monitorCounter, &bv, NULL );
+
+		mp = monitor_entrypriv_create();
+		if ( mp == NULL ) {
+			return -1;
+		}
+		e->e_private = ( void * )mp;
+		mp->mp_info = ms;
+		mp->mp_flags = ms->mss_flags
+			| MONITOR_F_SUB;
+
+		if ( monitor_cache_add( mi, e ) ) {
+			Debug( LDAP_DEBUG_ANY,
+				"monitor_subsys_listener_init: "
+				"unable to add entry \"cn=Thread %d,%s\"\n",
+				i, ms->mss_ndn.bv_val, 0 );
+			return( -1 );
+		}
+
+		*ep = e;
+		ep = &mp->mp_next;
+	}
 	
 	monitor_cache_release( mi, e_listener );
 
 	return( 0 );
 }
 
+static int
+monitor_subsys_listener_update(
+	Operation		*op,
+	SlapReply		*rs,
+	Entry                   *e )
+{
+	monitor_info_t	*mi = ( monitor_info_t * )op->o_bd->be_private;
+	Listener	**l;
+	Attribute	*a;
+	char		*next = NULL;
+	char		buf[ LDAP_PVT_INTTYPE_CHARS(unsigned long) ];
+	ber_len_t	len;
+	unsigned long	accepts;
+	long		n;
+	int		i;
+	static struct berval	nlistener_bv = BER_BVC( "cn=listener " ),
+				nthread_bv = BER_BVC( "cn=thread " );
+
+	assert( mi != NULL );
+	assert( e != NULL );
+
+	/* the normalized DN is either "cn=listener <n>,..."
+	 * or "cn=thread <n>,..." */
+	if ( e->e_nname.bv_len > nlistener_bv.bv_len
+		&& strncmp( e->e_nname.bv_val, nlistener_bv.bv_val,
+			nlistener_bv.bv_len ) == 0 )
+	{
+		n = strtol( &e->e_nname.bv_val[ nlistener_bv.bv_len ], &next, 10 );
+		if ( next[ 0 ] != ',' || n < 0 ) {
+			return SLAP_CB_CONTINUE;
+		}
+
+		if ( ( l = slapd_get_listeners() ) == NULL ) {
+			return SLAP_CB_CONTINUE;
+		}
+
+		for ( i = 0; i < n && l[ i ]; i++ )
+			/* count */ ;
+		if ( l[ i ] == NULL ) {
+			return SLAP_CB_CONTINUE;
+		}
+		accepts = l[ i ]->sl_accepts;
+
+	} else if ( e->e_nname.bv_len > nthread_bv.bv_len
+		&& strncmp( e->e_nname.bv_val, nthread_bv.bv_val,
+			nthread_bv.bv_len ) == 0 )
+	{
+		n = strtol( &e->e_nname.bv_val[ nthread_bv.bv_len ], &next, 10 );
+		if ( next[ 0 ] != ',' || n < 0 || n >= slapd_daemon_threads ) {
+			return SLAP_CB_CONTINUE;
+		}
+		accepts = slapd_get_accepts( (int)n );
+
+	} else {
+		return SLAP_CB_CONTINUE;
+	}
+
+	a = attr_find( e->e_attrs, mi->mi_ad_monitorCounter );
+	if ( a == NULL ) {
+		return SLAP_CB_CONTINUE;
+	}
+
+	snprintf( buf, sizeof( buf ), "%lu", accepts );
+	len = strlen( buf );
+	if ( len > a->a_vals[ 0 ].bv_len ) {
+		a->a_vals[ 0 ].bv_val = ber_memrealloc( a->a_vals[ 0 ].bv_val, len + 1 );
+	}
+	a->a_vals[ 0 ].bv_len = len;
+	AC_MEMCPY( a->a_vals[ 0 ].bv_val, buf, len + 1 );
+
+	/* FIXME: touch modifyTimestamp? */
+
+	return SLAP_CB_CONTINUE;
+}
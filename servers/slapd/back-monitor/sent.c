@@ -43,6 +43,7 @@ enum {
 	MONITOR_SENT_PDU,
 	MONITOR_SENT_ENTRIES,
 	MONITOR_SENT_REFERRALS,
+	MONITOR_SENT_WSAVED,
 
 	MONITOR_SENT_LAST
 };
@@ -55,6 +56,7 @@ struct monitor_sent_t {
 	{ BER_BVC("cn=PDU"),		BER_BVNULL },
 	{ BER_BVC("cn=Entries"),	BER_BVNULL },
 	{ BER_BVC("cn=Referrals"),	BER_BVNULL },
+	{ BER_BVC("cn=Writes Saved"),	BER_BVNULL },
 	{ BER_BVNULL,			BER_BVNULL }
 };
 
@@ -222,6 +224,15 @@ monitor_subsys_sent_update(
 		}
 		break;
 
+	case MONITOR_SENT_WSAVED:
+		ldap_pvt_mp_init_set( n, slap_counters.sc_wsaved );
+		for ( sc = slap_counters.sc_next; sc; sc = sc->sc_next ) {
+			ldap_pvt_thread_mutex_lock( &sc->sc_mutex );
+			ldap_pvt_mp_add( n, sc->sc_wsaved );
+			ldap_pvt_thread_mutex_unlock( &sc->sc_mutex );
+		}
+		break;
+
 	default:
 		assert(0);
 	}
@@ -195,6 +195,7 @@ enum {
 	CFG_ACL_ADD,
 	CFG_SYNC_SUBENTRY,
 	CFG_LTHREADS,
+	CFG_THRQS,
 
 	CFG_LAST
 };
@@ -341,6 +342,10 @@ static ConfigTable config_back_cf_table[] = {
 			"EQUALITY caseIgnoreMatch "
 			"SYNTAX OMsDirectoryString SINGLE-VALUE X-ORDERED 'SIBLINGS' )",
 				NULL, NULL },
+	{ "cachebudget", "bytes", 2, 2, 0, ARG_ULONG,
+		&entry_cache_budget, "( OLcfgGlAt:96 NAME 'olcCacheBudget' "
+			"DESC 'Entry cache size in bytes, shared by all databases' "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "concurrency", "level", 2, 2, 0, ARG_INT|ARG_MAGIC|CFG_CONCUR,
 		&config_generic, "( OLcfgGlAt:10 NAME 'olcConcurrency' "
 			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
@@ -657,6 +662,14 @@ static ConfigTable config_back_cf_table[] = {
 			"( OLcfgGlAt:90 NAME 'olcTCPBuffer' "
 			"DESC 'Custom TCP buffer size' "
 			"SYNTAX OMsDirectoryString )", NULL, NULL },
+	{ "threadqueues", "count", 2, 2, 0,
+#ifdef NO_THREADS
+		ARG_IGNORED, NULL,
+#else
+		ARG_INT|ARG_MAGIC|CFG_THRQS, &config_generic,
+#endif
+		"( OLcfgGlAt:94 NAME 'olcThreadQueues' "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "threads", "count", 2, 2, 0,
 #ifdef NO_THREADS
 		ARG_IGNORED, NULL,
@@ -768,6 +781,9 @@ static ConfigTable config_back_cf_table[] = {
 		&config_updateref, "( OLcfgDbAt:0.13 NAME 'olcUpdateRef' "
 			"EQUALITY caseIgnoreMatch "
 			"SUP labeledURI )", NULL, NULL },
+	{ "writequeue", "bytes", 2, 2, 0, ARG_BER_LEN_T,
+		&global_writequeue, "( OLcfgGlAt:95 NAME 'olcWriteQueue' "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "writetimeout", "timeout", 2, 2, 0, ARG_INT,
 		&global_writetimeout, "( OLcfgGlAt:88 NAME 'olcWriteTimeout' "
 			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
@@ -812,7 +828,8 @@ static ConfigOCs cf_ocs[] = {
 		"SUP olcConfig STRUCTURAL "
 		"MAY ( cn $ olcConfigFile $ olcConfigDir $ olcAllows $ olcArgsFile $ "
 		 "olcAttributeOptions $ olcAuthIDRewrite $ "
-		 "olcAuthzPolicy $ olcAuthzRegexp $ olcConcurrency $ "
+		 "olcAuthzPolicy $ olcAuthzRegexp $ olcCacheBudget $ "
+		 "olcConcurrency $ "
 		 "olcConnMaxPending $ olcConnMaxPendingAuth $ "
 		 "olcDisallows $ olcGentleHUP $ olcIdleTimeout $ "
 		 "olcIndexSubstrIfMaxLen $ olcIndexSubstrIfMinLen $ "
@@ -827,11 +844,11 @@ static ConfigOCs cf_ocs[] = {
 		 "olcSecurity $ olcServerID $ olcSizeLimit $ "
 		 "olcSockbufMaxIncoming $ olcSockbufMaxIncomingAuth $ "
 		 "olcTCPBuffer $ "
-		 "olcThreads $ olcTimeLimit $ olcTLSCACertificateFile $ "
+		 "olcThreadQueues $ olcThreads $ olcTimeLimit $ olcTLSCACertificateFile $ "
 		 "olcTLSCACertificatePath $ olcTLSCertificateFile $ "
 		 "olcTLSCertificateKeyFile $ olcTLSCipherSuite $ olcTLSCRLCheck $ "
 		 "olcTLSRandFile $ olcTLSVerifyClient $ olcTLSDHParamFile $ "
-		 "olcTLSCRLFile $ olcToolThreads $ olcWriteTimeout $ "
+		 "olcTLSCRLFile $ olcToolThreads $ olcWriteQueue $ olcWriteTimeout $ "
 		 "olcObjectIdentifier $ olcAttributeTypes $ olcObjectClasses $ "
 		 "olcDitContentRules $ olcLdapSyntaxes ) )", Cft_Global },
 	{ "( OLcfgGlOc:2 "
@@ -927,6 +944,9 @@ config_generic(ConfigArgs *c) {
 		case CFG_THREADS:
 			c->value_int = connection_pool_max;
 			break;
+		case CFG_THRQS:
+			c->value_int = connection_pool_queues;
+			break;
 		case CFG_TTHREADS:
 			c->value_int = slap_tool_thread_max;
 			break;
@@ -1274,6 +1294,7 @@ config_generic(ConfigArgs *c) {
 		/* single-valued attrs, no-ops */
 		case CFG_CONCUR:
 		case CFG_THREADS:
+		case CFG_THRQS:
 		case CFG_TTHREADS:
 		case CFG_LTHREADS:
 		case CFG_RO:
@@ -1621,6 +1642,26 @@ config_generic(ConfigArgs *c) {
 			connection_pool_max = c->value_int;	/* save for reference */
 			break;
 
+		case CFG_THRQS:
+			if ( c->value_int < 1 ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"threadqueues=%d smaller than minimum value 1",
+					c->value_int );
+				Debug(LDAP_DEBUG_ANY, "%s: %s.\n",
+					c->log, c->cr_msg, 0 );
+				return 1;
+			}
+			/* the queues can only be set up before the pool has threads */
+			if ( ldap_pvt_thread_pool_queues( &connection_pool, c->value_int ) ) {
+				Debug(LDAP_DEBUG_ANY, "%s: "
+					"threadqueues change requires slapd restart.\n",
+					c->log, 0, 0 );
+			}
+			/* report what the pool is using, it may have capped it */
+			ldap_pvt_thread_pool_query( &connection_pool,
+				LDAP_PVT_THREAD_POOL_PARAM_QUEUES, &connection_pool_queues );
+			break;
+
 		case CFG_TTHREADS:
 			if ( slapMode & SLAP_TOOL_MODE )
 				ldap_pvt_thread_pool_maxthreads(&connection_pool, c->value_int);
@@ -1635,6 +1676,17 @@ config_generic(ConfigArgs *c) {
 				mask <<= 1;
 				mask |= 1;
 			}
+			/* the SO_REUSEPORT sockets were sized for the
+			 * listener threads at startup, see slapd_assign_listeners() */
+			if ( slapd_listener_reuseport && CONFIG_ONLINE_ADD( c )
+				&& mask+1 != slapd_daemon_threads ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"<%s> cannot be changed while \"reuseport\" is on",
+					c->argv[0] );
+				Debug(LDAP_DEBUG_ANY, "%s: %s.\n",
+					c->log, c->cr_msg, 0 );
+				return 1;
+			}
 			slapd_daemon_mask = mask;
 			slapd_daemon_threads = mask+1;
 			}
@@ -60,6 +60,7 @@ slap_mask_t		global_disallows = 0;
 int		global_gentlehup = 0;
 int		global_idletimeout = 0;
 int		global_writetimeout = 0;
+ber_len_t	global_writequeue = 0;
 char	*global_host = NULL;
 struct berval global_host_bv = BER_BVNULL;
 char	*global_realm = NULL;
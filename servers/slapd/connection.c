@@ -219,7 +219,7 @@ int connections_timeout_idle(time_t now)
 		 * outbound connection. But if it has a writewaiter, see
 		 * if the waiter has been there too long.
 		 */
-		if(( c->c_n_ops_executing && !c->c_writewaiter)
+		if(( c->c_n_ops_executing && !c->c_writewaiter && !c->c_wq_bytes )
 			|| c->c_conn_state == SLAP_C_CLIENT ) {
 			continue;
 		}
@@ -232,7 +232,7 @@ int connections_timeout_idle(time_t now)
 			i++;
 			continue;
 		}
-		if ( c->c_writewaiter && global_writetimeout ) {
+		if (( c->c_writewaiter || c->c_wq_bytes ) && global_writetimeout ) {
 			writers = 1;
 			if( difftime( c->c_activitytime+global_writetimeout, now) < 0 ) {
 				/* close it */
@@ -388,6 +388,9 @@ Connection * connection_init(
 		}
 
 		c->c_currentber = NULL;
+		c->c_wq_out = NULL;
+		c->c_wq_in = NULL;
+		c->c_wq_bytes = 0;
 
 		/* should check status of thread calls */
 		ldap_pvt_thread_mutex_init( &c->c_mutex );
@@ -427,6 +430,7 @@ Connection * connection_init(
 	assert( c->c_currentber == NULL );
 	assert( c->c_writewaiter == 0);
 	assert( c->c_writers == 0);
+	assert( c->c_wq_bytes == 0 );
 
 	c->c_listener = listener;
 	c->c_sd = s;
@@ -488,6 +492,8 @@ Connection * connection_init(
 #endif
 		ber_sockbuf_add_io( c->c_sb, &ber_sockbuf_io_fd,
 			LBER_SBIOD_LEVEL_PROVIDER, (void *)&sfd );
+		ber_sockbuf_add_io( c->c_sb, &ber_sockbuf_io_readahead,
+			LBER_SBIOD_LEVEL_PROVIDER, NULL );
 #ifdef LDAP_PF_LOCAL_SENDMSG
 		if ( !BER_BVISEMPTY( peerbv ))
 			ber_sockbuf_ctrl( c->c_sb, LBER_SB_OPT_UNGET_BUF, peerbv );
@@ -501,6 +507,11 @@ Connection * connection_init(
 #endif
 		ber_sockbuf_add_io( c->c_sb, &ber_sockbuf_io_tcp,
 			LBER_SBIOD_LEVEL_PROVIDER, (void *)&sfd );
+		/* pipelined requests are taken from one read;
+		 * connection_read() keeps decoding until the socket would block
+		 */
+		ber_sockbuf_add_io( c->c_sb, &ber_sockbuf_io_readahead,
+			LBER_SBIOD_LEVEL_PROVIDER, NULL );
 	}
 
 #ifdef LDAP_DEBUG
@@ -645,6 +656,17 @@ connection_destroy( Connection *c )
 		c->c_currentber = NULL;
 	}
 
+	/* whatever output is still queued can't be delivered now */
+	if ( c->c_wq_out != NULL ) {
+		ber_free( c->c_wq_out, 1 );
+		c->c_wq_out = NULL;
+	}
+	if ( c->c_wq_in != NULL ) {
+		ber_free( c->c_wq_in, 1 );
+		c->c_wq_in = NULL;
+	}
+	c->c_wq_bytes = 0;
+
 
 #ifdef LDAP_SLAPI
 	/* call destructors, then constructors; avoids unnecessary allocation */
@@ -974,6 +996,7 @@ conn_counter_destroy( void *key, void *data )
 			ldap_pvt_mp_add( slap_counters.sc_pdu, sc->sc_pdu );
 			ldap_pvt_mp_add( slap_counters.sc_entries, sc->sc_entries );
 			ldap_pvt_mp_add( slap_counters.sc_refs, sc->sc_refs );
+			ldap_pvt_mp_add( slap_counters.sc_wsaved, sc->sc_wsaved );
 			ldap_pvt_mp_add( slap_counters.sc_ops_initiated, sc->sc_ops_initiated );
 			ldap_pvt_mp_add( slap_counters.sc_ops_completed, sc->sc_ops_completed );
 #ifdef SLAPD_MONITOR
@@ -1595,7 +1618,7 @@ connection_input( Connection *conn , conn_readinfo *cri )
 		if (conn->c_conn_state == SLAP_C_CLOSING) {
 			defer = "closing";
 			break;
-		} else if (conn->c_writewaiter) {
+		} else if (conn->c_writewaiter || conn->c_wq_bytes) {
 			defer = "awaiting write";
 			break;
 		} else if (conn->c_n_ops_pending) {
@@ -1668,7 +1691,7 @@ connection_resched( Connection *conn )
 {
 	Operation *op;
 
-	if( conn->c_writewaiter )
+	if( conn->c_writewaiter || conn->c_wq_bytes )
 		return 0;
 
 	if( conn->c_conn_state == SLAP_C_CLOSING ) {
@@ -1849,6 +1872,48 @@ static int connection_op_activate( Operation *op )
 	return rc;
 }
 
+/*
+ * Write out as much of the output that send_ldap_ber() queued on
+ * the connection as the socket takes. Called with c_mutex held.
+ * Returns 0 once the queue is empty, else the socket error that
+ * stopped it: EWOULDBLOCK or EAGAIN if the socket is full.
+ */
+int
+connection_flush_queued( Connection *c )
+{
+	struct berval before, after;
+	int err;
+
+	while ( c->c_wq_bytes ) {
+		if ( c->c_wq_out == NULL ) {
+			c->c_wq_out = c->c_wq_in;
+			c->c_wq_in = NULL;
+		}
+		assert( c->c_wq_out != NULL );
+
+		ber_get_option( c->c_wq_out, LBER_OPT_BER_UNFLUSHED, &before );
+		err = ber_flush2( c->c_sb, c->c_wq_out, LBER_FLUSH_FREE_NEVER );
+		ber_get_option( c->c_wq_out, LBER_OPT_BER_UNFLUSHED, &after );
+		c->c_wq_bytes -= before.bv_len - after.bv_len;
+
+		if ( err == 0 ) {
+			ber_free( c->c_wq_out, 1 );
+			c->c_wq_out = NULL;
+			continue;
+		}
+
+		err = sock_errno();
+		if ( err != EWOULDBLOCK && err != EAGAIN ) {
+			Debug( LDAP_DEBUG_CONNS,
+				"connection_flush_queued: conn=%lu errno=%d reason=\"%s\"\n",
+				c->c_connid, err, sock_errstr(err) );
+		}
+		return err;
+	}
+
+	return 0;
+}
+
 int connection_write(ber_socket_t s)
 {
 	Connection *c;
@@ -1876,6 +1941,27 @@ int connection_write(ber_socket_t s)
 
 	c->c_n_write++;
 
+	if ( c->c_wq_bytes ) {
+		int err = connection_flush_queued( c );
+
+		if ( err == 0 ) {
+			/* drained; start the ops that were held back for it */
+			if ( !c->c_writewaiter ) {
+				connection_resched( c );
+			}
+
+		} else if ( err == EWOULDBLOCK || err == EAGAIN ) {
+			/* still more to go, keep watching the socket */
+			slapd_set_write( s, 0 );
+
+		} else {
+			connection_closing( c, "connection lost on write" );
+			connection_close( c );
+			connection_return( c );
+			return -1;
+		}
+	}
+
 	Debug( LDAP_DEBUG_TRACE,
 		"connection_write(%d): waking output for id=%lu\n",
 		s, c->c_connid, 0 );
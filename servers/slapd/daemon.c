@@ -50,6 +50,15 @@
 # include <sys/devpoll.h>
 #endif /* ! epoll && ! /dev/poll */
 
+#if defined(SO_REUSEPORT) && !defined(HAVE_WINSOCK)
+# ifdef HAVE_FCNTL_H
+#  include <fcntl.h>
+# endif
+# ifdef F_DUPFD
+#  define SLAP_REUSEPORT
+# endif
+#endif /* SO_REUSEPORT */
+
 #ifdef HAVE_TCPD
 int allow_severity = LOG_INFO;
 int deny_severity = LOG_NOTICE;
@@ -83,6 +92,7 @@ int slapd_tcp_wmem;
 #endif /* LDAP_TCP_BUFFER */
 
 Listener **slap_listeners = NULL;
+int slapd_listener_reuseport = 0;
 
 #ifndef SLAPD_LISTEN_BACKLOG
 #define SLAPD_LISTEN_BACKLOG 1024
@@ -133,6 +143,7 @@ typedef struct slap_daemon_st {
 	ber_socket_t		sd_nactives;
 	int			sd_nwriters;
 	int			sd_nfds;
+	unsigned long		sd_accepts;	/* on all listeners of this thread */
 
 #if defined(HAVE_EPOLL)
 	struct epoll_event	*sd_epolls;
@@ -1275,6 +1286,141 @@ errexit:
 	return -1;
 }
 
+#ifdef SLAP_REUSEPORT
+static int
+slap_reuseport_setopt( ber_socket_t s )
+{
+	int rc, tmp = 1;
+
+	rc = setsockopt( s, SOL_SOCKET, SO_REUSEPORT,
+		(char *) &tmp, sizeof(tmp) );
+	if ( rc == AC_SOCKET_ERROR ) {
+		int err = sock_errno();
+		Debug( LDAP_DEBUG_ANY, "slapd(%ld): "
+			"setsockopt(SO_REUSEPORT) failed errno=%d (%s)\n",
+			(long) SLAP_SOCKNEW( s ), err, sock_errstr(err) );
+	}
+	return rc;
+}
+
+/*
+ * Bind one more socket to the address of li for each possible
+ * listener thread.  With SO_REUSEPORT the kernel then shards the
+ * incoming connections across the sockets, and each listener thread
+ * accepts from its own socket instead of all of them contending on
+ * one.  This has to happen now, before privileges are dropped; the
+ * sockets in excess of listener-threads are closed again by
+ * slapd_assign_listeners() once the configuration is known.
+ */
+static void
+slap_reuseport_clone(
+	Listener *li,
+	int addrlen,
+	int *listeners,
+	int *cur )
+{
+	int t, tmp, rc;
+	ber_socket_t s;
+	Listener *lc;
+
+	*listeners += MAX_DAEMON_THREADS - 1;
+	slap_listeners = ch_realloc( slap_listeners,
+		(*listeners + 1) * sizeof(Listener *) );
+
+	li->sl_thread = 0;
+
+	for ( t = 1; t < MAX_DAEMON_THREADS; t++ ) {
+		s = socket( li->sl_sa.sa_addr.sa_family, SOCK_STREAM, 0 );
+		if ( s == AC_SOCKET_INVALID ) {
+			int err = sock_errno();
+			Debug( LDAP_DEBUG_ANY,
+				"daemon: reuseport socket() failed errno=%d (%s)\n",
+				err, sock_errstr(err), 0 );
+			break;
+		}
+
+		if ( SLAP_SOCKNEW( s ) >= dtblsize ) {
+			Debug( LDAP_DEBUG_ANY,
+				"daemon: listener descriptor %ld is too great %ld\n",
+				(long) SLAP_SOCKNEW( s ), (long) dtblsize, 0 );
+			tcp_close( s );
+			break;
+		}
+
+#ifdef SO_REUSEADDR
+		tmp = 1;
+		(void) setsockopt( s, SOL_SOCKET, SO_REUSEADDR,
+			(char *) &tmp, sizeof(tmp) );
+#endif /* SO_REUSEADDR */
+		if ( slap_reuseport_setopt( s ) == AC_SOCKET_ERROR ) {
+			tcp_close( s );
+			break;
+		}
+#if defined(LDAP_PF_INET6) && defined(IPV6_V6ONLY)
+		if ( li->sl_sa.sa_addr.sa_family == AF_INET6 ) {
+			tmp = 1;
+			(void) setsockopt( s, IPPROTO_IPV6, IPV6_V6ONLY,
+				(char *) &tmp, sizeof(tmp) );
+		}
+#endif /* LDAP_PF_INET6 && IPV6_V6ONLY */
+
+		rc = bind( s, &li->sl_sa.sa_addr, addrlen );
+		if ( rc ) {
+			int err = sock_errno();
+			Debug( LDAP_DEBUG_ANY,
+				"daemon: reuseport bind(%s) failed errno=%d (%s)\n",
+				li->sl_name.bv_val, err, sock_errstr(err) );
+			tcp_close( s );
+			break;
+		}
+
+		lc = ch_malloc( sizeof( Listener ) );
+		*lc = *li;
+		lc->sl_sd = SLAP_SOCKNEW( s );
+		lc->sl_thread = t;
+		ber_dupbv( &lc->sl_url, &li->sl_url );
+		ber_dupbv( &lc->sl_name, &li->sl_name );
+		slap_listeners[*cur] = lc;
+		(*cur)++;
+	}
+
+	Debug( LDAP_DEBUG_TRACE,
+		"daemon: %d reuseport sockets bound to %s\n",
+		t, li->sl_name.bv_val, 0 );
+}
+
+/*
+ * Move a SO_REUSEPORT socket to a descriptor that belongs to the
+ * listener thread it was bound for (see DAEMON_ID()).
+ */
+static int
+slap_reuseport_move( Listener *sl )
+{
+	ber_socket_t s, want;
+
+	want = sl->sl_sd - DAEMON_ID( sl->sl_sd ) + sl->sl_thread;
+	while ( DAEMON_ID( sl->sl_sd ) != sl->sl_thread ) {
+		if ( want >= dtblsize ) {
+			return -1;
+		}
+		s = fcntl( sl->sl_sd, F_DUPFD, want );
+		if ( s == AC_SOCKET_INVALID ) {
+			return -1;
+		}
+		if ( DAEMON_ID( s ) == sl->sl_thread ) {
+			tcp_close( sl->sl_sd );
+			sl->sl_sd = s;
+		} else {
+			tcp_close( s );
+			want = s - DAEMON_ID( s ) + sl->sl_thread;
+			if ( want <= s ) want += slapd_daemon_mask + 1;
+		}
+	}
+
+	return 0;
+}
+#endif /* SLAP_REUSEPORT */
+
 static int
 slap_open_listener(
 	const char* url,
@@ -1310,6 +1456,8 @@ slap_open_listener(
 	l.sl_url.bv_val = NULL;
 	l.sl_mute = 0;
 	l.sl_busy = 0;
+	l.sl_thread = -1;
+	l.sl_accepts = 0;
 
 #ifndef HAVE_TLS
 	if( ldap_pvt_url_scheme2tls( lud->lud_scheme ) ) {
@@ -1450,6 +1598,11 @@ slap_open_listener(
 					(long) l.sl_sd, err, sock_errstr(err) );
 			}
 #endif /* SO_REUSEADDR */
+#ifdef SLAP_REUSEPORT
+			if ( slapd_listener_reuseport && socktype == SOCK_STREAM ) {
+				slap_reuseport_setopt( s );
+			}
+#endif /* SLAP_REUSEPORT */
 		}
 
 		switch( (*sal)->sa_family ) {
@@ -1576,6 +1729,17 @@ slap_open_listener(
 		*li = l;
 		slap_listeners[*cur] = li;
 		(*cur)++;
+
+#ifdef SLAP_REUSEPORT
+		if ( slapd_listener_reuseport && socktype == SOCK_STREAM
+#ifdef LDAP_PF_LOCAL
+			&& (*sal)->sa_family != AF_LOCAL
+#endif /* LDAP_PF_LOCAL */
+			)
+		{
+			slap_reuseport_clone( li, addrlen, listeners, cur );
+		}
+#endif /* SLAP_REUSEPORT */
 		sal++;
 	}
 
@@ -1733,6 +1897,46 @@ slapd_daemon_destroy( void )
 }
 
 
+/*
+ * Called once the configuration has been read, before anything
+ * (e.g. back-monitor) looks at the listeners: close the SO_REUSEPORT
+ * sockets that have no listener thread to serve them, and hand each
+ * of the others to its own thread.  None of them is listening yet,
+ * so no connection can be lost on the sockets that get closed.
+ */
+void
+slapd_assign_listeners( void )
+{
+#ifdef SLAP_REUSEPORT
+	int i, j;
+
+	if ( slap_listeners == NULL ) return;
+
+	for ( i = 0, j = 0; slap_listeners[i] != NULL; i++ ) {
+		Listener *lr = slap_listeners[i];
+
+		if ( lr->sl_thread >= slapd_daemon_threads ) {
+			tcp_close( SLAP_FD2SOCK( lr->sl_sd ) );
+			ber_memfree( lr->sl_url.bv_val );
+			ber_memfree( lr->sl_name.bv_val );
+			free( lr );
+			continue;
+		}
+
+		/* not fatal, the socket is just served by another thread */
+		if ( lr->sl_thread > -1 && slap_reuseport_move( lr ) ) {
+			int err = errno;
+			Debug( LDAP_DEBUG_ANY,
+				"daemon: unable to assign %s to listener thread %d "
+				"errno=%d\n", lr->sl_name.bv_val, lr->sl_thread, err );
+		}
+
+		slap_listeners[j++] = lr;
+	}
+	slap_listeners[j] = NULL;
+#endif /* SLAP_REUSEPORT */
+}
+
 static void
 close_listeners(
 	int remove )
@@ -1818,6 +2022,13 @@ slap_listener(
 
 	s = accept( SLAP_FD2SOCK( sl->sl_sd ), (struct sockaddr *) &from, &len );
 
+	/* sl_busy serializes accepts on this listener, but not on the
+	 * other listeners of its thread */
+	if ( s != AC_SOCKET_INVALID ) {
+		sl->sl_accepts++;
+		SLAP_COUNTER_ADD( &slap_daemon[DAEMON_ID(sl->sl_sd)].sd_accepts, 1 );
+	}
+
 	/* Resume the listener FD to allow concurrent-processing of
 	 * additional incoming connections.
 	 */
@@ -3026,6 +3237,14 @@ slapd_get_listeners( void )
 	return slap_listeners;
 }
 
+/* connections accepted by listener thread t */
+unsigned long
+slapd_get_accepts( int t )
+{
+	if ( t < 0 || t >= slapd_daemon_threads ) return 0;
+	return slap_daemon[t].sd_accepts;
+}
+
 void
 slap_wake_listener()
 {
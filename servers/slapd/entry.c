@@ -68,6 +68,15 @@ static slap_list *entry_chunks;
 static Entry *entry_list;
 static ldap_pvt_thread_mutex_t entry_mutex;
 
+/* Memory the entry caches of all databases may use together, in
+ * bytes. Zero means no shared limit.
+ */
+unsigned long entry_cache_budget;
+static unsigned long entry_cache_used;
+#ifndef SLAP_ATOMIC_ADD
+static ldap_pvt_thread_mutex_t entry_cache_mutex;
+#endif
+
 int entry_destroy(void)
 {
 	slap_list *e;
@@ -81,6 +90,9 @@ int entry_destroy(void)
 		free( e );
 	}
 
+#ifndef SLAP_ATOMIC_ADD
+	ldap_pvt_thread_mutex_destroy( &entry_cache_mutex );
+#endif
 	ldap_pvt_thread_mutex_destroy( &entry_mutex );
 	ldap_pvt_thread_mutex_destroy( &entry2str_mutex );
 	return attr_destroy();
@@ -91,9 +103,56 @@ entry_init(void)
 {
 	ldap_pvt_thread_mutex_init( &entry2str_mutex );
 	ldap_pvt_thread_mutex_init( &entry_mutex );
+#ifndef SLAP_ATOMIC_ADD
+	ldap_pvt_thread_mutex_init( &entry_cache_mutex );
+#endif
 	return attr_init();
 }
 
+/* A backend's entry cache grew (or shrank) by delta bytes */
+void
+entry_cache_charge( long delta )
+{
+#ifdef SLAP_ATOMIC_ADD
+	SLAP_ATOMIC_ADD( &entry_cache_used, delta );
+#else
+	ldap_pvt_thread_mutex_lock( &entry_cache_mutex );
+	entry_cache_used += delta;
+	ldap_pvt_thread_mutex_unlock( &entry_cache_mutex );
+#endif
+}
+
+/* How far the entry caches together are above pct percent of
+ * entry_cache_budget (the budget itself if pct is zero), in bytes.
+ * With mine non-zero, only the part a cache holding mine bytes
+ * should give back, in proportion to its size.
+ */
+unsigned long
+entry_cache_over( int pct, unsigned long mine )
+{
+	unsigned long mark, used, over = 0;
+
+	if ( !entry_cache_budget )
+		return 0;
+	mark = entry_cache_budget;
+	if ( pct )
+		mark = mark / 100 * pct + mark % 100 * pct / 100;
+#ifdef SLAP_ATOMIC_ADD
+	/* a plain read will do, it's only compared to the mark */
+	used = entry_cache_used;
+#else
+	ldap_pvt_thread_mutex_lock( &entry_cache_mutex );
+	used = entry_cache_used;
+	ldap_pvt_thread_mutex_unlock( &entry_cache_mutex );
+#endif
+	if ( used > mark ) {
+		over = used - mark;
+		if ( mine && mine < used )
+			over = (double) over * mine / used;
+	}
+	return over;
+}
+
 Entry *
 str2entry( char *s )
 {
@@ -716,19 +775,19 @@ ber_len_t entry_flatsize(Entry *e, int norm)
 	return len;
 }
 
-/* Flatten an Entry into a buffer. The buffer is filled with just the
- * strings/bervals of all the entry components. Each field is preceded
- * by its length, encoded the way ber_put_len works. Every field is NUL
- * terminated.  The entire buffer size is precomputed so that a single
- * malloc can be performed. The entry size is also recorded,
- * to aid in entry_decode.
+/* An encoded entry normally starts with its attribute count, which
+ * is never zero. A zero byte there is followed by a format byte.
  */
-int entry_encode(Entry *e, struct berval *bv)
+#define	ENTRY_FMT_NAMES		0	/* attributes stored by name */
+#define	ENTRY_FMT_ADINDEX	1	/* by index in an attribute dictionary */
+
+static int entry_encode_int(Entry *e, struct berval *bv, ber_len_t len,
+	int nattrs, int nvals, int *idx)
 {
-	ber_len_t len, dnlen, ndnlen, i;
-	int nattrs, nvals;
+	ber_len_t dnlen, ndnlen, i;
 	Attribute *a;
 	unsigned char *ptr;
+	int n;
 
 	Debug( LDAP_DEBUG_TRACE, "=> entry_encode(0x%08lx): %s\n",
 		(long) e->e_id, e->e_dn, 0 );
@@ -736,11 +795,13 @@ int entry_encode(Entry *e, struct berval *bv)
 	dnlen = e->e_name.bv_len;
 	ndnlen = e->e_nname.bv_len;
 
-	entry_partsize( e, &len, &nattrs, &nvals, 1 );
-
 	bv->bv_len = len;
 	bv->bv_val = ch_malloc(len);
 	ptr = (unsigned char *)bv->bv_val;
+	if (idx) {
+		*ptr++ = '\0';
+		*ptr++ = ENTRY_FMT_ADINDEX;
+	}
 	entry_putlen(&ptr, nattrs);
 	entry_putlen(&ptr, nvals);
 	entry_putlen(&ptr, dnlen);
@@ -752,12 +813,16 @@ int entry_encode(Entry *e, struct berval *bv)
 	ptr += ndnlen;
 	*ptr++ = '\0';
 
-	for (a=e->e_attrs; a; a=a->a_next) {
-		entry_putlen(&ptr, a->a_desc->ad_cname.bv_len);
-		AC_MEMCPY(ptr, a->a_desc->ad_cname.bv_val,
-			a->a_desc->ad_cname.bv_len);
-		ptr += a->a_desc->ad_cname.bv_len;
-		*ptr++ = '\0';
+	for (a=e->e_attrs, n=0; a; a=a->a_next, n++) {
+		if (idx) {
+			entry_putlen(&ptr, idx[n]);
+		} else {
+			entry_putlen(&ptr, a->a_desc->ad_cname.bv_len);
+			AC_MEMCPY(ptr, a->a_desc->ad_cname.bv_val,
+				a->a_desc->ad_cname.bv_len);
+			ptr += a->a_desc->ad_cname.bv_len;
+			*ptr++ = '\0';
+		}
 		if (a->a_vals) {
 			for (i=0; a->a_vals[i].bv_val; i++);
 			assert( i == a->a_numvals );
@@ -790,11 +855,61 @@ int entry_encode(Entry *e, struct berval *bv)
 	return 0;
 }
 
+/* Flatten an Entry into a buffer. The buffer is filled with just the
+ * strings/bervals of all the entry components. Each field is preceded
+ * by its length, encoded the way ber_put_len works. Every field is NUL
+ * terminated.  The entire buffer size is precomputed so that a single
+ * malloc can be performed. The entry size is also recorded,
+ * to aid in entry_decode.
+ */
+int entry_encode(Entry *e, struct berval *bv)
+{
+	ber_len_t len;
+	int nattrs, nvals;
+
+	entry_partsize( e, &len, &nattrs, &nvals, 1 );
+	return entry_encode_int( e, bv, len, nattrs, nvals, NULL );
+}
+
+/* Like entry_encode, but store each attribute as its index in the
+ * caller's dictionary instead of by name, so that entry_decode needs
+ * no schema lookups. Falls back to entry_encode if any attribute
+ * has no index.
+ */
+int entry_encode_ads(Entry *e, struct berval *bv, EntryAdIndex *adx,
+	void *arg)
+{
+	ber_len_t len, namelen;
+	int nattrs, nvals, n, rc;
+	int *idx;
+	Attribute *a;
+
+	entry_partsize( e, &len, &nattrs, &nvals, 1 );
+	idx = ch_malloc( nattrs * sizeof(int) );
+	for (a=e->e_attrs, n=0; a; a=a->a_next, n++) {
+		idx[n] = adx( arg, a->a_desc );
+		if ( !idx[n] ) {
+			ch_free( idx );
+			return entry_encode( e, bv );
+		}
+		namelen = a->a_desc->ad_cname.bv_len;
+		len -= namelen + 1 + entry_lenlen(namelen);
+		len += entry_lenlen(idx[n]);
+	}
+	len += 2;	/* format marker */
+
+	rc = entry_encode_int( e, bv, len, nattrs, nvals, idx );
+	ch_free( idx );
+	return rc;
+}
+
 /* Retrieve an Entry that was stored using entry_encode above.
  * First entry_header must be called to decode the size of the entry.
  * Then a single block of memory must be malloc'd to accomodate the
  * bervals and the bulk data. Next the bulk data is retrieved from
- * the DB and parsed by entry_decode.
+ * the DB and parsed by entry_decode. The bervals normally come first
+ * in the block; a caller that reads the data before it knows their
+ * number may put them after it instead and point eh->vals there.
  *
  * Note: everything is stored in a single contiguous block, so
  * you can not free individual attributes or names from this
@@ -804,6 +919,18 @@ int entry_header(EntryHeader *eh)
 {
 	unsigned char *ptr = (unsigned char *)eh->bv.bv_val;
 
+	eh->format = ENTRY_FMT_NAMES;
+	eh->vals = NULL;
+	if ( !*ptr ) {
+		ptr++;
+		eh->format = *ptr++;
+		if ( eh->format != ENTRY_FMT_ADINDEX ) {
+			Debug( LDAP_DEBUG_ANY,
+				"entry_header: unknown entry format %d\n",
+				eh->format, 0, 0 );
+			return LDAP_OTHER;
+		}
+	}
 	eh->nattrs = entry_getlen(&ptr);
 	if ( !eh->nattrs ) {
 		Debug( LDAP_DEBUG_ANY,
@@ -883,28 +1010,38 @@ int entry_decode(EntryHeader *eh, Entry **e)
 	x->e_bv = eh->bv;
 
 	a = x->e_attrs;
-	bptr = (BerVarray)eh->bv.bv_val;
+	bptr = eh->vals ? eh->vals : (BerVarray)eh->bv.bv_val;
 
 	while ((i = entry_getlen(&ptr))) {
-		struct berval bv;
-		bv.bv_len = i;
-		bv.bv_val = (char *) ptr;
-		ad = NULL;
-		rc = slap_bv2ad( &bv, &ad, &text );
-
-		if( rc != LDAP_SUCCESS ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"<= entry_decode: str2ad(%s): %s\n", ptr, text, 0 );
-			rc = slap_bv2undef_ad( &bv, &ad, &text, 0 );
+		if ( eh->format == ENTRY_FMT_ADINDEX ) {
+			if ( i >= eh->nads || !eh->ads[i] ) {
+				Debug( LDAP_DEBUG_ANY,
+					"<= entry_decode: unknown attribute index %d\n",
+					i, 0, 0 );
+				return LDAP_OTHER;
+			}
+			ad = eh->ads[i];
+		} else {
+			struct berval bv;
+			bv.bv_len = i;
+			bv.bv_val = (char *) ptr;
+			ad = NULL;
+			rc = slap_bv2ad( &bv, &ad, &text );
 
 			if( rc != LDAP_SUCCESS ) {
-				Debug( LDAP_DEBUG_ANY,
-					"<= entry_decode: slap_str2undef_ad(%s): %s\n",
-						ptr, text, 0 );
-				return rc;
+				Debug( LDAP_DEBUG_TRACE,
+					"<= entry_decode: str2ad(%s): %s\n", ptr, text, 0 );
+				rc = slap_bv2undef_ad( &bv, &ad, &text, 0 );
+
+				if( rc != LDAP_SUCCESS ) {
+					Debug( LDAP_DEBUG_ANY,
+						"<= entry_decode: slap_str2undef_ad(%s): %s\n",
+							ptr, text, 0 );
+					return rc;
+				}
 			}
+			ptr += i + 1;
 		}
-		ptr += i + 1;
 		a->a_desc = ad;
 		a->a_flags = SLAP_ATTR_DONT_FREE_DATA | SLAP_ATTR_DONT_FREE_VALS;
 		j = entry_getlen(&ptr);
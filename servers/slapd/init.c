@@ -60,6 +60,7 @@ BerVarray default_referral = NULL;
  */
 ldap_pvt_thread_pool_t	connection_pool;
 int			connection_pool_max = SLAP_MAX_WORKER_THREADS;
+int			connection_pool_queues = 1;
 int		slap_tool_thread_max = 1;
 
 slap_counters_t			slap_counters, *slap_counters_list;
@@ -285,6 +286,7 @@ void slap_counters_init( slap_counters_t *sc )
 	ldap_pvt_mp_init( sc->sc_pdu );
 	ldap_pvt_mp_init( sc->sc_entries );
 	ldap_pvt_mp_init( sc->sc_refs );
+	ldap_pvt_mp_init( sc->sc_wsaved );
 
 	ldap_pvt_mp_init( sc->sc_ops_initiated );
 	ldap_pvt_mp_init( sc->sc_ops_completed );
@@ -306,6 +308,7 @@ void slap_counters_destroy( slap_counters_t *sc )
 	ldap_pvt_mp_clear( sc->sc_pdu );
 	ldap_pvt_mp_clear( sc->sc_entries );
 	ldap_pvt_mp_clear( sc->sc_refs );
+	ldap_pvt_mp_clear( sc->sc_wsaved );
 
 	ldap_pvt_mp_clear( sc->sc_ops_initiated );
 	ldap_pvt_mp_clear( sc->sc_ops_completed );
@@ -139,6 +139,24 @@ slapd_opt_slp( const char *val, void *arg )
 #endif
 }
 
+static int
+slapd_opt_reuseport( const char *val, void *arg )
+{
+	/* NULL is default */
+	if ( val == NULL || strcasecmp( val, "on" ) == 0 ) {
+		slapd_listener_reuseport = 1;
+
+	} else if ( strcasecmp( val, "off" ) == 0 ) {
+		slapd_listener_reuseport = 0;
+
+	} else {
+		fprintf(stderr, "unrecognized value \"%s\" for reuseport option\n", val );
+		return -1;
+	}
+
+	return 0;
+}
+
 /*
  * Option helper structure:
  * 
@@ -159,6 +177,7 @@ struct option_helper {
 	const char	*oh_usage;
 } option_helpers[] = {
 	{ BER_BVC("slp"),	slapd_opt_slp,	NULL, "slp[={on|off|(attrs)}] enable/disable SLP using (attrs)" },
+	{ BER_BVC("reuseport"),	slapd_opt_reuseport,	NULL, "reuseport[={on|off}] enable/disable one SO_REUSEPORT socket per listener thread" },
 	{ BER_BVNULL, 0, NULL, NULL }
 };
 
@@ -962,6 +981,9 @@ unhandled_option:;
 	 */
 	time( &starttime );
 
+	/* listener-threads is only known now */
+	slapd_assign_listeners();
+
 	connections_init();
 
 	if ( slap_startup( NULL ) != 0 ) {
@@ -32,6 +32,14 @@
 #define	CHECK_CSN	1
 #endif
 
+/* Export psearch matching statistics to cn=monitor, unless
+ * back-monitor is not built or SYNCPROV_NO_MONITOR is defined
+ */
+#if defined(SLAPD_MONITOR) && !defined(SYNCPROV_NO_MONITOR)
+#define	SYNCPROV_MONITOR
+#include "../back-monitor/back-monitor.h"
+#endif
+
 /* A modify request on a particular entry */
 typedef struct modinst {
 	struct modinst *mi_next;
@@ -55,8 +63,24 @@ typedef struct syncres {
 	struct berval s_csn;
 	char s_mode;
 	char s_isreference;
+	char s_superseded;	/* a later change to the same entry is queued */
 } syncres;
 
+/* Attributes that persistent searches are indexed by */
+typedef struct spkeyattr {
+	struct spkeyattr *ka_next;
+	AttributeDescription *ka_ad;
+	int		ka_refcnt;
+	unsigned long	ka_gen;		/* last pass that couldn't key a value */
+} spkeyattr;
+
+/* Persistent searches sharing a search base, or an equality key */
+typedef struct spindex {
+	struct berval	sx_val;		/* base ndn, or index key */
+	spkeyattr	*sx_attr;	/* NULL for search bases */
+	struct syncops	*sx_ops;
+} spindex;
+
 /* Record of a persistent search */
 typedef struct syncops {
 	struct syncops *s_next;
@@ -75,8 +99,15 @@ typedef struct syncops {
 #define	PS_TASK_QUEUED		0x20
 
 	int		s_inuse;	/* reference count */
+	spindex		*s_baseidx;	/* psearches with the same base */
+	spindex		*s_keyidx;	/* psearches with the same equality key */
+	struct syncops	*s_bnext;
+	struct syncops	*s_knext;
+	unsigned long	s_kgen;		/* last matchops pass that hit our key */
+	unsigned long	s_mgen;		/* last matchops pass that chose us */
 	struct syncres *s_res;
 	struct syncres *s_restail;
+	Avlnode	*s_resuuids;	/* latest queued change per entryUUID, if batching */
 	ldap_pvt_thread_mutex_t	s_mutex;
 } syncops;
 
@@ -133,8 +164,24 @@ typedef struct syncprov_info_t {
 	int		si_numops;	/* number of ops since last checkpoint */
 	int		si_nopres;	/* Skip present phase */
 	int		si_usehint;	/* use reload hint */
+	int		si_batch;	/* max responses per write, 0 = no batching */
+	int		si_batchtime;	/* max msec spent on one batch */
 	time_t	si_chklast;	/* time of last checkpoint */
 	Avlnode	*si_mods;	/* entries being modified */
+	Avlnode	*si_bases;	/* psearches by search base */
+	Avlnode	*si_keys;	/* psearches by equality assertion */
+	spkeyattr	*si_keyattrs;
+	unsigned long	si_mgen;	/* matchops pass counter */
+	unsigned long	si_nmatch;	/* matchops statistics, for cn=monitor */
+	unsigned long	si_ntested;
+	unsigned long	si_nskipped;
+	unsigned long	si_matchusec;
+	unsigned long	si_nsuperseded;	/* queued changes dropped while batching */
+#ifdef SYNCPROV_MONITOR
+	int		si_monitoring;	/* monitor schema is available */
+	void		*si_monitor_cb;
+	struct berval	si_monitor_ndn;
+#endif /* SYNCPROV_MONITOR */
 	sessionlog	*si_logs;
 	ldap_pvt_thread_rdwr_t	si_csn_rwlock;
 	ldap_pvt_thread_mutex_t	si_ops_mutex;
@@ -364,6 +411,231 @@ sp_avl_cmp( const void *c1, const void *c2 )
 	return ber_bvcmp( &m1->mt_op->o_req_ndn, &m2->mt_op->o_req_ndn );
 }
 
+/* Persistent search index.
+ *
+ * Every psearch is filed under its search base, and, if its filter
+ * requires an equality match (alone or as a term of a top-level AND),
+ * under the index key of that assertion, as an equality index would
+ * compute it. syncprov_index_match() then only has to look at the
+ * ancestors of a changed entry and at the keys of its values to find
+ * the psearches worth running test_filter() for.
+ */
+static int
+sp_idx_cmp( const void *c1, const void *c2 )
+{
+	const spindex *x1 = c1, *x2 = c2;
+	int rc;
+
+	if ( x1->sx_attr != x2->sx_attr )
+		return x1->sx_attr < x2->sx_attr ? -1 : 1;
+	rc = x1->sx_val.bv_len - x2->sx_val.bv_len;
+	if ( rc ) return rc;
+	return memcmp( x1->sx_val.bv_val, x2->sx_val.bv_val, x1->sx_val.bv_len );
+}
+
+static spindex *
+syncprov_index_get( Avlnode **root, spkeyattr *ka, struct berval *val )
+{
+	spindex sx, *sp;
+
+	sx.sx_attr = ka;
+	sx.sx_val = *val;
+	sp = avl_find( *root, &sx, sp_idx_cmp );
+	if ( !sp ) {
+		sp = ch_malloc( sizeof( spindex ) + val->bv_len + 1 );
+		sp->sx_attr = ka;
+		sp->sx_ops = NULL;
+		sp->sx_val.bv_len = val->bv_len;
+		sp->sx_val.bv_val = (char *)( sp + 1 );
+		AC_MEMCPY( sp->sx_val.bv_val, val->bv_val, val->bv_len );
+		sp->sx_val.bv_val[val->bv_len] = '\0';
+		avl_insert( root, sp, sp_idx_cmp, avl_dup_error );
+	}
+	return sp;
+}
+
+static void
+syncprov_index_put( Avlnode **root, spindex *sp )
+{
+	if ( !sp->sx_ops ) {
+		avl_delete( root, sp, sp_idx_cmp );
+		ch_free( sp );
+	}
+}
+
+/* Pick an equality assertion that any entry matching f must satisfy */
+static AttributeAssertion *
+syncprov_index_ava( Filter *f )
+{
+	if ( f->f_choice == LDAP_FILTER_AND ) {
+		for ( f = f->f_and; f; f = f->f_next ) {
+			AttributeAssertion *ava = syncprov_index_ava( f );
+			if ( ava )
+				return ava;
+		}
+		return NULL;
+	}
+	if ( f->f_choice != LDAP_FILTER_EQUALITY )
+		return NULL;
+#ifdef LDAP_COMP_MATCH
+	if ( f->f_ava->aa_cf )
+		return NULL;
+#endif
+	/* objectClass is rarely selective, dynamic attributes are
+	 * not in the entries we get to see
+	 */
+	if ( f->f_av_desc == slap_schema.si_ad_objectClass ||
+		( f->f_av_desc->ad_type->sat_flags & SLAP_AT_DYNAMIC ))
+		return NULL;
+	return f->f_ava;
+}
+
+/* File a new psearch in the index. Called with si_ops_mutex held. */
+static void
+syncprov_index_add( Operation *op, syncprov_info_t *si, syncops *so )
+{
+	AttributeAssertion *ava;
+	AttributeDescription *ad;
+	MatchingRule *mr;
+	spkeyattr *ka;
+	BerVarray keys = NULL;
+
+	so->s_baseidx = syncprov_index_get( &si->si_bases, NULL, &so->s_base );
+	so->s_bnext = so->s_baseidx->sx_ops;
+	so->s_baseidx->sx_ops = so;
+
+	so->s_keyidx = NULL;
+	ava = syncprov_index_ava( so->s_op->ors_filter );
+	if ( !ava )
+		return;
+	ad = ava->aa_desc;
+	mr = ad->ad_type->sat_equality;
+	if ( !mr || !mr->smr_filter || !mr->smr_indexer )
+		return;
+	if ( mr->smr_filter( LDAP_FILTER_EQUALITY, SLAP_INDEX_EQUALITY,
+		ad->ad_type->sat_syntax, mr, &ad->ad_type->sat_cname,
+		&ava->aa_value, &keys, op->o_tmpmemctx ) != LDAP_SUCCESS || !keys )
+		return;
+
+	for ( ka = si->si_keyattrs; ka && ka->ka_ad != ad; ka = ka->ka_next )
+		;
+	if ( !ka ) {
+		ka = ch_calloc( 1, sizeof( spkeyattr ));
+		ka->ka_ad = ad;
+		ka->ka_next = si->si_keyattrs;
+		si->si_keyattrs = ka;
+	}
+	ka->ka_refcnt++;
+
+	so->s_keyidx = syncprov_index_get( &si->si_keys, ka, &keys[0] );
+	so->s_knext = so->s_keyidx->sx_ops;
+	so->s_keyidx->sx_ops = so;
+	ber_bvarray_free_x( keys, op->o_tmpmemctx );
+}
+
+/* Remove a psearch from the index. Called with si_ops_mutex held. */
+static void
+syncprov_index_del( syncprov_info_t *si, syncops *so )
+{
+	syncops **sp;
+
+	if ( so->s_baseidx ) {
+		for ( sp = &so->s_baseidx->sx_ops; *sp != so; sp = &(*sp)->s_bnext )
+			;
+		*sp = so->s_bnext;
+		syncprov_index_put( &si->si_bases, so->s_baseidx );
+		so->s_baseidx = NULL;
+	}
+	if ( so->s_keyidx ) {
+		spkeyattr *ka = so->s_keyidx->sx_attr, **kp;
+
+		for ( sp = &so->s_keyidx->sx_ops; *sp != so; sp = &(*sp)->s_knext )
+			;
+		*sp = so->s_knext;
+		syncprov_index_put( &si->si_keys, so->s_keyidx );
+		so->s_keyidx = NULL;
+
+		if ( !--ka->ka_refcnt ) {
+			for ( kp = &si->si_keyattrs; *kp != ka; kp = &(*kp)->ka_next )
+				;
+			*kp = ka->ka_next;
+			ch_free( ka );
+		}
+	}
+}
+
+/* Mark with a new pass number the psearches whose scope contains ndn
+ * and whose indexed assertion, if any, shares a key with a value of e.
+ * Called with si_ops_mutex held.
+ */
+static unsigned long
+syncprov_index_match( Operation *op, syncprov_info_t *si, Entry *e,
+	struct berval *ndn )
+{
+	unsigned long gen = ++si->si_mgen;
+	spkeyattr *ka;
+	spindex sx, *sp;
+	syncops *so;
+	struct berval dn;
+	int i, depth, scope;
+
+	for ( ka = si->si_keyattrs; ka; ka = ka->ka_next ) {
+		AttributeDescription *ad = ka->ka_ad;
+		MatchingRule *mr = ad->ad_type->sat_equality;
+		Attribute *a;
+
+		for ( a = attrs_find( e->e_attrs, ad ); a;
+			a = attrs_find( a->a_next, ad )) {
+			BerVarray keys = NULL;
+
+			/* A subtype with its own matching rule may match values
+			 * that key differently; take all of them then.
+			 */
+			if ( a->a_desc->ad_type->sat_equality != mr ||
+				mr->smr_indexer( LDAP_FILTER_EQUALITY, SLAP_INDEX_EQUALITY,
+					ad->ad_type->sat_syntax, mr, &ad->ad_type->sat_cname,
+					a->a_nvals, &keys, op->o_tmpmemctx ) != LDAP_SUCCESS ) {
+				ka->ka_gen = gen;
+				break;
+			}
+			if ( !keys )
+				continue;
+			sx.sx_attr = ka;
+			for ( i = 0; !BER_BVISNULL( &keys[i] ); i++ ) {
+				sx.sx_val = keys[i];
+				sp = avl_find( si->si_keys, &sx, sp_idx_cmp );
+				if ( !sp )
+					continue;
+				for ( so = sp->sx_ops; so; so = so->s_knext )
+					so->s_kgen = gen;
+			}
+			ber_bvarray_free_x( keys, op->o_tmpmemctx );
+		}
+	}
+
+	sx.sx_attr = NULL;
+	dn = *ndn;
+	for ( depth = 0;; depth++ ) {
+		sx.sx_val = dn;
+		sp = avl_find( si->si_bases, &sx, sp_idx_cmp );
+		for ( so = sp ? sp->sx_ops : NULL; so; so = so->s_bnext ) {
+			scope = so->s_op->ors_scope;
+			if (( scope == LDAP_SCOPE_BASE && depth != 0 ) ||
+				( scope == LDAP_SCOPE_ONELEVEL && depth != 1 ) ||
+				( scope == LDAP_SCOPE_SUBORDINATE && depth == 0 ))
+				continue;
+			if ( so->s_keyidx && so->s_kgen != gen &&
+				so->s_keyidx->sx_attr->ka_gen != gen )
+				continue;
+			so->s_mgen = gen;
+		}
+		if ( BER_BVISEMPTY( &dn ))
+			break;
+		dnParent( &dn, &dn );
+	}
+	return gen;
+}
+
 /* syncprov_findbase:
  *   finds the true DN of the base of a search (with alias dereferencing) and
  * checks to make sure the base entry doesn't get replaced with a different
@@ -798,6 +1070,7 @@ syncprov_free_syncop( syncops *so )
 		ch_free( so->s_op );
 	}
 	ch_free( so->s_base.bv_val );
+	avl_free( so->s_resuuids, NULL );
 	for ( sr=so->s_res; sr; sr=srnext ) {
 		srnext = sr->s_next;
 		if ( sr->s_e ) {
@@ -907,19 +1180,39 @@ syncprov_sendresp( Operation *op, opcookie *opc, syncops *so, int mode )
 static void
 syncprov_qstart( syncops *so );
 
+/* Find the queued response for an entryUUID */
+static int
+sr_uuid_cmp( const void *c1, const void *c2 )
+{
+	const syncres *r1 = c1, *r2 = c2;
+	int rc;
+
+	rc = r1->s_uuid.bv_len - r2->s_uuid.bv_len;
+	if ( rc ) return rc;
+	return memcmp( r1->s_uuid.bv_val, r2->s_uuid.bv_val, r1->s_uuid.bv_len );
+}
+
 /* Play back queued responses */
 static int
 syncprov_qplay( Operation *op, syncops *so )
 {
 	slap_overinst *on = LDAP_SLIST_FIRST(&so->s_op->o_extra)->oe_key;
+	syncprov_info_t *si = on->on_bi.bi_private;
 	syncres *sr;
 	Entry *e;
 	opcookie opc;
-	int rc = 0;
+	int rc = 0, sent = 0, batch = 0;
+	struct timeval start, now;
+	slap_wbatch wb;
 
 	opc.son = on;
 
-	do {
+	if ( si->si_batch ) {
+		batch = slap_write_batch_begin( op, &wb, 0 );
+		gettimeofday( &start, NULL );
+	}
+
+	for (;;) {
 		ldap_pvt_thread_mutex_lock( &so->s_mutex );
 		sr = so->s_res;
 		if ( sr )
@@ -929,13 +1222,21 @@ syncprov_qplay( Operation *op, syncops *so )
 		/* Exit loop with mutex held */
 		if ( !sr || so->s_op->o_abandon )
 			break;
+		if ( so->s_resuuids && !sr->s_superseded &&
+			avl_find( so->s_resuuids, sr, sr_uuid_cmp ) == sr )
+			avl_delete( &so->s_resuuids, sr, sr_uuid_cmp );
 		ldap_pvt_thread_mutex_unlock( &so->s_mutex );
 
-		if ( sr->s_mode == LDAP_SYNC_NEW_COOKIE ) {
+		if ( sr->s_superseded ) {
+			ldap_pvt_thread_mutex_lock( &si->si_ops_mutex );
+			si->si_nsuperseded++;
+			ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
+		} else if ( sr->s_mode == LDAP_SYNC_NEW_COOKIE ) {
 			SlapReply rs = { REP_INTERMEDIATE };
 
 			rc = syncprov_sendinfo( op, &rs, LDAP_TAG_SYNC_NEW_COOKIE,
 				&sr->s_csn, 0, NULL, 0 );
+			sent++;
 		} else {
 			opc.sdn = sr->s_dn;
 			opc.sndn = sr->s_ndn;
@@ -945,7 +1246,7 @@ syncprov_qplay( Operation *op, syncops *so )
 			opc.se = sr->s_e;
 
 			rc = syncprov_sendresp( op, &opc, so, sr->s_mode );
-
+			sent++;
 		}
 		if ( sr->s_e ) {
 			if ( !dec_mutexint( sr->s_e->e_private )) {
@@ -956,16 +1257,32 @@ syncprov_qplay( Operation *op, syncops *so )
 
 		ch_free( sr );
 
+		/* Without batching, send one change at a time, to prevent
+		 * one psearch from hogging all the CPU. With it, stop once
+		 * the batch is full or has taken long enough.
+		 */
+		if ( rc == 0 && si->si_batch && sent < si->si_batch ) {
+			gettimeofday( &now, NULL );
+			if (( now.tv_sec - start.tv_sec ) * 1000 +
+				( now.tv_usec - start.tv_usec ) / 1000 < si->si_batchtime )
+				continue;
+		}
+
 		/* Exit loop with mutex held */
 		ldap_pvt_thread_mutex_lock( &so->s_mutex );
+		break;
+	}
 
-	} while (0);
+	if ( batch ) {
+		ldap_pvt_thread_mutex_unlock( &so->s_mutex );
+		if ( slap_write_batch_end( op ) < 0 && rc == 0 )
+			rc = -1;
+		ldap_pvt_thread_mutex_lock( &so->s_mutex );
+	}
 
-	/* We now only send one change at a time, to prevent one
-	 * psearch from hogging all the CPU. Resubmit this task if
-	 * there are more responses queued and no errors occurred.
+	/* Resubmit this task if there are more responses queued
+	 * and no errors occurred.
 	 */
-
 	if ( rc == 0 && so->s_res ) {
 		syncprov_qstart( so );
 	} else {
@@ -1027,13 +1344,12 @@ syncprov_qstart( syncops *so )
 static int
 syncprov_qresp( opcookie *opc, syncops *so, int mode )
 {
+	syncprov_info_t	*si = opc->son->on_bi.bi_private;
 	syncres *sr;
 	int srsize;
 	struct berval cookie = opc->sctxcsn;
 
 	if ( mode == LDAP_SYNC_NEW_COOKIE ) {
-		syncprov_info_t	*si = opc->son->on_bi.bi_private;
-
 		slap_compose_sync_cookie( NULL, &cookie, si->si_ctxcsn,
 			so->s_rid, slap_serverID ? slap_serverID : -1);
 	}
@@ -1071,7 +1387,27 @@ syncprov_qresp( opcookie *opc, syncops *so, int mode )
 		ch_free( cookie.bv_val );
 	}
 
+	sr->s_superseded = 0;
+
 	ldap_pvt_thread_mutex_lock( &so->s_mutex );
+	/* If the consumer hasn't been sent an earlier change to this
+	 * entry yet, this one makes it obsolete.
+	 */
+	if ( si->si_batch && mode != LDAP_SYNC_NEW_COOKIE &&
+		!BER_BVISEMPTY( &sr->s_uuid )) {
+		syncres *old = avl_find( so->s_resuuids, sr, sr_uuid_cmp );
+
+		if ( old ) {
+			avl_delete( &so->s_resuuids, old, sr_uuid_cmp );
+			if ( old->s_mode != LDAP_SYNC_DELETE ) {
+				/* the consumer never saw the entry appear */
+				if ( old->s_mode == LDAP_SYNC_ADD && mode == LDAP_SYNC_MODIFY )
+					sr->s_mode = LDAP_SYNC_ADD;
+				old->s_superseded = 1;
+			}
+		}
+		avl_insert( &so->s_resuuids, sr, sr_uuid_cmp, avl_dup_error );
+	}
 	if ( !so->s_res ) {
 		so->s_res = sr;
 	} else {
@@ -1133,6 +1469,7 @@ syncprov_op_abandon( Operation *op, SlapReply *rs )
 			so->s_op->o_msgid == op->orn_msgid ) {
 				so->s_op->o_abandon = 1;
 				soprev->s_next = so->s_next;
+				syncprov_index_del( si, so );
 				break;
 		}
 	}
@@ -1172,6 +1509,8 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 	struct berval newdn;
 	int freefdn = 0;
 	BackendDB *b0 = op->o_bd, db;
+	unsigned long gen, tested = 0, skipped = 0;
+	struct timeval tv, tv2;
 
 	fc.fdn = &op->o_req_ndn;
 	/* compute new DN */
@@ -1227,7 +1566,9 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 		ber_dupbv_x( &opc->sndn, &e->e_nname, op->o_tmpmemctx );
 	}
 
+	gettimeofday( &tv, NULL );
 	ldap_pvt_thread_mutex_lock( &si->si_ops_mutex );
+	gen = syncprov_index_match( op, si, e, fc.fdn );
 	for (ss = si->si_ops, sprev = (syncops *)&si->si_ops; ss;
 		sprev = ss, ss=snext)
 	{
@@ -1240,6 +1581,15 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 		if ( ss->s_op->o_abandon )
 			continue;
 
+		/* Before the write, only the psearches the index picked can
+		 * be of interest. The rest are validated and sent their new
+		 * cookie afterwards.
+		 */
+		if ( saveit && ss->s_mgen != gen ) {
+			skipped++;
+			continue;
+		}
+
 		/* Don't send ops back to the originator */
 		if ( opc->osid > 0 && opc->osid == ss->s_sid ) {
 			Debug( LDAP_DEBUG_SYNC, "syncprov_matchops: skipping original sid %03x\n",
@@ -1266,6 +1616,7 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 			send_ldap_error( ss->s_op, &rs, LDAP_SYNC_REFRESH_REQUIRED,
 				"search base has changed" );
 			sprev->s_next = snext;
+			syncprov_index_del( si, ss );
 			syncprov_drop_psearch( ss, 1 );
 			ss = sprev;
 			continue;
@@ -1293,7 +1644,11 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 			}
 		}
 
-		if ( fc.fscope ) {
+		if ( fc.fscope && ss->s_mgen != gen ) {
+			/* the index already ruled it out */
+			rc = LDAP_COMPARE_FALSE;
+			skipped++;
+		} else if ( fc.fscope ) {
 			ldap_pvt_thread_mutex_lock( &ss->s_mutex );
 			op2 = *ss->s_op;
 			oh = *op->o_hdr;
@@ -1311,6 +1666,7 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 			}
 			ldap_pvt_thread_mutex_unlock( &ss->s_mutex );
 			rc = test_filter( &op2, e, op2.ors_filter );
+			tested++;
 		}
 
 		Debug( LDAP_DEBUG_TRACE, "syncprov_matchops: sid %03x fscope %d rc %d\n",
@@ -1344,6 +1700,12 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 			syncprov_free_syncop( ss );
 		}
 	}
+	gettimeofday( &tv2, NULL );
+	si->si_nmatch++;
+	si->si_ntested += tested;
+	si->si_nskipped += skipped;
+	si->si_matchusec += ( tv2.tv_sec - tv.tv_sec ) * 1000000 +
+		tv2.tv_usec - tv.tv_usec;
 	ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
 
 	if ( op->o_tag != LDAP_REQ_ADD && e ) {
@@ -2323,6 +2685,11 @@ syncprov_search_response( Operation *op, SlapReply *rs )
 			if ( !BER_BVISNULL( &cookie ))
 				op->o_tmpfree( cookie.bv_val, op->o_tmpmemctx );
 
+			/* The refresh phase must be on the wire before any
+			 * persist phase response can be sent by another thread
+			 */
+			slap_write_batch_end( op );
+
 			/* Detach this Op from frontend control */
 			ldap_pvt_thread_mutex_lock( &op->o_conn->c_mutex );
 
@@ -2413,6 +2780,7 @@ syncprov_op_search( Operation *op, SlapReply *rs )
 		ldap_pvt_thread_mutex_lock( &si->si_ops_mutex );
 		sop->s_next = si->si_ops;
 		si->si_ops = sop;
+		syncprov_index_add( op, si, sop );
 		ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
 	}
 
@@ -2495,6 +2863,7 @@ bailout:
 							while ( *sp != sop )
 								sp = &(*sp)->s_next;
 							*sp = sop->s_next;
+							syncprov_index_del( si, sop );
 							ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
 							ch_free( sop );
 						}
@@ -2716,7 +3085,8 @@ enum {
 	SP_CHKPT = 1,
 	SP_SESSL,
 	SP_NOPRES,
-	SP_USEHINT
+	SP_USEHINT,
+	SP_BATCH
 };
 
 static ConfigDriver sp_cf_gen;
@@ -2738,6 +3108,10 @@ static ConfigTable spcfg[] = {
 		sp_cf_gen, "( OLcfgOvAt:1.4 NAME 'olcSpReloadHint' "
 			"DESC 'Observe Reload Hint in Request control' "
 			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
+	{ "syncprov-batch", "count> <msec", 3, 3, 0, ARG_MAGIC|SP_BATCH,
+		sp_cf_gen, "( OLcfgOvAt:1.5 NAME 'olcSpBatch' "
+			"DESC 'Persistent search responses per write, and max msec per batch' "
+			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ NULL, NULL, 0, 0, 0, ARG_IGNORED }
 };
 
@@ -2750,6 +3124,7 @@ static ConfigOCs spocs[] = {
 			"$ olcSpSessionlog "
 			"$ olcSpNoPresent "
 			"$ olcSpReloadHint "
+			"$ olcSpBatch "
 		") )",
 			Cft_Overlay, spcfg },
 	{ NULL, 0, NULL }
@@ -2803,6 +3178,21 @@ sp_cf_gen(ConfigArgs *c)
 				rc = 1;
 			}
 			break;
+		case SP_BATCH:
+			if ( si->si_batch ) {
+				struct berval bv;
+				bv.bv_len = snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"%d %d", si->si_batch, si->si_batchtime );
+				if ( bv.bv_len >= sizeof( c->cr_msg ) ) {
+					rc = 1;
+				} else {
+					bv.bv_val = c->cr_msg;
+					value_add_one( &c->rvalue_vals, &bv );
+				}
+			} else {
+				rc = 1;
+			}
+			break;
 		}
 		return rc;
 	} else if ( c->op == LDAP_MOD_DELETE ) {
@@ -2829,6 +3219,10 @@ sp_cf_gen(ConfigArgs *c)
 			else
 				rc = LDAP_NO_SUCH_ATTRIBUTE;
 			break;
+		case SP_BATCH:
+			si->si_batch = 0;
+			si->si_batchtime = 0;
+			break;
 		}
 		return rc;
 	}
@@ -2894,10 +3288,358 @@ sp_cf_gen(ConfigArgs *c)
 	case SP_USEHINT:
 		si->si_usehint = c->value_int;
 		break;
+	case SP_BATCH: {
+		int batch, msec;
+
+		if ( lutil_atoi( &batch, c->argv[1] ) != 0 || batch < 0 ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s invalid batch count \"%s\"",
+				c->argv[0], c->argv[1] );
+			Debug( LDAP_DEBUG_CONFIG|LDAP_DEBUG_NONE,
+				"%s: %s\n", c->log, c->cr_msg, 0 );
+			return ARG_BAD_CONF;
+		}
+		if ( lutil_atoi( &msec, c->argv[2] ) != 0 || msec <= 0 ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s invalid batch time \"%s\"",
+				c->argv[0], c->argv[2] );
+			Debug( LDAP_DEBUG_CONFIG|LDAP_DEBUG_NONE,
+				"%s: %s\n", c->log, c->cr_msg, 0 );
+			return ARG_BAD_CONF;
+		}
+		si->si_batch = batch;
+		si->si_batchtime = msec;
+		}
+		break;
+	}
+	return rc;
+}
+
+#ifdef SYNCPROV_MONITOR
+
+static AttributeDescription	*ad_olmSyncProvPsearches,
+	*ad_olmSyncProvMatches, *ad_olmSyncProvFilterTests,
+	*ad_olmSyncProvFilterSkips, *ad_olmSyncProvMatchTime,
+	*ad_olmSyncProvSuperseded;
+static ObjectClass		*oc_olmSyncProv;
+
+static struct {
+	char			*name;
+	char			*oid;
+}		s_oid[] = {
+	{ "olmSyncProvAttributes",		"olmDatabaseAttributes:3" },
+	{ "olmSyncProvObjectClasses",		"olmDatabaseObjectClasses:3" },
+
+	{ NULL }
+};
+
+/* all the statistics are read-only counters */
+#define SYNCPROV_COUNTER(n, name, desc) \
+	"( olmSyncProvAttributes:" n " NAME ( '" name "' ) DESC '" desc "' " \
+	"SUP monitorCounter NO-USER-MODIFICATION USAGE dSAOperation )"
+
+static struct {
+	char			*desc;
+	AttributeDescription	**ad;
+}		s_at[] = {
+	{ SYNCPROV_COUNTER( "1", "olmSyncProvPsearches",
+		"Number of active persistent searches" ),
+		&ad_olmSyncProvPsearches },
+	{ SYNCPROV_COUNTER( "2", "olmSyncProvMatches",
+		"Number of times writes were matched against persistent searches" ),
+		&ad_olmSyncProvMatches },
+	{ SYNCPROV_COUNTER( "3", "olmSyncProvFilterTests",
+		"Number of persistent search filters evaluated" ),
+		&ad_olmSyncProvFilterTests },
+	{ SYNCPROV_COUNTER( "4", "olmSyncProvFilterSkips",
+		"Number of persistent search filters the index avoided" ),
+		&ad_olmSyncProvFilterSkips },
+	{ SYNCPROV_COUNTER( "5", "olmSyncProvMatchTime",
+		"Microseconds spent matching writes against persistent searches" ),
+		&ad_olmSyncProvMatchTime },
+	{ SYNCPROV_COUNTER( "6", "olmSyncProvSuperseded",
+		"Number of queued responses dropped for a later change to the same entry" ),
+		&ad_olmSyncProvSuperseded },
+	{ NULL }
+};
+
+static struct {
+	char		*desc;
+	ObjectClass	**oc;
+}		s_oc[] = {
+	/* augments an existing object, so it must be AUXILIARY */
+	{ "( olmSyncProvObjectClasses:1 "
+		"NAME ( 'olmSyncProv' ) "
+		"SUP top AUXILIARY "
+		"MAY ( "
+			"olmSyncProvPsearches "
+			"$ olmSyncProvMatches "
+			"$ olmSyncProvFilterTests "
+			"$ olmSyncProvFilterSkips "
+			"$ olmSyncProvMatchTime "
+			"$ olmSyncProvSuperseded "
+			") )",
+		&oc_olmSyncProv },
+
+	{ NULL }
+};
+
+static int
+syncprov_monitor_update(
+	Operation	*op,
+	SlapReply	*rs,
+	Entry		*e,
+	void		*priv )
+{
+	syncprov_info_t		*si = (syncprov_info_t *) priv;
+	syncops			*so;
+	unsigned long		n = 0, vals[ 6 ];
+	Attribute		*a;
+	char			buf[ SLAP_TEXT_BUFLEN ];
+	struct berval		bv;
+	int			i;
+
+	ldap_pvt_thread_mutex_lock( &si->si_ops_mutex );
+	for ( so = si->si_ops; so; so = so->s_next )
+		n++;
+	vals[ 0 ] = n;
+	vals[ 1 ] = si->si_nmatch;
+	vals[ 2 ] = si->si_ntested;
+	vals[ 3 ] = si->si_nskipped;
+	vals[ 4 ] = si->si_matchusec;
+	vals[ 5 ] = si->si_nsuperseded;
+	ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
+
+	bv.bv_val = buf;
+	for ( i = 0; s_at[ i ].desc != NULL; i++ ) {
+		a = attr_find( e->e_attrs, *s_at[ i ].ad );
+		assert( a != NULL );
+		bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", vals[ i ] );
+		ber_bvreplace( &a->a_vals[ 0 ], &bv );
+	}
+
+	return SLAP_CB_CONTINUE;
+}
+
+static int
+syncprov_monitor_free(
+	Entry		*e,
+	void		**priv )
+{
+	struct berval	values[ 2 ];
+	Modification	mod = { 0 };
+
+	const char	*text;
+	char		textbuf[ SLAP_TEXT_BUFLEN ];
+
+	int		i, rc;
+
+	/* NOTE: if slap_shutdown != 0, priv might have already been freed */
+	*priv = NULL;
+
+	/* Remove objectClass */
+	mod.sm_op = LDAP_MOD_DELETE;
+	mod.sm_desc = slap_schema.si_ad_objectClass;
+	mod.sm_values = values;
+	mod.sm_numvals = 1;
+	values[ 0 ] = oc_olmSyncProv->soc_cname;
+	BER_BVZERO( &values[ 1 ] );
+
+	rc = modify_delete_values( e, &mod, 1, &text,
+		textbuf, sizeof( textbuf ) );
+	/* don't care too much about return code... */
+
+	/* remove attrs */
+	mod.sm_values = NULL;
+	mod.sm_numvals = 0;
+	for ( i = 0; s_at[ i ].desc != NULL; i++ ) {
+		mod.sm_desc = *s_at[ i ].ad;
+		rc = modify_delete_values( e, &mod, 1, &text,
+			textbuf, sizeof( textbuf ) );
+		/* don't care too much about return code... */
+	}
+
+	return SLAP_CB_CONTINUE;
+}
+
+/*
+ * call from within syncprov_db_init()
+ */
+static int
+syncprov_monitor_initialize( void )
+{
+	int		i, code;
+	ConfigArgs c;
+	char	*argv[ 3 ];
+
+	static int	syncprov_monitor_initialized = 0;
+
+	if ( backend_info( "monitor" ) == NULL ) {
+		return -1;
+	}
+
+	if ( syncprov_monitor_initialized++ ) {
+		return 0;
+	}
+
+	/* register schema here */
+
+	argv[ 0 ] = "syncprov monitor";
+	c.argv = argv;
+	c.argc = 3;
+	c.fname = argv[0];
+
+	for ( i = 0; s_oid[ i ].name; i++ ) {
+		c.lineno = i;
+		argv[ 1 ] = s_oid[ i ].name;
+		argv[ 2 ] = s_oid[ i ].oid;
+
+		if ( parse_oidm( &c, 0, NULL ) != 0 ) {
+			Debug( LDAP_DEBUG_ANY, "syncprov_monitor_initialize: "
+				"unable to add objectIdentifier \"%s=%s\"\n",
+				s_oid[ i ].name, s_oid[ i ].oid, 0 );
+			return 1;
+		}
+	}
+
+	for ( i = 0; s_at[ i ].desc != NULL; i++ ) {
+		code = register_at( s_at[ i ].desc, s_at[ i ].ad, 1 );
+		if ( code != LDAP_SUCCESS ) {
+			Debug( LDAP_DEBUG_ANY, "syncprov_monitor_initialize: "
+				"register_at failed\n", 0, 0, 0 );
+			return code;
+		}
+		(*s_at[ i ].ad)->ad_type->sat_flags |= SLAP_AT_HIDE;
 	}
+
+	for ( i = 0; s_oc[ i ].desc != NULL; i++ ) {
+		code = register_oc( s_oc[ i ].desc, s_oc[ i ].oc, 1 );
+		if ( code != LDAP_SUCCESS ) {
+			Debug( LDAP_DEBUG_ANY, "syncprov_monitor_initialize: "
+				"register_oc failed\n", 0, 0, 0 );
+			return code;
+		}
+		(*s_oc[ i ].oc)->soc_flags |= SLAP_OC_HIDE;
+	}
+
+	return 0;
+}
+
+static int
+syncprov_monitor_db_init( BackendDB *be )
+{
+	slap_overinst		*on = (slap_overinst *)be->bd_info;
+	syncprov_info_t		*si = on->on_bi.bi_private;
+
+	si->si_monitoring = syncprov_monitor_initialize() == LDAP_SUCCESS;
+
+	return 0;
+}
+
+static int
+syncprov_monitor_db_open( BackendDB *be )
+{
+	slap_overinst		*on = (slap_overinst *)be->bd_info;
+	syncprov_info_t		*si = on->on_bi.bi_private;
+	Attribute		*a, *next;
+	monitor_callback_t	*cb = NULL;
+	int			i, rc = 0;
+	BackendInfo		*mi;
+	monitor_extra_t		*mbe;
+	struct berval		dummy = BER_BVC( "" );
+
+	if ( !si->si_monitoring ) {
+		return 0;
+	}
+
+	mi = backend_info( "monitor" );
+	if ( !mi || !mi->bi_extra ) {
+		si->si_monitoring = 0;
+		return 0;
+	}
+	mbe = mi->bi_extra;
+
+	/* don't bother if monitor is not configured */
+	if ( !mbe->is_configured() ) {
+		return 0;
+	}
+
+	/* alloc as many as required (plus 1 for objectClass) */
+	a = attrs_alloc( 1 + 6 );
+	if ( a == NULL ) {
+		rc = 1;
+		goto cleanup;
+	}
+
+	a->a_desc = slap_schema.si_ad_objectClass;
+	attr_valadd( a, &oc_olmSyncProv->soc_cname, NULL, 1 );
+	next = a->a_next;
+
+	{
+		struct berval	bv = BER_BVC( "0" );
+
+		for ( i = 0; s_at[ i ].desc != NULL; i++ ) {
+			next->a_desc = *s_at[ i ].ad;
+			attr_valadd( next, &bv, NULL, 1 );
+			next = next->a_next;
+		}
+	}
+
+	cb = ch_calloc( sizeof( monitor_callback_t ), 1 );
+	cb->mc_update = syncprov_monitor_update;
+	cb->mc_free = syncprov_monitor_free;
+	cb->mc_private = (void *)si;
+
+	/* make sure the database is registered; then add monitor attributes */
+	BER_BVZERO( &si->si_monitor_ndn );
+	rc = mbe->register_overlay( be, on, &si->si_monitor_ndn );
+	if ( rc == 0 ) {
+		rc = mbe->register_entry_attrs( &si->si_monitor_ndn, a, cb,
+			&dummy, -1, &dummy );
+	}
+
+cleanup:;
+	if ( rc != 0 ) {
+		if ( cb != NULL ) {
+			ch_free( cb );
+			cb = NULL;
+		}
+	}
+
+	/* store for cleanup */
+	si->si_monitor_cb = (void *)cb;
+
+	/* we don't need to keep track of the attributes, because
+	 * syncprov_monitor_free() takes care of everything */
+	if ( a != NULL ) {
+		attrs_free( a );
+	}
+
 	return rc;
 }
 
+static int
+syncprov_monitor_db_close( BackendDB *be )
+{
+	slap_overinst *on = (slap_overinst *)be->bd_info;
+	syncprov_info_t *si = on->on_bi.bi_private;
+
+	if ( si->si_monitor_cb != NULL ) {
+		BackendInfo		*mi = backend_info( "monitor" );
+		monitor_extra_t		*mbe;
+
+		if ( mi && mi->bi_extra ) {
+			mbe = mi->bi_extra;
+			mbe->unregister_entry_callback( &si->si_monitor_ndn,
+				(monitor_callback_t *)si->si_monitor_cb,
+				NULL, 0, NULL );
+		}
+		si->si_monitor_cb = NULL;
+	}
+
+	return 0;
+}
+
+#endif /* SYNCPROV_MONITOR */
+
 /* ITS#3456 we cannot run this search on the main thread, must use a
  * child thread in order to insure we have a big enough stack.
  */
@@ -2946,6 +3688,10 @@ syncprov_db_open(
 		return rc;
 	}
 
+#ifdef SYNCPROV_MONITOR
+	syncprov_monitor_db_open( be );
+#endif /* SYNCPROV_MONITOR */
+
 	thrctx = ldap_pvt_thread_pool_context();
 	connection_fake_init2( &conn, &opbuf, thrctx, 0 );
 	op = &opbuf.ob_op;
@@ -3027,6 +3773,9 @@ syncprov_db_close(
 	if ( slapMode & SLAP_TOOL_MODE ) {
 		return 0;
 	}
+#ifdef SYNCPROV_MONITOR
+	syncprov_monitor_db_close( be );
+#endif /* SYNCPROV_MONITOR */
 	if ( si->si_numops ) {
 		Connection conn = {0};
 		OperationBuffer opbuf;
@@ -3050,6 +3799,7 @@ syncprov_db_close(
 		rs.sr_err = LDAP_UNAVAILABLE;
 		send_ldap_result( so->s_op, &rs );
 		sonext=so->s_next;
+		syncprov_index_del( si, so );
 		syncprov_drop_psearch( so, 0);
 	}
 	si->si_ops=NULL;
@@ -3091,6 +3841,10 @@ syncprov_db_init(
 	uuid_anlist[0].an_desc = slap_schema.si_ad_entryUUID;
 	uuid_anlist[0].an_name = slap_schema.si_ad_entryUUID->ad_cname;
 
+#ifdef SYNCPROV_MONITOR
+	syncprov_monitor_db_init( be );
+#endif /* SYNCPROV_MONITOR */
+
 	return 0;
 }
 
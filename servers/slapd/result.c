@@ -176,9 +176,164 @@ rs_ensure_entry_modifiable( Operation *op, SlapReply *rs, slap_overinst *on )
 	return 1;
 }
 
+/* Flush a write batch once it holds this many bytes */
+#define SLAP_WRITE_BATCH_MAX	(64*1024)
+/* ...or once its oldest PDU has been queued this long (usec) */
+#define SLAP_WRITE_BATCH_USEC	2000
+/* The send path only looks at the clock every this many PDUs */
+#define SLAP_WRITE_BATCH_TICK	16
+
+static long write_ldap_ber( Operation *op, BerElement *ber );
+
+/* How long the oldest PDU in a batch has been waiting (usec) */
+static long
+write_batch_age( slap_wbatch *wb, struct timeval *now )
+{
+	return ( now->tv_sec - wb->wb_first.tv_sec ) * 1000000 +
+		now->tv_usec - wb->wb_first.tv_usec;
+}
+
+/* Write out op's batch in one go. The buffer is kept for the next one. */
+static long
+write_batch_flush( Operation *op )
+{
+	slap_wbatch *wb = op->o_wbatch;
+	BerElementBuffer berbuf;
+	BerElement *ber = (BerElement *) &berbuf;
+	struct berval bv;
+	long ret;
+
+	if ( !wb || !wb->wb_len )
+		return 0;
+
+	bv.bv_val = wb->wb_buf;
+	bv.bv_len = wb->wb_len;
+	ber_init2( ber, &bv, LBER_USE_DER );
+	ber_set_option( ber, LBER_OPT_BER_BYTES_TO_WRITE, &bv.bv_len );
+	ret = write_ldap_ber( op, ber );
+
+	/* every pdu past the first went out without a write of its own */
+	if ( ret > 0 && wb->wb_pdus > 1 ) {
+		ldap_pvt_thread_mutex_lock( &op->o_counters->sc_mutex );
+		ldap_pvt_mp_add_ulong( op->o_counters->sc_wsaved,
+			(unsigned long)( wb->wb_pdus - 1 ));
+		ldap_pvt_thread_mutex_unlock( &op->o_counters->sc_mutex );
+	}
+	wb->wb_len = 0;
+	wb->wb_pdus = 0;
+	return ret;
+}
+
+/*
+ * Where a PDU of len bytes can be placed at the end of op's batch,
+ * or NULL if it has to be written on its own. Search entries start
+ * gathering once wb_wait of them went out alone; other PDUs only
+ * join a batch that is already going, to stay in order.
+ */
+static char *
+write_batch_room( Operation *op, ber_len_t len, int entry )
+{
+	slap_wbatch *wb = op->o_wbatch;
+
+	if ( !wb )
+		return NULL;
+	if ( !wb->wb_buf ) {
+		if ( !entry || wb->wb_wait-- > 0 )
+			return NULL;
+		wb->wb_buf = ch_malloc( SLAP_WRITE_BATCH_MAX );
+	}
+	if ( wb->wb_len + len > SLAP_WRITE_BATCH_MAX &&
+		write_batch_flush( op ) < 0 )
+		return NULL;
+	if ( len > SLAP_WRITE_BATCH_MAX )
+		return NULL;
+	return wb->wb_buf + wb->wb_len;
+}
+
+/* Account for the len bytes just placed by the caller at the end
+ * of the batch. The age of the batch is looked at every so many
+ * pdus, when the backend calls slap_write_batch_check(), and at
+ * the end.
+ */
+static long
+write_batch_add( Operation *op, ber_len_t len )
+{
+	slap_wbatch *wb = op->o_wbatch;
+	struct timeval now;
+
+	wb->wb_len += len;
+	if ( !wb->wb_pdus++ ) {
+		gettimeofday( &wb->wb_first, NULL );
+
+	} else if ( wb->wb_pdus % SLAP_WRITE_BATCH_TICK == 0 ) {
+		gettimeofday( &now, NULL );
+		if ( write_batch_age( wb, &now ) >= SLAP_WRITE_BATCH_USEC &&
+			write_batch_flush( op ) < 0 )
+			return -1;
+	}
+	return len;
+}
+
+/*
+ * Append the unwritten part of ber to the connection's output queue
+ * for the daemon to finish, unless that would take the queue past
+ * the writequeue limit. Called with c_mutex held.
+ *
+ * Not on TLS connections: an interrupted SSL_write() must be retried
+ * with the very same buffer, and the queue writes from a copy.
+ */
+static int
+write_queue_add( Connection *conn, BerElement *ber )
+{
+	struct berval bv;
+
+#ifdef HAVE_TLS
+	if ( conn->c_is_tls )
+		return -1;
+#endif
+
+	ber_get_option( ber, LBER_OPT_BER_UNFLUSHED, &bv );
+	if ( conn->c_wq_bytes + bv.bv_len > global_writequeue )
+		return -1;
+
+	if ( conn->c_wq_in == NULL &&
+		( conn->c_wq_in = ber_alloc_t( LBER_USE_DER )) == NULL )
+		return -1;
+
+	if ( ber_write( conn->c_wq_in, bv.bv_val, bv.bv_len, 0 ) !=
+		(ber_slen_t) bv.bv_len )
+		return -1;
+
+	conn->c_wq_bytes += bv.bv_len;
+	return 0;
+}
+
 static long send_ldap_ber(
 	Operation *op,
 	BerElement *ber )
+{
+	struct berval bv;
+	char *buf;
+
+	if ( !op->o_wbatch )
+		return write_ldap_ber( op, ber );
+
+	/* small pdus follow the entries into the batch */
+	ber_flatten2( ber, &bv, 0 );
+	buf = write_batch_room( op, bv.bv_len, 0 );
+	if ( buf == NULL ) {
+		if ( write_batch_flush( op ) < 0 )
+			return -1;
+		return write_ldap_ber( op, ber );
+	}
+	AC_MEMCPY( buf, bv.bv_val, bv.bv_len );
+	return write_batch_add( op, bv.bv_len );
+}
+
+static long
+write_ldap_ber(
+	Operation *op,
+	BerElement *ber )
 {
 	Connection *conn = op->o_conn;
 	ber_len_t bytes;
@@ -215,7 +370,7 @@ static long send_ldap_ber(
 
 	/* write the pdu */
 	while( 1 ) {
-		int err;
+		int err = 0;
 
 		/* lock the connection */ 
 		if ( ldap_pvt_thread_mutex_trylock( &conn->c_mutex )) {
@@ -232,13 +387,19 @@ static long send_ldap_ber(
 			continue;
 		}
 
-		if ( ber_flush2( conn->c_sb, ber, LBER_FLUSH_FREE_NEVER ) == 0 ) {
-			ldap_pvt_thread_mutex_unlock( &conn->c_mutex );
-			ret = bytes;
-			break;
+		/* anything already queued for the daemon goes out first */
+		if ( conn->c_wq_bytes ) {
+			err = connection_flush_queued( conn );
 		}
 
-		err = sock_errno();
+		if ( err == 0 ) {
+			if ( ber_flush2( conn->c_sb, ber, LBER_FLUSH_FREE_NEVER ) == 0 ) {
+				ldap_pvt_thread_mutex_unlock( &conn->c_mutex );
+				ret = bytes;
+				break;
+			}
+			err = sock_errno();
+		}
 
 		/*
 		 * we got an error.  if it's ewouldblock, we need to
@@ -259,6 +420,16 @@ static long send_ldap_ber(
 			return -1;
 		}
 
+		/* if the queue has room, leave the rest to the daemon
+		 * instead of holding this thread until the client reads
+		 */
+		if ( global_writequeue && write_queue_add( conn, ber ) == 0 ) {
+			slapd_set_write( conn->c_sd, 2 );
+			ldap_pvt_thread_mutex_unlock( &conn->c_mutex );
+			ret = bytes;
+			break;
+		}
+
 		/* wait for socket to be write-ready */
 		ldap_pvt_thread_mutex_lock( &conn->c_write2_mutex );
 		conn->c_writewaiter = 1;
@@ -290,6 +461,68 @@ static long send_ldap_ber(
 	return ret;
 }
 
+/*
+ * Send op's batch if its oldest PDU has waited too long. The batch is
+ * otherwise only looked at when the next PDU comes in, so backends call
+ * this while they scan or wait, to not hold on to entries already found.
+ */
+long
+slap_write_batch_check( Operation *op )
+{
+	slap_wbatch *wb = op->o_wbatch;
+	struct timeval now;
+
+	if ( !wb || !wb->wb_pdus )
+		return 0;
+	gettimeofday( &now, NULL );
+	if ( write_batch_age( wb, &now ) < SLAP_WRITE_BATCH_USEC )
+		return 0;
+	return write_batch_flush( op );
+}
+
+/* Have the PDUs sent for op gathered in wb into as few writes as
+ * possible until slap_write_batch_end(). Gathering starts once wait
+ * search entries went out on their own, so short searches never pay
+ * for it. A batch goes out when it reaches SLAP_WRITE_BATCH_MAX bytes,
+ * when its oldest PDU is older than SLAP_WRITE_BATCH_USEC, or together
+ * with the operation's result. For senders of long runs of small
+ * responses, where a write and the connection locks per PDU dominate.
+ *
+ * wb hangs off the Opheader, so all copies of op see the same batch
+ * and whichever of them ends it ends it for all. Returns 0 if op
+ * already has a batch going, which the caller then must not end.
+ */
+int
+slap_write_batch_begin( Operation *op, slap_wbatch *wb, int wait )
+{
+	if ( op->o_wbatch )
+		return 0;
+	memset( wb, 0, sizeof( slap_wbatch ));
+	wb->wb_wait = wait;
+	op->o_wbatch = wb;
+	return 1;
+}
+
+/* Write out whatever is left of the batch. Returns the number of
+ * bytes written, or -1 if the connection was lost.
+ */
+long
+slap_write_batch_end( Operation *op )
+{
+	slap_wbatch *wb = op->o_wbatch;
+	long ret;
+
+	if ( !wb )
+		return 0;
+	ret = write_batch_flush( op );
+	op->o_wbatch = NULL;
+	if ( wb->wb_buf ) {
+		ch_free( wb->wb_buf );
+		wb->wb_buf = NULL;
+	}
+	return ret;
+}
+
 static int
 send_ldap_control( BerElement *ber, LDAPControl *c )
 {
@@ -597,6 +830,12 @@ send_ldap_response(
 		ber_free_buf( ber );
 	}
 
+	/* the result goes out at once, along with anything queued before it */
+	if ( bytes >= 0 && op->o_wbatch && rs->sr_type != REP_INTERMEDIATE ) {
+		if ( write_batch_flush( op ) < 0 )
+			bytes = -1;
+	}
+
 	if ( bytes < 0 ) {
 		Debug( LDAP_DEBUG_ANY,
 			"send_ldap_response: ber write failed\n",
@@ -836,6 +1075,58 @@ slap_send_ldap_intermediate( Operation *op, SlapReply *rs )
  * LDAP_SIZELIMIT_EXCEEDED	entry not sent (caller must send sizelimitExceeded)
  */
 
+/* Encoded size of a primitive element with len content octets */
+static ber_len_t
+ber_elem_size( ber_len_t len )
+{
+	ber_len_t n = 2 + len, l;
+
+	if ( len > 0x7f ) {
+		for ( l = len; l; l >>= 8 )
+			n++;
+	}
+	return n;
+}
+
+/* Encoded size of an INTEGER element, as ber_put_int() writes it */
+static ber_len_t
+ber_int_size( ber_int_t num )
+{
+	ber_uint_t unum = num < 0 ? ~(ber_uint_t)num : (ber_uint_t)num;
+	ber_len_t n = 1;
+
+	for ( ; unum >= 0x80; unum >>= 8 )
+		n++;
+	return 2 + n;
+}
+
+/* Write the tag and length octets of an element whose content length
+ * is already known. Only single octet tags are needed here.
+ */
+static int
+send_ber_header( BerElement *ber, ber_tag_t tag, ber_len_t len )
+{
+	unsigned char buf[2 + sizeof(ber_len_t)], *p = buf + sizeof(buf);
+
+	assert( tag <= 0xff );
+
+	if ( len > 0x7f ) {
+		unsigned char n = 0;
+
+		for ( ; len; len >>= 8, n++ )
+			*--p = (unsigned char) len;
+		*--p = 0x80 | n;
+	} else {
+		*--p = (unsigned char) len;
+	}
+	*--p = (unsigned char) tag;
+
+	return ber_write( ber, (char *) p, buf + sizeof(buf) - p, 0 ) < 0 ? -1 : 0;
+}
+
+/* The encoded length of an attribute's values, or that it is left out */
+#define ATTR_NOT_SENT	((ber_len_t) -1)
+
 int
 slap_send_search_entry( Operation *op, SlapReply *rs )
 {
@@ -847,6 +1138,13 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 	AccessControlState acl_state = ACL_STATE_INIT;
 	int			 attrsonly;
 	AttributeDescription *ad_entry = slap_schema.si_ad_entry;
+	int		k, nattrs, nvals;
+	ber_len_t	*alens = NULL, *ap, attrslen, msglen = 0;
+	char		*vsel, *vp;
+	BerElementBuffer cberbuf;
+	BerElement	*cber = (BerElement *) &cberbuf;
+	struct berval	ctrls = BER_BVNULL;
+	char		*wbuf = NULL;
 
 	/* a_flags: array of flags telling if the i-th element will be
 	 *          returned or filtered out
@@ -909,49 +1207,34 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 		/* read back control or LDAP_CONNECTIONLESS */
 	    ber = op->o_res_ber;
 	} else {
-		struct berval	bv;
-
-		bv.bv_len = entry_flatsize( rs->sr_entry, 0 );
-		bv.bv_val = op->o_tmpalloc( bv.bv_len, op->o_tmpmemctx );
-
-		ber_init2( ber, &bv, LBER_USE_DER );
+		/* sized and filled in once the encoded length is known */
+		ber_init2( ber, NULL, LBER_USE_DER );
 		ber_set_option( ber, LBER_OPT_BER_MEMCTX, &op->o_tmpmemctx );
 	}
 
-#ifdef LDAP_CONNECTIONLESS
-	if ( op->o_conn && op->o_conn->c_is_udp ) {
-		/* CONNECTIONLESS */
-		if ( op->o_protocol == LDAP_VERSION2 ) {
-	    	rc = ber_printf(ber, "t{O{" /*}}*/,
-				LDAP_RES_SEARCH_ENTRY, &rs->sr_entry->e_name );
-		} else {
-	    	rc = ber_printf( ber, "{it{O{" /*}}}*/, op->o_msgid,
-				LDAP_RES_SEARCH_ENTRY, &rs->sr_entry->e_name );
-		}
-	} else
-#endif
-	if ( op->o_res_ber ) {
-		/* read back control */
-	    rc = ber_printf( ber, "{O{" /*}}*/, &rs->sr_entry->e_name );
-	} else {
-	    rc = ber_printf( ber, "{it{O{" /*}}}*/, op->o_msgid,
-			LDAP_RES_SEARCH_ENTRY, &rs->sr_entry->e_name );
-	}
-
-	if ( rc == -1 ) {
-		Debug( LDAP_DEBUG_ANY, 
-			"send_search_entry: conn %lu  ber_printf failed\n", 
-			op->o_connid, 0, 0 );
-
-		if ( op->o_res_ber == NULL ) ber_free_buf( ber );
-		send_ldap_error( op, rs, LDAP_OTHER, "encoding DN error" );
-		rc = rs->sr_err;
-		goto error_return;
-	}
-
 	/* check for special all user attributes ("*") type */
 	userattrs = SLAP_USERATTRS( rs->sr_attr_flags );
 
+	/* The entry is encoded in two passes. The first one makes the
+	 * access and ValuesReturnFilter decisions for every attribute and
+	 * value and adds up the lengths of what is to be sent. The second
+	 * one writes the PDU with those lengths already known, so that no
+	 * sequence has to be moved into place when it is closed.
+	 */
+	nattrs = nvals = 0;
+	for ( k = 0; k < 2; k++ ) {
+		a = k ? rs->sr_operational_attrs : rs->sr_entry->e_attrs;
+		for ( ; a != NULL; a = a->a_next ) {
+			nattrs++;
+			for ( i = 0; a->a_vals[i].bv_val != NULL; i++ ) nvals++;
+		}
+	}
+	alens = op->o_tmpalloc( nattrs * sizeof(ber_len_t) + nvals + 1,
+		op->o_tmpmemctx );
+	vsel = (char *)( alens + nattrs );
+	memset( vsel, 0, nvals );
+	attrslen = 0;
+
 	/* create an array of arrays of flags. Each flag corresponds
 	 * to particular value of attribute and equals 1 if value matches
 	 * to ValuesReturnFilter or 0 if not
@@ -972,7 +1255,7 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 		    	Debug( LDAP_DEBUG_ANY, 
 					"send_search_entry: conn %lu slap_sl_calloc failed\n",
 					op->o_connid, 0, 0 );
-				ber_free( ber, 1 );
+				if ( op->o_res_ber == NULL ) ber_free_buf( ber );
 	
 				send_ldap_error( op, rs, LDAP_OTHER, "out of memory" );
 				goto error_return;
@@ -999,9 +1282,17 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 		}
 	}
 
+	ap = alens;
+	vp = vsel;
 	for ( a = rs->sr_entry->e_attrs, j = 0; a != NULL; a = a->a_next, j++ ) {
 		AttributeDescription *desc = a->a_desc;
-		int finish = 0;
+		char *vs = vp;
+		ber_len_t vlen = 0;
+		int sent = 0;
+
+		for ( i = 0; a->a_vals[i].bv_val != NULL; i++ );
+		vp += i;
+		*ap++ = ATTR_NOT_SENT;
 
 		if ( rs->sr_attrs == NULL ) {
 			/* all user attrs request, skip operational attributes */
@@ -1038,22 +1329,9 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 				        op->o_connid, desc->ad_cname.bv_val, 0 );
 				continue;
 			}
-
-			if (( rc = ber_printf( ber, "{O[" /*]}*/ , &desc->ad_cname )) == -1 ) {
-				Debug( LDAP_DEBUG_ANY, 
-					"send_search_entry: conn %lu  ber_printf failed\n", 
-					op->o_connid, 0, 0 );
-
-				if ( op->o_res_ber == NULL ) ber_free_buf( ber );
-				send_ldap_error( op, rs, LDAP_OTHER,
-					"encoding description error");
-				rc = rs->sr_err;
-				goto error_return;
-			}
-			finish = 1;
+			sent = 1;
 
 		} else {
-			int first = 1;
 			for ( i = 0; a->a_nvals[i].bv_val != NULL; i++ ) {
 				if ( ! access_allowed( op, rs->sr_entry,
 					desc, &a->a_nvals[i], ACL_READ, &acl_state ) )
@@ -1070,44 +1348,16 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 					continue;
 				}
 
-				if ( first ) {
-					first = 0;
-					finish = 1;
-					if (( rc = ber_printf( ber, "{O[" /*]}*/ , &desc->ad_cname )) == -1 ) {
-						Debug( LDAP_DEBUG_ANY,
-							"send_search_entry: conn %lu  ber_printf failed\n", 
-							op->o_connid, 0, 0 );
-
-						if ( op->o_res_ber == NULL ) ber_free_buf( ber );
-						send_ldap_error( op, rs, LDAP_OTHER,
-							"encoding description error");
-						rc = rs->sr_err;
-						goto error_return;
-					}
-				}
-				if (( rc = ber_printf( ber, "O", &a->a_vals[i] )) == -1 ) {
-					Debug( LDAP_DEBUG_ANY,
-						"send_search_entry: conn %lu  "
-						"ber_printf failed.\n", op->o_connid, 0, 0 );
-
-					if ( op->o_res_ber == NULL ) ber_free_buf( ber );
-					send_ldap_error( op, rs, LDAP_OTHER,
-						"encoding values error" );
-					rc = rs->sr_err;
-					goto error_return;
-				}
+				vs[i] = 1;
+				vlen += ber_elem_size( a->a_vals[i].bv_len );
+				sent = 1;
 			}
 		}
 
-		if ( finish && ( rc = ber_printf( ber, /*{[*/ "]N}" )) == -1 ) {
-			Debug( LDAP_DEBUG_ANY,
-				"send_search_entry: conn %lu ber_printf failed\n", 
-				op->o_connid, 0, 0 );
-
-			if ( op->o_res_ber == NULL ) ber_free_buf( ber );
-			send_ldap_error( op, rs, LDAP_OTHER, "encode end error" );
-			rc = rs->sr_err;
-			goto error_return;
+		if ( sent ) {
+			ap[-1] = vlen;
+			attrslen += ber_elem_size( ber_elem_size( desc->ad_cname.bv_len ) +
+				ber_elem_size( vlen ));
 		}
 	}
 
@@ -1168,6 +1418,12 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 
 	for (a = rs->sr_operational_attrs, j=0; a != NULL; a = a->a_next, j++ ) {
 		AttributeDescription *desc = a->a_desc;
+		char *vs = vp;
+		ber_len_t vlen = 0;
+
+		for ( i = 0; a->a_vals[i].bv_val != NULL; i++ );
+		vp += i;
+		*ap++ = ATTR_NOT_SENT;
 
 		if ( rs->sr_attrs == NULL ) {
 			/* all user attrs request, skip operational attributes */
@@ -1201,19 +1457,6 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 			continue;
 		}
 
-		rc = ber_printf( ber, "{O[" /*]}*/ , &desc->ad_cname );
-		if ( rc == -1 ) {
-			Debug( LDAP_DEBUG_ANY,
-				"send_search_entry: conn %lu  "
-				"ber_printf failed\n", op->o_connid, 0, 0 );
-
-			if ( op->o_res_ber == NULL ) ber_free_buf( ber );
-			send_ldap_error( op, rs, LDAP_OTHER,
-				"encoding description error" );
-			rc = rs->sr_err;
-			goto error_return;
-		}
-
 		if ( ! attrsonly ) {
 			for ( i = 0; a->a_vals[i].bv_val != NULL; i++ ) {
 				if ( ! access_allowed( op, rs->sr_entry,
@@ -1231,30 +1474,14 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 					continue;
 				}
 
-				if (( rc = ber_printf( ber, "O", &a->a_vals[i] )) == -1 ) {
-					Debug( LDAP_DEBUG_ANY,
-						"send_search_entry: conn %lu  ber_printf failed\n", 
-						op->o_connid, 0, 0 );
-
-					if ( op->o_res_ber == NULL ) ber_free_buf( ber );
-					send_ldap_error( op, rs, LDAP_OTHER,
-						"encoding values error" );
-					rc = rs->sr_err;
-					goto error_return;
-				}
+				vs[i] = 1;
+				vlen += ber_elem_size( a->a_vals[i].bv_len );
 			}
 		}
 
-		if (( rc = ber_printf( ber, /*{[*/ "]N}" )) == -1 ) {
-			Debug( LDAP_DEBUG_ANY,
-				"send_search_entry: conn %lu  ber_printf failed\n",
-				op->o_connid, 0, 0 );
-
-			if ( op->o_res_ber == NULL ) ber_free_buf( ber );
-			send_ldap_error( op, rs, LDAP_OTHER, "encode end error" );
-			rc = rs->sr_err;
-			goto error_return;
-		}
+		ap[-1] = vlen;
+		attrslen += ber_elem_size( ber_elem_size( desc->ad_cname.bv_len ) +
+			ber_elem_size( vlen ));
 	}
 
 	/* free e_flags */
@@ -1263,29 +1490,168 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 		e_flags = NULL;
 	}
 
-	rc = ber_printf( ber, /*{{*/ "}N}" );
+	/* Second pass: the envelope, then the attributes */
+	if ( op->o_res_ber == NULL ) {
+		struct berval	bv;
+		ber_len_t	oplen;
 
-	if( rc != -1 ) {
-		rc = send_ldap_controls( op, ber, rs->sr_ctrls );
-	}
+		/* the controls go last, but their length is needed up front */
+		if ( rs->sr_ctrls ) {
+			ber_init2( cber, NULL, LBER_USE_DER );
+			ber_set_option( cber, LBER_OPT_BER_MEMCTX, &op->o_tmpmemctx );
+			if ( send_ldap_controls( op, cber, rs->sr_ctrls ) == -1 ||
+				ber_flatten2( cber, &ctrls, 0 ) == -1 )
+			{
+				Debug( LDAP_DEBUG_ANY,
+					"send_search_entry: conn %lu  ber_printf failed\n", 
+					op->o_connid, 0, 0 );
 
-	if( rc != -1 ) {
+				ber_free_buf( cber );
+				send_ldap_error( op, rs, LDAP_OTHER,
+					"encode controls error" );
+				rc = rs->sr_err;
+				goto error_return;
+			}
+		}
+
+		oplen = ber_elem_size( rs->sr_entry->e_name.bv_len ) +
+			ber_elem_size( attrslen );
+		msglen = ber_int_size( op->o_msgid ) + ber_elem_size( oplen ) +
+			ctrls.bv_len;
+
+		/* one more byte for the NUL ber_flatten2() leaves behind */
+		bv.bv_len = ber_elem_size( msglen ) + 1;
+
+		/* encode right into the write batch if there is one */
+		wbuf = write_batch_room( op, bv.bv_len, 1 );
+		if ( wbuf ) {
+			bv.bv_val = wbuf;
+			ber_init2( ber, &bv, LBER_USE_DER );
+		} else {
+			bv.bv_val = op->o_tmpalloc( bv.bv_len, op->o_tmpmemctx );
+			ber_init2( ber, &bv, LBER_USE_DER );
+			ber_set_option( ber, LBER_OPT_BER_MEMCTX, &op->o_tmpmemctx );
+		}
+
+		rc = send_ber_header( ber, LBER_SEQUENCE, msglen );
+		if ( rc != -1 ) {
+			rc = ber_printf( ber, "i", op->o_msgid );
+		}
+		if ( rc != -1 ) {
+			rc = send_ber_header( ber, LDAP_RES_SEARCH_ENTRY, oplen );
+		}
+		if ( rc != -1 ) {
+			rc = ber_printf( ber, "O", &rs->sr_entry->e_name );
+		}
+		if ( rc != -1 ) {
+			rc = send_ber_header( ber, LBER_SEQUENCE, attrslen );
+		}
+
+	} else
 #ifdef LDAP_CONNECTIONLESS
-		if( op->o_conn && op->o_conn->c_is_udp ) {
-			if ( op->o_protocol != LDAP_VERSION2 ) {
-				rc = ber_printf( ber, /*{*/ "N}" );
+	if ( op->o_conn && op->o_conn->c_is_udp ) {
+		/* CONNECTIONLESS */
+		if ( op->o_protocol == LDAP_VERSION2 ) {
+	    	rc = ber_printf(ber, "t{O{" /*}}*/,
+				LDAP_RES_SEARCH_ENTRY, &rs->sr_entry->e_name );
+		} else {
+	    	rc = ber_printf( ber, "{it{O{" /*}}}*/, op->o_msgid,
+				LDAP_RES_SEARCH_ENTRY, &rs->sr_entry->e_name );
+		}
+	} else
+#endif
+	{
+		/* read back control */
+	    rc = ber_printf( ber, "{O{" /*}}*/, &rs->sr_entry->e_name );
+	}
+
+	if ( rc == -1 ) {
+		Debug( LDAP_DEBUG_ANY, 
+			"send_search_entry: conn %lu  ber_printf failed\n", 
+			op->o_connid, 0, 0 );
+
+		if ( op->o_res_ber == NULL && !wbuf ) ber_free_buf( ber );
+		send_ldap_error( op, rs, LDAP_OTHER, "encoding DN error" );
+		rc = rs->sr_err;
+		goto error_return;
+	}
+
+	ap = alens;
+	vp = vsel;
+	for ( k = 0; k < 2; k++ ) {
+		a = k ? rs->sr_operational_attrs : rs->sr_entry->e_attrs;
+		for ( ; a != NULL; a = a->a_next, ap++ ) {
+			char *vs = vp;
+
+			for ( i = 0; a->a_vals[i].bv_val != NULL; i++ );
+			vp += i;
+			if ( *ap == ATTR_NOT_SENT )
+				continue;
+
+			rc = send_ber_header( ber, LBER_SEQUENCE,
+				ber_elem_size( a->a_desc->ad_cname.bv_len ) +
+				ber_elem_size( *ap ));
+			if ( rc != -1 ) {
+				rc = ber_printf( ber, "O", &a->a_desc->ad_cname );
 			}
-		} else
+			if ( rc != -1 ) {
+				rc = send_ber_header( ber, LBER_SET, *ap );
+			}
+			for ( i = 0; rc != -1 && a->a_vals[i].bv_val != NULL; i++ ) {
+				if ( vs[i] ) {
+					rc = ber_printf( ber, "O", &a->a_vals[i] );
+				}
+			}
+			if ( rc == -1 ) {
+				Debug( LDAP_DEBUG_ANY,
+					"send_search_entry: conn %lu  "
+					"ber_printf failed.\n", op->o_connid, 0, 0 );
+
+				if ( op->o_res_ber == NULL && !wbuf ) ber_free_buf( ber );
+				send_ldap_error( op, rs, LDAP_OTHER,
+					"encoding values error" );
+				rc = rs->sr_err;
+				goto error_return;
+			}
+		}
+	}
+
+	if ( op->o_res_ber == NULL ) {
+		if ( ctrls.bv_len ) {
+			rc = ber_write( ber, ctrls.bv_val, ctrls.bv_len, 0 ) ==
+				(ber_slen_t) ctrls.bv_len ? 0 : -1;
+			ber_free_buf( cber );
+			BER_BVZERO( &ctrls );
+		}
+#ifndef NDEBUG
+		if ( rc != -1 ) {
+			ber_len_t	written;
+
+			ber_get_option( ber, LBER_OPT_BER_BYTES_TO_WRITE, &written );
+			assert( written == ber_elem_size( msglen ));
+		}
 #endif
-		if ( op->o_res_ber == NULL ) {
+
+	} else {
+		rc = ber_printf( ber, /*{{*/ "}N}" );
+
+		if( rc != -1 ) {
+			rc = send_ldap_controls( op, ber, rs->sr_ctrls );
+		}
+
+#ifdef LDAP_CONNECTIONLESS
+		if( rc != -1 && op->o_conn && op->o_conn->c_is_udp &&
+			op->o_protocol != LDAP_VERSION2 )
+		{
 			rc = ber_printf( ber, /*{*/ "N}" );
 		}
+#endif
 	}
 
 	if ( rc == -1 ) {
 		Debug( LDAP_DEBUG_ANY, "ber_printf failed\n", 0, 0, 0 );
 
-		if ( op->o_res_ber == NULL ) ber_free_buf( ber );
+		if ( op->o_res_ber == NULL && !wbuf ) ber_free_buf( ber );
 		send_ldap_error( op, rs, LDAP_OTHER, "encode entry end error" );
 		rc = rs->sr_err;
 		goto error_return;
@@ -1301,8 +1667,12 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 	}
 
 	if ( op->o_res_ber == NULL ) {
-		bytes = send_ldap_ber( op, ber );
-		ber_free_buf( ber );
+		if ( wbuf ) {
+			bytes = write_batch_add( op, ber_elem_size( msglen ));
+		} else {
+			bytes = send_ldap_ber( op, ber );
+			ber_free_buf( ber );
+		}
 
 		if ( bytes < 0 ) {
 			Debug( LDAP_DEBUG_ANY,
@@ -1335,6 +1705,14 @@ error_return:;
 		slap_sl_free( e_flags, op->o_tmpmemctx );
 	}
 
+	if ( alens ) {
+		op->o_tmpfree( alens, op->o_tmpmemctx );
+	}
+
+	if ( !BER_BVISNULL( &ctrls ) ) {
+		ber_free_buf( cber );
+	}
+
 	if ( rs->sr_operational_attrs ) {
 		attrs_free( rs->sr_operational_attrs );
 		rs->sr_operational_attrs = NULL;
@@ -1638,6 +2016,9 @@ int slap_read_controls(
 	rs->sr_attrs = ( oid == &slap_pre_read_bv ) ?
 		op->o_preread_attrs : op->o_postread_attrs; 
 
+	/* A starting point; operational attributes are added while the
+	 * entry is encoded, and the buffer grows to fit them.
+	 */
 	bv.bv_len = entry_flatsize( rs->sr_entry, 0 );
 	bv.bv_val = op->o_tmpalloc( bv.bv_len, op->o_tmpmemctx );
 
@@ -362,8 +362,23 @@ fe_op_search( Operation *op, SlapReply *rs )
 
 	} else if ( op->o_bd->be_search ) {
 		if ( limits_check( op, rs ) == 0 ) {
+			slap_wbatch wb;
+			int batch = 0;
+
+			/* gather the entries of long searches into as few
+			 * writes as possible
+			 */
+#ifdef LDAP_CONNECTIONLESS
+			if ( !op->o_conn->c_is_udp )
+#endif
+			batch = slap_write_batch_begin( op, &wb,
+				SLAP_WRITE_BATCH_WAIT );
+
 			/* actually do the search and send the result(s) */
 			(op->o_bd->be_search)( op, rs );
+
+			if ( batch )
+				slap_write_batch_end( op );
 		}
 		/* else limits_check() sends error */
 
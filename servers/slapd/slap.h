@@ -97,6 +97,23 @@ LDAP_BEGIN_DECL
 #define SLAP_STRDUP(s)      ber_strdup((s))
 #define SLAP_STRNDUP(s,l)   ber_strndup((s),(l))
 
+/*
+ * Counters that many threads add to, without a lock where the compiler
+ * has atomic builtins. Where it has none SLAP_ATOMIC_ADD is undefined
+ * and callers fall back to a mutex, or live with approximate counts.
+ */
+#if defined(__GNUC__) && \
+	( __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 1 ))
+#define SLAP_ATOMIC_ADD(p,v)	__sync_add_and_fetch((p),(v))
+#endif
+
+/* Statistics counters that may be approximate when nothing better exists */
+#ifdef SLAP_ATOMIC_ADD
+#define SLAP_COUNTER_ADD(p,v)	SLAP_ATOMIC_ADD(p,v)
+#else
+#define SLAP_COUNTER_ADD(p,v)	(*(p) += (v))
+#endif
+
 #ifdef f_next
 #undef f_next /* name conflict between sys/file.h on SCO and struct filter */
 #endif
@@ -1186,8 +1203,17 @@ typedef struct EntryHeader {
 	char *data;
 	int nattrs;
 	int nvals;
+	int format;		/* set by entry_header */
+	BerVarray vals;	/* space for the values, if not at bv start */
+	AttributeDescription **ads;	/* dictionary for entry_encode_ads */
+	int nads;
 } EntryHeader;
 
+/* Returns the nonzero index of ad in a backend's attribute
+ * dictionary, or 0 if it has none.
+ */
+typedef int (EntryAdIndex)( void *arg, AttributeDescription *ad );
+
 /*
  * represents an entry in core
  */
@@ -2503,6 +2529,7 @@ typedef struct slap_counters_t {
 	ldap_pvt_mp_t		sc_pdu;
 	ldap_pvt_mp_t		sc_entries;
 	ldap_pvt_mp_t		sc_refs;
+	ldap_pvt_mp_t		sc_wsaved;	/* writes saved by batching */
 
 	ldap_pvt_mp_t		sc_ops_completed;
 	ldap_pvt_mp_t		sc_ops_initiated;
@@ -2512,6 +2539,22 @@ typedef struct slap_counters_t {
 #endif /* SLAPD_MONITOR */
 } slap_counters_t;
 
+/*
+ * PDUs of one operation gathered for a single write. It lives with
+ * whoever called slap_write_batch_begin() and is reached through the
+ * Opheader, so that copies of the Operation share it.
+ */
+typedef struct slap_wbatch {
+	char		*wb_buf;	/* the gathered PDUs, back to back */
+	ber_len_t	wb_len;		/* bytes of wb_buf in use */
+	int		wb_pdus;	/* how many PDUs are in it */
+	int		wb_wait;	/* entries sent alone before gathering */
+	struct timeval	wb_first;	/* when the oldest was gathered */
+} slap_wbatch;
+
+/* searches only gather entries once this many went out alone */
+#define SLAP_WRITE_BATCH_WAIT	16
+
 /*
  * represents an operation pending from an ldap client
  */
@@ -2530,6 +2573,7 @@ typedef struct Opheader {
 	BerMemoryFunctions *oh_tmpmfuncs;
 
 	slap_counters_t	*oh_counters;
+	slap_wbatch	*oh_wbatch;	/* PDUs waiting for one write */
 
 	char		oh_log_prefix[ /* sizeof("conn= op=") + 2*LDAP_PVT_INTTYPE_CHARS(unsigned long) */ SLAP_TEXT_BUFLEN ];
 
@@ -2578,6 +2622,7 @@ struct Operation {
 #define o_tmpmemctx o_hdr->oh_tmpmemctx
 #define o_tmpmfuncs o_hdr->oh_tmpmfuncs
 #define o_counters o_hdr->oh_counters
+#define o_wbatch o_hdr->oh_wbatch
 
 #define	o_tmpalloc	o_tmpmfuncs->bmf_malloc
 #define o_tmpcalloc	o_tmpmfuncs->bmf_calloc
@@ -2884,6 +2929,9 @@ struct Connection {
 	char		c_sasl_bind_in_progress;	/* multi-op bind in progress */
 	char		c_writewaiter;	/* true if blocked on write */
 
+	BerElement	*c_wq_out;	/* queued output being written */
+	BerElement	*c_wq_in;	/* queued output behind that */
+	ber_len_t	c_wq_bytes;	/* unwritten bytes in both */
 
 #define	CONN_IS_TLS	1
 #define	CONN_IS_UDP	2
@@ -2982,6 +3030,8 @@ struct Listener {
 #endif
 	int	sl_mute;	/* Listener is temporarily disabled due to emfile */
 	int	sl_busy;	/* Listener is busy (accept thread activated) */
+	int	sl_thread;	/* daemon thread of a SO_REUSEPORT socket, or -1 */
+	unsigned long	sl_accepts;	/* connections accepted */
 	ber_socket_t sl_sd;
 	Sockaddr sl_sa;
 #define sl_addr	sl_sa.sa_in_addr
@@ -42,6 +42,35 @@ struct nonpresent_entry {
 	LDAP_LIST_ENTRY(nonpresent_entry) npe_link;
 };
 
+/* The present list holds the UUIDs the provider reported during a
+ * present phase refresh. It is partitioned on the leading pl_bits bits
+ * of each UUID; a partition is a packed array of UUIDs, appended to as
+ * they arrive and sorted when it is first searched. The partitions
+ * are split in two whenever they average PRESENT_SPLIT UUIDs, so a
+ * short refresh only needs a small table.
+ */
+#define	UUIDLEN	16
+#define	PRESENT_KEYLEN	UUIDLEN
+#define	PRESENT_MINBITS	4
+#define	PRESENT_MAXBITS	16
+#define	PRESENT_SPLIT	64
+#define	PRESENT_PART(u,bits)	\
+	((((unsigned char *)(u))[0] << 8 | ((unsigned char *)(u))[1]) >> \
+		( PRESENT_MAXBITS - (bits) ))
+
+typedef struct presentpart {
+	unsigned char	*pp_keys;
+	unsigned int	pp_num;
+	unsigned int	pp_max;
+	unsigned int	pp_sorted;	/* leading keys known sorted and unique */
+} presentpart;
+
+typedef struct presentlist {
+	unsigned long	pl_count;
+	int		pl_bits;
+	presentpart	*pl_parts;	/* 1 << pl_bits of them */
+} presentlist;
+
 typedef struct cookie_state {
 	ldap_pvt_thread_mutex_t	cs_mutex;
 	int	cs_num;
@@ -112,7 +141,13 @@ typedef struct syncinfo_s {
 	int			si_logstate;
 	int			si_got;
 	ber_int_t	si_msgid;
-	Avlnode			*si_presentlist;
+	presentlist		*si_presentlist;
+	int			si_decodeahead;	/* max messages read ahead */
+	int			si_npipe;
+	struct syncpipe_s	*si_pipe;	/* read ahead, not yet applied */
+	struct syncpipe_s	*si_pipelast;
+	ldap_pvt_thread_mutex_t	si_pipe_mutex;
+	ldap_pvt_thread_cond_t	si_pipe_cond;
 	LDAP			*si_ld;
 	Connection		*si_conn;
 	LDAP_LIST_HEAD(np, nonpresent_entry)	si_nonpresentlist;
@@ -123,13 +158,40 @@ typedef struct syncinfo_s {
 	ldap_pvt_thread_mutex_t	si_mutex;
 } syncinfo_t;
 
-static int syncuuid_cmp( const void *, const void * );
-static int avl_presentlist_insert( syncinfo_t* si, struct berval *syncUUID );
+/* A message read ahead of the one being applied. Search entries
+ * are decoded by a pool thread in the meantime; they are still
+ * applied one at a time, in the order they arrived.
+ */
+typedef struct syncpipe_s {
+	struct syncpipe_s	*sp_next;
+	syncinfo_t		*sp_si;
+	LDAPMessage		*sp_msg;
+	Entry			*sp_entry;
+	Modifications		*sp_modlist;
+	int			sp_syncstate;
+	int			sp_rc;
+	int			sp_state;
+} syncpipe;
+
+#define	SYNCPIPE_PENDING	0	/* queued for decoding */
+#define	SYNCPIPE_DECODED	1
+#define	SYNCPIPE_UNDECODED	2	/* left for the writer to decode */
+
+static int syncrepl_next_msg( syncinfo_t *si, struct timeval *tout,
+	LDAPMessage **msg, syncpipe **spp );
+static int syncrepl_pipe_entry( syncinfo_t *si, Operation *op,
+	syncpipe *sp, LDAPMessage *msg, Modifications **modlist,
+	Entry **entry, int syncstate );
+static void syncpipe_free( syncpipe *sp );
+static void syncrepl_pipe_flush( syncinfo_t *si );
+static void presentlist_insert( syncinfo_t* si, struct berval *syncUUID );
+static int presentlist_find( presentlist *pl, struct berval *syncUUID );
+static void presentlist_free( syncinfo_t* si );
 static void syncrepl_del_nonpresent( Operation *, syncinfo_t *, BerVarray, struct sync_cookie *, int );
 static int syncrepl_message_to_op(
 					syncinfo_t *, Operation *, LDAPMessage * );
 static int syncrepl_message_to_entry(
-					syncinfo_t *, Operation *, LDAPMessage *,
+					syncinfo_t *, LDAP *, Operation *, LDAPMessage *,
 					Modifications **, Entry **, int );
 static int syncrepl_entry(
 					syncinfo_t *, Operation*, Entry*,
@@ -705,6 +767,7 @@ do_syncrep1(
 done:
 	if ( rc ) {
 		if ( si->si_ld ) {
+			syncrepl_pipe_flush( si );
 			ldap_unbind_ext( si->si_ld, NULL, NULL );
 			si->si_ld = NULL;
 		}
@@ -767,6 +830,7 @@ do_syncrep2(
 	struct berval	*retdata = NULL;
 
 	Entry		*entry = NULL;
+	syncpipe	*sp = NULL;
 
 	int		syncstate;
 	struct berval	syncUUID = BER_BVNULL;
@@ -807,8 +871,7 @@ do_syncrep2(
 		tout_p = NULL;
 	}
 
-	while ( ( rc = ldap_result( si->si_ld, si->si_msgid, LDAP_MSG_ONE,
-		tout_p, &msg ) ) > 0 )
+	while ( ( rc = syncrepl_next_msg( si, tout_p, &msg, &sp ) ) > 0 )
 	{
 		LDAPControl	*rctrlp = NULL;
 
@@ -944,7 +1007,7 @@ do_syncrep2(
 					default:
 						break;
 				}
-			} else if ( ( rc = syncrepl_message_to_entry( si, op, msg,
+			} else if ( ( rc = syncrepl_pipe_entry( si, op, sp, msg,
 				&modlist, &entry, syncstate ) ) == LDAP_SUCCESS )
 			{
 				if ( ( rc = syncrepl_entry( si, op, entry, &modlist,
@@ -1082,8 +1145,7 @@ do_syncrep2(
 					syncrepl_del_nonpresent( op, si, NULL,
 						&syncCookie, m );
 				} else {
-					avl_free( si->si_presentlist, ch_free );
-					si->si_presentlist = NULL;
+					presentlist_free( si );
 				}
 			}
 			if ( syncCookie.ctxcsn && match < 0 && err == LDAP_SUCCESS )
@@ -1212,7 +1274,7 @@ do_syncrep2(
 					} else {
 						int i;
 						for ( i = 0; !BER_BVISNULL( &syncUUIDs[i] ); i++ ) {
-							(void)avl_presentlist_insert( si, &syncUUIDs[i] );
+							presentlist_insert( si, &syncUUIDs[i] );
 							slap_sl_free( syncUUIDs[i].bv_val, op->o_tmpmemctx );
 						}
 						slap_sl_free( syncUUIDs, op->o_tmpmemctx );
@@ -1282,6 +1344,10 @@ do_syncrep2(
 			slap_dup_sync_cookie( &syncCookie_req, &syncCookie );
 			slap_sync_cookie_free( &syncCookie, 0 );
 		}
+		if ( sp ) {
+			syncpipe_free( sp );
+			sp = NULL;
+		}
 		ldap_msgfree( msg );
 		msg = NULL;
 		if ( ldap_pvt_thread_pool_pausing( &connection_pool )) {
@@ -1306,9 +1372,21 @@ done:
 	slap_sync_cookie_free( &syncCookie, 0 );
 	slap_sync_cookie_free( &syncCookie_req, 0 );
 
+	if ( sp ) syncpipe_free( sp );
 	if ( msg ) ldap_msgfree( msg );
 
-	if ( rc && rc != LDAP_SYNC_REFRESH_REQUIRED && si->si_ld ) {
+	if ( rc == LDAP_SUCCESS && si->si_pipe ) {
+		/* the socket may stay quiet, run again for what we've read,
+		 * on this same session
+		 */
+		rc = SYNC_PAUSED;
+	} else if ( rc ) {
+		/* nothing read ahead may outlive the session it came from */
+		syncrepl_pipe_flush( si );
+	}
+
+	if ( rc && rc != SYNC_PAUSED && rc != LDAP_SYNC_REFRESH_REQUIRED &&
+		si->si_ld ) {
 		if ( si->si_conn ) {
 			connection_client_stop( si->si_conn );
 			si->si_conn = NULL;
@@ -1320,6 +1398,235 @@ done:
 	return rc;
 }
 
+/* Decode a read ahead search entry */
+static void *
+syncrepl_decode_task(
+	void	*ctx,
+	void	*arg )
+{
+	syncpipe *sp = arg;
+	syncinfo_t *si = sp->sp_si;
+	LDAP *ld;
+	Connection conn = {0};
+	OperationBuffer opbuf;
+	Operation *op;
+	LDAPControl **rctrls = NULL, *rctrlp = NULL;
+	BerElementBuffer berbuf;
+	BerElement *ber = (BerElement *)&berbuf;
+	struct berval syncUUID;
+	int state = SYNCPIPE_UNDECODED;
+
+	/* Anything unexpected is left for the writer, which also
+	 * takes care of reporting it.
+	 *
+	 * Parsing errors are recorded in the LDAP handle, which the
+	 * writer keeps using meanwhile. Decode with a duplicate of it:
+	 * it shares the session but has its own error state.
+	 */
+	ld = ldap_dup( si->si_ld );
+	if ( ld == NULL )
+		goto done;
+	ldap_get_entry_controls( ld, sp->sp_msg, &rctrls );
+	if ( rctrls )
+		rctrlp = ldap_control_find( LDAP_CONTROL_SYNC_STATE, rctrls, NULL );
+	if ( rctrlp ) {
+		ber_init2( ber, &rctrlp->ldctl_value, LBER_USE_DER );
+		if ( ber_scanf( ber, "{em" /*"}"*/, &sp->sp_syncstate,
+				&syncUUID ) != LBER_ERROR &&
+			sp->sp_syncstate != LDAP_SYNC_PRESENT &&
+			sp->sp_syncstate != LDAP_SYNC_DELETE )
+		{
+			connection_fake_init( &conn, &opbuf, ctx );
+			op = &opbuf.ob_op;
+			op->o_bd = si->si_be;
+			if ( !si->si_schemachecking )
+				op->o_no_schema_check = 1;
+			sp->sp_rc = syncrepl_message_to_entry( si, ld, op, sp->sp_msg,
+				&sp->sp_modlist, &sp->sp_entry, sp->sp_syncstate );
+			state = SYNCPIPE_DECODED;
+		}
+	}
+	if ( rctrls )
+		ldap_controls_free( rctrls );
+	ldap_unbind_ext( ld, NULL, NULL );
+
+done:
+	ldap_pvt_thread_mutex_lock( &si->si_pipe_mutex );
+	sp->sp_state = state;
+	ldap_pvt_thread_cond_broadcast( &si->si_pipe_cond );
+	ldap_pvt_thread_mutex_unlock( &si->si_pipe_mutex );
+
+	return NULL;
+}
+
+/* Wait for a decode to finish. If no thread has started it yet,
+ * take it back so we never block on a task that can't run, e.g.
+ * while the pool is pausing.
+ */
+static void
+syncpipe_wait( syncpipe *sp )
+{
+	syncinfo_t *si = sp->sp_si;
+
+	if ( sp->sp_state != SYNCPIPE_PENDING )
+		return;
+
+	if ( ldap_pvt_thread_pool_retract( &connection_pool,
+		syncrepl_decode_task, sp ) > 0 )
+	{
+		sp->sp_state = SYNCPIPE_UNDECODED;
+		return;
+	}
+
+	ldap_pvt_thread_mutex_lock( &si->si_pipe_mutex );
+	while ( sp->sp_state == SYNCPIPE_PENDING )
+		ldap_pvt_thread_cond_wait( &si->si_pipe_cond, &si->si_pipe_mutex );
+	ldap_pvt_thread_mutex_unlock( &si->si_pipe_mutex );
+}
+
+/* The message itself belongs to whoever dequeued it */
+static void
+syncpipe_free( syncpipe *sp )
+{
+	syncpipe_wait( sp );
+	if ( sp->sp_modlist )
+		slap_mods_free( sp->sp_modlist, 1 );
+	if ( sp->sp_entry )
+		entry_free( sp->sp_entry );
+	ch_free( sp );
+}
+
+/* Drop everything read ahead, when the session ends or restarts */
+static void
+syncrepl_pipe_flush( syncinfo_t *si )
+{
+	syncpipe *sp;
+	LDAPMessage *msg;
+
+	while (( sp = si->si_pipe ) != NULL ) {
+		si->si_pipe = sp->sp_next;
+		msg = sp->sp_msg;
+		syncpipe_free( sp );
+		ldap_msgfree( msg );
+	}
+	si->si_pipelast = NULL;
+	si->si_npipe = 0;
+}
+
+/* Read up to si_decodeahead messages that have already arrived,
+ * and start decoding the search entries among them.
+ */
+static void
+syncrepl_pipe_fill( syncinfo_t *si )
+{
+	struct timeval tout = { 0, 0 };
+	LDAPMessage *msg;
+	syncpipe *sp;
+
+	while ( si->si_npipe < si->si_decodeahead ) {
+		/* nothing follows the search result */
+		if ( si->si_pipelast &&
+			ldap_msgtype( si->si_pipelast->sp_msg ) == LDAP_RES_SEARCH_RESULT )
+			break;
+		if ( ldap_result( si->si_ld, si->si_msgid, LDAP_MSG_ONE,
+			&tout, &msg ) <= 0 )
+			break;
+
+		sp = ch_calloc( 1, sizeof( syncpipe ) );
+		sp->sp_si = si;
+		sp->sp_msg = msg;
+		sp->sp_state = SYNCPIPE_UNDECODED;
+		if ( ldap_msgtype( msg ) == LDAP_RES_SEARCH_ENTRY &&
+			!( si->si_syncdata && si->si_logstate == SYNCLOG_LOGGING ))
+		{
+			sp->sp_state = SYNCPIPE_PENDING;
+			if ( ldap_pvt_thread_pool_submit( &connection_pool,
+				syncrepl_decode_task, sp ) )
+			{
+				sp->sp_state = SYNCPIPE_UNDECODED;
+			}
+		}
+
+		if ( si->si_pipelast )
+			si->si_pipelast->sp_next = sp;
+		else
+			si->si_pipe = sp;
+		si->si_pipelast = sp;
+		si->si_npipe++;
+	}
+}
+
+/* Get the next message to apply, from the read ahead queue if
+ * there is one. Returns like ldap_result().
+ */
+static int
+syncrepl_next_msg(
+	syncinfo_t *si,
+	struct timeval *tout,
+	LDAPMessage **msg,
+	syncpipe **spp )
+{
+	syncpipe *sp;
+
+	if ( *spp ) {
+		syncpipe_free( *spp );
+		*spp = NULL;
+	}
+
+	if ( si->si_decodeahead )
+		syncrepl_pipe_fill( si );
+
+	sp = si->si_pipe;
+	if ( sp == NULL )
+		return ldap_result( si->si_ld, si->si_msgid, LDAP_MSG_ONE,
+			tout, msg );
+
+	si->si_pipe = sp->sp_next;
+	if ( si->si_pipe == NULL )
+		si->si_pipelast = NULL;
+	si->si_npipe--;
+	sp->sp_next = NULL;
+
+	*msg = sp->sp_msg;
+	*spp = sp;
+	return ldap_msgtype( *msg );
+}
+
+/* Like syncrepl_message_to_entry(), using the result of the
+ * decode stage if it got to the message first.
+ */
+static int
+syncrepl_pipe_entry(
+	syncinfo_t *si,
+	Operation *op,
+	syncpipe *sp,
+	LDAPMessage *msg,
+	Modifications **modlist,
+	Entry **entry,
+	int syncstate )
+{
+	if ( sp ) {
+		syncpipe_wait( sp );
+		if ( sp->sp_state == SYNCPIPE_DECODED &&
+			sp->sp_syncstate == syncstate )
+		{
+			*modlist = sp->sp_modlist;
+			*entry = sp->sp_entry;
+			sp->sp_modlist = NULL;
+			sp->sp_entry = NULL;
+			op->o_tag = LDAP_REQ_ADD;
+			if ( *entry ) {
+				op->o_req_dn = (*entry)->e_name;
+				op->o_req_ndn = (*entry)->e_nname;
+			}
+			return sp->sp_rc;
+		}
+	}
+
+	return syncrepl_message_to_entry( si, si->si_ld, op, msg, modlist,
+		entry, syncstate );
+}
+
 static void *
 do_syncrepl(
 	void	*ctx,
@@ -1370,6 +1677,7 @@ do_syncrepl(
 				connection_client_stop( si->si_conn );
 				si->si_conn = NULL;
 			}
+			syncrepl_pipe_flush( si );
 			ldap_unbind_ext( si->si_ld, NULL, NULL );
 			si->si_ld = NULL;
 		}
@@ -1424,10 +1732,7 @@ do_syncrepl(
 		si->si_refreshDelete = 0;
 		si->si_refreshPresent = 0;
 
-		if ( si->si_presentlist ) {
-		    avl_free( si->si_presentlist, ch_free );
-		    si->si_presentlist = NULL;
-		}
+		presentlist_free( si );
 
 		/* use main DB when retrieving contextCSN */
 		op->o_bd = si->si_wbe;
@@ -1965,6 +2270,7 @@ done:
 static int
 syncrepl_message_to_entry(
 	syncinfo_t	*si,
+	LDAP		*ld,
 	Operation	*op,
 	LDAPMessage	*msg,
 	Modifications	**modlist,
@@ -1996,7 +2302,7 @@ syncrepl_message_to_entry(
 
 	op->o_tag = LDAP_REQ_ADD;
 
-	rc = ldap_get_dn_ber( si->si_ld, msg, &ber, &bdn );
+	rc = ldap_get_dn_ber( ld, msg, &ber, &bdn );
 	if ( rc != LDAP_SUCCESS ) {
 		Debug( LDAP_DEBUG_ANY,
 			"syncrepl_message_to_entry: %s dn get failed (%d)",
@@ -2195,27 +2501,160 @@ typedef struct dninfo {
 	AttributeDescription *newDesc;	/* for renames */
 } dninfo;
 
-/* return 1 if inserted, 0 otherwise */
-static int
-avl_presentlist_insert(
+/* Split every partition in two on the next bit of the UUIDs. A
+ * partition's keys keep their order, so sorted ones stay sorted.
+ */
+static void
+presentlist_split( presentlist *pl )
+{
+	int bits = pl->pl_bits + 1, n = 1 << pl->pl_bits, i, j;
+	presentpart *parts, *pp, *lo, *hi;
+	unsigned char *k;
+
+	parts = ch_calloc( 2 * n, sizeof( presentpart ) );
+	for ( i = 0; i < n; i++ ) {
+		pp = &pl->pl_parts[i];
+		lo = &parts[2 * i];
+		hi = lo + 1;
+		for ( j = 0, k = pp->pp_keys; j < pp->pp_num; j++, k += PRESENT_KEYLEN )
+			hi->pp_max += PRESENT_PART( k, bits ) & 1;
+		lo->pp_max = pp->pp_num - hi->pp_max;
+		if ( lo->pp_max )
+			lo->pp_keys = ch_malloc( lo->pp_max * PRESENT_KEYLEN );
+		if ( hi->pp_max )
+			hi->pp_keys = ch_malloc( hi->pp_max * PRESENT_KEYLEN );
+		for ( j = 0, k = pp->pp_keys; j < pp->pp_num; j++, k += PRESENT_KEYLEN ) {
+			presentpart *to = ( PRESENT_PART( k, bits ) & 1 ) ? hi : lo;
+			AC_MEMCPY( to->pp_keys + to->pp_num * PRESENT_KEYLEN, k,
+				PRESENT_KEYLEN );
+			to->pp_num++;
+		}
+		if ( pp->pp_sorted == pp->pp_num ) {
+			lo->pp_sorted = lo->pp_num;
+			hi->pp_sorted = hi->pp_num;
+		}
+		ch_free( pp->pp_keys );
+	}
+	ch_free( pl->pl_parts );
+	pl->pl_parts = parts;
+	pl->pl_bits = bits;
+}
+
+/* Duplicates are weeded out when the partition is sorted */
+static void
+presentlist_insert(
 	syncinfo_t* si,
 	struct berval *syncUUID )
 {
-	struct berval *syncuuid_bv = ch_malloc( sizeof( struct berval ) + syncUUID->bv_len + 1 );
+	presentlist *pl = si->si_presentlist;
+	presentpart *pp;
+
+	if ( syncUUID->bv_len != UUIDLEN )
+		return;
+
+	if ( !pl ) {
+		pl = ch_calloc( 1, sizeof( presentlist ) );
+		pl->pl_bits = PRESENT_MINBITS;
+		pl->pl_parts = ch_calloc( 1 << PRESENT_MINBITS, sizeof( presentpart ) );
+		si->si_presentlist = pl;
+	} else if ( pl->pl_bits < PRESENT_MAXBITS &&
+		pl->pl_count >= (unsigned long)PRESENT_SPLIT << pl->pl_bits ) {
+		presentlist_split( pl );
+	}
+	pp = &pl->pl_parts[ PRESENT_PART( syncUUID->bv_val, pl->pl_bits ) ];
+	if ( pp->pp_num == pp->pp_max ) {
+		pp->pp_max = pp->pp_max ? pp->pp_max * 2 : 8;
+		pp->pp_keys = ch_realloc( pp->pp_keys, pp->pp_max * PRESENT_KEYLEN );
+	}
+	AC_MEMCPY( pp->pp_keys + pp->pp_num * PRESENT_KEYLEN,
+		syncUUID->bv_val, PRESENT_KEYLEN );
+	pp->pp_num++;
+	pl->pl_count++;
+}
+
+static int
+presentkey_cmp( const void *k1, const void *k2 )
+{
+	return memcmp( k1, k2, PRESENT_KEYLEN );
+}
 
-	syncuuid_bv->bv_len = syncUUID->bv_len;
-	syncuuid_bv->bv_val = (char *)&syncuuid_bv[1];
-	AC_MEMCPY( syncuuid_bv->bv_val, syncUUID->bv_val, syncUUID->bv_len );
-	syncuuid_bv->bv_val[ syncuuid_bv->bv_len ] = '\0';
+/* Sort a partition and drop duplicate keys */
+static void
+presentpart_sort( presentlist *pl, presentpart *pp )
+{
+	unsigned int i, j;
 
-	if ( avl_insert( &si->si_presentlist, (caddr_t) syncuuid_bv,
-		syncuuid_cmp, avl_dup_error ) )
-	{
-		ch_free( syncuuid_bv );
+	qsort( pp->pp_keys, pp->pp_num, PRESENT_KEYLEN, presentkey_cmp );
+	for ( i = 1, j = 0; i < pp->pp_num; i++ ) {
+		unsigned char *k = pp->pp_keys + i * PRESENT_KEYLEN;
+		if ( !memcmp( k, pp->pp_keys + j * PRESENT_KEYLEN, PRESENT_KEYLEN ))
+			continue;
+		j++;
+		if ( j != i )
+			AC_MEMCPY( pp->pp_keys + j * PRESENT_KEYLEN, k, PRESENT_KEYLEN );
+	}
+	if ( pp->pp_num ) {
+		pl->pl_count -= pp->pp_num - ( j + 1 );
+		pp->pp_num = j + 1;
+	}
+	pp->pp_sorted = pp->pp_num;
+}
+
+/* return 1 if the UUID is in the list, 0 otherwise */
+static int
+presentlist_find(
+	presentlist *pl,
+	struct berval *syncUUID )
+{
+	presentpart *pp;
+	char *key;
+	unsigned int lo, hi;
+
+	if ( !pl || syncUUID->bv_len != UUIDLEN )
 		return 0;
+
+	pp = &pl->pl_parts[ PRESENT_PART( syncUUID->bv_val, pl->pl_bits ) ];
+	if ( pp->pp_sorted != pp->pp_num )
+		presentpart_sort( pl, pp );
+
+	key = syncUUID->bv_val;
+	lo = 0;
+	hi = pp->pp_num;
+	while ( lo < hi ) {
+		unsigned int mid = lo + ( hi - lo ) / 2;
+		int rc = memcmp( key, pp->pp_keys + mid * PRESENT_KEYLEN, PRESENT_KEYLEN );
+		if ( rc == 0 )
+			return 1;
+		if ( rc < 0 )
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
+	return 0;
+}
 
-	return 1;
+static void
+presentlist_free( syncinfo_t* si )
+{
+	presentlist *pl = si->si_presentlist;
+	unsigned long size;
+	int i;
+
+	if ( !pl )
+		return;
+
+	size = sizeof( presentlist ) + ( sizeof( presentpart ) << pl->pl_bits );
+	for ( i = 0; i < 1 << pl->pl_bits; i++ ) {
+		if ( pl->pl_parts[i].pp_keys ) {
+			size += pl->pl_parts[i].pp_max * PRESENT_KEYLEN;
+			ch_free( pl->pl_parts[i].pp_keys );
+		}
+	}
+	Debug( LDAP_DEBUG_SYNC, "presentlist_free: %s %lu UUIDs, %lu bytes\n",
+		si->si_ridtxt, pl->pl_count, size );
+	ch_free( pl->pl_parts );
+	ch_free( pl );
+	si->si_presentlist = NULL;
 }
 
 static int
@@ -2230,7 +2669,7 @@ syncrepl_entry(
 {
 	Backend *be = op->o_bd;
 	slap_callback	cb = { NULL, NULL, NULL, NULL };
-	int syncuuid_inserted = 0;
+	int syncuuid_present = 0;
 	struct berval	syncUUID_strrep = BER_BVNULL;
 
 	SlapReply	rs_search = {REP_RESULT};
@@ -2252,7 +2691,8 @@ syncrepl_entry(
 
 	if (( syncstate == LDAP_SYNC_PRESENT || syncstate == LDAP_SYNC_ADD ) ) {
 		if ( !si->si_refreshPresent && !si->si_refreshDone ) {
-			syncuuid_inserted = avl_presentlist_insert( si, syncUUID );
+			presentlist_insert( si, syncUUID );
+			syncuuid_present = 1;
 		}
 	}
 
@@ -2289,8 +2729,8 @@ syncrepl_entry(
 	ava.aa_desc = slap_schema.si_ad_entryUUID;
 	ava.aa_value = *syncUUID;
 
-	if ( syncuuid_inserted ) {
-		Debug( LDAP_DEBUG_SYNC, "syncrepl_entry: %s inserted UUID %s\n",
+	if ( syncuuid_present ) {
+		Debug( LDAP_DEBUG_SYNC, "syncrepl_entry: %s present UUID %s\n",
 			si->si_ridtxt, syncUUID_strrep.bv_val, 0 );
 	}
 	op->ors_filter = &f;
@@ -3705,28 +4145,26 @@ nonpresent_callback(
 {
 	syncinfo_t *si = op->o_callback->sc_private;
 	Attribute *a;
-	int count = 0;
-	struct berval* present_uuid = NULL;
+	int present = 0;
 	struct nonpresent_entry *np_entry;
 
 	if ( rs->sr_type == REP_RESULT ) {
-		count = avl_free( si->si_presentlist, ch_free );
-		si->si_presentlist = NULL;
+		presentlist_free( si );
 
 	} else if ( rs->sr_type == REP_SEARCH ) {
 		if ( !( si->si_refreshDelete & NP_DELETE_ONE ) ) {
 			a = attr_find( rs->sr_entry->e_attrs, slap_schema.si_ad_entryUUID );
 
 			if ( a ) {
-				present_uuid = avl_find( si->si_presentlist, &a->a_nvals[0],
-					syncuuid_cmp );
+				present = presentlist_find( si->si_presentlist,
+					&a->a_nvals[0] );
 			}
 
 			if ( LogTest( LDAP_DEBUG_SYNC ) ) {
 				char buf[sizeof("rid=999 non")];
 
 				snprintf( buf, sizeof(buf), "%s %s", si->si_ridtxt,
-					present_uuid ? "" : "non" );
+					present ? "" : "non" );
 
 				Debug( LDAP_DEBUG_SYNC, "nonpresent_callback: %spresent UUID %s, dn %s\n",
 					buf, a ? a->a_vals[0].bv_val : "<missing>", rs->sr_entry->e_name.bv_val );
@@ -3735,17 +4173,12 @@ nonpresent_callback(
 			if ( a == NULL ) return 0;
 		}
 
-		if ( present_uuid == NULL ) {
+		if ( !present ) {
 			np_entry = (struct nonpresent_entry *)
 				ch_calloc( 1, sizeof( struct nonpresent_entry ) );
 			np_entry->npe_name = ber_dupbv( NULL, &rs->sr_entry->e_name );
 			np_entry->npe_nname = ber_dupbv( NULL, &rs->sr_entry->e_nname );
 			LDAP_LIST_INSERT_HEAD( &si->si_nonpresentlist, np_entry, npe_link );
-
-		} else {
-			avl_delete( &si->si_presentlist,
-				&a->a_nvals[0], syncuuid_cmp );
-			ch_free( present_uuid );
 		}
 	}
 	return LDAP_SUCCESS;
@@ -3872,16 +4305,6 @@ done:;
 	return new;
 }
 
-static int
-syncuuid_cmp( const void* v_uuid1, const void* v_uuid2 )
-{
-	const struct berval *uuid1 = v_uuid1;
-	const struct berval *uuid2 = v_uuid2;
-	int rc = uuid1->bv_len - uuid2->bv_len;
-	if ( rc ) return rc;
-	return ( memcmp( uuid1->bv_val, uuid2->bv_val, uuid1->bv_len ) );
-}
-
 void
 syncinfo_free( syncinfo_t *sie, int free_all )
 {
@@ -3898,6 +4321,7 @@ syncinfo_free( syncinfo_t *sie, int free_all )
 				connection_client_stop( sie->si_conn );
 				sie->si_conn = NULL;
 			}
+			syncrepl_pipe_flush( sie );
 			ldap_unbind_ext( sie->si_ld, NULL, NULL );
 		}
 	
@@ -3913,6 +4337,8 @@ syncinfo_free( syncinfo_t *sie, int free_all )
 		}
 
 		ldap_pvt_thread_mutex_destroy( &sie->si_mutex );
+		ldap_pvt_thread_cond_destroy( &sie->si_pipe_cond );
+		ldap_pvt_thread_mutex_destroy( &sie->si_pipe_mutex );
 
 		bindconf_free( &sie->si_bindconf );
 
@@ -3976,9 +4402,7 @@ syncinfo_free( syncinfo_t *sie, int free_all )
 			ch_free( sie->si_retrynum_init );
 		}
 		slap_sync_cookie_free( &sie->si_syncCookie, 0 );
-		if ( sie->si_presentlist ) {
-		    avl_free( sie->si_presentlist, ch_free );
-		}
+		presentlist_free( sie );
 		while ( !LDAP_LIST_EMPTY( &sie->si_nonpresentlist ) ) {
 			struct nonpresent_entry* npe;
 			npe = LDAP_LIST_FIRST( &sie->si_nonpresentlist );
@@ -4076,6 +4500,7 @@ config_suffixm( ConfigArgs *c, syncinfo_t *si )
 #define LOGBASESTR		"logbase"
 #define LOGFILTERSTR	"logfilter"
 #define SUFFIXMSTR		"suffixmassage"
+#define DECODEAHEADSTR		"decodeahead"
 
 /* FIXME: undocumented */
 #define EXATTRSSTR		"exattrs"
@@ -4103,6 +4528,7 @@ enum {
 	GOT_MANAGEDSAIT		= 0x00020000U,
 	GOT_BINDCONF		= 0x00040000U,
 	GOT_SUFFIXM		= 0x00080000U,
+	GOT_DECODEAHEAD		= 0x00100000U,
 
 /* check */
 	GOT_REQUIRED		= (GOT_RID|GOT_PROVIDER|GOT_SEARCHBASE)
@@ -4568,6 +4994,18 @@ parse_syncrepl_line(
 				return 1;
 			}
 			si->si_got |= GOT_TLIMIT;
+		} else if ( !strncasecmp( c->argv[ i ], DECODEAHEADSTR "=",
+					STRLENOF( DECODEAHEADSTR "=" ) ) )
+		{
+			val = c->argv[ i ] + STRLENOF( DECODEAHEADSTR "=" );
+			if ( lutil_atoi( &si->si_decodeahead, val ) != 0 || si->si_decodeahead < 0 ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"invalid decodeahead value \"%s\".\n",
+					val );
+				Debug( LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg, 0 );
+				return 1;
+			}
+			si->si_got |= GOT_DECODEAHEAD;
 		} else if ( !strncasecmp( c->argv[ i ], SYNCDATASTR "=",
 					STRLENOF( SYNCDATASTR "=" ) ) )
 		{
@@ -4688,6 +5126,8 @@ add_syncrepl(
 	si->si_presentlist = NULL;
 	LDAP_LIST_INIT( &si->si_nonpresentlist );
 	ldap_pvt_thread_mutex_init( &si->si_mutex );
+	ldap_pvt_thread_mutex_init( &si->si_pipe_mutex );
+	ldap_pvt_thread_cond_init( &si->si_pipe_cond );
 
 	rc = parse_syncrepl_line( c, si );
 
@@ -4966,6 +5406,12 @@ syncrepl_unparse( syncinfo_t *si, struct berval *bv )
 		ptr += len;
 	}
 
+	if ( si->si_decodeahead ) {
+		len = snprintf( ptr, WHATSLEFT, " " DECODEAHEADSTR "=%d", si->si_decodeahead );
+		if ( WHATSLEFT <= len ) return;
+		ptr += len;
+	}
+
 	if ( si->si_syncdata ) {
 		if ( enum_to_verb( datamodes, si->si_syncdata, &bc ) >= 0 ) {
 			if ( WHATSLEFT <= STRLENOF( " " SYNCDATASTR "=" ) + bc.bv_len ) return;
@@ -21,6 +21,8 @@
  * This tool is a MT reader.  It behaves like slapd-read however
  * with one or more threads simultaneously using the same connection.
  * If -M is enabled, then M threads will also perform write operations.
+ * If -S is enabled, the read-only workload is run repeatedly with 1, 2,
+ * 4, ... up to m threads, and the throughput of each round is reported.
  */
 
 #include "portable.h"
@@ -34,6 +36,7 @@
 #include "ac/param.h"
 #include "ac/socket.h"
 #include "ac/string.h"
+#include "ac/time.h"
 #include "ac/unistd.h"
 #include "ac/wait.h"
 
@@ -77,6 +80,9 @@ do_onethread( void *arg );
 static void *
 do_onerwthread( void *arg );
 
+static int
+do_scale( void );
+
 #define MAX_THREAD	1024
 int	rt_pass[MAX_THREAD];
 int	rt_fail[MAX_THREAD];
@@ -102,6 +108,7 @@ int		nobind = 0;
 int		threads = 1;
 int		rwthreads = 0;
 int		verbose = 0;
+int		scale = 0;
 
 int		noconns = 1;
 LDAP		**lds = NULL;
@@ -157,6 +164,7 @@ usage( char *name )
 		"[-m threads] "
 		"[-M threads] "
 		"[-r <maxretries>] "
+		"[-S] "
 		"[-t <delay>] "
 		"[-T <attrs>] "
 		"[<attrs>] "
@@ -185,7 +193,7 @@ main( int argc, char **argv )
 	/* by default, tolerate referrals and no such object */
 	tester_ignore_str2errlist( "REFERRAL,NO_SUCH_OBJECT" );
 
-	while ( (i = getopt( argc, argv, "ACc:D:e:Ff:H:h:i:L:l:M:m:p:r:t:T:w:v" )) != EOF ) {
+	while ( (i = getopt( argc, argv, "ACc:D:e:Ff:H:h:i:L:l:M:m:p:r:St:T:w:v" )) != EOF ) {
 		switch ( i ) {
 		case 'A':
 			noattrs++;
@@ -282,6 +290,10 @@ main( int argc, char **argv )
 			}
 			break;
 
+		case 'S':		/* report scaling with the number of threads */
+			scale++;
+			break;
+
 		case 't':		/* delay in seconds */
 			if ( lutil_atoi( &delay, optarg ) != 0 ) {
 				usage( argv[0] );
@@ -340,6 +352,11 @@ main( int argc, char **argv )
 	snprintf(outstr, BUFSIZ, "Threads: RO: %d RW: %d", threads, rwthreads);
 	tester_error(outstr);
 
+	if ( scale ) {
+		testfail = do_scale();
+		goto done;
+	}
+
 	/* Set up read only threads */
 	for ( i = 0; i < threads; i++ ) {
 		ldap_pvt_thread_create( &rtid[i], 0, do_onethread, (void*)i);
@@ -362,13 +379,6 @@ main( int argc, char **argv )
 	for ( i = 0; i < rwthreads; i++ )
 		ldap_pvt_thread_join(rwtid[i], NULL);
 
-	for(i = 0; i < noconns; i++) {
-		if ( lds[i] != NULL ) {
-			ldap_unbind_ext( lds[i], NULL, NULL );
-		}
-	}
-	free( lds );
-
 	for ( i = 0; i < threads; i++ ) {
 		snprintf(outstr, BUFSIZ, "RO thread %d pass=%d fail=%d", i,
 			rt_pass[i], rt_fail[i]);
@@ -389,6 +399,15 @@ main( int argc, char **argv )
 			testfail++;
 		}
 	}
+
+done:
+	for(i = 0; i < noconns; i++) {
+		if ( lds[i] != NULL ) {
+			ldap_unbind_ext( lds[i], NULL, NULL );
+		}
+	}
+	free( lds );
+
 	snprintf(outstr, BUFSIZ, "MT Test complete" );
 	tester_error(outstr);
 
@@ -397,6 +416,54 @@ main( int argc, char **argv )
 	exit( EXIT_SUCCESS );
 }
 
+/*
+ * Run the read-only workload with 1, 2, 4, ... threads, up to the
+ * number given with -m, and report the throughput of each round.
+ * Every thread does the same amount of work, so ideal scaling shows
+ * as a constant elapsed time and linearly growing ops/sec.
+ */
+static int
+do_scale( void )
+{
+	ldap_pvt_thread_t	tid[MAX_THREAD];
+	struct timeval	beg, end;
+	char		outstr[BUFSIZ];
+	int		i, n, ops, fails = 0;
+	double		secs;
+
+	for ( n = 1; ; n <<= 1 ) {
+		if ( n > threads )
+			n = threads;
+
+		memset( rt_pass, 0, sizeof( rt_pass ) );
+		memset( rt_fail, 0, sizeof( rt_fail ) );
+
+		gettimeofday( &beg, NULL );
+		for ( i = 0; i < n; i++ )
+			ldap_pvt_thread_create( &tid[i], 0, do_onethread, (void*)i );
+		for ( i = 0; i < n; i++ )
+			ldap_pvt_thread_join( tid[i], NULL );
+		gettimeofday( &end, NULL );
+
+		for ( ops = 0, i = 0; i < n; i++ ) {
+			ops += rt_pass[i];
+			fails += rt_fail[i];
+		}
+		secs = ( end.tv_sec - beg.tv_sec ) +
+			( end.tv_usec - beg.tv_usec ) / 1000000.0;
+
+		snprintf( outstr, BUFSIZ,
+			"Scale: threads: %d ops: %d secs: %.3f ops/sec: %.0f",
+			n, ops, secs, secs > 0 ? ops / secs : 0.0 );
+		tester_error( outstr );
+
+		if ( n == threads )
+			break;
+	}
+
+	return fails;
+}
+
 static void *
 do_onethread( void *arg )
 {
@@ -134,6 +134,7 @@ PASSWDCONF=$DATADIR/slapd-passwd.conf
 UNDOCONF=$DATADIR/slapd-config-undo.conf
 NAKEDCONF=$DATADIR/slapd-config-naked.conf
 VALREGEXCONF=$DATADIR/slapd-valregex.conf
+SUBTREECACHECONF=$DATADIR/slapd-subtree-cache.conf
 
 DYNAMICCONF=$DATADIR/slapd-dynamic.ldif
 
@@ -349,6 +350,7 @@ METAOUT=$DATADIR/meta.out
 METACONCURRENCYOUT=$DATADIR/metaconcurrency.out
 MANAGEOUT=$DATADIR/manage.out
 SUBTREERENAMEOUT=$DATADIR/subtree-rename.out
+SUBTREECACHEOUT=$DATADIR/subtree-cache.out
 ACIOUT=$DATADIR/aci.out
 DYNLISTOUT=$DATADIR/dynlist.out
 DDSOUT=$DATADIR/dds.out